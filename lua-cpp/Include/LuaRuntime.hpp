@@ -1,11 +1,15 @@
 #ifndef _LUA_RUNTIME_HPP
 #define _LUA_RUNTIME_HPP
 
+#include <chrono>
+#include <cstddef>
+#include <memory>
 #include <string>
 #include <vector>
 
 struct lua_State;
 typedef int (*lua_CFunction) (lua_State *L);
+typedef void * (*lua_Alloc) (void *ud, void *ptr, size_t osize, size_t nsize);
 
 namespace Lua
 {
@@ -42,14 +46,29 @@ namespace Lua
         std::vector<Function> mFunctions;
     };
 
+    // Allocator accounting of a Runtime. A limit of 0 means no limit.
+    struct MemoryStats
+    {
+        size_t used              = 0;
+        size_t peak              = 0;
+        size_t softLimit         = 0;
+        size_t hardLimit         = 0;
+        size_t failedAllocations = 0;
+
+        bool OverSoftLimit() const { return softLimit && used > softLimit; }
+        bool HitHardLimit()  const { return failedAllocations > 0; }
+    };
+
+    // A moved-from Runtime has no state until Restart gives it a new one;
+    // meanwhile, only Restart, the memory methods and Compact are usable.
     class Runtime
     {
     public:
         explicit Runtime();
         ~Runtime();
 
-        Runtime(Runtime&&) noexcept = default;
-        Runtime& operator=(Runtime&&) noexcept = default;
+        Runtime(Runtime&& other) noexcept;
+        Runtime& operator=(Runtime&& other) noexcept;
         Runtime(const Runtime&) = delete;
         Runtime& operator=(Runtime&) = delete;
 
@@ -62,10 +81,34 @@ namespace Lua
         bool DoString(const std::string& script);
         bool DoFile(const std::string& path);
 
+        // Finalizers (__gc) normally run inside GC steps. When deferred,
+        // they wait in a queue until the host drains it with RunFinalizers.
+        void SetDeferredFinalizers(bool deferred);
+        int  RunFinalizers(int maxCount = 0);
+        int  RunFinalizers(std::chrono::microseconds budget);
+        int  PendingFinalizers();
+
+        // Allocations beyond the hard limit fail after one emergency
+        // collection, raising a memory error in the running script.
+        // ClearLimitFailures resets the count behind HitHardLimit.
+        void        SetMemoryLimit(size_t hardLimit, size_t softLimit = 0);
+        MemoryStats GetMemoryStats() const;
+        void        ResetPeakMemory();
+        void        ClearLimitFailures();
+
+        // Runs a full collection and shrinks stacks, the string table and
+        // the hash parts of sparse tables. Returns the bytes reclaimed.
+        size_t Compact();
+
         lua_State *GetRawState();
         lua_State *ReleaseRawState();
     private:
-        lua_State *mL;
+        void InstallAllocator();
+
+        lua_State                   *mL;
+        std::unique_ptr<MemoryStats> mMemory;
+        lua_Alloc                    mDefaultAlloc;
+        void                        *mDefaultAllocUd;
     };
 }
 
@@ -1,13 +1,52 @@
 #include "LuaRuntime.hpp"
 
+#include <algorithm>
+#include <cstdlib>
 #include <iostream>
+#include <utility>
 #include "LibTools.hpp"
 
 namespace Lua
 {
+    namespace
+    {
+        void *Allocate(void *ud, void *ptr, size_t osize, size_t nsize)
+        {
+            auto *memory = static_cast<MemoryStats *>(ud);
+            size_t oldSize = ptr ? osize : 0;
+
+            if (nsize == 0)
+            {
+                std::free(ptr);
+                memory->used -= oldSize;
+                return nullptr;
+            }
+
+            if (memory->hardLimit && nsize > oldSize
+                && memory->used - oldSize + nsize > memory->hardLimit)
+            {
+                // Lua runs an emergency collection and retries once
+                // before raising LUA_ERRMEM.
+                ++memory->failedAllocations;
+                return nullptr;
+            }
+
+            void *block = std::realloc(ptr, nsize);
+            if (block)
+            {
+                memory->used = memory->used - oldSize + nsize;
+                memory->peak = std::max(memory->peak, memory->used);
+            }
+            return block;
+        }
+    }
+
     Runtime::Runtime()
-        : mL(luaL_newstate())
-    {}
+        : mL(luaL_newstate()), mMemory(std::make_unique<MemoryStats>()),
+          mDefaultAlloc(nullptr), mDefaultAllocUd(nullptr)
+    {
+        InstallAllocator();
+    }
 
     Runtime::~Runtime()
     {
@@ -17,6 +56,27 @@ namespace Lua
         }
     }
 
+    Runtime::Runtime(Runtime&& other) noexcept
+        : mL(std::exchange(other.mL, nullptr)), mMemory(std::move(other.mMemory)),
+          mDefaultAlloc(other.mDefaultAlloc), mDefaultAllocUd(other.mDefaultAllocUd)
+    {}
+
+    Runtime& Runtime::operator=(Runtime&& other) noexcept
+    {
+        if (this != &other)
+        {
+            if (mL)
+            {
+                lua_close(mL);
+            }
+            mL = std::exchange(other.mL, nullptr);
+            mMemory = std::move(other.mMemory);
+            mDefaultAlloc = other.mDefaultAlloc;
+            mDefaultAllocUd = other.mDefaultAllocUd;
+        }
+        return *this;
+    }
+
     void Runtime::Restart()
     {
         if (mL)
@@ -24,6 +84,30 @@ namespace Lua
             lua_close(mL);
         }
         mL = luaL_newstate();
+        InstallAllocator();
+    }
+
+    void Runtime::InstallAllocator()
+    {
+        if (!mL)
+        {
+            return;
+        }
+
+        // A moved-from runtime gave its accounting away with its state.
+        if (!mMemory)
+        {
+            mMemory = std::make_unique<MemoryStats>();
+        }
+
+        // Blocks allocated so far come from the default allocator, which
+        // also uses realloc/free, so they can be freed by ours.
+        mDefaultAlloc = lua_getallocf(mL, &mDefaultAllocUd);
+        mMemory->used = static_cast<size_t>(lua_gc(mL, LUA_GCCOUNT)) * 1024
+            + static_cast<size_t>(lua_gc(mL, LUA_GCCOUNTB));
+        mMemory->peak = mMemory->used;
+        mMemory->failedAllocations = 0;
+        lua_setallocf(mL, Allocate, mMemory.get());
     }
 
     void Runtime::OpenLibs()
@@ -72,6 +156,79 @@ namespace Lua
         return true;
     }
 
+    void Runtime::SetDeferredFinalizers(bool deferred)
+    {
+        lua_gc(mL, LUA_GCDEFERFINALIZERS, deferred ? 1 : 0);
+    }
+
+    int Runtime::RunFinalizers(int maxCount)
+    {
+        return lua_gc(mL, LUA_GCRUNFINALIZERS, maxCount);
+    }
+
+    int Runtime::RunFinalizers(std::chrono::microseconds budget)
+    {
+        auto deadline = std::chrono::steady_clock::now() + budget;
+        int count = 0;
+
+        while (std::chrono::steady_clock::now() < deadline
+            && lua_gc(mL, LUA_GCRUNFINALIZERS, 1) > 0)
+        {
+            ++count;
+        }
+
+        return count;
+    }
+
+    int Runtime::PendingFinalizers()
+    {
+        return lua_gc(mL, LUA_GCPENDINGFINALIZERS);
+    }
+
+    void Runtime::SetMemoryLimit(size_t hardLimit, size_t softLimit)
+    {
+        if (!mMemory)
+        {
+            mMemory = std::make_unique<MemoryStats>();
+        }
+        mMemory->hardLimit = hardLimit;
+        mMemory->softLimit = softLimit;
+    }
+
+    MemoryStats Runtime::GetMemoryStats() const
+    {
+        return mMemory ? *mMemory : MemoryStats();
+    }
+
+    void Runtime::ResetPeakMemory()
+    {
+        if (!mMemory)
+        {
+            return;
+        }
+        mMemory->peak = mMemory->used;
+    }
+
+    void Runtime::ClearLimitFailures()
+    {
+        if (!mMemory)
+        {
+            return;
+        }
+        mMemory->failedAllocations = 0;
+    }
+
+    size_t Runtime::Compact()
+    {
+        if (!mL)
+        {
+            return 0;
+        }
+        size_t before = mMemory->used;
+        lua_gc(mL, LUA_GCCOMPACT);
+        return before > mMemory->used ? before - mMemory->used : 0;
+    }
+
     lua_State *Runtime::GetRawState()
     {
         return mL;
@@ -80,6 +237,11 @@ namespace Lua
     lua_State *Runtime::ReleaseRawState()
     {
         lua_State *L = mL;
+        if (L)
+        {
+            // The state outlives this runtime and its accounting.
+            lua_setallocf(L, mDefaultAlloc, mDefaultAllocUd);
+        }
         mL = 0;
         return L;
     }
@@ -380,6 +380,15 @@ LUA_API size_t lua_stringtonumber (lua_State *L, const char *s) {
 }
 
 
+LUA_API unsigned lua_numbertocstring (lua_State *L, int idx, char *buff) {
+  const TValue *o = index2value(L, idx);
+  if (ttisnumber(o))
+    return luaO_tostringbuff(o, buff) + 1;  /* count the final '\0' */
+  else
+    return 0;  /* not a number */
+}
+
+
 LUA_API lua_Number lua_tonumberx (lua_State *L, int idx, int *pisnum) {
   lua_Number n = 0;
   const TValue *o = index2value(L, idx);
@@ -420,6 +429,7 @@ LUA_API const char *lua_tolstring (lua_State *L, int idx, size_t *len) {
     luaC_checkGC(L);
     o = index2value(L, idx);  /* previous call may reallocate the stack */
   }
+  luaS_seal(L, tsvalue(o));
   if (len != NULL)
     *len = vslen(o);
   lua_unlock(L);
@@ -948,6 +958,7 @@ LUA_API int lua_setmetatable (lua_State *L, int objindex) {
   }
   switch (ttype(obj)) {
     case LUA_TTABLE: {
+      invalidatechains(L, hvalue(obj));
       hvalue(obj)->metatable = mt;
       if (mt) {
         luaC_objbarrier(L, gcvalue(obj), mt);
@@ -1224,6 +1235,28 @@ LUA_API int lua_gc (lua_State *L, int what, ...) {
       luaC_changemode(L, KGC_INC);
       break;
     }
+    case LUA_GCDEFERFINALIZERS: {
+      int defer = va_arg(argp, int);
+      res = g->gcdeferfin;
+      g->gcdeferfin = (defer != 0);
+      break;
+    }
+    case LUA_GCRUNFINALIZERS: {
+      int n = va_arg(argp, int);
+      res = luaC_runfinalizers(L, n);
+      break;
+    }
+    case LUA_GCPENDINGFINALIZERS: {
+      res = luaC_pendingfinalizers(g);
+      break;
+    }
+    case LUA_GCCOMPACT: {
+      lu_mem before = gettotalbytes(g);
+      luaC_compact(L);
+      if (before > gettotalbytes(g))  /* Kbytes returned */
+        res = cast_int((before - gettotalbytes(g)) >> 10);
+      break;
+    }
     default: res = -1;  /* invalid option */
   }
   va_end(argp);
@@ -1232,6 +1265,43 @@ LUA_API int lua_gc (lua_State *L, int what, ...) {
 }
 
 
+/*
+** Set the mode of the native-code compiler and return the previous
+** one; a negative 'mode' only queries it. Returns -1 when Lua was
+** built without the compiler.
+*/
+LUA_API int lua_jitmode (lua_State *L, int mode) {
+#if defined(LUA_USE_JIT)
+  global_State *g = G(L);
+  int res;
+  lua_lock(L);
+  res = g->jitmode;
+  if (mode >= 0) {
+    api_check(L, mode <= LUA_JITALL, "invalid compiler mode");
+    g->jitmode = cast_byte(mode);
+  }
+  lua_unlock(L);
+  return res;
+#else
+  UNUSED(L); UNUSED(mode);
+  return -1;
+#endif
+}
+
+
+/*
+** Declare that 'f' is the standard function 'id', so that the VM can
+** run calls to it inline. (Only the identity of 'f' matters: the VM
+** does the same work that 'f' would do.)
+*/
+LUA_API void lua_setbuiltin (lua_State *L, int id, lua_CFunction f) {
+  lua_lock(L);
+  api_check(L, 0 <= id && id < LUA_NUMBUILTINS, "invalid builtin");
+  G(L)->builtins[id] = f;
+  lua_unlock(L);
+}
+
+
 
 /*
 ** miscellaneous functions
@@ -1309,6 +1379,23 @@ LUA_API void lua_len (lua_State *L, int idx) {
 }
 
 
+/*
+** Sort in place the first 'n' elements of the table at 'idx' when they
+** are all numbers or all strings in its array part. Return 0 (doing
+** nothing) otherwise.
+*/
+LUA_API int lua_sortarray (lua_State *L, int idx, lua_Integer n) {
+  const TValue *t;
+  int res = 0;
+  lua_lock(L);
+  t = index2value(L, idx);
+  if (ttistable(t) && 0 < n && l_castS2U(n) <= UINT_MAX)
+    res = luaV_sortarray(L, hvalue(t), cast_uint(n));
+  lua_unlock(L);
+  return res;
+}
+
+
 LUA_API lua_Alloc lua_getallocf (lua_State *L, void **ud) {
   lua_Alloc f;
   lua_lock(L);
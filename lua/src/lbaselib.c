@@ -199,10 +199,12 @@ static int pushmode (lua_State *L, int oldmode) {
 static int luaB_collectgarbage (lua_State *L) {
   static const char *const opts[] = {"stop", "restart", "collect",
     "count", "step", "setpause", "setstepmul",
-    "isrunning", "generational", "incremental", NULL};
+    "isrunning", "generational", "incremental", "deferfinalizers",
+    "runfinalizers", "pendingfinalizers", "compact", NULL};
   static const int optsnum[] = {LUA_GCSTOP, LUA_GCRESTART, LUA_GCCOLLECT,
     LUA_GCCOUNT, LUA_GCSTEP, LUA_GCSETPAUSE, LUA_GCSETSTEPMUL,
-    LUA_GCISRUNNING, LUA_GCGEN, LUA_GCINC};
+    LUA_GCISRUNNING, LUA_GCGEN, LUA_GCINC, LUA_GCDEFERFINALIZERS,
+    LUA_GCRUNFINALIZERS, LUA_GCPENDINGFINALIZERS, LUA_GCCOMPACT};
   int o = optsnum[luaL_checkoption(L, 1, "collect", opts)];
   switch (o) {
     case LUA_GCCOUNT: {
@@ -244,6 +246,20 @@ static int luaB_collectgarbage (lua_State *L) {
       int stepsize = (int)luaL_optinteger(L, 4, 0);
       return pushmode(L, lua_gc(L, o, pause, stepmul, stepsize));
     }
+    case LUA_GCDEFERFINALIZERS: {
+      int defer = lua_isnone(L, 2) || lua_toboolean(L, 2);
+      int previous = lua_gc(L, o, defer);
+      checkvalres(previous);
+      lua_pushboolean(L, previous);
+      return 1;
+    }
+    case LUA_GCRUNFINALIZERS: {
+      int n = (int)luaL_optinteger(L, 2, 0);
+      int res = lua_gc(L, o, n);
+      checkvalres(res);
+      lua_pushinteger(L, res);
+      return 1;
+    }
     default: {
       int res = lua_gc(L, o);
       checkvalres(res);
@@ -544,6 +560,9 @@ LUAMOD_API int luaopen_base (lua_State *L) {
   /* set global _VERSION */
   lua_pushliteral(L, LUA_VERSION);
   lua_setfield(L, -2, "_VERSION");
+  lua_setbuiltin(L, LUA_BUILTINSELECT, luaB_select);
+  lua_setbuiltin(L, LUA_BUILTINNEXT, luaB_next);
+  lua_setbuiltin(L, LUA_BUILTINIPAIRS, ipairsaux);
   return 1;
 }
 
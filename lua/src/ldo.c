@@ -4,6 +4,10 @@
 ** See Copyright Notice in lua.h
 */
 
+#if defined(LUA_USE_MAPSTACK)
+#define _DEFAULT_SOURCE		/* for MAP_ANONYMOUS and 'madvise' */
+#endif
+
 #define ldo_c
 #define LUA_CORE
 
@@ -157,6 +161,7 @@ int luaD_rawrunprotected (lua_State *L, Pfunc f, void *ud) {
 ** Stack reallocation
 ** ===================================================================
 */
+
 static void correctstack (lua_State *L, StkId oldstack, StkId newstack) {
   CallInfo *ci;
   UpVal *up;
@@ -177,6 +182,158 @@ static void correctstack (lua_State *L, StkId oldstack, StkId newstack) {
 #define ERRORSTACKSIZE	(LUAI_MAXSTACK + 200)
 
 
+/*
+** {==================================================================
+** Reserved stacks
+** ===================================================================
+*/
+
+#if defined(LUA_USE_MAPSTACK)
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#if !defined(MAP_ANONYMOUS)
+#define MAP_ANONYMOUS	MAP_ANON
+#endif
+
+#if !defined(MAP_NORESERVE)
+#define MAP_NORESERVE	0
+#endif
+
+/*
+** A stack that grows beyond LUAI_MAPSTACKMIN elements moves (once) to
+** its own reservation of address space for LUAI_MAPSTACKSIZE elements,
+** where it grows and shrinks in place: pointers into it never change
+** and 'correctstack' is not needed. The system commits pages as they
+** are touched; pages left behind by a shrink are given back with
+** 'madvise'. Reserved stacks do not go through the allocator function,
+** but they are counted as GC debt, as they would be otherwise. Smaller
+** stacks, stacks larger than a reservation and stacks that could not
+** get one ('mmap' failed) are allocated as usual. Reservations from
+** freed stacks are kept in a small per-state pool.
+*/
+
+/* bytes of address space reserved for each stack */
+#define RESERVEDSIZE  \
+	(cast_sizet(LUAI_MAPSTACKSIZE + EXTRA_STACK) * sizeof(StackValue))
+
+#define stackbytes(n)	(cast_sizet((n) + EXTRA_STACK) * sizeof(StackValue))
+
+
+/*
+** Give back to the system the whole pages of 'stack' beyond its
+** first 'n' bytes.
+*/
+static void releasepages (StkId stack, size_t n) {
+  size_t pagesize = cast_sizet(sysconf(_SC_PAGESIZE));
+  size_t first = (n + pagesize - 1) & ~(pagesize - 1);
+  if (first < RESERVEDSIZE)
+    madvise(cast(char *, stack) + first, RESERVEDSIZE - first, MADV_DONTNEED);
+}
+
+
+/*
+** Get a reservation from the pool or from the system (NULL if that
+** fails).
+*/
+static StkId getreserved (global_State *g) {
+  void *stack;
+  if (g->nstackpool > 0)  /* some reservation available? */
+    return cast(StkId, g->stackpool[--g->nstackpool]);
+  stack = mmap(NULL, RESERVEDSIZE, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  return (stack == MAP_FAILED) ? NULL : cast(StkId, stack);
+}
+
+
+/*
+** Resize a reserved stack in place or, if it is large enough and fits
+** in a reservation, move it to one. Return false if the stack must be
+** reallocated with the allocator.
+*/
+static int mapstack (lua_State *L, int newsize) {
+  global_State *g = G(L);
+  int oldsize = stacksize(L);
+  int i;
+  if (newsize > LUAI_MAPSTACKSIZE)
+    return 0;  /* does not fit in a reservation */
+  else if (L->stackmapped) {  /* already reserved? resize it in place */
+    if (newsize < oldsize)
+      releasepages(L->stack, stackbytes(newsize));
+    g->GCdebt -= cast(l_mem, stackbytes(oldsize));
+    i = oldsize + EXTRA_STACK;
+  }
+  else if (newsize > LUAI_MAPSTACKMIN) {  /* large enough to move? */
+    StkId newstack = getreserved(g);
+    if (newstack == NULL)
+      return 0;  /* no address space; use the allocator */
+    i = ((oldsize <= newsize) ? oldsize : newsize) + EXTRA_STACK;
+    memcpy(newstack, L->stack, i * sizeof(StackValue));
+    correctstack(L, L->stack, newstack);
+    luaM_freearray(L, L->stack, oldsize + EXTRA_STACK);
+    L->stack = newstack;
+    L->stackmapped = 1;
+  }
+  else
+    return 0;  /* small stacks use the allocator */
+  for (; i < newsize + EXTRA_STACK; i++)
+    setnilvalue(s2v(L->stack + i)); /* erase new segment */
+  g->GCdebt += cast(l_mem, stackbytes(newsize));
+  L->stack_last = L->stack + newsize;
+  return 1;
+}
+
+
+/*
+** Free a reserved stack, keeping its reservation in the pool when
+** there is room for it.
+*/
+static void freereserved (lua_State *L) {
+  global_State *g = G(L);
+  g->GCdebt -= cast(l_mem, stackbytes(stacksize(L)));
+  if (g->nstackpool < LUAI_STACKPOOL) {
+    releasepages(L->stack, 0);
+    g->stackpool[g->nstackpool++] = L->stack;
+  }
+  else
+    munmap(L->stack, RESERVEDSIZE);
+}
+
+
+/*
+** Free all reservations in the pool (when closing the state).
+*/
+void luaD_freestackpool (global_State *g) {
+  while (g->nstackpool > 0)
+    munmap(g->stackpool[--g->nstackpool], RESERVEDSIZE);
+}
+
+#endif
+
+/* }================================================================== */
+
+
+/*
+** Create a stack with room for 'size' (+ EXTRA_STACK) elements. Its
+** elements are not initialized.
+*/
+StkId luaD_newstack (lua_State *L, int size) {
+  return luaM_newvector(L, size + EXTRA_STACK, StackValue);
+}
+
+
+void luaD_freestack (lua_State *L) {
+#if defined(LUA_USE_MAPSTACK)
+  if (L->stackmapped) {
+    freereserved(L);
+    return;
+  }
+#endif
+  luaM_freearray(L, L->stack, stacksize(L) + EXTRA_STACK);
+}
+
+
 /*
 ** Reallocate the stack to a new size, correcting all pointers into
 ** it. (There are pointers to a stack from its upvalues, from its list
@@ -186,14 +343,18 @@ static void correctstack (lua_State *L, StkId oldstack, StkId newstack) {
 ** (In ISO C, any pointer use after the pointer has been deallocated is
 ** undefined behavior.)
 ** In case of allocation error, raise an error or return false according
-** to 'raiseerror'.
+** to 'raiseerror'. (Reserved stacks are resized in place.)
 */
 int luaD_reallocstack (lua_State *L, int newsize, int raiseerror) {
   int oldsize = stacksize(L);
   int i;
-  StkId newstack = luaM_reallocvector(L, NULL, 0,
-                                      newsize + EXTRA_STACK, StackValue);
+  StkId newstack;
   lua_assert(newsize <= LUAI_MAXSTACK || newsize == ERRORSTACKSIZE);
+#if defined(LUA_USE_MAPSTACK)
+  if (mapstack(L, newsize))
+    return 1;  /* stack resized or moved without the allocator */
+#endif
+  newstack = luaM_reallocvector(L, NULL, 0, newsize + EXTRA_STACK, StackValue);
   if (l_unlikely(newstack == NULL)) {  /* reallocation failed? */
     if (raiseerror)
       luaM_error(L);
@@ -205,9 +366,12 @@ int luaD_reallocstack (lua_State *L, int newsize, int raiseerror) {
   for (; i < newsize + EXTRA_STACK; i++)
     setnilvalue(s2v(newstack + i)); /* erase new segment */
   correctstack(L, L->stack, newstack);
-  luaM_freearray(L, L->stack, oldsize + EXTRA_STACK);
+  luaD_freestack(L);  /* free old stack */
   L->stack = newstack;
   L->stack_last = L->stack + newsize;
+#if defined(LUA_USE_MAPSTACK)
+  L->stackmapped = 0;
+#endif
   return 1;
 }
 
@@ -290,6 +454,19 @@ void luaD_shrinkstack (lua_State *L) {
 }
 
 
+/*
+** Shrink the stack to the part in use and free all CallInfo structures
+** not in use. (Used by explicit compactions, which are not worried
+** about having to grow them again soon.)
+*/
+void luaD_compactstack (lua_State *L) {
+  int inuse = stackinuse(L);
+  if (inuse <= LUAI_MAXSTACK && stacksize(L) > inuse)
+    luaD_reallocstack(L, inuse, 0);  /* ok if that fails */
+  luaE_shrinkCI(L);
+}
+
+
 void luaD_inctop (lua_State *L) {
   luaD_checkstack(L, 1);
   L->top++;
@@ -539,7 +716,7 @@ int luaD_pretailcall (lua_State *L, CallInfo *ci, StkId func,
         setnilvalue(s2v(func + narg1));  /* complete missing arguments */
       ci->top = func + 1 + fsize;  /* top for new function */
       lua_assert(ci->top <= L->stack_last);
-      ci->u.l.savedpc = p->code;  /* starting point */
+      ci->u.l.savedpc = p->qcode;  /* starting point */
       ci->callstatus |= CIST_TAIL;
       L->top = func + narg1;  /* set top */
       return -1;
@@ -579,7 +756,7 @@ CallInfo *luaD_precall (lua_State *L, StkId func, int nresults) {
       int fsize = p->maxstacksize;  /* frame size */
       checkstackGCp(L, fsize, func);
       L->ci = ci = prepCallInfo(L, func, nresults, 0, func + 1 + fsize);
-      ci->u.l.savedpc = p->code;  /* starting point */
+      ci->u.l.savedpc = p->qcode;  /* starting point */
       for (; narg < nfixparams; narg++)
         setnilvalue(s2v(L->top++));  /* complete missing arguments */
       lua_assert(ci->top <= L->stack_last);
@@ -654,7 +831,8 @@ static int finishpcallk (lua_State *L,  CallInfo *ci) {
     luaF_close(L, func, status, 1);  /* can yield or raise an error */
     func = restorestack(L, ci->u2.funcidx);  /* stack may be moved */
     luaD_seterrorobj(L, status, func);
-    luaD_shrinkstack(L);   /* restore stack size in case of overflow */
+    if (l_unlikely(stacksize(L) > LUAI_MAXSTACK))  /* stack overflow? */
+      luaD_shrinkstack(L);   /* restore stack size */
     setcistrecst(ci, LUA_OK);  /* clear original status */
   }
   ci->callstatus &= ~CIST_YPCALL;
@@ -892,11 +1070,17 @@ static void closepaux (lua_State *L, void *ud) {
 
 /*
 ** Calls 'luaF_close' in protected mode. Return the original status
-** or, in case of errors, the new status.
+** or, in case of errors, the new status. Closing only upvalues cannot
+** raise errors, so that case (the usual one when unwinding an error)
+** needs no protection.
 */
 int luaD_closeprotected (lua_State *L, ptrdiff_t level, int status) {
   CallInfo *old_ci = L->ci;
   lu_byte old_allowhooks = L->allowhook;
+  if (L->tbclist < restorestack(L, level)) {  /* no tbc variables? */
+    luaF_closeupval(L, restorestack(L, level));
+    return status;
+  }
   for (;;) {  /* keep closing upvalues until no more errors */
     struct CloseP pcl;
     pcl.level = restorestack(L, level); pcl.status = status;
@@ -929,7 +1113,8 @@ int luaD_pcall (lua_State *L, Pfunc func, void *u,
     L->allowhook = old_allowhooks;
     status = luaD_closeprotected(L, old_top, status);
     luaD_seterrorobj(L, status, restorestack(L, old_top));
-    luaD_shrinkstack(L);   /* restore stack size in case of overflow */
+    if (l_unlikely(stacksize(L) > LUAI_MAXSTACK))  /* stack overflow? */
+      luaD_shrinkstack(L);   /* restore stack size */
   }
   L->errfunc = old_errfunc;
   return status;
@@ -18,6 +18,7 @@
 #include "ldo.h"
 #include "lfunc.h"
 #include "lgc.h"
+#include "ljit.h"
 #include "lmem.h"
 #include "lobject.h"
 #include "lstate.h"
@@ -245,6 +246,12 @@ Proto *luaF_newproto (lua_State *L) {
   f->p = NULL;
   f->sizep = 0;
   f->code = NULL;
+  f->qcode = NULL;
+  f->icache = NULL;
+#if defined(LUA_USE_JIT)
+  f->jit = NULL;
+  f->hotness = 0;
+#endif
   f->sizecode = 0;
   f->lineinfo = NULL;
   f->sizelineinfo = 0;
@@ -264,8 +271,30 @@ Proto *luaF_newproto (lua_State *L) {
 }
 
 
+/*
+** Create the executable copy of the code of a prototype and its
+** per-instruction caches, once its code is complete.
+*/
+void luaF_initcode (lua_State *L, Proto *f) {
+  int i;
+  f->qcode = luaM_newvectorchecked(L, f->sizecode, Instruction);
+  for (i = 0; i < f->sizecode; i++)
+    f->qcode[i] = f->code[i];
+  f->icache = luaM_newvectorchecked(L, f->sizecode, unsigned int);
+  for (i = 0; i < f->sizecode; i++)
+    f->icache[i] = 0;
+}
+
+
 void luaF_freeproto (lua_State *L, Proto *f) {
+#if defined(LUA_USE_JIT)
+  luaJ_free(L, f);
+#endif
   luaM_freearray(L, f->code, f->sizecode);
+  if (f->qcode != NULL)
+    luaM_freearray(L, f->qcode, f->sizecode);
+  if (f->icache != NULL)
+    luaM_freearray(L, f->icache, f->sizecode);
   luaM_freearray(L, f->p, f->sizep);
   luaM_freearray(L, f->k, f->sizek);
   luaM_freearray(L, f->lineinfo, f->sizelineinfo);
@@ -105,6 +105,7 @@
 #define markobjectN(g,t)	{ if (t) markobject(g,t); }
 
 static void reallymarkobject (global_State *g, GCObject *o);
+static void ephkeymarked (global_State *g, GCObject *o);
 static lu_mem atomic (lua_State *L);
 static void entersweep (lua_State *L);
 
@@ -289,6 +290,8 @@ GCObject *luaC_newobj (lua_State *L, int tt, size_t sz) {
 ** (only closures can), and a userdata's metatable must be a table.
 */
 static void reallymarkobject (global_State *g, GCObject *o) {
+  if (l_unlikely(g->ephdeps != NULL))  /* converging ephemerons? */
+    ephkeymarked(g, o);  /* 'o' may be a key that some values wait for */
   switch (o->tt) {
     case LUA_VSHRSTR:
     case LUA_VLNGSTR: {
@@ -673,16 +676,237 @@ static lu_mem propagateall (global_State *g) {
 }
 
 
+/*
+** While ephemerons converge, each "white key -> white value" entry of
+** an ephemeron table is recorded in a hash keyed by the key object.
+** When that key is marked, 'ephkeymarked' moves its entries to the
+** 'ready' list, whose values are then marked. So, each entry is
+** visited a constant number of times, instead of once for each pass
+** over all ephemeron tables.
+*/
+typedef struct EphDep {
+  GCObject *key;
+  TValue *value;
+  int next;  /* next entry in the same bucket or in the 'ready' list */
+} EphDep;
+
+
+typedef struct EphDeps {
+  EphDep *deps;  /* all entries */
+  int *buckets;  /* hash of entries by key; -1 ends a chain */
+  int ndeps;  /* number of entries in use */
+  int size;  /* size of both 'deps' and 'buckets' */
+  int lsize;  /* log2 of 'size' */
+  int ready;  /* list of entries whose keys were marked */
+} EphDeps;
+
+
+/* log2 of the initial size for the dependency hash */
+#define MINLOGEPHDEPS	6
+
+/*
+** Objects of the same kind tend to have addresses with equal low bits,
+** so use multiplicative hashing, which takes the high bits of the
+** product.
+*/
+#define ephhash(o,lsz)  \
+	cast_int((cast(l_uint32, point2uint(o)) * 2654435769u) >> (32 - (lsz)))
+
+#define ephbucket(d,o)	(&(d)->buckets[ephhash(o, (d)->lsize)])
+
+
+/*
+** Allocation for the dependency hash. The collector is in its atomic
+** phase, so it cannot run emergency collections, and a failure is not
+** an error: convergence simply falls back to repeated traversals.
+*/
+static void *ephrealloc (global_State *g, void *block, size_t osize,
+                                                       size_t nsize) {
+  lu_byte oldstopem = g->gcstopem;
+  void *res;
+  g->gcstopem = 1;  /* avoid reentering the collector */
+  res = luaM_realloc_(g->mainthread, block, osize, nsize);
+  g->gcstopem = oldstopem;
+  return res;
+}
+
+
+/*
+** Double the size of the dependency hash, rehashing the entries still
+** waiting for their keys. Returns 0 if it cannot allocate the new
+** arrays.
+*/
+static int ephgrowdeps (global_State *g, EphDeps *d) {
+  int i;
+  int oldsize = d->size;
+  int lsize = (oldsize == 0) ? MINLOGEPHDEPS : d->lsize + 1;
+  int nsize = 1 << lsize;
+  int *nbuckets;
+  EphDep *ndeps;
+  if (lsize >= 30)  /* too many entries? */
+    return 0;
+  nbuckets = cast(int *, ephrealloc(g, NULL, 0,
+                                    cast_sizet(nsize) * sizeof(int)));
+  if (nbuckets == NULL)
+    return 0;
+  ndeps = cast(EphDep *, ephrealloc(g, d->deps,
+                                    cast_sizet(oldsize) * sizeof(EphDep),
+                                    cast_sizet(nsize) * sizeof(EphDep)));
+  if (ndeps == NULL) {
+    ephrealloc(g, nbuckets, cast_sizet(nsize) * sizeof(int), 0);
+    return 0;
+  }
+  d->deps = ndeps;
+  for (i = 0; i < nsize; i++)
+    nbuckets[i] = -1;
+  for (i = 0; i < oldsize; i++) {  /* move old chains to new buckets */
+    int e = d->buckets[i];
+    while (e != -1) {
+      EphDep *dep = &d->deps[e];
+      int next = dep->next;
+      int *b = &nbuckets[ephhash(dep->key, lsize)];
+      dep->next = *b;
+      *b = e;
+      e = next;
+    }
+  }
+  ephrealloc(g, d->buckets, cast_sizet(oldsize) * sizeof(int), 0);
+  d->buckets = nbuckets;
+  d->size = nsize;
+  d->lsize = lsize;
+  return 1;
+}
+
+
+/*
+** Called by 'reallymarkobject' while ephemerons converge: move all
+** entries waiting for key 'o' to the 'ready' list.
+*/
+static void ephkeymarked (global_State *g, GCObject *o) {
+  EphDeps *d = g->ephdeps;
+  int *p;
+  if (d->ndeps == 0)  /* no entries? */
+    return;
+  p = ephbucket(d, o);
+  while (*p != -1) {
+    EphDep *dep = &d->deps[*p];
+    if (dep->key == o) {
+      int e = *p;
+      *p = dep->next;  /* remove entry from its chain... */
+      dep->next = d->ready;  /* ...and insert it in the 'ready' list */
+      d->ready = e;
+    }
+    else
+      p = &dep->next;
+  }
+}
+
+
+/*
+** Visit an ephemeron table, marking values of marked keys and
+** recording entries with white keys and white values. Returns 0 if
+** it cannot record some entry.
+*/
+static int ephrecord (global_State *g, EphDeps *d, Table *h) {
+  unsigned int i;
+  unsigned int asize = luaH_realasize(h);
+  Node *n, *limit = gnodelast(h);
+  for (i = 0; i < asize; i++)  /* array part has no weak keys */
+    markvalue(g, &h->array[i]);
+  for (n = gnode(h, 0); n < limit; n++) {
+    if (isempty(gval(n)))  /* entry is empty? */
+      clearkey(n);  /* clear its key */
+    else if (iscleared(g, gckeyN(n))) {  /* key is not marked (yet)? */
+      if (valiswhite(gval(n))) {  /* white->white entry? */
+        EphDep *dep;
+        int *b;
+        if (d->ndeps == d->size && !ephgrowdeps(g, d))
+          return 0;
+        dep = &d->deps[d->ndeps];
+        dep->key = gckey(n);
+        dep->value = gval(n);
+        b = ephbucket(d, dep->key);
+        dep->next = *b;
+        *b = d->ndeps++;
+      }
+    }
+    else
+      markvalue(g, gval(n));
+  }
+  return 1;
+}
+
+
+/*
+** Propagate marks from keys to values through all ephemeron tables
+** (including the ones that become reachable meanwhile), visiting each
+** table once. Visited tables are kept in 'done' and, in the end, they
+** are traversed again to be linked to their proper lists. Returns 0
+** if it runs out of memory; then, all tables go back to the
+** 'ephemeron' list, and all marks done so far remain valid.
+*/
+static int ephconverge (global_State *g) {
+  EphDeps d;
+  GCObject *done = NULL;
+  int ok = 1;
+  d.deps = NULL; d.buckets = NULL;
+  d.ndeps = d.size = d.lsize = 0;
+  d.ready = -1;
+  g->ephdeps = &d;
+  for (;;) {
+    if (g->ephemeron != NULL) {  /* a table not yet recorded? */
+      Table *h = gco2t(g->ephemeron);
+      g->ephemeron = h->gclist;
+      nw2black(h);  /* out of the list (for now) */
+      h->gclist = done;
+      done = obj2gco(h);
+      if (!ephrecord(g, &d, h)) {
+        ok = 0;
+        break;
+      }
+    }
+    else if (d.ready != -1) {  /* a value whose key was marked? */
+      EphDep *dep = &d.deps[d.ready];
+      d.ready = dep->next;
+      markvalue(g, dep->value);
+    }
+    else if (g->gray != NULL)
+      propagatemark(g);
+    else
+      break;  /* nothing else can be marked */
+  }
+  g->ephdeps = NULL;
+  ephrealloc(g, d.deps, cast_sizet(d.size) * sizeof(EphDep), 0);
+  ephrealloc(g, d.buckets, cast_sizet(d.size) * sizeof(int), 0);
+  while (done != NULL) {  /* link tables into their proper lists */
+    Table *h = gco2t(done);
+    done = h->gclist;
+    if (ok) {
+      int marked = traverseephemeron(g, h, 0);
+      lua_assert(!marked);  /* everything was already marked */
+      UNUSED(marked);
+    }
+    else
+      linkgclist(h, g->ephemeron);  /* to be traversed again */
+  }
+  return ok;
+}
+
+
 /*
 ** Traverse all ephemeron tables propagating marks from keys to values.
-** Repeat until it converges, that is, nothing new is marked. 'dir'
-** inverts the direction of the traversals, trying to speed up
-** convergence on chains in the same table.
-**
+** Usually, 'ephconverge' does that visiting each table once. If it
+** cannot allocate its dependency hash, repeat traversals until it
+** converges, that is, nothing new is marked. 'dir' inverts the
+** direction of the traversals, trying to speed up convergence on
+** chains in the same table.
 */
 static void convergeephemerons (global_State *g) {
   int changed;
   int dir = 0;
+  if (ephconverge(g))
+    return;  /* done */
+  propagateall(g);  /* finish interrupted propagation */
   do {
     GCObject *w;
     GCObject *next = g->ephemeron;  /* get ephemeron list */
@@ -798,7 +1022,10 @@ static void freeobj (lua_State *L, GCObject *o) {
     }
     case LUA_VLNGSTR: {
       TString *ts = gco2ts(o);
-      luaM_freemem(L, ts, sizelstring(ts->u.lnglen));
+      if (isshared(ts))
+        luaS_freeshared(L, ts);
+      else
+        luaM_freemem(L, ts, sizelstring(ts->u.lnglen));
       break;
     }
     default: lua_assert(0);
@@ -946,6 +1173,32 @@ static void callallpendingfinalizers (lua_State *L) {
 }
 
 
+/*
+** Call up to 'n' pending finalizers (all of them if 'n' <= 0) on
+** request of the host. That is the only way finalizers run, except
+** when closing the state, if 'gcdeferfin' is set.
+*/
+int luaC_runfinalizers (lua_State *L, int n) {
+  global_State *g = G(L);
+  int i;
+  for (i = 0; (n <= 0 || i < n) && g->tobefnz; i++)
+    GCTM(L);  /* call one finalizer */
+  return i;
+}
+
+
+/*
+** Number of objects waiting for their finalizers
+*/
+int luaC_pendingfinalizers (global_State *g) {
+  GCObject *o;
+  int n = 0;
+  for (o = g->tobefnz; o != NULL; o = o->next)
+    n++;
+  return n;
+}
+
+
 /*
 ** find last 'next' field in list 'p' list (to add elements in its end)
 */
@@ -1212,7 +1465,7 @@ static void finishgencycle (lua_State *L, global_State *g) {
   correctgraylists(g);
   checkSizes(L, g);
   g->gcstate = GCSpropagate;  /* skip restart */
-  if (!g->gcemergency)
+  if (!g->gcemergency && !g->gcdeferfin)
     callallpendingfinalizers(L);
 }
 
@@ -1621,11 +1874,11 @@ static lu_mem singlestep (lua_State *L) {
       break;
     }
     case GCScallfin: {  /* call remaining finalizers */
-      if (g->tobefnz && !g->gcemergency) {
+      if (g->tobefnz && !g->gcemergency && !g->gcdeferfin) {
         g->gcstopem = 0;  /* ok collections during finalizers */
         work = runafewfinalizers(L, GCFINMAX) * GCFINALIZECOST;
       }
-      else {  /* emergency mode or no more finalizers */
+      else {  /* emergency mode, deferred or no more finalizers */
         g->gcstate = GCSpause;  /* finish collection */
         work = 0;
       }
@@ -1729,3 +1982,56 @@ void luaC_fullgc (lua_State *L, int isemergency) {
 /* }====================================================== */
 
 
+/*
+** {======================================================
+** Compaction
+** =======================================================
+*/
+
+
+static void compactlist (lua_State *L, GCObject *o) {
+  for (; o != NULL; o = o->next) {
+    switch (o->tt) {
+      case LUA_VTABLE: luaH_compact(L, gco2t(o)); break;
+      case LUA_VTHREAD: luaD_compactstack(gco2th(o)); break;
+      default: break;
+    }
+  }
+}
+
+
+static void compactobjects (lua_State *L, void *ud) {
+  global_State *g = G(L);
+  UNUSED(ud);
+  luaD_compactstack(g->mainthread);
+  compactlist(L, g->allgc);
+  compactlist(L, g->finobj);
+  compactlist(L, g->tobefnz);
+}
+
+
+/*
+** Return memory held by idle structures: after a full collection,
+** shrink all stacks and CallInfo lists, the string table, and the hash
+** parts of sparse tables (which does not disturb traversals; see
+** 'luaH_compact'). The object lists cannot change while they are
+** being traversed, so emergency collections are disabled; if an
+** allocation fails, compaction stops there.
+*/
+void luaC_compact (lua_State *L) {
+  global_State *g = G(L);
+  lu_byte oldstopem = g->gcstopem;
+  int size = MINSTRTABSIZE;
+  luaC_fullgc(L, 0);
+  g->gcstopem = 1;
+  luaD_rawrunprotected(L, compactobjects, NULL);  /* ok if that fails */
+  g->gcstopem = oldstopem;
+  while (size < g->strt.nuse && size < g->strt.size)
+    size *= 2;
+  if (size < g->strt.size)
+    luaS_resize(L, size);
+}
+
+/* }====================================================== */
+
+
@@ -194,6 +194,9 @@ LUAI_FUNC void luaC_barrier_ (lua_State *L, GCObject *o, GCObject *v);
 LUAI_FUNC void luaC_barrierback_ (lua_State *L, GCObject *o);
 LUAI_FUNC void luaC_checkfinalizer (lua_State *L, GCObject *o, Table *mt);
 LUAI_FUNC void luaC_changemode (lua_State *L, int newmode);
+LUAI_FUNC int luaC_runfinalizers (lua_State *L, int n);
+LUAI_FUNC int luaC_pendingfinalizers (global_State *g);
+LUAI_FUNC void luaC_compact (lua_State *L);
 
 
 #endif
@@ -663,11 +663,18 @@ static int g_write (lua_State *L, FILE *f, int arg) {
   for (; nargs--; arg++) {
     if (lua_type(L, arg) == LUA_TNUMBER) {
       /* optimization: could be done exactly as for strings */
-      int len = lua_isinteger(L, arg)
-                ? fprintf(f, LUA_INTEGER_FMT,
-                             (LUAI_UACINT)lua_tointeger(L, arg))
-                : fprintf(f, LUA_NUMBER_FMT,
-                             (LUAI_UACNUMBER)lua_tonumber(L, arg));
+      int len;
+      if (lua_isinteger(L, arg))
+        len = fprintf(f, LUA_INTEGER_FMT,
+                         (LUAI_UACINT)lua_tointeger(L, arg));
+      else {  /* shortest numeral, as 'tostring' but without ".0" */
+        char buff[LUA_N2SBUFFSZ];
+        size_t l = lua_numbertocstring(L, arg, buff) - 1;
+        size_t n = strspn(buff, "-0123456789");
+        if (n + 2 == l && buff[n + 1] == '0')
+          l = n;  /* remove ".0" */
+        len = (fwrite(buff, sizeof(char), l, f) == l);
+      }
       status = status && (len > 0);
     }
     else {
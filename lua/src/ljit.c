@@ -0,0 +1,1055 @@
+/*
+** $Id: ljit.c $
+** Baseline compiler to native code
+** See Copyright Notice in lua.h
+*/
+
+#define _DEFAULT_SOURCE		/* for MAP_ANONYMOUS */
+
+#define ljit_c
+#define LUA_CORE
+
+#include "lprefix.h"
+
+
+#if defined(LUA_USE_JIT)
+
+#include <string.h>
+
+#if defined(__x86_64__) && !defined(_WIN32)
+#define JIT_X64
+#include <sys/mman.h>
+#endif
+
+#include "lua.h"
+
+#include "ldebug.h"
+#include "ldo.h"
+#include "lfunc.h"
+#include "ljit.h"
+#include "lmem.h"
+#include "lobject.h"
+#include "lopcodes.h"
+#include "lstate.h"
+#include "lvm.h"
+
+
+/*
+** This is a baseline compiler: it translates a whole prototype,
+** instruction by instruction, into x86-64 code that keeps the same
+** frame layout as the interpreter ('ci', the stack, 'savedpc').
+** Frequent instructions over integers, floats and array slots are
+** compiled inline; everything else, including their slow paths, is a
+** call to the C helper that 'lvm.c' provides for each opcode (see
+** 'luaV_jithelper'), with the instruction and its address passed as
+** immediates. A helper returns the address of the next instruction,
+** which the code compares against the successors known at compile
+** time. Anything else (calls to Lua functions, returns, hooks being
+** turned on, opcodes without helpers) leaves the compiled code with
+** 'savedpc' pointing to the next instruction, so that the interpreter
+** continues exactly where the compiled code stopped.
+**
+** Register use: rbx = L, r12 = ci, r13 = base, r14 = closure.
+*/
+
+
+#if defined(JIT_X64) && !defined(MAP_ANONYMOUS)
+#define MAP_ANONYMOUS	MAP_ANON
+#endif
+
+
+typedef void (*JitEntry) (lua_State *L, CallInfo *ci, const lu_byte *target);
+
+
+typedef struct JitCode {
+  lu_byte *mcode;  /* machine code (executable, read only), or NULL */
+  size_t size;  /* size of 'mcode' */
+  int *pcmap;  /* offset in 'mcode' of the code of each instruction */
+  int sizepcmap;
+  JitEntry entry;  /* function entry (start of 'mcode') */
+  luaJ_Native native;  /* precompiled code, used instead of 'mcode' */
+} JitCode;
+
+
+/* jump to code of an instruction, patched when the code is complete */
+typedef struct Fixup {
+  int pos;  /* position of the 32-bit displacement */
+  int pc;  /* target instruction */
+} Fixup;
+
+
+/* maximum number of pending jumps to the slow path of an instruction */
+#define MAXSLOW		8
+
+
+typedef struct JitState {
+  lua_State *L;
+  Proto *p;
+  lu_byte *buff;  /* code being generated */
+  int n;  /* bytes in 'buff' */
+  int size;  /* size of 'buff' */
+  int *pcmap;
+  Fixup *fix;
+  int nfix;
+  int sizefix;
+  int exitsave;  /* saves 'rax' as 'savedpc' and leaves */
+  int exit;  /* leaves */
+  int slow[MAXSLOW];  /* pending jumps to the slow path */
+  int nslow;
+  JitCode *jc;  /* result */
+} JitState;
+
+
+/*
+** {======================================================
+** Machine-code emission
+** =======================================================
+*/
+
+/* registers */
+#define RAX	0
+#define RCX	1
+#define RDX	2
+#define RBX	3
+#define RSP	4
+#define RBP	5
+#define RSI	6
+#define RDI	7
+#define R12	12
+#define R13	13
+#define R14	14
+
+#define XMM0	0
+#define XMM1	1
+
+/* condition codes */
+#define CC_E	0x4
+#define CC_NE	0x5
+#define CC_AE	0x3
+#define CC_A	0x7
+#define CC_L	0xC
+#define CC_GE	0xD
+#define CC_LE	0xE
+#define CC_G	0xF
+
+/* opcodes (two-byte ones have their 0x0F prefix in the high byte) */
+#define X_ADD	0x03
+#define X_SUB	0x2B
+#define X_CMP	0x3B
+#define X_MOVST	0x89
+#define X_MOVLD	0x8B
+#define X_MOVB	0x88
+#define X_IMUL	0x0FAF
+#define X_MOVZXB	0x0FB6
+#define X_MOVSDLD	0x0F10
+#define X_MOVSDST	0x0F11
+#define X_ADDSD	0x0F58
+#define X_MULSD	0x0F59
+#define X_SUBSD	0x0F5C
+#define X_DIVSD	0x0F5E
+#define X_UCOMISD	0x0F2E
+
+#define P_F2	0xF2	/* scalar-double prefix */
+#define P_66	0x66	/* operand-size prefix */
+
+
+/* offset of register 'r' from 'base' */
+#define RD(r)	(cast_int(sizeof(StackValue)) * (r))
+
+/* offset of the tag of a value */
+#define TT	cast_int(offsetof(TValue, tt_))
+
+
+static void e8 (JitState *J, int b) {
+  if (J->n >= J->size)
+    luaM_growvector(J->L, J->buff, J->n, J->size, lu_byte, MAX_INT,
+                    "native code");
+  J->buff[J->n++] = cast_byte(b);
+}
+
+
+static void e32 (JitState *J, int v) {
+  unsigned int u = cast_uint(v);
+  int i;
+  for (i = 0; i < 4; i++, u >>= 8)
+    e8(J, u & 0xff);
+}
+
+
+static void e64 (JitState *J, lu_mem v) {
+  int i;
+  for (i = 0; i < 8; i++, v >>= 8)
+    e8(J, cast_int(v & 0xff));
+}
+
+
+static void patch32 (JitState *J, int pos, int v) {
+  unsigned int u = cast_uint(v);
+  int i;
+  for (i = 0; i < 4; i++, u >>= 8)
+    J->buff[pos + i] = cast_byte(u & 0xff);
+}
+
+
+/* prefix, REX and opcode bytes of an instruction */
+static void emitop (JitState *J, int pfx, int w, int op, int r, int b) {
+  int rex = 0x40 | (w ? 8 : 0) | ((r & 8) ? 4 : 0) | ((b & 8) ? 1 : 0);
+  if (pfx)
+    e8(J, pfx);
+  if (rex != 0x40)
+    e8(J, rex);
+  if (op > 0xff)
+    e8(J, op >> 8);
+  e8(J, op & 0xff);
+}
+
+
+/* 'op r, [b + d]' (or 'op [b + d], r') */
+static void emitrm (JitState *J, int pfx, int w, int op, int r, int b,
+                    int d) {
+  emitop(J, pfx, w, op, r, b);
+  e8(J, 0x80 | ((r & 7) << 3) | (b & 7));  /* mod = disp32 */
+  if ((b & 7) == RSP)  /* 'rsp' and 'r12' need a SIB byte */
+    e8(J, 0x24);
+  e32(J, d);
+}
+
+
+/* 'op r, b' */
+static void emitrr (JitState *J, int pfx, int w, int op, int r, int b) {
+  emitop(J, pfx, w, op, r, b);
+  e8(J, 0xC0 | ((r & 7) << 3) | (b & 7));
+}
+
+
+/* 'mov r, imm64' */
+static void emitmovi (JitState *J, int r, lu_mem v) {
+  e8(J, 0x48 | ((r & 8) ? 1 : 0));
+  e8(J, 0xB8 | (r & 7));
+  e64(J, v);
+}
+
+
+static void emitmovp (JitState *J, int r, const void *p) {
+  emitmovi(J, r, cast(lu_mem, cast(size_t, p)));
+}
+
+
+/* 'mov byte [b + d], imm8' */
+static void emitstb (JitState *J, int b, int d, int v) {
+  emitrm(J, 0, 0, 0xC6, 0, b, d);
+  e8(J, v);
+}
+
+
+/* 'cmp byte [b + d], imm8' */
+static void emitcmpb (JitState *J, int b, int d, int v) {
+  emitrm(J, 0, 0, 0x80, 7, b, d);
+  e8(J, v);
+}
+
+
+/* 'add r, imm32' / 'cmp r, imm32' (64 bits) */
+static void emitaddi (JitState *J, int r, int v) {
+  emitrr(J, 0, 1, 0x81, 0, r);
+  e32(J, v);
+}
+
+static void emitcmpi (JitState *J, int r, int v) {
+  emitrr(J, 0, 1, 0x81, 7, r);
+  e32(J, v);
+}
+
+
+/* 'test r8, imm8' for the low byte of 'rax' or 'rdx' */
+static void emittestb (JitState *J, int r, int v) {
+  e8(J, 0xF6);
+  e8(J, 0xC0 | (r & 7));
+  e8(J, v);
+}
+
+
+/* 'movq xmm, r' */
+static void emitmovq (JitState *J, int x, int r) {
+  emitrr(J, P_66, 1, 0x0F6E, x, r);
+}
+
+
+/* jump (or conditional jump) with a 32-bit displacement to fill later */
+static int emitjmp (JitState *J, int cc) {
+  if (cc < 0)
+    e8(J, 0xE9);
+  else {
+    e8(J, 0x0F);
+    e8(J, 0x80 | cc);
+  }
+  e32(J, 0);
+  return J->n - 4;
+}
+
+
+/* make jump at 'pos' go to 'target' */
+static void setjmp32 (JitState *J, int pos, int target) {
+  patch32(J, pos, target - (pos + 4));
+}
+
+
+/* make jump at 'pos' go to the current position */
+static void here (JitState *J, int pos) {
+  setjmp32(J, pos, J->n);
+}
+
+
+/* jump to the code of instruction 'pc' */
+static void jumpto (JitState *J, int cc, int pc) {
+  int pos = emitjmp(J, cc);
+  if (J->nfix >= J->sizefix)
+    luaM_growvector(J->L, J->fix, J->nfix, J->sizefix, Fixup, MAX_INT,
+                    "native code");
+  J->fix[J->nfix].pos = pos;
+  J->fix[J->nfix].pc = pc;
+  J->nfix++;
+}
+
+
+/* jump to the slow path of the current instruction */
+static void toslow (JitState *J, int cc) {
+  lua_assert(J->nslow < MAXSLOW);
+  J->slow[J->nslow++] = emitjmp(J, cc);
+}
+
+
+/* address of instruction 'pc' in the code run by the interpreter */
+#define pcaddr(J,pc)	((J)->p->qcode + (pc))
+
+
+/* leave compiled code with 'savedpc' at instruction 'pc' */
+static void exitat (JitState *J, int pc) {
+  emitmovp(J, RAX, pcaddr(J, pc));
+  setjmp32(J, emitjmp(J, -1), J->exitsave);
+}
+
+
+/* leave compiled code to instruction 'pc' if hooks were turned on */
+static void checkhook (JitState *J, int pc) {
+  int pos;
+  emitrm(J, 0, 0, 0x83, 7, RBX, cast_int(offsetof(lua_State, hookmask)));
+  e8(J, 0);  /* cmp dword [L->hookmask], 0 */
+  pos = emitjmp(J, CC_E);
+  exitat(J, pc);
+  here(J, pos);
+}
+
+
+/* r13 = ci->func + 1 */
+static void loadbase (JitState *J) {
+  emitrm(J, 0, 1, X_MOVLD, R13, R12, cast_int(offsetof(CallInfo, func)));
+  emitaddi(J, R13, cast_int(sizeof(StackValue)));
+}
+
+/* }====================================================== */
+
+
+
+/*
+** {======================================================
+** Instruction translation
+** =======================================================
+*/
+
+/* copy value and tag from [b + d] to register 'ra' */
+static void copyvalue (JitState *J, int a, int b, int d) {
+  emitrm(J, 0, 1, X_MOVLD, RCX, b, d);
+  emitrm(J, 0, 1, X_MOVST, RCX, R13, RD(a));
+  emitrm(J, 0, 0, X_MOVZXB, RCX, b, d + TT);
+  emitrm(J, 0, 0, X_MOVB, RCX, R13, RD(a) + TT);
+}
+
+
+/* store a constant value and tag in register 'ra' */
+static void setconst (JitState *J, int a, lu_mem v, int tt) {
+  emitmovi(J, RAX, v);
+  emitrm(J, 0, 1, X_MOVST, RAX, R13, RD(a));
+  emitstb(J, R13, RD(a) + TT, tt);
+}
+
+
+static lu_mem rawvalue (const TValue *o) {
+  lu_mem v = 0;
+  memcpy(&v, &o->value_, sizeof(Value));
+  return v;
+}
+
+
+static lu_mem fltbits (lua_Number n) {
+  lu_mem v;
+  memcpy(&v, &n, sizeof(v));
+  return v;
+}
+
+
+/*
+** Conditional jump of a test at 'pc' whose result is in the flags
+** (true when 'cc' holds): as in the interpreter, the jump that follows
+** the test is taken when the result equals 'k'.
+*/
+#define condtarget(pc,cond,k)	((cond) != (k) ? (pc) + 2 : (pc) + 1)
+
+static void condjump (JitState *J, int pc, int cc, int k) {
+  jumpto(J, cc, condtarget(pc, 1, k));
+  jumpto(J, -1, condtarget(pc, 0, k));
+}
+
+
+/*
+** Call the helper for instruction 'i' at 'pc' and dispatch on the
+** address it returns among the successors 's' ('ns' of them). The
+** first successor is the only one that may fall through to the next
+** instruction.
+*/
+static void callhelper (JitState *J, int pc, Instruction i,
+                        const int *s, int ns) {
+  luaV_Helper h = luaV_jithelper(GET_OPCODE(i));
+  int pos, j;
+  for (j = 0; j < J->nslow; j++)  /* slow paths of inline code come here */
+    here(J, J->slow[j]);
+  J->nslow = 0;
+  emitrr(J, 0, 1, X_MOVST, RBX, RDI);  /* rdi = L */
+  emitrr(J, 0, 1, X_MOVST, R12, RSI);  /* rsi = ci */
+  emitmovp(J, RDX, pcaddr(J, pc + 1));  /* rdx = pc */
+  e8(J, 0xB9);  /* ecx = i */
+  e32(J, cast_int(i));
+  emitmovi(J, RAX, cast(lu_mem, cast(size_t, h)));
+  e8(J, 0xFF); e8(J, 0xD0);  /* call rax */
+  loadbase(J);  /* stack may have been reallocated */
+  emitrr(J, 0, 1, 0x85, RAX, RAX);  /* test rax, rax */
+  setjmp32(J, emitjmp(J, CC_E), J->exit);  /* entered a Lua function */
+  emitrm(J, 0, 0, 0x83, 7, RBX, cast_int(offsetof(lua_State, hookmask)));
+  e8(J, 0);
+  setjmp32(J, emitjmp(J, CC_NE), J->exitsave);  /* hooks turned on */
+  for (j = 0; j < ns; j++) {
+    emitmovp(J, RDX, pcaddr(J, s[j]));
+    emitrr(J, 0, 1, X_CMP, RAX, RDX);  /* cmp rax, rdx */
+    if (j == 0 && s[j] == pc + 1) {  /* can fall through? */
+      pos = emitjmp(J, CC_NE);
+      jumpto(J, -1, pc + 1);
+      here(J, pos);
+    }
+    else
+      jumpto(J, CC_E, s[j]);
+  }
+  setjmp32(J, emitjmp(J, -1), J->exitsave);  /* unexpected successor */
+}
+
+
+/* call helper for an instruction that only continues to the next one */
+static void callplain (JitState *J, int pc, Instruction i) {
+  int s = pc + 1;
+  callhelper(J, pc, i, &s, 1);
+}
+
+
+/* call helper for an instruction that may skip the next one */
+static void callskip (JitState *J, int pc, Instruction i) {
+  int s[2];
+  s[0] = pc + 1; s[1] = pc + 2;
+  callhelper(J, pc, i, s, 2);
+}
+
+
+/* jump to slow path unless register 'r' has tag 'tt' */
+static void guardtag (JitState *J, int r, int tt) {
+  emitcmpb(J, R13, RD(r) + TT, tt);
+  toslow(J, CC_NE);
+}
+
+
+/*
+** Arithmetic over registers 'rb' and 'rc' (or constant 'kc' when
+** 'kc' is not NULL) for integers ('iop', if not zero) and floats
+** ('fop'); on success it skips the following OP_MMBIN*.
+*/
+static void arith (JitState *J, int pc, Instruction i, int iop, int fop,
+                   const TValue *kc) {
+  int a = GETARG_A(i);
+  int b = GETARG_B(i);
+  int c = GETARG_C(i);
+  int tflt = -1;  /* jump to float case */
+  if (iop && (kc == NULL || ttisinteger(kc))) {
+    emitcmpb(J, R13, RD(b) + TT, LUA_VNUMINT);
+    if (kc == NULL) {
+      tflt = emitjmp(J, CC_NE);
+      guardtag(J, c, LUA_VNUMINT);
+    }
+    else
+      toslow(J, CC_NE);
+    emitrm(J, 0, 1, X_MOVLD, RAX, R13, RD(b));
+    if (kc == NULL)
+      emitrm(J, 0, 1, iop, RAX, R13, RD(c));
+    else {
+      emitmovi(J, RCX, rawvalue(kc));
+      emitrr(J, 0, 1, iop, RAX, RCX);
+    }
+    emitrm(J, 0, 1, X_MOVST, RAX, R13, RD(a));
+    emitstb(J, R13, RD(a) + TT, LUA_VNUMINT);
+    jumpto(J, -1, pc + 2);
+  }
+  if (kc == NULL || ttisfloat(kc)) {
+    if (tflt >= 0)
+      here(J, tflt);
+    guardtag(J, b, LUA_VNUMFLT);
+    if (kc == NULL)
+      guardtag(J, c, LUA_VNUMFLT);
+    emitrm(J, P_F2, 0, X_MOVSDLD, XMM0, R13, RD(b));
+    if (kc == NULL)
+      emitrm(J, P_F2, 0, fop, XMM0, R13, RD(c));
+    else {
+      emitmovi(J, RAX, rawvalue(kc));
+      emitmovq(J, XMM1, RAX);
+      emitrr(J, P_F2, 0, fop, XMM0, XMM1);
+    }
+    emitrm(J, P_F2, 0, X_MOVSDST, XMM0, R13, RD(a));
+    emitstb(J, R13, RD(a) + TT, LUA_VNUMFLT);
+    jumpto(J, -1, pc + 2);
+  }
+  else if (tflt >= 0)
+    toslow(J, -1);
+  callskip(J, pc, i);
+}
+
+
+/*
+** Order comparison of registers 'ra' and 'rb' with integer condition
+** 'icc' and float condition 'fcc' (the latter over 'rb' compared to
+** 'ra', so that unordered operands give false).
+*/
+static void order (JitState *J, int pc, Instruction i, int icc, int fcc) {
+  int a = GETARG_A(i);
+  int b = GETARG_B(i);
+  int k = GETARG_k(i);
+  int tflt;
+  emitcmpb(J, R13, RD(a) + TT, LUA_VNUMINT);
+  tflt = emitjmp(J, CC_NE);
+  guardtag(J, b, LUA_VNUMINT);
+  emitrm(J, 0, 1, X_MOVLD, RAX, R13, RD(a));
+  emitrm(J, 0, 1, X_CMP, RAX, R13, RD(b));
+  condjump(J, pc, icc, k);
+  here(J, tflt);
+  guardtag(J, a, LUA_VNUMFLT);
+  guardtag(J, b, LUA_VNUMFLT);
+  emitrm(J, P_F2, 0, X_MOVSDLD, XMM0, R13, RD(b));
+  emitrm(J, P_66, 0, X_UCOMISD, XMM0, R13, RD(a));
+  condjump(J, pc, fcc, k);
+  callskip(J, pc, i);
+}
+
+
+/* comparison of integer register 'ra' with immediate 'sB' */
+static void orderI (JitState *J, int pc, Instruction i, int cc) {
+  int a = GETARG_A(i);
+  guardtag(J, a, LUA_VNUMINT);
+  emitrm(J, 0, 1, X_MOVLD, RAX, R13, RD(a));
+  emitcmpi(J, RAX, GETARG_sB(i));
+  condjump(J, pc, cc, GETARG_k(i));
+  callskip(J, pc, i);
+}
+
+
+/* compare register 'ra' with constant 'kb' */
+static void eqk (JitState *J, int pc, Instruction i, const TValue *kb) {
+  int a = GETARG_A(i);
+  int k = GETARG_k(i);
+  if (ttisinteger(kb)) {
+    guardtag(J, a, LUA_VNUMINT);
+    emitrm(J, 0, 1, X_MOVLD, RAX, R13, RD(a));
+    emitmovi(J, RCX, rawvalue(kb));
+    emitrr(J, 0, 1, X_CMP, RAX, RCX);
+    condjump(J, pc, CC_E, k);
+  }
+  else if (ttisshrstring(kb)) {  /* equal only to the same short string */
+    emitcmpb(J, R13, RD(a) + TT, ctb(LUA_VSHRSTR));
+    jumpto(J, CC_NE, condtarget(pc, 0, k));
+    emitrm(J, 0, 1, X_MOVLD, RAX, R13, RD(a));
+    emitmovi(J, RCX, rawvalue(kb));
+    emitrr(J, 0, 1, X_CMP, RAX, RCX);
+    condjump(J, pc, CC_E, k);
+  }
+  else if (ttisnil(kb) || ttisboolean(kb)) {  /* equal iff same tag */
+    emitcmpb(J, R13, RD(a) + TT, rawtt(kb));
+    condjump(J, pc, CC_E, k);
+  }
+  callskip(J, pc, i);
+}
+
+
+/*
+** Table access 't[n]', with 't' in register 'rt' and 'n' either in
+** register 'rn' (when 'rn' >= 0) or the constant 'n': a fast path for
+** integer keys inside the array part. It leaves the address of the
+** slot in 'rcx' and its tag in 'dl', going to the slow path when the
+** slot is empty.
+*/
+static void arrayslot (JitState *J, int rt, int rn, int n) {
+  guardtag(J, rt, ctb(LUA_VTABLE));
+  if (rn >= 0) {
+    guardtag(J, rn, LUA_VNUMINT);
+    emitrm(J, 0, 1, X_MOVLD, RAX, R13, RD(rn));
+    emitaddi(J, RAX, -1);
+  }
+  else
+    emitmovi(J, RAX, l_castS2U(cast(lua_Integer, n) - 1));
+  emitrm(J, 0, 1, X_MOVLD, RCX, R13, RD(rt));  /* rcx = table */
+  emitrm(J, 0, 0, X_MOVLD, RDX, RCX, cast_int(offsetof(Table, alimit)));
+  emitrr(J, 0, 1, X_CMP, RAX, RDX);  /* n - 1 < alimit (unsigned)? */
+  toslow(J, CC_AE);
+  emitrm(J, 0, 1, X_MOVLD, RCX, RCX, cast_int(offsetof(Table, array)));
+  emitrr(J, 0, 1, 0xC1, 4, RAX);  /* shl rax, 4 */
+  e8(J, 4);
+  emitrr(J, 0, 1, 0x01, RAX, RCX);  /* add rcx, rax */
+  emitrm(J, 0, 0, X_MOVZXB, RDX, RCX, TT);
+  emittestb(J, RDX, 0x0F);  /* empty slot? */
+  toslow(J, CC_E);
+}
+
+
+static void gettable (JitState *J, int pc, Instruction i, int rn, int n) {
+  int a = GETARG_A(i);
+  arrayslot(J, GETARG_B(i), rn, n);
+  emitrm(J, 0, 1, X_MOVLD, RAX, RCX, 0);
+  emitrm(J, 0, 1, X_MOVST, RAX, R13, RD(a));
+  emitrm(J, 0, 0, X_MOVB, RDX, R13, RD(a) + TT);
+  jumpto(J, -1, pc + 1);
+  callplain(J, pc, i);
+}
+
+
+/*
+** Store into an array slot that is not empty. Only values that are
+** not collectable are stored inline, so that no barrier is needed.
+*/
+static void settable (JitState *J, int pc, Instruction i, int rn, int n) {
+  int a = GETARG_A(i);
+  int c = GETARG_C(i);
+  const TValue *kc = TESTARG_k(i) ? J->p->k + c : NULL;
+  if (kc == NULL || !iscollectable(kc)) {
+    if (kc == NULL) {
+      emitrm(J, 0, 0, X_MOVZXB, RAX, R13, RD(c) + TT);
+      emittestb(J, RAX, BIT_ISCOLLECTABLE);
+      toslow(J, CC_NE);
+    }
+    arrayslot(J, a, rn, n);
+    if (kc == NULL) {
+      emitrm(J, 0, 1, X_MOVLD, RAX, R13, RD(c));
+      emitrm(J, 0, 1, X_MOVST, RAX, RCX, 0);
+      emitrm(J, 0, 0, X_MOVZXB, RAX, R13, RD(c) + TT);
+      emitrm(J, 0, 0, X_MOVB, RAX, RCX, TT);
+    }
+    else {
+      emitmovi(J, RAX, rawvalue(kc));
+      emitrm(J, 0, 1, X_MOVST, RAX, RCX, 0);
+      emitstb(J, RCX, TT, rawtt(kc));
+    }
+    jumpto(J, -1, pc + 1);
+  }
+  callplain(J, pc, i);
+}
+
+
+static void translate (JitState *J, int pc) {
+  Proto *p = J->p;
+  Instruction i = p->code[pc];
+  int a = GETARG_A(i);
+  switch (GET_OPCODE(i)) {
+    case OP_MOVE: {
+      copyvalue(J, a, R13, RD(GETARG_B(i)));
+      break;
+    }
+    case OP_LOADI: {
+      setconst(J, a, l_castS2U(cast(lua_Integer, GETARG_sBx(i))),
+               LUA_VNUMINT);
+      break;
+    }
+    case OP_LOADF: {
+      setconst(J, a, fltbits(cast_num(GETARG_sBx(i))), LUA_VNUMFLT);
+      break;
+    }
+    case OP_LOADK: {
+      const TValue *kb = p->k + GETARG_Bx(i);
+      setconst(J, a, rawvalue(kb), rawtt(kb));
+      break;
+    }
+    case OP_LOADKX: {
+      const TValue *kb = p->k + GETARG_Ax(p->code[pc + 1]);
+      setconst(J, a, rawvalue(kb), rawtt(kb));
+      jumpto(J, -1, pc + 2);
+      break;
+    }
+    case OP_LOADFALSE: {
+      emitstb(J, R13, RD(a) + TT, LUA_VFALSE);
+      break;
+    }
+    case OP_LFALSESKIP: {
+      emitstb(J, R13, RD(a) + TT, LUA_VFALSE);
+      jumpto(J, -1, pc + 2);
+      break;
+    }
+    case OP_LOADTRUE: {
+      emitstb(J, R13, RD(a) + TT, LUA_VTRUE);
+      break;
+    }
+    case OP_LOADNIL: {
+      int b = GETARG_B(i);
+      do {
+        emitstb(J, R13, RD(a++) + TT, LUA_VNIL);
+      } while (b--);
+      break;
+    }
+    case OP_GETUPVAL: {
+      emitrm(J, 0, 1, X_MOVLD, RAX, R14, cast_int(offsetof(LClosure, upvals))
+                                     + GETARG_B(i) * cast_int(sizeof(UpVal *)));
+      emitrm(J, 0, 1, X_MOVLD, RAX, RAX, cast_int(offsetof(UpVal, v)));
+      copyvalue(J, a, RAX, 0);
+      break;
+    }
+    case OP_JMP: {
+      int dest = pc + 1 + GETARG_sJ(i);
+      if (dest <= pc)  /* backward jump? */
+        checkhook(J, dest);  /* let hooks and signals stop loops */
+      jumpto(J, -1, dest);
+      break;
+    }
+    case OP_ADD: arith(J, pc, i, X_ADD, X_ADDSD, NULL); break;
+    case OP_SUB: arith(J, pc, i, X_SUB, X_SUBSD, NULL); break;
+    case OP_MUL: arith(J, pc, i, X_IMUL, X_MULSD, NULL); break;
+    case OP_DIV: arith(J, pc, i, 0, X_DIVSD, NULL); break;
+    case OP_ADDK: arith(J, pc, i, X_ADD, X_ADDSD, p->k + GETARG_C(i)); break;
+    case OP_SUBK: arith(J, pc, i, X_SUB, X_SUBSD, p->k + GETARG_C(i)); break;
+    case OP_MULK: arith(J, pc, i, X_IMUL, X_MULSD, p->k + GETARG_C(i)); break;
+    case OP_DIVK: arith(J, pc, i, 0, X_DIVSD, p->k + GETARG_C(i)); break;
+    case OP_ADDI: {
+      int b = GETARG_B(i);
+      guardtag(J, b, LUA_VNUMINT);
+      emitrm(J, 0, 1, X_MOVLD, RAX, R13, RD(b));
+      emitaddi(J, RAX, GETARG_sC(i));
+      emitrm(J, 0, 1, X_MOVST, RAX, R13, RD(a));
+      emitstb(J, R13, RD(a) + TT, LUA_VNUMINT);
+      jumpto(J, -1, pc + 2);
+      callskip(J, pc, i);
+      break;
+    }
+    case OP_EQ: {
+      int b = GETARG_B(i);
+      guardtag(J, a, LUA_VNUMINT);
+      guardtag(J, b, LUA_VNUMINT);
+      emitrm(J, 0, 1, X_MOVLD, RAX, R13, RD(a));
+      emitrm(J, 0, 1, X_CMP, RAX, R13, RD(b));
+      condjump(J, pc, CC_E, GETARG_k(i));
+      callskip(J, pc, i);
+      break;
+    }
+    case OP_LT: order(J, pc, i, CC_L, CC_A); break;
+    case OP_LE: order(J, pc, i, CC_LE, CC_AE); break;
+    case OP_EQK: eqk(J, pc, i, p->k + GETARG_B(i)); break;
+    case OP_EQI: orderI(J, pc, i, CC_E); break;
+    case OP_LTI: orderI(J, pc, i, CC_L); break;
+    case OP_LEI: orderI(J, pc, i, CC_LE); break;
+    case OP_GTI: orderI(J, pc, i, CC_G); break;
+    case OP_GEI: orderI(J, pc, i, CC_GE); break;
+    case OP_TEST: {
+      int k = GETARG_k(i);
+      int f1, f2;
+      emitrm(J, 0, 0, X_MOVZXB, RAX, R13, RD(a) + TT);
+      emitcmpi(J, RAX, LUA_VFALSE);
+      f1 = emitjmp(J, CC_E);
+      emittestb(J, RAX, 0x0F);  /* nil? */
+      f2 = emitjmp(J, CC_E);
+      jumpto(J, -1, condtarget(pc, 1, k));
+      here(J, f1); here(J, f2);
+      jumpto(J, -1, condtarget(pc, 0, k));
+      break;
+    }
+    case OP_GETI: gettable(J, pc, i, -1, GETARG_C(i)); break;
+    case OP_GETTABLE: gettable(J, pc, i, GETARG_C(i), 0); break;
+    case OP_SETI: settable(J, pc, i, -1, GETARG_B(i)); break;
+    case OP_SETTABLE: settable(J, pc, i, GETARG_B(i), 0); break;
+    case OP_FORLOOP: {
+      int dest = pc + 1 - GETARG_Bx(i);
+      int s[2];
+      int done;
+      guardtag(J, a + 2, LUA_VNUMINT);
+      emitrm(J, 0, 1, X_MOVLD, RAX, R13, RD(a + 1));  /* count */
+      emitrr(J, 0, 1, 0x85, RAX, RAX);
+      done = emitjmp(J, CC_E);
+      emitaddi(J, RAX, -1);
+      emitrm(J, 0, 1, X_MOVST, RAX, R13, RD(a + 1));
+      emitrm(J, 0, 1, X_MOVLD, RAX, R13, RD(a));
+      emitrm(J, 0, 1, X_ADD, RAX, R13, RD(a + 2));
+      emitrm(J, 0, 1, X_MOVST, RAX, R13, RD(a));
+      emitrm(J, 0, 1, X_MOVST, RAX, R13, RD(a + 3));
+      emitstb(J, R13, RD(a + 3) + TT, LUA_VNUMINT);
+      checkhook(J, dest);
+      jumpto(J, -1, dest);
+      here(J, done);
+      jumpto(J, -1, pc + 1);
+      s[0] = pc + 1; s[1] = dest;
+      callhelper(J, pc, i, s, 2);
+      break;
+    }
+    case OP_FORPREP: {
+      int s[2];
+      s[0] = pc + 1; s[1] = pc + GETARG_Bx(i) + 2;
+      callhelper(J, pc, i, s, 2);
+      break;
+    }
+    case OP_TFORPREP: {
+      int s = pc + 1 + GETARG_Bx(i);
+      callhelper(J, pc, i, &s, 1);
+      break;
+    }
+    case OP_TFORLOOP: {
+      int s[2];
+      s[0] = pc + 1; s[1] = pc + 1 - GETARG_Bx(i);
+      callhelper(J, pc, i, s, 2);
+      break;
+    }
+    case OP_NEWTABLE: case OP_SETLIST: {
+      int s[2];  /* may skip an OP_EXTRAARG */
+      s[0] = pc + 1; s[1] = pc + 2;
+      callhelper(J, pc, i, s, 2);
+      break;
+    }
+    default: {
+      if (luaV_jithelper(GET_OPCODE(i)) != NULL)
+        callskip(J, pc, i);
+      else
+        exitat(J, pc);  /* leave it to the interpreter */
+      break;
+    }
+  }
+}
+
+/* }====================================================== */
+
+
+
+/*
+** {======================================================
+** Compilation
+** =======================================================
+*/
+
+/*
+** Entry: saves callee-saved registers, sets up the fixed registers and
+** jumps to its third argument. Exits: 'exitsave' stores 'rax' as the
+** 'savedpc' of the frame; both restore the registers and return.
+*/
+static void prologue (JitState *J) {
+  e8(J, 0x55);  /* push rbp */
+  e8(J, 0x53);  /* push rbx */
+  e8(J, 0x41); e8(J, 0x54);  /* push r12 */
+  e8(J, 0x41); e8(J, 0x55);  /* push r13 */
+  e8(J, 0x41); e8(J, 0x56);  /* push r14 (stack is now aligned) */
+  emitrr(J, 0, 1, X_MOVST, RDI, RBX);  /* rbx = L */
+  emitrr(J, 0, 1, X_MOVST, RSI, R12);  /* r12 = ci */
+  loadbase(J);
+  emitrm(J, 0, 1, X_MOVLD, R14, R13, -RD(1));  /* r14 = closure */
+  e8(J, 0xFF); e8(J, 0xE2);  /* jmp rdx */
+  J->exitsave = J->n;
+  emitrm(J, 0, 1, X_MOVST, RAX, R12,
+            cast_int(offsetof(CallInfo, u.l.savedpc)));
+  J->exit = J->n;
+  e8(J, 0x41); e8(J, 0x5E);  /* pop r14 */
+  e8(J, 0x41); e8(J, 0x5D);  /* pop r13 */
+  e8(J, 0x41); e8(J, 0x5C);  /* pop r12 */
+  e8(J, 0x5B);  /* pop rbx */
+  e8(J, 0x5D);  /* pop rbp */
+  e8(J, 0xC3);  /* ret */
+}
+
+
+/* copy generated code to executable memory */
+static lu_byte *makeexec (JitState *J) {
+#if defined(JIT_X64)
+  void *mem = mmap(NULL, cast_sizet(J->n), PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (mem == MAP_FAILED)
+    return NULL;
+  memcpy(mem, J->buff, cast_sizet(J->n));
+  if (mprotect(mem, cast_sizet(J->n), PROT_READ | PROT_EXEC) != 0) {
+    munmap(mem, cast_sizet(J->n));
+    return NULL;
+  }
+  return cast(lu_byte *, mem);
+#else
+  UNUSED(J);
+  return NULL;
+#endif
+}
+
+
+static void build (lua_State *L, void *ud) {
+  JitState *J = cast(JitState *, ud);
+  Proto *p = J->p;
+  JitCode *jc;
+  int pc, j;
+  J->pcmap = luaM_newvectorchecked(L, p->sizecode, int);
+  prologue(J);
+  for (pc = 0; pc < p->sizecode; pc++) {
+    J->pcmap[pc] = J->n;
+    translate(J, pc);
+  }
+  for (j = 0; j < J->nfix; j++) {
+    int target = J->fix[j].pc;
+    if (target < 0 || target >= p->sizecode)  /* malformed code? */
+      luaD_throw(L, LUA_ERRRUN);
+    setjmp32(J, J->fix[j].pos, J->pcmap[target]);
+  }
+  jc = J->jc = luaM_new(L, JitCode);
+  jc->native = NULL;
+  jc->mcode = makeexec(J);
+  jc->size = cast_sizet(J->n);
+  jc->pcmap = J->pcmap;
+  jc->sizepcmap = p->sizecode;
+  J->pcmap = NULL;
+  if (jc->mcode == NULL)
+    luaD_throw(L, LUA_ERRMEM);
+  memcpy(&jc->entry, &jc->mcode, sizeof(jc->entry));  /* object to code */
+}
+
+
+/*
+** Layout assumptions of the generated code; compilation is not tried
+** in builds that break them.
+*/
+static int supported (void) {
+#if defined(JIT_X64)
+  return (sizeof(StackValue) == 16 && sizeof(TValue) == 16 &&
+          offsetof(TValue, tt_) == 8 && sizeof(lua_Integer) == 8 &&
+          sizeof(lua_Number) == 8 && sizeof(l_signalT) == 4);
+#else
+  return 0;
+#endif
+}
+
+
+/*
+** Compile prototype 'p'. Errors (such as lack of memory) only mean
+** that 'p' keeps being interpreted. Emergency collections are stopped
+** because the interpreter has not saved its stack top.
+*/
+static int compile (lua_State *L, Proto *p) {
+  global_State *g = G(L);
+  JitState J;
+  lu_byte oldstopem = g->gcstopem;
+  int status;
+  if (!supported()) {
+    p->hotness = -1;
+    return 0;
+  }
+  memset(&J, 0, sizeof(J));
+  J.L = L;
+  J.p = p;
+  g->gcstopem = 1;
+  status = luaD_rawrunprotected(L, build, &J);
+  g->gcstopem = oldstopem;
+  luaM_freearray(L, J.buff, J.size);
+  luaM_freearray(L, J.fix, J.sizefix);
+  if (J.pcmap != NULL)
+    luaM_freearray(L, J.pcmap, p->sizecode);
+  if (status == LUA_OK)
+    p->jit = J.jc;
+  else {
+    if (J.jc != NULL) {
+      luaM_freearray(L, J.jc->pcmap, J.jc->sizepcmap);
+      luaM_free(L, J.jc);
+    }
+    p->hotness = -1;  /* do not try again */
+  }
+  return (p->jit != NULL);
+}
+
+
+int luaJ_tick (lua_State *L, Proto *p, int n) {
+  global_State *g = G(L);
+  if (g->jitmode == LUA_JITOFF || p->hotness < 0)
+    return 0;
+  p->hotness += n;
+  if (g->jitmode != LUA_JITALL && p->hotness < LUAI_JITHOT)
+    return 0;
+  return compile(L, p);
+}
+
+
+/*
+** Run the compiled code of the function of 'ci' from its 'savedpc'
+** until it needs the interpreter.
+*/
+void luaJ_run (lua_State *L, CallInfo *ci) {
+  Proto *p = clLvalue(s2v(ci->func))->p;
+  JitCode *jc = p->jit;
+  int pc = cast_int(ci->u.l.savedpc - p->qcode);
+  lua_assert(jc != NULL && 0 <= pc && pc < p->sizecode);
+  if (jc->native != NULL)
+    jc->native(L, ci);
+  else
+    jc->entry(L, ci, jc->mcode + jc->pcmap[pc]);
+}
+
+
+void luaJ_free (lua_State *L, Proto *p) {
+  JitCode *jc = p->jit;
+  if (jc != NULL) {
+#if defined(JIT_X64)
+    if (jc->mcode != NULL)
+      munmap(jc->mcode, jc->size);
+#endif
+    luaM_freearray(L, jc->pcmap, jc->sizepcmap);
+    luaM_free(L, jc);
+    p->jit = NULL;
+  }
+}
+
+
+
+static int countprotos (const Proto *p) {
+  int i;
+  int n = 1;
+  for (i = 0; i < p->sizep; i++)
+    n += countprotos(p->p[i]);
+  return n;
+}
+
+
+static int attach (lua_State *L, Proto *p, const luaJ_Native *f, int i) {
+  int j;
+  if (p->jit == NULL) {
+    JitCode *jc = luaM_new(L, JitCode);
+    jc->mcode = NULL;
+    jc->size = 0;
+    jc->pcmap = NULL;
+    jc->sizepcmap = 0;
+    jc->entry = NULL;
+    jc->native = f[i];
+    p->jit = jc;
+  }
+  i++;
+  for (j = 0; j < p->sizep; j++)  /* prototypes in the order 'luac' lists */
+    i = attach(L, p->p[j], f, i);
+  return i;
+}
+
+
+/*
+** Attach the precompiled code 'f' ('n' functions, one per prototype in
+** preorder) to the Lua function on the top of the stack.
+*/
+void luaJ_attach (lua_State *L, const luaJ_Native *f, int n) {
+  Proto *p = getproto(s2v(L->top - 1));
+  if (countprotos(p) != n)
+    luaG_runerror(L, "precompiled code does not match its chunk");
+  attach(L, p, f, 0);
+}
+
+/* }====================================================== */
+
+#endif
@@ -0,0 +1,50 @@
+/*
+** $Id: ljit.h $
+** Baseline compiler to native code
+** See Copyright Notice in lua.h
+*/
+
+#ifndef ljit_h
+#define ljit_h
+
+
+#include "lobject.h"
+#include "lstate.h"
+
+
+#if defined(LUA_USE_JIT)
+
+/*
+** Number of calls plus loop iterations after which a function is
+** compiled
+*/
+#if !defined(LUAI_JITHOT)
+#define LUAI_JITHOT	200
+#endif
+
+
+/*
+** Count 'n' events for prototype 'p' and tell whether the interpreter
+** should switch to its compiled code
+*/
+#define luaJ_hot(L,p,n)  \
+	((p)->jit != NULL ? G(L)->jitmode != LUA_JITOFF  \
+	                  : ((n) != 0 && luaJ_tick(L,p,n)))
+
+
+/*
+** Precompiled C code of a prototype (see 'luac -C'): runs the function
+** of 'ci' from its 'savedpc' and, when it stops, leaves in 'savedpc'
+** the instruction the interpreter must continue from.
+*/
+typedef void (*luaJ_Native) (lua_State *L, CallInfo *ci);
+
+
+LUAI_FUNC int luaJ_tick (lua_State *L, Proto *p, int n);
+LUAI_FUNC void luaJ_run (lua_State *L, CallInfo *ci);
+LUAI_FUNC void luaJ_free (lua_State *L, Proto *p);
+LUAI_FUNC void luaJ_attach (lua_State *L, const luaJ_Native *f, int n);
+
+#endif
+
+#endif
@@ -107,6 +107,19 @@ static const void *const disptab[NUM_OPCODES] = {
 &&L_OP_CLOSURE,
 &&L_OP_VARARG,
 &&L_OP_VARARGPREP,
-&&L_OP_EXTRAARG
+&&L_OP_EXTRAARG,
+&&L_OP_ADD_II,
+&&L_OP_ADD_FF,
+&&L_OP_SUB_II,
+&&L_OP_SUB_FF,
+&&L_OP_MUL_II,
+&&L_OP_MUL_FF,
+&&L_OP_DIV_FF,
+&&L_OP_LT_II,
+&&L_OP_LT_FF,
+&&L_OP_LE_II,
+&&L_OP_LE_FF,
+&&L_OP_GETTABLE_ARRAYINT,
+&&L_OP_SETTABLE_ARRAYINT
 
 };
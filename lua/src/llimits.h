@@ -204,6 +204,22 @@ typedef l_uint32 Instruction;
 #endif
 
 
+/*
+** Minimum length for the result of a concatenation to share its
+** buffer with the first operand (see 'luaS_extend'), so that repeated
+** appends to a string do not copy it each time.
+*/
+#if !defined(LUAI_MINSHAREDLEN)
+#define LUAI_MINSHAREDLEN	256
+#endif
+
+
+/* maximum length of a numeral to be converted to a number */
+#if !defined (L_MAXLENNUM)
+#define L_MAXLENNUM	200
+#endif
+
+
 /*
 ** Initial size for the string table (must be power of 2).
 ** The Lua core alone registers ~50 strings (reserved words +
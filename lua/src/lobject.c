@@ -10,6 +10,7 @@
 #include "lprefix.h"
 
 
+#include <float.h>
 #include <locale.h>
 #include <math.h>
 #include <stdarg.h>
@@ -215,11 +216,6 @@ static lua_Number lua_strx2number (const char *s, char **endptr) {
 /* }====================================================== */
 
 
-/* maximum length of a numeral to be converted to a number */
-#if !defined (L_MAXLENNUM)
-#define L_MAXLENNUM	200
-#endif
-
 /*
 ** Convert string 's' to a Lua number (put in 'result'). Return NULL on
 ** fail or the address of the ending '\0' on success. ('mode' == 'x')
@@ -235,6 +231,112 @@ static const char *l_str2dloc (const char *s, lua_Number *result, int mode) {
 }
 
 
+/*
+** The fast conversions between floats and numerals assume IEEE doubles,
+** 64-bit integers, and float operations rounded to their types.
+*/
+#if !defined(l_fastnumconv)
+#if LUA_FLOAT_TYPE == LUA_FLOAT_DOUBLE && \
+    (LUA_MAXINTEGER >> 31 >> 31) == 1 && \
+    defined(FLT_EVAL_METHOD) && FLT_EVAL_METHOD == 0
+#define l_fastnumconv	1
+#else
+#define l_fastnumconv	0
+#endif
+#endif
+
+
+#if l_fastnumconv
+
+/* powers of ten that are exact as floats */
+static const lua_Number pow10tab[] = {
+  1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+#define MAXPOW10	22
+
+/* 2^53: larger significands may not be exact as floats */
+#define MAXEXACT	(cast(lua_Unsigned, 1) << 53)
+
+
+/*
+** Convert a decimal numeral with one float operation, which gives the
+** correctly rounded result when its significand and its power of ten
+** are both exact as floats (Clinger's fast path). Return NULL if 's'
+** is not such a numeral; then the caller uses 'lua_str2number'. Both
+** a dot and the locale radix mark are accepted, as in 'l_str2d'.
+*/
+static const char *l_str2dfast (const char *s, lua_Number *result) {
+  int dot = lua_getlocaledecpoint();
+  lua_Unsigned w = 0;  /* significand */
+  int nsig = 0;  /* number of significant digits */
+  int ndig = 0;  /* number of digits */
+  int e = 0;  /* decimal exponent */
+  int hasdot = 0;
+  int neg;
+  lua_Number r;
+  while (lisspace(cast_uchar(*s))) s++;  /* skip initial spaces */
+  neg = isneg(&s);
+  for (;; s++) {
+    if (*s == '.' || *s == dot) {
+      if (hasdot) return NULL;  /* second dot */
+      hasdot = 1;
+    }
+    else if (lisdigit(cast_uchar(*s))) {
+      ndig++;
+      if (nsig > 0 || *s != '0') {  /* significant digit? */
+        if (++nsig > 19)
+          return NULL;  /* significand may not fit in an integer */
+        w = w * 10 + (*s - '0');
+      }
+      if (hasdot) e--;  /* decimal digit? correct exponent */
+    }
+    else break;
+  }
+  if (ndig == 0)  /* no digits? */
+    return NULL;
+  if (*s == 'e' || *s == 'E') {  /* exponent part? */
+    int exp1 = 0;
+    int neg1;
+    s++;  /* skip 'e' */
+    neg1 = isneg(&s);
+    if (!lisdigit(cast_uchar(*s)))
+      return NULL;  /* invalid; must have at least one digit */
+    for (; lisdigit(cast_uchar(*s)); s++) {
+      if (exp1 < 10000)  /* avoid overflows */
+        exp1 = exp1 * 10 + (*s - '0');
+    }
+    e += (neg1) ? -exp1 : exp1;
+  }
+  while (lisspace(cast_uchar(*s))) s++;  /* skip trailing spaces */
+  if (*s != '\0' || w > MAXEXACT)
+    return NULL;
+  if (w == 0)
+    r = 0;
+  else if (e < 0) {
+    if (e < -MAXPOW10) return NULL;
+    r = cast_num(w) / pow10tab[-e];
+  }
+  else {
+    if (e > MAXPOW10) {  /* move part of the exponent to the significand */
+      int i;
+      if (e > MAXPOW10 + 15) return NULL;
+      for (i = e - MAXPOW10; i > 0; i--) {
+        if (w > MAXEXACT / 10) return NULL;
+        w *= 10;
+      }
+      e = MAXPOW10;
+    }
+    r = cast_num(w) * pow10tab[e];
+  }
+  *result = (neg) ? -r : r;
+  return s;
+}
+
+#endif
+
+
 /*
 ** Convert string 's' to a Lua number (put in 'result') handling the
 ** current locale.
@@ -254,6 +356,10 @@ static const char *l_str2d (const char *s, lua_Number *result) {
   int mode = pmode ? ltolower(cast_uchar(*pmode)) : 0;
   if (mode == 'n')  /* reject 'inf' and 'nan' */
     return NULL;
+#if l_fastnumconv
+  if (mode != 'x' && (endptr = l_str2dfast(s, result)) != NULL)
+    return endptr;
+#endif
   endptr = l_str2dloc(s, result, mode);  /* try to convert */
   if (endptr == NULL) {  /* failed? may be a different locale */
     char buff[L_MAXLENNUM + 1];
@@ -344,27 +450,351 @@ int luaO_utf8esc (char *buff, unsigned long x) {
 ** (For a long long int, this is 19 digits plus a sign and a final '\0',
 ** adding to 21. For a long double, it can go to a sign, 33 digits,
 ** the dot, an exponent letter, an exponent sign, 5 exponent digits,
-** and a final '\0', adding to 43.)
+** and a final '\0', adding to 43.) LUA_N2SBUFFSZ must not be smaller.
 */
 #define MAXNUMBER2STR	44
 
 
 /*
-** Convert a number object to a string, adding it to a buffer
+** Write 'u' in decimal into the space ending at 'end'. Return the
+** address of its first digit.
+*/
+static char *udigits (char *end, lua_Unsigned u) {
+  do {
+    *--end = cast_char('0' + cast_int(u % 10));
+    u /= 10;
+  } while (u != 0);
+  return end;
+}
+
+
+static int tostringint (char *buff, lua_Integer i) {
+  char digits[MAXNUMBER2STR];
+  char *end = digits + MAXNUMBER2STR;
+  lua_Unsigned u = l_castS2U(i);
+  char *d = udigits(end, (i < 0) ? 0u - u : u);
+  int len = 0;
+  if (i < 0) buff[len++] = '-';
+  memcpy(buff + len, d, end - d);
+  return len + cast_int(end - d);
+}
+
+
+/*
+** {==================================================================
+** Conversion of floats to numerals
+** ===================================================================
+*/
+
+#if l_fastnumconv
+
+/*
+** Floats are converted to the shortest numeral that reads back as the
+** same float; with LUA_COMPAT_NUMFMT, they are converted as with
+** LUA_NUMBER_FMT ("%.14g"). In both cases, the layout is the one of
+** format '%.<P>g', with P equal to NUMPREC.
+*/
+#if defined(LUA_COMPAT_NUMFMT)
+#define NUMPREC		14
+#else
+#define NUMPREC		17
+#endif
+
+
+/*
+** Write into 'buff' the numeral with the 'nd' significant digits in
+** 'd' (without trailing zeros) and decimal exponent 'p' (the exponent
+** of its first digit), following the layout of format '%.<prec>g'.
+*/
+static int layoutnum (char *buff, int neg, const char *d, int nd, int p,
+                      int prec) {
+  char *b = buff;
+  if (neg) *b++ = '-';
+  if (p < -4 || p >= prec) {  /* exponential notation */
+    *b++ = *d;
+    if (nd > 1) {
+      *b++ = lua_getlocaledecpoint();
+      memcpy(b, d + 1, nd - 1);
+      b += nd - 1;
+    }
+    *b++ = 'e';
+    *b++ = (p < 0) ? '-' : '+';
+    if (p < 0) p = -p;
+    if (p >= 100) *b++ = cast_char('0' + p / 100);
+    *b++ = cast_char('0' + (p / 10) % 10);
+    *b++ = cast_char('0' + p % 10);
+  }
+  else if (p >= 0) {  /* integer part has 'p' + 1 digits */
+    if (nd <= p + 1) {
+      memcpy(b, d, nd);
+      memset(b + nd, '0', p + 1 - nd);
+      b += p + 1;
+    }
+    else {
+      memcpy(b, d, p + 1);
+      b += p + 1;
+      *b++ = lua_getlocaledecpoint();
+      memcpy(b, d + p + 1, nd - p - 1);
+      b += nd - p - 1;
+    }
+  }
+  else {  /* 0.000ddd */
+    *b++ = '0';
+    *b++ = lua_getlocaledecpoint();
+    memset(b, '0', -p - 1);
+    b += -p - 1;
+    memcpy(b, d, nd);
+    b += nd;
+  }
+  return cast_int(b - buff);
+}
+
+
+/*
+** Write integer 'n' (the significand) with decimal exponent 'p' into
+** 'buff'.
+*/
+static int layoutint (char *buff, int neg, lua_Unsigned n, int p) {
+  char digits[MAXNUMBER2STR];
+  char *end = digits + MAXNUMBER2STR;
+  char *d;
+  while (n % 10 == 0) n /= 10;  /* remove trailing zeros */
+  d = udigits(end, n);
+  return layoutnum(buff, neg, d, cast_int(end - d), p, NUMPREC);
+}
+
+
+/*
+** Compute 'ax' * 10^('prec' - 1 - 'p'), which is in [10^(prec-1),
+** 10^prec) when 'p' is the decimal exponent of 'ax'. Return -1 if the
+** power of ten is not exact.
+*/
+static lua_Number scale10 (lua_Number ax, int p, int prec) {
+  int k = prec - 1 - p;
+  if (k > MAXPOW10 || k < -MAXPOW10)
+    return -1;
+  return (k >= 0) ? ax * pow10tab[k] : ax / pow10tab[-k];
+}
+
+
+#if !defined(LUA_COMPAT_NUMFMT)
+
+#if defined(__SIZEOF_INT128__)
+
+typedef unsigned __int128 l_uint128;
+
+/*
+** Shortest numeral for 'ax', with exact integer arithmetic (in the
+** style of Steele & White's algorithm). Scaled by 10^k, the numerals
+** that read back as 'ax' form an interval [L, H] of integers with at
+** least 17 digits; the result is the multiple of the largest possible
+** power of ten inside that interval closest to 'ax'. 'p' is the
+** decimal exponent of 'ax' or one less than it. Return -1 if the
+** scaled values may not fit in 128 bits.
+*/
+static int shortestexact (char *buff, int neg, lua_Number ax, int p) {
+  int k = 16 - p;
+  int e, i, incl;
+  lua_Unsigned m, vi, lo, hi, pw, c;
+  l_uint128 mv, mlo, mhi, f = 1, r, d;
+  if (k > 21 || k < -20)
+    return -1;
+  m = cast(lua_Unsigned, l_mathop(ldexp)(l_mathop(frexp)(ax, &e), 53));
+  e -= 55;  /* ax == 4m * 2^e */
+  mv = cast(l_uint128, m) * 4;
+  mlo = mv - ((m == (MAXEXACT >> 1)) ? 1 : 2);  /* closer lower neighbor? */
+  mhi = mv + 2;
+  incl = (m % 2 == 0);  /* even floats get their rounding ties */
+  for (i = 0; i < (k < 0 ? -k : k); i++)
+    f *= 10;
+  if (k >= 0) {  /* multiply by 10^k and divide by 2^-e */
+    int s = 0;
+    if (e >= 0) f <<= e;
+    else s = -e;
+    mv *= f; mlo *= f; mhi *= f;
+    d = cast(l_uint128, 1) << s;
+    vi = cast(lua_Unsigned, mv >> s);
+    r = mv & (d - 1);
+    lo = cast(lua_Unsigned, mlo >> s) + ((mlo & (d - 1)) != 0);
+    if ((mlo & (d - 1)) == 0 && !incl) lo++;
+    hi = cast(lua_Unsigned, mhi >> s);
+    if ((mhi & (d - 1)) == 0 && !incl) hi--;
+  }
+  else {  /* multiply by 2^e and divide by 10^-k */
+    if (e < 0) return -1;
+    mv <<= e; mlo <<= e; mhi <<= e;
+    d = f;
+    vi = cast(lua_Unsigned, mv / d);
+    r = mv % d;
+    lo = cast(lua_Unsigned, mlo / d) + ((mlo % d) != 0);
+    if ((mlo % d) == 0 && !incl) lo++;
+    hi = cast(lua_Unsigned, mhi / d);
+    if ((mhi % d) == 0 && !incl) hi--;
+  }
+  /* find the largest power of ten with a multiple in [lo, hi] */
+  for (pw = 1; pw <= hi / 10; pw *= 10) ;
+  while (hi / pw * pw < lo)
+    pw /= 10;
+  c = vi / pw * pw;  /* multiple below the scaled value */
+  if (c < lo)
+    c += pw;
+  else if (c + pw <= hi) {  /* both neighbors are in the interval */
+    lua_Unsigned a = vi - c;  /* distances to the scaled value are */
+    lua_Unsigned b = c + pw - vi;  /* a + r/d and b - r/d */
+    if (b < a || (b == a && r > 0) ||
+        (b == a + 1 && 2 * r > d) ||
+        (((b == a && r == 0) || (b == a + 1 && 2 * r == d)) &&
+         (c / pw) % 2 != 0))  /* tie: choose the even one */
+      c += pw;
+  }
+  {
+    char digits[MAXNUMBER2STR];
+    char *end = digits + MAXNUMBER2STR;
+    char *dg = udigits(end, c);
+    int nd = cast_int(end - dg);
+    p = nd - 1 - k;  /* decimal exponent of the result */
+    while (nd > 1 && dg[nd - 1] == '0') nd--;  /* remove trailing zeros */
+    return layoutnum(buff, neg, dg, nd, p, NUMPREC);
+  }
+}
+
+#else
+
+#define shortestexact(buff,neg,ax,p)	(-1)
+
+#endif
+
+
+/*
+** Slow path for the shortest numeral: try increasing precisions until
+** the result reads back as 'x'. For normal floats, 15 digits are the
+** minimum worth trying: a shorter numeral that reads back as 'x', if
+** any, is the 15-digit one without its trailing zeros. Subnormal floats
+** have fewer significant bits and may need fewer digits.
+*/
+static int shortestslow (char *buff, lua_Number x) {
+  char num[MAXNUMBER2STR];
+  char digits[MAXNUMBER2STR];
+  char form[] = "%.00e";
+  int prec, nd = 0, p;
+  const char *s;
+  prec = (l_mathop(fabs)(x) < l_floatatt(MIN)) ? 1 : 15;
+  for (;; prec++) {  /* 17 digits always read back as 'x' */
+    form[2] = cast_char('0' + (prec - 1) / 10);
+    form[3] = cast_char('0' + (prec - 1) % 10);
+    l_sprintf(num, sizeof(num), form, (LUAI_UACNUMBER)x);
+    if (prec == 17 || lua_str2number(num, NULL) == x)
+      break;
+  }
+  for (s = num; *s != 'e'; s++) {  /* collect digits */
+    if (lisdigit(cast_uchar(*s)))
+      digits[nd++] = *s;
+  }
+  p = atoi(s + 1);
+  while (nd > 1 && digits[nd - 1] == '0') nd--;  /* remove trailing zeros */
+  return layoutnum(buff, x < 0, digits, nd, p, NUMPREC);
+}
+
+#endif
+
+
+/*
+** Convert float 'x' to a numeral in 'buff'. For most floats, the
+** significant digits come from scaling 'x' by an exact power of ten,
+** which needs only one float operation. Return -1 if 'x' is not
+** handled here.
+*/
+static int tostringflt (char *buff, lua_Number x) {
+  lua_Number ax = l_mathop(fabs)(x);
+  lua_Number y;
+  lua_Unsigned n;
+  int neg = (x < 0);
+  int p, e2;
+#if !defined(LUA_COMPAT_NUMFMT)
+  int p0, len;
+#endif
+  if (x == 0) {  /* keep the sign of -0.0 */
+    lua_Number one = l_mathop(1.0);
+    return layoutnum(buff, l_mathop(copysign)(one, x) < 0, "0", 1, 0,
+                     NUMPREC);
+  }
+  if (!(ax <= l_floatatt(MAX)))  /* inf or NaN? */
+    return -1;
+  l_mathop(frexp)(ax, &e2);  /* 2^(e2 - 1) <= ax < 2^e2 */
+  p = cast_int(l_mathop(floor)((e2 - 1) * 0.30102999566398119521));
+  /* 'p' is the decimal exponent of 'ax' or one less than it */
+#if defined(LUA_COMPAT_NUMFMT)
+  /*
+  ** With 'y' in [10^13, 10^14), the error in its computation is less
+  ** than 0.02; so, unless it is near a tie, rounding it gives the same
+  ** 14 digits as rounding the exact value.
+  */
+  if ((y = scale10(ax, p, 14)) >= 1e14)
+    y = scale10(ax, ++p, 14);
+  if (y < 0 || l_mathop(fabs)(y - l_mathop(floor)(y) - 0.5) < 0.05)
+    return -1;
+  n = cast(lua_Unsigned, y + 0.5);
+  if (n == cast(lua_Unsigned, 100000000000000.0))  /* rounded up to 10^14? */
+    p++;
+  return layoutint(buff, neg, n, p);
+#else
+  /*
+  ** With 'y' in [10^14, 10^15), at most one 15-digit numeral reads back
+  ** as 'x', and it is the rounded value of 'y' (the error in 'y' is less
+  ** than 0.12). Checking whether it reads back as 'x' needs again only
+  ** one float operation.
+  */
+  p0 = p;
+  if ((y = scale10(ax, p, 15)) >= 1e15)
+    y = scale10(ax, ++p, 15);
+  if (y >= 0) {
+    int k = 14 - p;
+    n = cast(lua_Unsigned, y + 0.5);
+    if (((k >= 0) ? cast_num(n) / pow10tab[k]
+                  : cast_num(n) * pow10tab[-k]) == ax) {
+      if (n == cast(lua_Unsigned, 1000000000000000.0))  /* rounded up? */
+        p++;
+      return layoutint(buff, neg, n, p);
+    }
+  }
+  if ((len = shortestexact(buff, neg, ax, p0)) >= 0)
+    return len;
+  return shortestslow(buff, x);
+#endif
+}
+
+#else
+
+#define tostringflt(buff,x)	(-1)
+
+#endif
+
+/* }================================================================== */
+
+
+/*
+** Convert a number object to a string in 'buff', which must have at
+** least MAXNUMBER2STR bytes. Return the length of the string (without
+** its final '\0').
 */
-static int tostringbuff (TValue *obj, char *buff) {
+unsigned luaO_tostringbuff (const TValue *obj, char *buff) {
   int len;
   lua_assert(ttisnumber(obj));
   if (ttisinteger(obj))
-    len = lua_integer2str(buff, MAXNUMBER2STR, ivalue(obj));
+    len = tostringint(buff, ivalue(obj));
   else {
-    len = lua_number2str(buff, MAXNUMBER2STR, fltvalue(obj));
+    len = tostringflt(buff, fltvalue(obj));
+    if (len >= 0)
+      buff[len] = '\0';
+    else  /* not handled */
+      len = lua_number2str(buff, MAXNUMBER2STR, fltvalue(obj));
     if (buff[strspn(buff, "-0123456789")] == '\0') {  /* looks like an int? */
       buff[len++] = lua_getlocaledecpoint();
       buff[len++] = '0';  /* adds '.0' to result */
     }
   }
-  return len;
+  buff[len] = '\0';
+  return cast_uint(len);
 }
 
 
@@ -373,7 +803,7 @@ static int tostringbuff (TValue *obj, char *buff) {
 */
 void luaO_tostring (lua_State *L, TValue *obj) {
   char buff[MAXNUMBER2STR];
-  int len = tostringbuff(obj, buff);
+  int len = cast_int(luaO_tostringbuff(obj, buff));
   setsvalue(L, obj, luaS_newlstr(L, buff, len));
 }
 
@@ -458,7 +888,8 @@ static void addstr2buff (BuffFS *buff, const char *str, size_t slen) {
 */
 static void addnum2buff (BuffFS *buff, TValue *num) {
   char *numbuff = getbuff(buff, MAXNUMBER2STR);
-  int len = tostringbuff(num, numbuff);  /* format number into 'numbuff' */
+  /* format number into 'numbuff' */
+  int len = cast_int(luaO_tostringbuff(num, numbuff));
   addsize(buff, len);
 }
 
@@ -532,6 +963,7 @@ const char *luaO_pushvfstring (lua_State *L, const char *fmt, va_list argp) {
   addstr2buff(&buff, fmt, strlen(fmt));  /* rest of 'fmt' */
   clearbuff(&buff);  /* empty buffer into the stack */
   lua_assert(buff.pushed == 1);
+  luaS_seal(L, tsvalue(s2v(L->top - 1)));
   return svalue(s2v(L->top - 1));
 }
 
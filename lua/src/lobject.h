@@ -385,9 +385,40 @@ typedef struct TString {
 
 
 /*
-** Get the actual string (array of bytes) from a 'TString'.
+** Buffer shared by long strings built by appending to each other (see
+** 'luaS_extend'): the contents of each of these strings is a prefix of
+** 'data', so only the longest one ('used' bytes) is sure to be followed
+** by a '\0'.
 */
-#define getstr(ts)  ((ts)->contents)
+typedef struct StrBuf {
+  size_t refs;  /* number of strings using this buffer */
+  size_t size;  /* size of 'data' */
+  size_t limit;  /* appended strings must be shorter than this */
+  size_t used;  /* length of the longest string using this buffer */
+  char data[1];
+} StrBuf;
+
+
+/*
+** A long string using a 'StrBuf' has SHAREDSTR in its 'shrlen' (which
+** is otherwise zero for long strings) and keeps a pointer to the
+** buffer instead of its contents.
+*/
+#define SHAREDSTR	0xFF
+
+#define isshared(ts)	((ts)->shrlen == SHAREDSTR)
+#define sharedbuf(ts)	(*cast(StrBuf **, (ts)->contents))
+
+
+/*
+** Get the actual string (array of bytes) from a 'TString'. Short
+** strings are never shared, so 'getshrstr' can skip the test.
+*/
+#define getshrstr(ts)	check_exp((ts)->tt == LUA_VSHRSTR, (ts)->contents)
+
+l_sinline char *getstr (const TString *ts) {
+  return isshared(ts) ? sharedbuf(ts)->data : cast_charp(ts->contents);
+}
 
 
 /* get the actual string (array of bytes) from a Lua value */
@@ -552,6 +583,12 @@ typedef struct Proto {
   int lastlinedefined;  /* debug information  */
   TValue *k;  /* constants used by the function */
   Instruction *code;  /* opcodes */
+  Instruction *qcode;  /* quickened copy of 'code' (the one executed) */
+  unsigned int *icache;  /* per-instruction caches (see 'lvm.c') */
+#if defined(LUA_USE_JIT)
+  struct JitCode *jit;  /* native code (see 'ljit.c') */
+  int hotness;  /* calls and loop iterations so far (-1: not compilable) */
+#endif
   struct Proto **p;  /* functions defined inside the function */
   Upvaldesc *upvalues;  /* upvalue information */
   ls_byte *lineinfo;  /* information about source lines (debug information) */
@@ -715,16 +752,17 @@ typedef union Node {
 ** is zero); 'alimit' is then used as a hint for #t.
 */
 
-#define BITRAS		(1 << 7)
+#define BITRAS		(1u << 31)
 #define isrealasize(t)		(!((t)->flags & BITRAS))
-#define setrealasize(t)		((t)->flags &= cast_byte(~BITRAS))
+#define setrealasize(t)		((t)->flags &= ~BITRAS)
 #define setnorealasize(t)	((t)->flags |= BITRAS)
 
 
 typedef struct Table {
   CommonHeader;
-  lu_byte flags;  /* 1<<p means tagmethod(p) is not present */
   lu_byte lsizenode;  /* log2 of size of 'node' array */
+  lu_byte travs;  /* traversals going through the hash part (see 'nextfrom') */
+  unsigned int flags;  /* 1<<p means tagmethod(p) is not present */
   unsigned int alimit;  /* "limit" of 'array' array */
   TValue *array;  /* array part */
   Node *node;
@@ -789,6 +827,7 @@ LUAI_FUNC void luaO_arith (lua_State *L, int op, const TValue *p1,
                            const TValue *p2, StkId res);
 LUAI_FUNC size_t luaO_str2num (const char *s, TValue *o);
 LUAI_FUNC int luaO_hexavalue (int c);
+LUAI_FUNC unsigned luaO_tostringbuff (const TValue *obj, char *buff);
 LUAI_FUNC void luaO_tostring (lua_State *L, TValue *obj);
 LUAI_FUNC const char *luaO_pushvfstring (lua_State *L, const char *fmt,
                                                        va_list argp);
@@ -100,5 +100,18 @@ LUAI_DDEF const lu_byte luaP_opmodes[NUM_OPCODES] = {
  ,opmode(0, 1, 0, 0, 1, iABC)		/* OP_VARARG */
  ,opmode(0, 0, 1, 0, 1, iABC)		/* OP_VARARGPREP */
  ,opmode(0, 0, 0, 0, 0, iAx)		/* OP_EXTRAARG */
+ ,opmode(0, 0, 0, 0, 1, iABC)		/* OP_ADD_II */
+ ,opmode(0, 0, 0, 0, 1, iABC)		/* OP_ADD_FF */
+ ,opmode(0, 0, 0, 0, 1, iABC)		/* OP_SUB_II */
+ ,opmode(0, 0, 0, 0, 1, iABC)		/* OP_SUB_FF */
+ ,opmode(0, 0, 0, 0, 1, iABC)		/* OP_MUL_II */
+ ,opmode(0, 0, 0, 0, 1, iABC)		/* OP_MUL_FF */
+ ,opmode(0, 0, 0, 0, 1, iABC)		/* OP_DIV_FF */
+ ,opmode(0, 0, 0, 1, 0, iABC)		/* OP_LT_II */
+ ,opmode(0, 0, 0, 1, 0, iABC)		/* OP_LT_FF */
+ ,opmode(0, 0, 0, 1, 0, iABC)		/* OP_LE_II */
+ ,opmode(0, 0, 0, 1, 0, iABC)		/* OP_LE_FF */
+ ,opmode(0, 0, 0, 0, 1, iABC)		/* OP_GETTABLE_ARRAYINT */
+ ,opmode(0, 0, 0, 0, 0, iABC)		/* OP_SETTABLE_ARRAYINT */
 };
 
@@ -306,11 +306,26 @@ OP_VARARG,/*	A C	R[A], R[A+1], ..., R[A+C-2] = vararg		*/
 
 OP_VARARGPREP,/*A	(adjust vararg parameters)			*/
 
-OP_EXTRAARG/*	Ax	extra (larger) argument for previous opcode	*/
+OP_EXTRAARG,/*	Ax	extra (larger) argument for previous opcode	*/
+
+/* quickened opcodes; they only appear in 'qcode' (see 'lvm.c') */
+OP_ADD_II,/*	A B C	R[A] := R[B] + R[C] (integers)			*/
+OP_ADD_FF,/*	A B C	R[A] := R[B] + R[C] (floats)			*/
+OP_SUB_II,/*	A B C	R[A] := R[B] - R[C] (integers)			*/
+OP_SUB_FF,/*	A B C	R[A] := R[B] - R[C] (floats)			*/
+OP_MUL_II,/*	A B C	R[A] := R[B] * R[C] (integers)			*/
+OP_MUL_FF,/*	A B C	R[A] := R[B] * R[C] (floats)			*/
+OP_DIV_FF,/*	A B C	R[A] := R[B] / R[C] (floats)			*/
+OP_LT_II,/*	A B k	if ((R[A] <  R[B]) ~= k) then pc++ (integers)	*/
+OP_LT_FF,/*	A B k	if ((R[A] <  R[B]) ~= k) then pc++ (floats)	*/
+OP_LE_II,/*	A B k	if ((R[A] <= R[B]) ~= k) then pc++ (integers)	*/
+OP_LE_FF,/*	A B k	if ((R[A] <= R[B]) ~= k) then pc++ (floats)	*/
+OP_GETTABLE_ARRAYINT,/*	A B C	R[A] := R[B][R[C]] (table, integer key)	*/
+OP_SETTABLE_ARRAYINT/*	A B C	R[A][R[B]] := RK(C) (table, integer key)	*/
 } OpCode;
 
 
-#define NUM_OPCODES	((int)(OP_EXTRAARG) + 1)
+#define NUM_OPCODES	((int)(OP_SETTABLE_ARRAYINT) + 1)
 
 
 
@@ -365,6 +380,12 @@ OP_EXTRAARG/*	Ax	extra (larger) argument for previous opcode	*/
   original operand was a float. (It must be corrected in case of
   metamethods.)
 
+  (*) Quickened opcodes are never generated by the compiler nor saved
+  in binary chunks. The interpreter rewrites a generic instruction in
+  'qcode' into a quickened one after seeing operands of the given types,
+  and back into the generic one when that guard fails. They have the
+  same arguments and modes as their generic forms.
+
 ===========================================================================*/
 
 
@@ -96,6 +96,19 @@ static const char *const opnames[] = {
   "VARARG",
   "VARARGPREP",
   "EXTRAARG",
+  "ADD_II",
+  "ADD_FF",
+  "SUB_II",
+  "SUB_FF",
+  "MUL_II",
+  "MUL_FF",
+  "DIV_FF",
+  "LT_II",
+  "LT_FF",
+  "LE_II",
+  "LE_FF",
+  "GETTABLE_ARRAYINT",
+  "SETTABLE_ARRAYINT",
   NULL
 };
 
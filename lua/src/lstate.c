@@ -102,11 +102,55 @@ LUA_API int lua_setcstacklimit (lua_State *L, unsigned int limit) {
 }
 
 
+/*
+** {==================================================================
+** CallInfo blocks
+** ===================================================================
+*/
+
+/*
+** CallInfo structures live in blocks of consecutive entries, each block
+** twice the size of the previous one (from LUAI_CIBLOCK up to
+** MAXCIBLOCK). Blocks never move, as pointers to CallInfo are kept all
+** over the place. The entries in the 'ci' list are always a prefix of
+** the blocks: all blocks but the last one are full, and a block is
+** freed as soon as none of its entries is in the list.
+*/
+
+#define MAXCIBLOCK	1024
+
+typedef struct CIBlock {
+  struct CIBlock *previous;  /* previous block of the same thread */
+  int size;  /* number of entries in 'ci' */
+  CallInfo ci[1];  /* entries */
+} CIBlock;
+
+
+#define ciblocksize(n)	(offsetof(CIBlock, ci) + cast_sizet(n) * sizeof(CallInfo))
+
+/* true if 'c' is an entry of block 'b' */
+#define inblock(b,c)  \
+	(cast_sizet(c) - cast_sizet((b)->ci) < ciblocksize((b)->size) - offsetof(CIBlock, ci))
+
+
 CallInfo *luaE_extendCI (lua_State *L) {
+  CIBlock *b = L->ciblock;
   CallInfo *ci;
   lua_assert(L->ci->next == NULL);
-  ci = luaM_new(L, CallInfo);
-  lua_assert(L->ci->next == NULL);
+  if (L->ci != &L->base_ci && L->ci != b->ci + b->size - 1) {
+    lua_assert(inblock(b, L->ci));
+    ci = L->ci + 1;  /* next entry of the last block */
+  }
+  else {  /* last block is full (or there is none); create a new one */
+    int size = (b == NULL) ? LUAI_CIBLOCK
+                           : (b->size < MAXCIBLOCK / 2) ? b->size * 2
+                                                        : MAXCIBLOCK;
+    b = cast(CIBlock *, luaM_malloc_(L, ciblocksize(size), 0));
+    b->previous = L->ciblock;
+    b->size = size;
+    L->ciblock = b;
+    ci = b->ci;
+  }
   L->ci->next = ci;
   ci->previous = L->ci;
   ci->next = NULL;
@@ -117,42 +161,26 @@ CallInfo *luaE_extendCI (lua_State *L) {
 
 
 /*
-** free all CallInfo structures not in use by a thread
+** Cut the 'ci' list after the current entry and free all blocks
+** beyond the one holding it (all of them if the thread is at its
+** base level). Free entries left in that block are reused by the
+** next calls.
 */
-void luaE_freeCI (lua_State *L) {
+void luaE_shrinkCI (lua_State *L) {
   CallInfo *ci = L->ci;
   CallInfo *next = ci->next;
   ci->next = NULL;
-  while ((ci = next) != NULL) {
-    next = ci->next;
-    luaM_free(L, ci);
+  for (; next != NULL; next = next->next)
     L->nci--;
+  while (L->ciblock != NULL &&
+         (ci == &L->base_ci || !inblock(L->ciblock, ci))) {
+    CIBlock *b = L->ciblock;
+    L->ciblock = b->previous;
+    luaM_freemem(L, b, ciblocksize(b->size));
   }
 }
 
-
-/*
-** free half of the CallInfo structures not in use by a thread,
-** keeping the first one.
-*/
-void luaE_shrinkCI (lua_State *L) {
-  CallInfo *ci = L->ci->next;  /* first free CallInfo */
-  CallInfo *next;
-  if (ci == NULL)
-    return;  /* no extra elements */
-  while ((next = ci->next) != NULL) {  /* two extra elements? */
-    CallInfo *next2 = next->next;  /* next's next */
-    ci->next = next2;  /* remove next from the list */
-    L->nci--;
-    luaM_free(L, next);  /* free next */
-    if (next2 == NULL)
-      break;  /* no more elements */
-    else {
-      next2->previous = ci;
-      ci = next2;  /* continue */
-    }
-  }
-}
+/* }================================================================== */
 
 
 /*
@@ -177,15 +205,24 @@ LUAI_FUNC void luaE_incCstack (lua_State *L) {
 }
 
 
-static void stack_init (lua_State *L1, lua_State *L) {
+/*
+** Initialize the stack of 'L1' with 'size' elements, unless it
+** already has one (a thread reused from the pool).
+*/
+static void stack_init (lua_State *L1, lua_State *L, int size) {
   int i; CallInfo *ci;
   /* initialize stack array */
-  L1->stack = luaM_newvector(L, BASIC_STACK_SIZE + EXTRA_STACK, StackValue);
+  if (L1->stack == NULL) {
+    L1->stack = luaD_newstack(L, size);
+    L1->stack_last = L1->stack + size;
+#if defined(LUA_USE_MAPSTACK)
+    L1->stackmapped = 0;
+#endif
+  }
   L1->tbclist = L1->stack;
-  for (i = 0; i < BASIC_STACK_SIZE + EXTRA_STACK; i++)
+  for (i = 0; i < stacksize(L1) + EXTRA_STACK; i++)
     setnilvalue(s2v(L1->stack + i));  /* erase new stack */
   L1->top = L1->stack;
-  L1->stack_last = L1->stack + BASIC_STACK_SIZE;
   /* initialize first ci */
   ci = &L1->base_ci;
   ci->next = ci->previous = NULL;
@@ -204,9 +241,9 @@ static void freestack (lua_State *L) {
   if (L->stack == NULL)
     return;  /* stack not completely built yet */
   L->ci = &L->base_ci;  /* free the entire 'ci' list */
-  luaE_freeCI(L);
+  luaE_shrinkCI(L);
   lua_assert(L->nci == 0);
-  luaM_freearray(L, L->stack, stacksize(L) + EXTRA_STACK);  /* free stack */
+  luaD_freestack(L);  /* free stack */
 }
 
 
@@ -231,7 +268,7 @@ static void init_registry (lua_State *L, global_State *g) {
 static void f_luaopen (lua_State *L, void *ud) {
   global_State *g = G(L);
   UNUSED(ud);
-  stack_init(L, L);  /* init stack */
+  stack_init(L, L, BASIC_STACK_SIZE);  /* init stack */
   init_registry(L, g);
   luaS_init(L);
   luaT_init(L);
@@ -248,9 +285,9 @@ static void f_luaopen (lua_State *L, void *ud) {
 */
 static void preinit_thread (lua_State *L, global_State *g) {
   G(L) = g;
-  L->stack = NULL;
   L->ci = NULL;
   L->nci = 0;
+  L->ciblock = NULL;
   L->twups = L;  /* thread has no upvalues */
   L->nCcalls = 0;
   L->errorJmp = NULL;
@@ -266,6 +303,18 @@ static void preinit_thread (lua_State *L, global_State *g) {
 }
 
 
+static void freethreadpool (lua_State *L) {
+  global_State *g = G(L);
+  while (g->threadpool != NULL) {
+    lua_State *L1 = gco2th(g->threadpool);
+    g->threadpool = L1->next;
+    freestack(L1);
+    luaM_free(L, fromstate(L1));
+  }
+  g->nthreadpool = 0;
+}
+
+
 static void close_state (lua_State *L) {
   global_State *g = G(L);
   if (!completestate(g))  /* closing a partially built state? */
@@ -277,7 +326,11 @@ static void close_state (lua_State *L) {
     luai_userstateclose(L);
   }
   luaM_freearray(L, G(L)->strt.hash, G(L)->strt.size);
+  freethreadpool(L);
   freestack(L);
+#if defined(LUA_USE_MAPSTACK)
+  luaD_freestackpool(g);
+#endif
   lua_assert(gettotalbytes(g) == sizeof(LG));
   (*g->frealloc)(g->ud, fromstate(L), sizeof(LG), 0);  /* free main block */
 }
@@ -290,7 +343,15 @@ LUA_API lua_State *lua_newthread (lua_State *L) {
   g = G(L);
   luaC_checkGC(L);
   /* create new thread */
-  L1 = &cast(LX *, luaM_newobject(L, LUA_TTHREAD, sizeof(LX)))->l;
+  if (g->threadpool != NULL) {  /* reuse a dead thread? */
+    L1 = gco2th(g->threadpool);
+    g->threadpool = L1->next;
+    g->nthreadpool--;
+  }
+  else {
+    L1 = &cast(LX *, luaM_newobject(L, LUA_TTHREAD, sizeof(LX)))->l;
+    L1->stack = NULL;
+  }
   L1->marked = luaC_white(g);
   L1->tt = LUA_VTHREAD;
   /* link it on list 'allgc' */
@@ -308,19 +369,41 @@ LUA_API lua_State *lua_newthread (lua_State *L) {
   memcpy(lua_getextraspace(L1), lua_getextraspace(g->mainthread),
          LUA_EXTRASPACE);
   luai_userstatethread(L, L1);
-  stack_init(L1, L);  /* init stack */
+  stack_init(L1, L, LUAI_THREADSTACK);  /* init stack */
   lua_unlock(L);
   return L1;
 }
 
 
+/* largest stack size of a thread that can go to the pool */
+#define POOLSTACK	(4 * LUA_MINSTACK)
+
+
+/*
+** Dead threads with small stacks are kept in 'g->threadpool' (linked
+** through their 'next' fields, up to LUAI_THREADPOOL of them) so that
+** 'lua_newthread' can reuse them, stack included. Pooled threads still
+** count as allocated memory. (This function runs during sweeps, so it
+** must not allocate memory; that is why large stacks are not shrunk
+** to be pooled.)
+*/
 void luaE_freethread (lua_State *L, lua_State *L1) {
-  LX *l = fromstate(L1);
+  global_State *g = G(L);
   luaF_closeupval(L1, L1->stack);  /* close all upvalues */
   lua_assert(L1->openupval == NULL);
   luai_userstatefree(L, L1);
-  freestack(L1);
-  luaM_free(L, l);
+  if (g->nthreadpool < LUAI_THREADPOOL && L1->stack != NULL &&
+      stacksize(L1) <= POOLSTACK) {
+    L1->ci = &L1->base_ci;  /* free its 'ci' list */
+    luaE_shrinkCI(L1);
+    L1->next = g->threadpool;
+    g->threadpool = obj2gco(L1);
+    g->nthreadpool++;
+  }
+  else {
+    freestack(L1);
+    luaM_free(L, fromstate(L1));
+  }
 }
 
 
@@ -360,6 +443,7 @@ LUA_API lua_State *lua_newstate (lua_Alloc f, void *ud) {
   if (l == NULL) return NULL;
   L = &l->l.l;
   g = &l->g;
+  L->stack = NULL;
   L->tt = LUA_VTHREAD;
   g->currentwhite = bitmask(WHITE0BIT);
   L->marked = luaC_white(g);
@@ -382,12 +466,22 @@ LUA_API lua_State *lua_newstate (lua_Alloc f, void *ud) {
   g->gckind = KGC_INC;
   g->gcstopem = 0;
   g->gcemergency = 0;
+  g->gcdeferfin = 0;
+#if defined(LUA_USE_JIT)
+  g->jitmode = LUA_JITON;
+#endif
+#if defined(LUA_USE_MAPSTACK)
+  g->nstackpool = 0;
+#endif
+  g->threadpool = NULL;
+  g->nthreadpool = 0;
   g->finobj = g->tobefnz = g->fixedgc = NULL;
   g->firstold1 = g->survival = g->old1 = g->reallyold = NULL;
   g->finobjsur = g->finobjold1 = g->finobjrold = NULL;
   g->sweepgc = NULL;
   g->gray = g->grayagain = NULL;
   g->weak = g->ephemeron = g->allweak = NULL;
+  g->ephdeps = NULL;
   g->twups = NULL;
   g->totalbytes = sizeof(LG);
   g->GCdebt = 0;
@@ -399,6 +493,9 @@ LUA_API lua_State *lua_newstate (lua_Alloc f, void *ud) {
   setgcparam(g->genmajormul, LUAI_GENMAJORMUL);
   g->genminormul = LUAI_GENMINORMUL;
   for (i=0; i < LUA_NUMTAGS; i++) g->mt[i] = NULL;
+  for (i=0; i < LUA_NUMBUILTINS; i++) g->builtins[i] = NULL;
+  g->chainepoch = 1;
+  for (i=0; i < LUAI_CHAINCACHE; i++) g->chaincache[i].epoch = 0;
   if (luaD_rawrunprotected(L, f_luaopen, NULL) != LUA_OK) {
     /* memory allocation error: free partial state */
     close_state(L);
@@ -427,9 +524,13 @@ void luaE_warning (lua_State *L, const char *msg, int tocont) {
 */
 void luaE_warnerror (lua_State *L, const char *where) {
   TValue *errobj = s2v(L->top - 1);  /* error object */
-  const char *msg = (ttisstring(errobj))
-                  ? svalue(errobj)
-                  : "error object is not a string";
+  const char *msg;
+  if (ttisstring(errobj)) {
+    luaS_seal(L, tsvalue(errobj));
+    msg = svalue(errobj);
+  }
+  else
+    msg = "error object is not a string";
   /* produce warning "error in %s (%s)" (where, msg) */
   luaE_warning(L, "error in ", 1);
   luaE_warning(L, where, 1);
@@ -139,6 +139,45 @@ struct lua_longjmp;  /* defined in ldo.c */
 
 #define BASIC_STACK_SIZE        (2*LUA_MINSTACK)
 
+/* initial stack size of new threads (at least LUA_MINSTACK + 1) */
+#if !defined(LUAI_THREADSTACK)
+#define LUAI_THREADSTACK	(LUA_MINSTACK + 1)
+#endif
+
+/* number of entries in the first CallInfo block of a thread */
+#if !defined(LUAI_CIBLOCK)
+#define LUAI_CIBLOCK		4
+#endif
+
+/* maximum number of dead threads kept for reuse */
+#if !defined(LUAI_THREADPOOL)
+#define LUAI_THREADPOOL		128
+#endif
+
+/* number of entries in the cache of '__index' chains (a power of 2) */
+#if !defined(LUAI_CHAINCACHE)
+#define LUAI_CHAINCACHE		256
+#endif
+
+#if defined(LUA_USE_MAPSTACK)
+/* maximum number of free stack reservations kept for reuse */
+#if !defined(LUAI_STACKPOOL)
+#define LUAI_STACKPOOL		32
+#endif
+
+/* stacks larger than this (in elements) move to a reservation; only
+   deep stacks, so that reservations stay few and mostly in use */
+#if !defined(LUAI_MAPSTACKMIN)
+#define LUAI_MAPSTACKMIN	(LUAI_MAXSTACK / 16)
+#endif
+
+/* number of stack elements reserved for each stack (by default, the
+   largest stack plus the extra space used to handle an overflow) */
+#if !defined(LUAI_MAPSTACKSIZE)
+#define LUAI_MAPSTACKSIZE	(LUAI_MAXSTACK + 200)
+#endif
+#endif
+
 #define stacksize(th)	cast_int((th)->stack_last - (th)->stack)
 
 
@@ -243,6 +282,18 @@ typedef struct CallInfo {
 #define getoah(st)	((st) & CIST_OAH)
 
 
+/*
+** Entry in the cache of keys found through chains of '__index' tables
+** (see 'lvm.c')
+*/
+typedef struct ChainEntry {
+  struct Table *t;  /* first table of the chain */
+  TString *key;
+  const TValue *slot;  /* where 'key' was found */
+  unsigned int epoch;  /* value of 'chainepoch' when entry was filled */
+} ChainEntry;
+
+
 /*
 ** 'global state', shared by all threads of this state
 */
@@ -265,9 +316,13 @@ typedef struct global_State {
   lu_byte genmajormul;  /* control for major generational collections */
   lu_byte gcstp;  /* control whether GC is running */
   lu_byte gcemergency;  /* true if this is an emergency collection */
+  lu_byte gcdeferfin;  /* true if finalizers only run when requested */
   lu_byte gcpause;  /* size of pause between successive GCs */
   lu_byte gcstepmul;  /* GC "speed" */
   lu_byte gcstepsize;  /* (log2 of) GC granularity */
+#if defined(LUA_USE_JIT)
+  lu_byte jitmode;  /* mode of the native-code compiler */
+#endif
   GCObject *allgc;  /* list of all collectable objects */
   GCObject **sweepgc;  /* current position of sweep in list */
   GCObject *finobj;  /* list of collectable objects with finalizers */
@@ -276,6 +331,7 @@ typedef struct global_State {
   GCObject *weak;  /* list of tables with weak values */
   GCObject *ephemeron;  /* list of ephemeron tables (weak keys) */
   GCObject *allweak;  /* list of all-weak tables */
+  struct EphDeps *ephdeps;  /* key->value dependencies (see 'lgc.c') */
   GCObject *tobefnz;  /* list of userdata to be GC */
   GCObject *fixedgc;  /* list of objects not to be collected */
   /* fields for generational collector */
@@ -291,10 +347,20 @@ typedef struct global_State {
   struct lua_State *mainthread;
   TString *memerrmsg;  /* message for memory-allocation errors */
   TString *tmname[TM_N];  /* array with tag-method names */
+  unsigned int tmhint[TM_N];  /* where each tag method was last found */
   struct Table *mt[LUA_NUMTAGS];  /* metatables for basic types */
   TString *strcache[STRCACHE_N][STRCACHE_M];  /* cache for strings in API */
+  lua_CFunction builtins[LUA_NUMBUILTINS];  /* see 'lua_setbuiltin' */
   lua_WarnFunction warnf;  /* warning function */
   void *ud_warn;         /* auxiliary data to 'warnf' */
+  unsigned int chainepoch;  /* entries from other epochs are invalid */
+  ChainEntry chaincache[LUAI_CHAINCACHE];
+  GCObject *threadpool;  /* dead threads kept for reuse */
+  int nthreadpool;  /* number of threads in 'threadpool' */
+#if defined(LUA_USE_MAPSTACK)
+  void *stackpool[LUAI_STACKPOOL];  /* free stack reservations */
+  int nstackpool;  /* number of entries in 'stackpool' */
+#endif
 } global_State;
 
 
@@ -305,6 +371,9 @@ struct lua_State {
   CommonHeader;
   lu_byte status;
   lu_byte allowhook;
+#if defined(LUA_USE_MAPSTACK)
+  lu_byte stackmapped;  /* true if 'stack' is a reservation */
+#endif
   unsigned short nci;  /* number of items in 'ci' list */
   StkId top;  /* first free slot in the stack */
   global_State *l_G;
@@ -317,6 +386,7 @@ struct lua_State {
   struct lua_State *twups;  /* list of threads with open upvalues */
   struct lua_longjmp *errorJmp;  /* current error recover point */
   CallInfo base_ci;  /* CallInfo for first level (C calling Lua) */
+  struct CIBlock *ciblock;  /* last block of CallInfo entries */
   volatile lua_Hook hook;
   ptrdiff_t errfunc;  /* current error handling function (stack index) */
   l_uint32 nCcalls;  /* number of nested (non-yieldable | C)  calls */
@@ -336,6 +406,10 @@ struct lua_State {
 #define completestate(g)	ttisnil(&g->nilvalue)
 
 
+/* true if 'o' is the standard function 'id' (see 'lua_setbuiltin') */
+#define isbuiltin(L,o,id)	(ttislcf(o) && fvalue(o) == G(L)->builtins[id])
+
+
 /*
 ** Union of all collectable objects (only for conversions)
 ** ISO C99, 6.5.2.3 p.5:
@@ -391,7 +465,6 @@ union GCUnion {
 LUAI_FUNC void luaE_setdebt (global_State *g, l_mem debt);
 LUAI_FUNC void luaE_freethread (lua_State *L, lua_State *L1);
 LUAI_FUNC CallInfo *luaE_extendCI (lua_State *L);
-LUAI_FUNC void luaE_freeCI (lua_State *L);
 LUAI_FUNC void luaE_shrinkCI (lua_State *L);
 LUAI_FUNC void luaE_checkcstack (lua_State *L);
 LUAI_FUNC void luaE_incCstack (lua_State *L);
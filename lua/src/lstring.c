@@ -149,6 +149,7 @@ static TString *createstrobj (lua_State *L, size_t l, int tag, unsigned int h) {
   ts = gco2ts(o);
   ts->hash = h;
   ts->extra = 0;
+  ts->shrlen = 0;
   getstr(ts)[l] = '\0';  /* ending 0 */
   return ts;
 }
@@ -161,6 +162,101 @@ TString *luaS_createlngstrobj (lua_State *L, size_t l) {
 }
 
 
+/*
+** {======================================================
+** Shared buffers for long strings
+** =======================================================
+*/
+
+/*
+** Create a new buffer with room for 'size' bytes, with a copy of the
+** first 'l' bytes of 'str'.
+*/
+static StrBuf *newstrbuf (lua_State *L, size_t size, const char *str,
+                                                    size_t l) {
+  StrBuf *b = cast(StrBuf *, luaM_malloc_(L, sizestrbuf(size), 0));
+  b->refs = 1;
+  b->size = b->limit = size;
+  memcpy(b->data, str, l * sizeof(char));
+  return b;
+}
+
+
+static void releasestrbuf (lua_State *L, StrBuf *b) {
+  if (--b->refs == 0)
+    luaM_freemem(L, b, sizestrbuf(b->size));
+}
+
+
+/*
+** Create a long string with length 'l' (greater than the length of
+** long string 'ts') whose contents start with the contents of 'ts';
+** the caller fills in the rest. When 'ts' is the longest string in
+** its buffer and there is room, the new string shares that buffer,
+** so that building a string by repeated appends copies each piece
+** only once (plus the copies when the buffer grows). Otherwise, the
+** new string gets a new buffer, with room to grow.
+*/
+TString *luaS_extend (lua_State *L, TString *ts, size_t l) {
+  size_t len = tsslen(ts);
+  GCObject *o;
+  TString *res;
+  StrBuf *b;
+  lua_assert(ts->tt == LUA_VLNGSTR && len < l);
+  if (l_unlikely(l >= (MAX_SIZE - sizeof(StrBuf)) / sizeof(char)))
+    luaM_toobig(L);
+  o = luaC_newobj(L, LUA_VLNGSTR, sizesharedstr);
+  res = gco2ts(o);
+  res->hash = G(L)->seed;
+  res->extra = 0;
+  res->shrlen = SHAREDSTR;
+  sharedbuf(res) = NULL;  /* no buffer yet */
+  res->u.lnglen = l;
+  if (isshared(ts) && (b = sharedbuf(ts))->used == len && l < b->limit)
+    b->refs++;  /* append to the buffer of 'ts' */
+  else {
+    size_t size = (l < (MAX_SIZE - sizeof(StrBuf)) / 2) ? l * 2 : l + 1;
+    setsvalue2s(L, L->top, res);  /* anchor 'res' (assume EXTRA_STACK) */
+    L->top++;
+    b = newstrbuf(L, size, getstr(ts), len);
+    L->top--;
+  }
+  b->used = l;
+  b->data[l] = '\0';  /* ending 0 */
+  sharedbuf(res) = b;
+  return res;
+}
+
+
+/*
+** Make the final '\0' of shared string 'ts' permanent: if 'ts' is the
+** longest string in its buffer, no more appends are allowed to that
+** buffer; otherwise, 'ts' gets its own (final) copy.
+*/
+void luaS_sealshared (lua_State *L, TString *ts) {
+  StrBuf *b = sharedbuf(ts);
+  size_t l = ts->u.lnglen;
+  if (b->used == l)
+    b->limit = 0;  /* no more appends */
+  else {
+    StrBuf *nb = newstrbuf(L, l + 1, b->data, l);
+    nb->used = l;
+    nb->data[l] = '\0';
+    sharedbuf(ts) = nb;
+    releasestrbuf(L, b);
+  }
+}
+
+
+void luaS_freeshared (lua_State *L, TString *ts) {
+  if (sharedbuf(ts) != NULL)  /* not an incomplete string? */
+    releasestrbuf(L, sharedbuf(ts));
+  luaM_freemem(L, ts, sizesharedstr);
+}
+
+/* }====================================================== */
+
+
 void luaS_remove (lua_State *L, TString *ts) {
   stringtable *tb = &G(L)->strt;
   TString **p = &tb->hash[lmod(ts->hash, tb->size)];
@@ -193,7 +289,8 @@ static TString *internshrstr (lua_State *L, const char *str, size_t l) {
   TString **list = &tb->hash[lmod(h, tb->size)];
   lua_assert(str != NULL);  /* otherwise 'memcmp'/'memcpy' are undefined */
   for (ts = *list; ts != NULL; ts = ts->u.hnext) {
-    if (l == ts->shrlen && (memcmp(str, getstr(ts), l * sizeof(char)) == 0)) {
+    if (l == ts->shrlen &&
+        (memcmp(str, getshrstr(ts), l * sizeof(char)) == 0)) {
       /* found! */
       if (isdead(g, ts))  /* dead (but not collected yet)? */
         changewhite(ts);  /* resurrect it */
@@ -206,7 +303,7 @@ static TString *internshrstr (lua_State *L, const char *str, size_t l) {
     list = &tb->hash[lmod(h, tb->size)];  /* rehash with new size */
   }
   ts = createstrobj(L, l, LUA_VSHRSTR, h);
-  memcpy(getstr(ts), str, l * sizeof(char));
+  memcpy(getshrstr(ts), str, l * sizeof(char));
   ts->shrlen = cast_byte(l);
   ts->u.hnext = *list;
   *list = ts;
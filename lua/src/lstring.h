@@ -25,10 +25,24 @@
 */
 #define sizelstring(l)  (offsetof(TString, contents) + ((l) + 1) * sizeof(char))
 
+/* size of a long string that keeps its contents in a 'StrBuf' */
+#define sizesharedstr	(offsetof(TString, contents) + sizeof(StrBuf *))
+
+/* size of a 'StrBuf' whose 'data' has 'n' bytes */
+#define sizestrbuf(n)	(offsetof(StrBuf, data) + (n) * sizeof(char))
+
 #define luaS_newliteral(L, s)	(luaS_newlstr(L, "" s, \
                                  (sizeof(s)/sizeof(char))-1))
 
 
+/*
+** Make sure that the contents of string 'ts' are followed by a '\0' that
+** stays there, as C code expects. (For a string sharing its buffer,
+** other contents may be appended after its own.)
+*/
+#define luaS_seal(L,ts)	{ if (isshared(ts)) luaS_sealshared(L, ts); }
+
+
 /*
 ** test whether a string is a reserved word
 */
@@ -52,6 +66,9 @@ LUAI_FUNC Udata *luaS_newudata (lua_State *L, size_t s, int nuvalue);
 LUAI_FUNC TString *luaS_newlstr (lua_State *L, const char *str, size_t l);
 LUAI_FUNC TString *luaS_new (lua_State *L, const char *str);
 LUAI_FUNC TString *luaS_createlngstrobj (lua_State *L, size_t l);
+LUAI_FUNC TString *luaS_extend (lua_State *L, TString *ts, size_t l);
+LUAI_FUNC void luaS_sealshared (lua_State *L, TString *ts);
+LUAI_FUNC void luaS_freeshared (lua_State *L, TString *ts);
 
 
 #endif
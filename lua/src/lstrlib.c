@@ -359,6 +359,7 @@ typedef struct MatchState {
   const char *src_init;  /* init of source string */
   const char *src_end;  /* end ('\0') of source string */
   const char *p_end;  /* end ('\0') of pattern */
+  const struct Pattern *prog;  /* compiled pattern (or NULL) */
   lua_State *L;
   int matchdepth;  /* control for recursive depth (to avoid C stack overflow) */
   unsigned char level;  /* total number of captures (finished or unfinished) */
@@ -467,42 +468,55 @@ static int matchbracketclass (int c, const char *p, const char *ec) {
 }
 
 
+/*
+** Check whether character 'c' matches the single char class 'p'
+** (ending at 'ep').
+*/
+static int charmatch (int c, const char *p, const char *ep) {
+  switch (*p) {
+    case '.': return 1;  /* matches any char */
+    case L_ESC: return match_class(c, uchar(*(p+1)));
+    case '[': return matchbracketclass(c, p, ep-1);
+    default:  return (uchar(*p) == c);
+  }
+}
+
+
 static int singlematch (MatchState *ms, const char *s, const char *p,
                         const char *ep) {
   if (s >= ms->src_end)
     return 0;
-  else {
-    int c = uchar(*s);
-    switch (*p) {
-      case '.': return 1;  /* matches any char */
-      case L_ESC: return match_class(c, uchar(*(p+1)));
-      case '[': return matchbracketclass(c, p, ep-1);
-      default:  return (uchar(*p) == c);
-    }
-  }
+  else
+    return charmatch(uchar(*s), p, ep);
 }
 
 
-static const char *matchbalance (MatchState *ms, const char *s,
-                                   const char *p) {
-  if (l_unlikely(p >= ms->p_end - 1))
-    luaL_error(ms->L, "malformed pattern (missing arguments to '%%b')");
-  if (*s != *p) return NULL;
+/*
+** Match a balanced string delimited by 'b' and 'e' starting at 's'.
+*/
+static const char *balance (MatchState *ms, const char *s, int b, int e) {
+  if (uchar(*s) != b) return NULL;
   else {
-    int b = *p;
-    int e = *(p+1);
     int cont = 1;
     while (++s < ms->src_end) {
-      if (*s == e) {
+      if (uchar(*s) == e) {
         if (--cont == 0) return s+1;
       }
-      else if (*s == b) cont++;
+      else if (uchar(*s) == b) cont++;
     }
   }
   return NULL;  /* string ends out of balance */
 }
 
 
+static const char *matchbalance (MatchState *ms, const char *s,
+                                   const char *p) {
+  if (l_unlikely(p >= ms->p_end - 1))
+    luaL_error(ms->L, "malformed pattern (missing arguments to '%%b')");
+  return balance(ms, s, uchar(*p), uchar(*(p+1)));
+}
+
+
 static const char *max_expand (MatchState *ms, const char *s,
                                  const char *p, const char *ep) {
   ptrdiff_t i = 0;  /* counts maximum expand for item */
@@ -670,711 +684,2179 @@ static const char *match (MatchState *ms, const char *s, const char *p) {
 
 
 
-static const char *lmemfind (const char *s1, size_t l1,
-                               const char *s2, size_t l2) {
-  if (l2 == 0) return s1;  /* empty strings are everywhere */
-  else if (l2 > l1) return NULL;  /* avoids a negative 'l1' */
-  else {
-    const char *init;  /* to search for a '*s2' inside 's1' */
-    l2--;  /* 1st char will be checked by 'memchr' */
-    l1 = l1-l2;  /* 's2' cannot be found after that */
-    while (l1 > 0 && (init = (const char *)memchr(s1, *s2, l1)) != NULL) {
-      init++;   /* 1st char is already checked */
-      if (memcmp(init, s2+1, l2) == 0)
-        return init-1;
-      else {  /* correct 'l1' and 's1' to try again */
-        l1 -= init-s1;
-        s1 = init;
-      }
-    }
-    return NULL;  /* not found */
-  }
-}
+/*
+** {======================================================
+** Substring search
+** =======================================================
+*/
+
+/*
+** Define LUA_NOSIMD if you do not want 'lmemfind' to use SSE2 (and
+** AVX2, when the processor has it) in x86 compilers that support GCC
+** extensions.
+*/
+#if !defined(LUA_NOSIMD) && defined(__GNUC__) && defined(__SSE2__)
+#define LUAI_SIMDFIND
+#include <immintrin.h>
+#endif
 
 
 /*
-** get information about the i-th capture. If there are no captures
-** and 'i==0', return information about the whole match, which
-** is the range 's'..'e'. If the capture is a string, return
-** its length and put its address in '*cap'. If it is an integer
-** (a position), push it on the stack and return CAP_POSITION.
+** Two-way string matching (Crochemore-Perrin): finds 'n' (with length
+** 'ln' >= 1) in 'h' in linear time and constant space.
 */
-static size_t get_onecapture (MatchState *ms, int i, const char *s,
-                              const char *e, const char **cap) {
-  if (i >= ms->level) {
-    if (l_unlikely(i != 0))
-      luaL_error(ms->L, "invalid capture index %%%d", i + 1);
-    *cap = s;
-    return e - s;
+static const char *twowayfind (const char *h, size_t lh,
+                               const char *n, size_t ln) {
+  const unsigned char *hu = (const unsigned char *)h;
+  const unsigned char *nu = (const unsigned char *)n;
+  size_t ms, p, p0, ip, jp, k, j, mem, mem0;
+  if (ln > lh) return NULL;  /* avoids a negative 'lh - ln' */
+  /* compute the maximal suffix of 'n' for '<' ... */
+  ip = (size_t)-1; jp = 0; k = p = 1;
+  while (jp + k < ln) {
+    if (nu[ip + k] == nu[jp + k]) {
+      if (k == p) { jp += p; k = 1; }
+      else k++;
+    }
+    else if (nu[ip + k] > nu[jp + k]) { jp += k; k = 1; p = jp - ip; }
+    else { ip = jp++; k = p = 1; }
   }
-  else {
-    ptrdiff_t capl = ms->capture[i].len;
-    *cap = ms->capture[i].init;
-    if (l_unlikely(capl == CAP_UNFINISHED))
-      luaL_error(ms->L, "unfinished capture");
-    else if (capl == CAP_POSITION)
-      lua_pushinteger(ms->L, (ms->capture[i].init - ms->src_init) + 1);
-    return capl;
+  ms = ip; p0 = p;
+  /* ... and for '>'; the critical factorization is the longer one */
+  ip = (size_t)-1; jp = 0; k = p = 1;
+  while (jp + k < ln) {
+    if (nu[ip + k] == nu[jp + k]) {
+      if (k == p) { jp += p; k = 1; }
+      else k++;
+    }
+    else if (nu[ip + k] < nu[jp + k]) { jp += k; k = 1; p = jp - ip; }
+    else { ip = jp++; k = p = 1; }
+  }
+  if (ip + 1 > ms + 1) ms = ip;
+  else p = p0;
+  if (memcmp(n, n + p, ms + 1) != 0) {  /* not periodic? */
+    mem0 = 0;
+    p = ((ms > ln - ms - 1) ? ms : ln - ms - 1) + 1;
   }
+  else
+    mem0 = ln - p;
+  mem = 0;
+  for (j = 0; j <= lh - ln; ) {
+    /* compare right half */
+    for (k = (ms + 1 > mem) ? ms + 1 : mem; k < ln && nu[k] == hu[j + k]; k++)
+      ;
+    if (k < ln) {
+      j += k - ms;
+      mem = 0;
+      continue;
+    }
+    /* compare left half */
+    for (k = ms + 1; k > mem && nu[k - 1] == hu[j + k - 1]; k--)
+      ;
+    if (k <= mem)
+      return h + j;
+    j += p;
+    mem = mem0;
+  }
+  return NULL;  /* not found */
 }
 
 
+#if defined(LUAI_SIMDFIND)	/* { */
+
 /*
-** Push the i-th capture on the stack.
+** Vectorized search: test, for a block of consecutive positions, both
+** the first and the last char of 's2' at once, and compare the rest
+** only at positions where both match. When too many of these turn out
+** to be false candidates (e.g., with periodic texts), finish the search
+** with 'twowayfind', which is linear.
 */
-static void push_onecapture (MatchState *ms, int i, const char *s,
-                                                    const char *e) {
-  const char *cap;
-  ptrdiff_t l = get_onecapture(ms, i, s, e, &cap);
-  if (l != CAP_POSITION)
-    lua_pushlstring(ms->L, cap, l);
-  /* else position was already pushed */
-}
+#define simdfind_body(W,vec,loadv,set1v,eqv,andv,maskv) {  \
+  const vec first = set1v((char)s2[0]);  \
+  const vec last = set1v((char)s2[l2 - 1]);  \
+  size_t np = l1 - l2 + 1;  /* number of possible positions */  \
+  size_t fails = 0;  /* number of false candidates */  \
+  size_t i;  \
+  for (i = 0; i + (W) <= np; i += (W)) {  \
+    vec bf = loadv((const vec *)(s1 + i));  \
+    vec bl = loadv((const vec *)(s1 + i + l2 - 1));  \
+    unsigned int mask = (unsigned int)maskv(andv(eqv(first, bf),  \
+                                                 eqv(last, bl)));  \
+    while (mask != 0) {  \
+      size_t c = i + (size_t)__builtin_ctz(mask);  \
+      if (memcmp(s1 + c + 1, s2 + 1, l2 - 2) == 0)  \
+        return s1 + c;  \
+      if (++fails > (i >> 3) + 64)  /* too many false candidates? */  \
+        return twowayfind(s1 + c + 1, l1 - c - 1, s2, l2);  \
+      mask &= mask - 1;  \
+    }  \
+  }  \
+  for (; i < np; i++) {  /* remaining positions */  \
+    if (s1[i] == s2[0] && s1[i + l2 - 1] == s2[l2 - 1] &&  \
+        memcmp(s1 + i + 1, s2 + 1, l2 - 2) == 0)  \
+      return s1 + i;  \
+  }  \
+  return NULL;  }
+
+
+static const char *simdfind_sse2 (const char *s1, size_t l1,
+                                  const char *s2, size_t l2)
+  simdfind_body(16, __m128i, _mm_loadu_si128, _mm_set1_epi8,
+                _mm_cmpeq_epi8, _mm_and_si128, _mm_movemask_epi8)
+
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#define LUAI_AVX2FIND
+
+__attribute__((target("avx2")))
+static const char *simdfind_avx2 (const char *s1, size_t l1,
+                                  const char *s2, size_t l2)
+  simdfind_body(32, __m256i, _mm256_loadu_si256, _mm256_set1_epi8,
+                _mm256_cmpeq_epi8, _mm256_and_si256, _mm256_movemask_epi8)
 
+#endif
 
-static int push_captures (MatchState *ms, const char *s, const char *e) {
-  int i;
-  int nlevels = (ms->level == 0 && s) ? 1 : ms->level;
-  luaL_checkstack(ms->L, nlevels, "too many captures");
-  for (i = 0; i < nlevels; i++)
-    push_onecapture(ms, i, s, e);
-  return nlevels;  /* number of strings pushed */
+
+/* 's2' has at least 2 chars and is not longer than 's1' */
+static const char *simdfind (const char *s1, size_t l1,
+                             const char *s2, size_t l2) {
+#if defined(LUAI_AVX2FIND)
+  if (__builtin_cpu_supports("avx2"))
+    return simdfind_avx2(s1, l1, s2, l2);
+#endif
+  return simdfind_sse2(s1, l1, s2, l2);
 }
 
+#else				/* }{ */
 
-/* check whether pattern has no special characters */
-static int nospecials (const char *p, size_t l) {
-  size_t upto = 0;
-  do {
-    if (strpbrk(p + upto, SPECIALS))
-      return 0;  /* pattern has a special character */
-    upto += strlen(p + upto) + 1;  /* may have more after \0 */
-  } while (upto <= l);
-  return 1;  /* no special chars found */
+/*
+** Search with 'memchr' for the first char of 's2', comparing the rest
+** at each occurrence; as in the vectorized search, too many false
+** candidates send the rest of the search to 'twowayfind'.
+*/
+static const char *simdfind (const char *s1, size_t l1,
+                             const char *s2, size_t l2) {
+  const char *s = s1;
+  const char *init;  /* to search for a '*s2' inside 's1' */
+  size_t np = l1 - l2 + 1;  /* number of possible positions */
+  size_t fails = 0;  /* number of false candidates */
+  while (np > 0 && (init = (const char *)memchr(s, *s2, np)) != NULL) {
+    if (memcmp(init + 1, s2 + 1, l2 - 1) == 0)
+      return init;
+    init++;  /* 1st char is already checked */
+    if (++fails > ((size_t)(init - s1) >> 3) + 64)
+      return twowayfind(init, l1 - (init - s1), s2, l2);
+    np -= init - s;  /* correct 'np' and 's' to try again */
+    s = init;
+  }
+  return NULL;  /* not found */
 }
 
+#endif				/* } */
 
-static void prepstate (MatchState *ms, lua_State *L,
-                       const char *s, size_t ls, const char *p, size_t lp) {
-  ms->L = L;
-  ms->matchdepth = MAXCCALLS;
-  ms->src_init = s;
-  ms->src_end = s + ls;
-  ms->p_end = p + lp;
+
+static const char *lmemfind (const char *s1, size_t l1,
+                               const char *s2, size_t l2) {
+  if (l2 == 0) return s1;  /* empty strings are everywhere */
+  else if (l2 > l1) return NULL;  /* avoids a negative 'l1' */
+  else if (l2 == 1)
+    return (const char *)memchr(s1, *s2, l1);
+  else
+    return simdfind(s1, l1, s2, l2);
 }
 
+/* }====================================================== */
 
-static void reprepstate (MatchState *ms) {
-  ms->level = 0;
-  lua_assert(ms->matchdepth == MAXCCALLS);
-}
 
+/*
+** {======================================================
+** Compiled patterns
+** =======================================================
+*/
 
-static int str_find_aux (lua_State *L, int find) {
-  size_t ls, lp;
-  const char *s = luaL_checklstring(L, 1, &ls);
-  const char *p = luaL_checklstring(L, 2, &lp);
-  size_t init = posrelatI(luaL_optinteger(L, 3, 1), ls) - 1;
-  if (init > ls) {  /* start after string's end? */
-    luaL_pushfail(L);  /* cannot find anything */
-    return 1;
-  }
-  /* explicit request or no special characters? */
-  if (find && (lua_toboolean(L, 4) || nospecials(p, lp))) {
-    /* do a plain search */
-    const char *s2 = lmemfind(s + init, ls - init, p, lp);
-    if (s2) {
-      lua_pushinteger(L, (s2 - s) + 1);
-      lua_pushinteger(L, (s2 - s) + lp);
-      return 2;
-    }
-  }
-  else {
-    MatchState ms;
-    const char *s1 = s + init;
-    int anchor = (*p == '^');
-    if (anchor) {
-      p++; lp--;  /* skip anchor character */
-    }
-    prepstate(&ms, L, s, ls, p, lp);
-    do {
-      const char *res;
-      reprepstate(&ms);
-      if ((res=match(&ms, s1, p)) != NULL) {
-        if (find) {
-          lua_pushinteger(L, (s1 - s) + 1);  /* start */
-          lua_pushinteger(L, res - s);   /* end */
-          return push_captures(&ms, NULL, 0) + 2;
-        }
-        else
-          return push_captures(&ms, s1, res);
-      }
-    } while (s1++ < ms.src_end && !anchor);
-  }
-  luaL_pushfail(L);  /* not found */
-  return 1;
-}
+/*
+** Patterns are compiled on first use into an array of items, so that
+** matching does not have to parse them again; each single char class
+** becomes a bitmap with the result of 'charmatch' for every character.
+** 'pmatch' follows exactly the same steps as 'match' (including its
+** recursions), so both give the same results and errors. Malformed
+** patterns are not compiled; 'match' handles them, raising errors only
+** when (and if) it reaches the malformed part.
+*/
 
+#define NCHARS		(UCHAR_MAX + 1)
 
-static int str_find (lua_State *L) {
-  return str_find_aux(L, 1);
-}
+typedef struct CharSet {
+  unsigned char b[NCHARS / CHAR_BIT];
+} CharSet;
 
+#define inset(cs,c)	((cs)->b[(c) / CHAR_BIT] & (1u << ((c) % CHAR_BIT)))
 
-static int str_match (lua_State *L) {
-  return str_find_aux(L, 0);
-}
 
+/* kinds of pattern items */
+enum PatCode {
+  PI_CHAR,  /* single char 'c1' */
+  PI_ANY,  /* any char */
+  PI_SET,  /* any char in 'set' */
+  PI_OPEN,  /* start capture */
+  PI_POSITION,  /* position capture */
+  PI_CLOSE,  /* end capture */
+  PI_END,  /* final '$' */
+  PI_BALANCE,  /* '%b' with delimiters 'c1' and 'c2' */
+  PI_FRONTIER,  /* '%f' with 'set' */
+  PI_BACKREF,  /* '%0'-'%9', with the digit in 'c1' */
+  PI_STOP  /* end of pattern */
+};
 
-/* state for 'gmatch' */
-typedef struct GMatchState {
-  const char *src;  /* current position */
-  const char *p;  /* pattern */
-  const char *lastmatch;  /* end of last match */
-  MatchState ms;  /* match state */
-} GMatchState;
 
+typedef struct PatItem {
+  unsigned char code;  /* kind of item ('PatCode') */
+  unsigned char rep;  /* suffix ('?', '*', '+', '-') for single chars */
+  unsigned char c1, c2;
+  const CharSet *set;
+} PatItem;
 
-static int gmatch_aux (lua_State *L) {
-  GMatchState *gm = (GMatchState *)lua_touserdata(L, lua_upvalueindex(3));
-  const char *src;
-  gm->ms.L = L;
-  for (src = gm->src; src <= gm->ms.src_end; src++) {
-    const char *e;
-    reprepstate(&gm->ms);
-    if ((e = match(&gm->ms, src, gm->p)) != NULL && e != gm->lastmatch) {
-      gm->src = gm->lastmatch = e;
-      return push_captures(&gm->ms, src, e);
+
+typedef struct Pattern {
+  int anchor;  /* pattern starts with '^'? */
+  int ctype;  /* pattern depends on the locale? */
+  const CharSet *first;  /* set of chars that can start a match, if known */
+  const char *prefix;  /* literal text that starts any match */
+  size_t lprefix;  /* length of 'prefix' */
+  PatItem items[1];
+} Pattern;
+
+
+/*
+** Returns the end of the single char class starting at 'p' (as
+** 'classend'), or NULL if it is malformed.
+*/
+static const char *itemend (const char *p, const char *p_end) {
+  switch (*p++) {
+    case L_ESC: {
+      return (p == p_end) ? NULL : p+1;
+    }
+    case '[': {
+      if (*p == '^') p++;
+      do {  /* look for a ']' */
+        if (p == p_end)
+          return NULL;
+        if (*(p++) == L_ESC && p < p_end)
+          p++;  /* skip escapes (e.g. '%]') */
+      } while (*p != ']');
+      return p+1;
+    }
+    default: {
+      return p;
     }
   }
-  return 0;  /* not found */
 }
 
 
-static int gmatch (lua_State *L) {
-  size_t ls, lp;
-  const char *s = luaL_checklstring(L, 1, &ls);
-  const char *p = luaL_checklstring(L, 2, &lp);
-  size_t init = posrelatI(luaL_optinteger(L, 3, 1), ls) - 1;
-  GMatchState *gm;
-  lua_settop(L, 2);  /* keep strings on closure to avoid being collected */
-  gm = (GMatchState *)lua_newuserdatauv(L, sizeof(GMatchState), 0);
-  if (init > ls)  /* start after string's end? */
-    init = ls + 1;  /* avoid overflows in 's + init' */
-  prepstate(&gm->ms, L, s, ls, p, lp);
-  gm->src = s + init; gm->p = p; gm->lastmatch = NULL;
-  lua_pushcclosure(L, gmatch_aux, 3);
-  return 1;
+/*
+** Fill 'cs' with the chars that match the class 'p' ('ep' is its end)
+** and return how many they are; '*last' gets the last one.
+*/
+static int fillset (CharSet *cs, const char *p, const char *ep, int *last) {
+  int c;
+  int n = 0;
+  memset(cs->b, 0, sizeof(cs->b));
+  for (c = 0; c < NCHARS; c++) {
+    if (charmatch(c, p, ep)) {
+      cs->b[c / CHAR_BIT] |= 1u << (c % CHAR_BIT);
+      *last = c;
+      n++;
+    }
+  }
+  return n;
 }
 
 
-static void add_s (MatchState *ms, luaL_Buffer *b, const char *s,
-                                                   const char *e) {
-  size_t l;
-  lua_State *L = ms->L;
-  const char *news = lua_tolstring(L, 3, &l);
-  const char *p;
-  while ((p = (char *)memchr(news, L_ESC, l)) != NULL) {
-    luaL_addlstring(b, news, p - news);
-    p++;  /* skip ESC */
-    if (*p == L_ESC)  /* '%%' */
-      luaL_addchar(b, *p);
-    else if (*p == '0')  /* '%0' */
-        luaL_addlstring(b, s, e - s);
-    else if (isdigit(uchar(*p))) {  /* '%n' */
-      const char *cap;
-      ptrdiff_t resl = get_onecapture(ms, *p - '1', s, e, &cap);
-      if (resl == CAP_POSITION)
-        luaL_addvalue(b);  /* add position to accumulated result */
-      else
-        luaL_addlstring(b, cap, resl);
-    }
-    else
-      luaL_error(L, "invalid use of '%c' in replacement string", L_ESC);
-    l -= p + 1 - news;
-    news = p + 1;
+/*
+** Compute the literal prefix of a compiled pattern (after its initial
+** captures) or, when there is none, the set of chars that can start a
+** match. Trying a match only where these can match skips only
+** positions where 'match' would fail with its first single char.
+*/
+static void setprefix (Pattern *pt, char *prefix) {
+  const PatItem *item = pt->items;
+  while (item->code == PI_OPEN || item->code == PI_POSITION)
+    item++;
+  pt->prefix = prefix;
+  for (; item->code == PI_CHAR && (item->rep == 0 || item->rep == '+');
+         item++) {
+    prefix[pt->lprefix++] = (char)item->c1;
+    if (item->rep == '+')
+      break;  /* other repetitions are optional */
   }
-  luaL_addlstring(b, news, l);
+  if (pt->lprefix == 0 && item->code == PI_SET &&
+      (item->rep == 0 || item->rep == '+'))
+    pt->first = item->set;
 }
 
 
 /*
-** Add the replacement value to the string buffer 'b'.
+** The sets of classes like '%a' depend on the locale (LC_CTYPE) where
+** the pattern was compiled. ('%d' and '%x' do not: ISO C fixes their
+** chars.) A pattern with any of them keeps the name of that locale as
+** its user value, and it is compiled again if it is used under another
+** locale, whoever changed it.
+*/
+static int usesctype (const char *p, size_t lp) {
+  size_t i;
+  for (i = 0; i + 1 < lp; i++) {
+    if (p[i] == L_ESC) {
+      if (memchr("acglpsuwACGLPSUW", p[i + 1], 16))
+        return 1;
+      i++;  /* skip escaped char */
+    }
+  }
+  return 0;
+}
+
+
+/*
+** Check whether the compiled pattern on the top of the stack was
+** compiled under the current locale.
+*/
+static int samelocale (lua_State *L) {
+  const char *loc = setlocale(LC_CTYPE, NULL);
+  const char *old;
+  int res;
+  lua_getiuservalue(L, -1, 1);
+  old = lua_tostring(L, -1);
+  res = (loc != NULL && old != NULL && strcmp(loc, old) == 0);
+  lua_pop(L, 1);
+  return res;
+}
+
+
+/*
+** Compile pattern 'p' into a new userdata, which is left on the stack.
+** Returns NULL (leaving nothing on the stack) if the pattern is
+** malformed.
+*/
+static Pattern *compile (lua_State *L, const char *p, size_t lp) {
+  const char *p_end = p + lp;
+  size_t nsets = 1;  /* one extra set to compute single classes */
+  size_t i;
+  Pattern *pt;
+  PatItem *item;
+  CharSet *set;
+  for (i = 0; i < lp; i++)  /* each set needs a '%' or a '[' */
+    if (p[i] == L_ESC || p[i] == '[') nsets++;
+  /* 'lp' items plus the final one, sets, and prefix */
+  pt = (Pattern *)lua_newuserdatauv(L, sizeof(Pattern) +
+          lp * sizeof(PatItem) + nsets * sizeof(CharSet) + lp, 1);
+  pt->ctype = usesctype(p, lp);
+  if (pt->ctype) {
+    lua_pushstring(L, setlocale(LC_CTYPE, NULL));
+    lua_setiuservalue(L, -2, 1);  /* keep its locale */
+  }
+  pt->anchor = (*p == '^');
+  if (pt->anchor)
+    p++;  /* skip anchor character */
+  pt->first = NULL;
+  pt->lprefix = 0;
+  item = pt->items;
+  set = (CharSet *)(pt->items + lp + 1);
+  while (p < p_end) {
+    item->rep = 0;
+    switch (*p) {
+      case '(': {
+        if (*(p + 1) == ')') {  /* position capture? */
+          item->code = PI_POSITION;
+          p += 2;
+        }
+        else {
+          item->code = PI_OPEN;
+          p++;
+        }
+        break;
+      }
+      case ')': {
+        item->code = PI_CLOSE;
+        p++;
+        break;
+      }
+      case '$': {
+        if ((p + 1) != p_end)  /* is the '$' the last char in pattern? */
+          goto dflt;  /* no; go to default */
+        item->code = PI_END;
+        p++;
+        break;
+      }
+      case L_ESC: {
+        switch (*(p + 1)) {
+          case 'b': {
+            if (p + 2 >= p_end - 1)  /* missing arguments? */
+              goto malformed;
+            item->code = PI_BALANCE;
+            item->c1 = uchar(*(p + 2));
+            item->c2 = uchar(*(p + 3));
+            p += 4;
+            break;
+          }
+          case 'f': {
+            const char *ep;
+            int last;
+            p += 2;
+            if (*p != '[' || (ep = itemend(p, p_end)) == NULL)
+              goto malformed;
+            fillset(set, p, ep, &last);
+            item->code = PI_FRONTIER;
+            item->set = set++;
+            p = ep;
+            break;
+          }
+          case '0': case '1': case '2': case '3':
+          case '4': case '5': case '6': case '7':
+          case '8': case '9': {
+            item->code = PI_BACKREF;
+            item->c1 = uchar(*(p + 1));
+            p += 2;
+            break;
+          }
+          default: goto dflt;
+        }
+        break;
+      }
+      default: dflt: {  /* single char class plus optional suffix */
+        const char *ep = itemend(p, p_end);
+        int n, last;
+        if (ep == NULL)
+          goto malformed;
+        n = fillset(set, p, ep, &last);
+        if (n == NCHARS)
+          item->code = PI_ANY;
+        else if (n == 1) {
+          item->code = PI_CHAR;
+          item->c1 = (unsigned char)last;
+        }
+        else {
+          item->code = PI_SET;
+          item->set = set++;
+        }
+        if (*ep == '?' || *ep == '*' || *ep == '+' || *ep == '-')
+          item->rep = uchar(*ep++);
+        p = ep;
+        break;
+      }
+    }
+    item++;
+  }
+  item->code = PI_STOP;
+  setprefix(pt, (char *)(pt->items + lp + 1) + nsets * sizeof(CharSet));
+  return pt;
+ malformed:
+  lua_pop(L, 1);  /* remove userdata */
+  return NULL;
+}
+
+
+/*
+** Get the compiled form of the pattern at index 2, from the cache (the
+** first upvalue) or compiling it. Leaves the compiled pattern (or nil)
+** on the stack, to keep it alive while in use.
+*/
+static const Pattern *getprog (lua_State *L) {
+  Pattern *pt;
+  lua_pushvalue(L, 2);
+  if (lua_rawget(L, lua_upvalueindex(1)) == LUA_TUSERDATA) {
+    pt = (Pattern *)lua_touserdata(L, -1);
+    if (!pt->ctype || samelocale(L))
+      return pt;
+  }
+  lua_pop(L, 1);  /* remove nil or outdated pattern */
+  pt = compile(L, lua_tostring(L, 2), lua_rawlen(L, 2));
+  if (pt == NULL) {  /* malformed pattern? */
+    lua_pushnil(L);  /* interpret it */
+    return NULL;
+  }
+  lua_pushvalue(L, 2);
+  lua_pushvalue(L, -2);
+  lua_rawset(L, lua_upvalueindex(1));  /* cache[pattern] = pt */
+  return pt;
+}
+
+
+static const char *pmatch (MatchState *ms, const char *s, const PatItem *p);
+
+
+static int psinglematch (MatchState *ms, const char *s, const PatItem *p) {
+  if (s >= ms->src_end)
+    return 0;
+  switch (p->code) {
+    case PI_CHAR: return (uchar(*s) == p->c1);
+    case PI_ANY: return 1;
+    default: return inset(p->set, uchar(*s));
+  }
+}
+
+
+static const char *pmax_expand (MatchState *ms, const char *s,
+                                  const PatItem *p) {
+  ptrdiff_t i = 0;  /* counts maximum expand for item */
+  if (p->code == PI_ANY)
+    i = ms->src_end - s;
+  else {
+    while (psinglematch(ms, s + i, p))
+      i++;
+  }
+  /* keeps trying to match with the maximum repetitions */
+  if ((p + 1)->code == PI_CHAR && (p + 1)->rep != '*' &&
+      (p + 1)->rep != '?' && (p + 1)->rep != '-') {
+    int c = (p + 1)->c1;  /* next item needs this char */
+    /* skip only the calls that would fail on their first char */
+    if (l_unlikely(ms->matchdepth == 0))
+      luaL_error(ms->L, "pattern too complex");
+    while (i >= 0) {
+      if (s + i < ms->src_end && uchar(s[i]) == c) {
+        const char *res = pmatch(ms, (s+i), p+1);
+        if (res) return res;
+      }
+      i--;
+    }
+  }
+  else {
+    while (i >= 0) {
+      const char *res = pmatch(ms, (s+i), p+1);
+      if (res) return res;
+      i--;  /* else didn't match; reduce 1 repetition to try again */
+    }
+  }
+  return NULL;
+}
+
+
+static const char *pmin_expand (MatchState *ms, const char *s,
+                                  const PatItem *p) {
+  for (;;) {
+    const char *res = pmatch(ms, s, p+1);
+    if (res != NULL)
+      return res;
+    else if (psinglematch(ms, s, p))
+      s++;  /* try with one more repetition */
+    else return NULL;
+  }
+}
+
+
+static const char *pstart_capture (MatchState *ms, const char *s,
+                                     const PatItem *p, int what) {
+  const char *res;
+  int level = ms->level;
+  if (level >= LUA_MAXCAPTURES) luaL_error(ms->L, "too many captures");
+  ms->capture[level].init = s;
+  ms->capture[level].len = what;
+  ms->level = level+1;
+  if ((res=pmatch(ms, s, p)) == NULL)  /* match failed? */
+    ms->level--;  /* undo capture */
+  return res;
+}
+
+
+static const char *pend_capture (MatchState *ms, const char *s,
+                                   const PatItem *p) {
+  int l = capture_to_close(ms);
+  const char *res;
+  ms->capture[l].len = s - ms->capture[l].init;  /* close capture */
+  if ((res = pmatch(ms, s, p)) == NULL)  /* match failed? */
+    ms->capture[l].len = CAP_UNFINISHED;  /* undo capture */
+  return res;
+}
+
+
+/*
+** Same as 'match', over a compiled pattern.
+*/
+static const char *pmatch (MatchState *ms, const char *s, const PatItem *p) {
+  if (l_unlikely(ms->matchdepth-- == 0))
+    luaL_error(ms->L, "pattern too complex");
+  init: /* using goto's to optimize tail recursion */
+  switch (p->code) {
+    case PI_STOP: break;  /* end of pattern */
+    case PI_OPEN: {
+      s = pstart_capture(ms, s, p + 1, CAP_UNFINISHED);
+      break;
+    }
+    case PI_POSITION: {
+      s = pstart_capture(ms, s, p + 1, CAP_POSITION);
+      break;
+    }
+    case PI_CLOSE: {
+      s = pend_capture(ms, s, p + 1);
+      break;
+    }
+    case PI_END: {
+      s = (s == ms->src_end) ? s : NULL;  /* check end of string */
+      break;
+    }
+    case PI_BALANCE: {
+      s = balance(ms, s, p->c1, p->c2);
+      if (s != NULL) {
+        p++; goto init;  /* return pmatch(ms, s, p + 1); */
+      }
+      break;
+    }
+    case PI_FRONTIER: {
+      int previous = (s == ms->src_init) ? '\0' : uchar(*(s - 1));
+      if (!inset(p->set, previous) && inset(p->set, uchar(*s))) {
+        p++; goto init;  /* return pmatch(ms, s, p + 1); */
+      }
+      s = NULL;  /* match failed */
+      break;
+    }
+    case PI_BACKREF: {
+      s = match_capture(ms, s, p->c1);
+      if (s != NULL) {
+        p++; goto init;  /* return pmatch(ms, s, p + 1); */
+      }
+      break;
+    }
+    default: {  /* single char class plus optional suffix */
+      if (!psinglematch(ms, s, p)) {
+        if (p->rep == '*' || p->rep == '?' || p->rep == '-') {
+          p++; goto init;  /* accept empty */
+        }
+        else  /* '+' or no suffix */
+          s = NULL;  /* fail */
+      }
+      else {  /* matched once */
+        switch (p->rep) {  /* handle optional suffix */
+          case '?': {  /* optional */
+            const char *res;
+            if ((res = pmatch(ms, s + 1, p + 1)) != NULL)
+              s = res;
+            else {
+              p++; goto init;  /* else return pmatch(ms, s, p + 1); */
+            }
+            break;
+          }
+          case '+':  /* 1 or more repetitions */
+            s++;  /* 1 match already done */
+            /* FALLTHROUGH */
+          case '*':  /* 0 or more repetitions */
+            s = pmax_expand(ms, s, p);
+            break;
+          case '-':  /* 0 or more repetitions (minimum) */
+            s = pmin_expand(ms, s, p);
+            break;
+          default:  /* no suffix */
+            s++; p++; goto init;  /* return pmatch(ms, s + 1, p + 1); */
+        }
+      }
+      break;
+    }
+  }
+  ms->matchdepth++;
+  return s;
+}
+
+
+/*
+** Try to match the pattern at 's', using its compiled form if there
+** is one. ('p' is the pattern without the anchor.)
+*/
+static const char *domatch (MatchState *ms, const char *s, const char *p) {
+  if (ms->prog != NULL)
+    return pmatch(ms, s, ms->prog->items);
+  else
+    return match(ms, s, p);
+}
+
+
+/*
+** Return the first position from 's' on where a match may start
+** (or the end of the subject, where a match attempt fails).
+*/
+static const char *nextstart (MatchState *ms, const char *s) {
+  const Pattern *pt = ms->prog;
+  if (pt != NULL) {
+    if (pt->lprefix > 0) {
+      s = lmemfind(s, ms->src_end - s, pt->prefix, pt->lprefix);
+      return (s != NULL) ? s : ms->src_end;
+    }
+    else if (pt->first != NULL) {
+      while (s < ms->src_end && !inset(pt->first, uchar(*s)))
+        s++;
+    }
+  }
+  return s;
+}
+
+/* }====================================================== */
+
+
+/*
+** get information about the i-th capture. If there are no captures
+** and 'i==0', return information about the whole match, which
+** is the range 's'..'e'. If the capture is a string, return
+** its length and put its address in '*cap'. If it is an integer
+** (a position), push it on the stack and return CAP_POSITION.
+*/
+static size_t get_onecapture (MatchState *ms, int i, const char *s,
+                              const char *e, const char **cap) {
+  if (i >= ms->level) {
+    if (l_unlikely(i != 0))
+      luaL_error(ms->L, "invalid capture index %%%d", i + 1);
+    *cap = s;
+    return e - s;
+  }
+  else {
+    ptrdiff_t capl = ms->capture[i].len;
+    *cap = ms->capture[i].init;
+    if (l_unlikely(capl == CAP_UNFINISHED))
+      luaL_error(ms->L, "unfinished capture");
+    else if (capl == CAP_POSITION)
+      lua_pushinteger(ms->L, (ms->capture[i].init - ms->src_init) + 1);
+    return capl;
+  }
+}
+
+
+/*
+** Push the i-th capture on the stack.
+*/
+static void push_onecapture (MatchState *ms, int i, const char *s,
+                                                    const char *e) {
+  const char *cap;
+  ptrdiff_t l = get_onecapture(ms, i, s, e, &cap);
+  if (l != CAP_POSITION)
+    lua_pushlstring(ms->L, cap, l);
+  /* else position was already pushed */
+}
+
+
+static int push_captures (MatchState *ms, const char *s, const char *e) {
+  int i;
+  int nlevels = (ms->level == 0 && s) ? 1 : ms->level;
+  luaL_checkstack(ms->L, nlevels, "too many captures");
+  for (i = 0; i < nlevels; i++)
+    push_onecapture(ms, i, s, e);
+  return nlevels;  /* number of strings pushed */
+}
+
+
+/* check whether pattern has no special characters */
+static int nospecials (const char *p, size_t l) {
+  size_t upto = 0;
+  do {
+    if (strpbrk(p + upto, SPECIALS))
+      return 0;  /* pattern has a special character */
+    upto += strlen(p + upto) + 1;  /* may have more after \0 */
+  } while (upto <= l);
+  return 1;  /* no special chars found */
+}
+
+
+static void prepstate (MatchState *ms, lua_State *L,
+                       const char *s, size_t ls, const char *p, size_t lp) {
+  ms->L = L;
+  ms->prog = NULL;
+  ms->matchdepth = MAXCCALLS;
+  ms->src_init = s;
+  ms->src_end = s + ls;
+  ms->p_end = p + lp;
+}
+
+
+static void reprepstate (MatchState *ms) {
+  ms->level = 0;
+  lua_assert(ms->matchdepth == MAXCCALLS);
+}
+
+
+static int str_find_aux (lua_State *L, int find) {
+  size_t ls, lp;
+  const char *s = luaL_checklstring(L, 1, &ls);
+  const char *p = luaL_checklstring(L, 2, &lp);
+  size_t init = posrelatI(luaL_optinteger(L, 3, 1), ls) - 1;
+  if (init > ls) {  /* start after string's end? */
+    luaL_pushfail(L);  /* cannot find anything */
+    return 1;
+  }
+  /* explicit request or no special characters? */
+  if (find && (lua_toboolean(L, 4) || nospecials(p, lp))) {
+    /* do a plain search */
+    const char *s2 = lmemfind(s + init, ls - init, p, lp);
+    if (s2) {
+      lua_pushinteger(L, (s2 - s) + 1);
+      lua_pushinteger(L, (s2 - s) + lp);
+      return 2;
+    }
+  }
+  else {
+    MatchState ms;
+    const char *s1 = s + init;
+    int anchor = (*p == '^');
+    if (anchor) {
+      p++; lp--;  /* skip anchor character */
+    }
+    prepstate(&ms, L, s, ls, p, lp);
+    ms.prog = getprog(L);
+    do {
+      const char *res;
+      if (!anchor)
+        s1 = nextstart(&ms, s1);
+      reprepstate(&ms);
+      if ((res=domatch(&ms, s1, p)) != NULL) {
+        if (find) {
+          lua_pushinteger(L, (s1 - s) + 1);  /* start */
+          lua_pushinteger(L, res - s);   /* end */
+          return push_captures(&ms, NULL, 0) + 2;
+        }
+        else
+          return push_captures(&ms, s1, res);
+      }
+    } while (s1++ < ms.src_end && !anchor);
+  }
+  luaL_pushfail(L);  /* not found */
+  return 1;
+}
+
+
+static int str_find (lua_State *L) {
+  return str_find_aux(L, 1);
+}
+
+
+static int str_match (lua_State *L) {
+  return str_find_aux(L, 0);
+}
+
+
+/* state for 'gmatch' */
+typedef struct GMatchState {
+  const char *src;  /* current position */
+  const char *p;  /* pattern */
+  const char *lastmatch;  /* end of last match */
+  MatchState ms;  /* match state */
+} GMatchState;
+
+
+static int gmatch_aux (lua_State *L) {
+  GMatchState *gm = (GMatchState *)lua_touserdata(L, lua_upvalueindex(3));
+  const char *src;
+  gm->ms.L = L;
+  for (src = gm->src; src <= gm->ms.src_end; src++) {
+    const char *e;
+    src = nextstart(&gm->ms, src);
+    reprepstate(&gm->ms);
+    if ((e = domatch(&gm->ms, src, gm->p)) != NULL && e != gm->lastmatch) {
+      gm->src = gm->lastmatch = e;
+      return push_captures(&gm->ms, src, e);
+    }
+  }
+  return 0;  /* not found */
+}
+
+
+static int gmatch (lua_State *L) {
+  size_t ls, lp;
+  const char *s = luaL_checklstring(L, 1, &ls);
+  const char *p = luaL_checklstring(L, 2, &lp);
+  size_t init = posrelatI(luaL_optinteger(L, 3, 1), ls) - 1;
+  GMatchState *gm;
+  const Pattern *pt;
+  lua_settop(L, 2);  /* keep strings on closure to avoid being collected */
+  gm = (GMatchState *)lua_newuserdatauv(L, sizeof(GMatchState), 0);
+  if (init > ls)  /* start after string's end? */
+    init = ls + 1;  /* avoid overflows in 's + init' */
+  prepstate(&gm->ms, L, s, ls, p, lp);
+  pt = getprog(L);  /* also kept on closure */
+  if (pt != NULL && !pt->anchor)  /* ('^' is not an anchor here) */
+    gm->ms.prog = pt;
+  gm->src = s + init; gm->p = p; gm->lastmatch = NULL;
+  lua_pushcclosure(L, gmatch_aux, 4);
+  return 1;
+}
+
+
+static void add_s (MatchState *ms, luaL_Buffer *b, const char *s,
+                                                   const char *e) {
+  size_t l;
+  lua_State *L = ms->L;
+  const char *news = lua_tolstring(L, 3, &l);
+  const char *p;
+  while ((p = (char *)memchr(news, L_ESC, l)) != NULL) {
+    luaL_addlstring(b, news, p - news);
+    p++;  /* skip ESC */
+    if (*p == L_ESC)  /* '%%' */
+      luaL_addchar(b, *p);
+    else if (*p == '0')  /* '%0' */
+        luaL_addlstring(b, s, e - s);
+    else if (isdigit(uchar(*p))) {  /* '%n' */
+      const char *cap;
+      ptrdiff_t resl = get_onecapture(ms, *p - '1', s, e, &cap);
+      if (resl == CAP_POSITION)
+        luaL_addvalue(b);  /* add position to accumulated result */
+      else
+        luaL_addlstring(b, cap, resl);
+    }
+    else
+      luaL_error(L, "invalid use of '%c' in replacement string", L_ESC);
+    l -= p + 1 - news;
+    news = p + 1;
+  }
+  luaL_addlstring(b, news, l);
+}
+
+
+/*
+** Add the replacement value to the string buffer 'b'.
 ** Return true if the original string was changed. (Function calls and
 ** table indexing resulting in nil or false do not change the subject.)
 */
-static int add_value (MatchState *ms, luaL_Buffer *b, const char *s,
-                                      const char *e, int tr) {
-  lua_State *L = ms->L;
-  switch (tr) {
-    case LUA_TFUNCTION: {  /* call the function */
-      int n;
-      lua_pushvalue(L, 3);  /* push the function */
-      n = push_captures(ms, s, e);  /* all captures as arguments */
-      lua_call(L, n, 1);  /* call it */
+static int add_value (MatchState *ms, luaL_Buffer *b, const char *s,
+                                      const char *e, int tr) {
+  lua_State *L = ms->L;
+  switch (tr) {
+    case LUA_TFUNCTION: {  /* call the function */
+      int n;
+      lua_pushvalue(L, 3);  /* push the function */
+      n = push_captures(ms, s, e);  /* all captures as arguments */
+      lua_call(L, n, 1);  /* call it */
+      break;
+    }
+    case LUA_TTABLE: {  /* index the table */
+      push_onecapture(ms, 0, s, e);  /* first capture is the index */
+      lua_gettable(L, 3);
+      break;
+    }
+    default: {  /* LUA_TNUMBER or LUA_TSTRING */
+      add_s(ms, b, s, e);  /* add value to the buffer */
+      return 1;  /* something changed */
+    }
+  }
+  if (!lua_toboolean(L, -1)) {  /* nil or false? */
+    lua_pop(L, 1);  /* remove value */
+    luaL_addlstring(b, s, e - s);  /* keep original text */
+    return 0;  /* no changes */
+  }
+  else if (l_unlikely(!lua_isstring(L, -1)))
+    return luaL_error(L, "invalid replacement value (a %s)",
+                         luaL_typename(L, -1));
+  else {
+    luaL_addvalue(b);  /* add result to accumulator */
+    return 1;  /* something changed */
+  }
+}
+
+
+static int str_gsub (lua_State *L) {
+  size_t srcl, lp;
+  const char *src = luaL_checklstring(L, 1, &srcl);  /* subject */
+  const char *p = luaL_checklstring(L, 2, &lp);  /* pattern */
+  const char *lastmatch = NULL;  /* end of last match */
+  int tr = lua_type(L, 3);  /* replacement type */
+  lua_Integer max_s = luaL_optinteger(L, 4, srcl + 1);  /* max replacements */
+  int anchor = (*p == '^');
+  lua_Integer n = 0;  /* replacement count */
+  int changed = 0;  /* change flag */
+  MatchState ms;
+  const Pattern *pt;
+  luaL_Buffer b;
+  luaL_argexpected(L, tr == LUA_TNUMBER || tr == LUA_TSTRING ||
+                   tr == LUA_TFUNCTION || tr == LUA_TTABLE, 3,
+                      "string/function/table");
+  pt = getprog(L);
+  luaL_buffinit(L, &b);
+  if (anchor) {
+    p++; lp--;  /* skip anchor character */
+  }
+  prepstate(&ms, L, src, srcl, p, lp);
+  ms.prog = pt;
+  while (n < max_s) {
+    const char *e;
+    reprepstate(&ms);  /* (re)prepare state for new match */
+    if ((e = domatch(&ms, src, p)) != NULL && e != lastmatch) {  /* match? */
+      n++;
+      changed = add_value(&ms, &b, src, e, tr) | changed;
+      src = lastmatch = e;
+    }
+    else if (src < ms.src_end) {  /* otherwise, skip to next possible match */
+      const char *next = anchor ? src + 1 : nextstart(&ms, src + 1);
+      luaL_addlstring(&b, src, next - src);
+      src = next;
+    }
+    else break;  /* end of subject */
+    if (anchor) break;
+  }
+  if (!changed)  /* no changes? */
+    lua_pushvalue(L, 1);  /* return original string */
+  else {  /* something changed */
+    luaL_addlstring(&b, src, ms.src_end-src);
+    luaL_pushresult(&b);  /* create and return new string */
+  }
+  lua_pushinteger(L, n);  /* number of substitutions */
+  return 2;
+}
+
+/* }====================================================== */
+
+
+
+/*
+** {======================================================
+** STRING FORMAT
+** =======================================================
+*/
+
+#if !defined(lua_number2strx)	/* { */
+
+/*
+** Hexadecimal floating-point formatter
+*/
+
+#define SIZELENMOD	(sizeof(LUA_NUMBER_FRMLEN)/sizeof(char))
+
+
+/*
+** Number of bits that goes into the first digit. It can be any value
+** between 1 and 4; the following definition tries to align the number
+** to nibble boundaries by making what is left after that first digit a
+** multiple of 4.
+*/
+#define L_NBFD		((l_floatatt(MANT_DIG) - 1)%4 + 1)
+
+
+/*
+** Add integer part of 'x' to buffer and return new 'x'
+*/
+static lua_Number adddigit (char *buff, int n, lua_Number x) {
+  lua_Number dd = l_mathop(floor)(x);  /* get integer part from 'x' */
+  int d = (int)dd;
+  buff[n] = (d < 10 ? d + '0' : d - 10 + 'a');  /* add to buffer */
+  return x - dd;  /* return what is left */
+}
+
+
+static int num2straux (char *buff, int sz, lua_Number x) {
+  /* if 'inf' or 'NaN', format it like '%g' */
+  if (x != x || x == (lua_Number)HUGE_VAL || x == -(lua_Number)HUGE_VAL)
+    return l_sprintf(buff, sz, LUA_NUMBER_FMT, (LUAI_UACNUMBER)x);
+  else if (x == 0) {  /* can be -0... */
+    /* create "0" or "-0" followed by exponent */
+    return l_sprintf(buff, sz, LUA_NUMBER_FMT "x0p+0", (LUAI_UACNUMBER)x);
+  }
+  else {
+    int e;
+    lua_Number m = l_mathop(frexp)(x, &e);  /* 'x' fraction and exponent */
+    int n = 0;  /* character count */
+    if (m < 0) {  /* is number negative? */
+      buff[n++] = '-';  /* add sign */
+      m = -m;  /* make it positive */
+    }
+    buff[n++] = '0'; buff[n++] = 'x';  /* add "0x" */
+    m = adddigit(buff, n++, m * (1 << L_NBFD));  /* add first digit */
+    e -= L_NBFD;  /* this digit goes before the radix point */
+    if (m > 0) {  /* more digits? */
+      buff[n++] = lua_getlocaledecpoint();  /* add radix point */
+      do {  /* add as many digits as needed */
+        m = adddigit(buff, n++, m * 16);
+      } while (m > 0);
+    }
+    n += l_sprintf(buff + n, sz - n, "p%+d", e);  /* add exponent */
+    lua_assert(n < sz);
+    return n;
+  }
+}
+
+
+static int lua_number2strx (lua_State *L, char *buff, int sz,
+                            const char *fmt, lua_Number x) {
+  int n = num2straux(buff, sz, x);
+  if (fmt[SIZELENMOD] == 'A') {
+    int i;
+    for (i = 0; i < n; i++)
+      buff[i] = toupper(uchar(buff[i]));
+  }
+  else if (l_unlikely(fmt[SIZELENMOD] != 'a'))
+    return luaL_error(L, "modifiers for format '%%a'/'%%A' not implemented");
+  return n;
+}
+
+#endif				/* } */
+
+
+/*
+** Maximum size for items formatted with '%f'. This size is produced
+** by format('%.99f', -maxfloat), and is equal to 99 + 3 ('-', '.',
+** and '\0') + number of decimal digits to represent maxfloat (which
+** is maximum exponent + 1). (99+3+1, adding some extra, 110)
+*/
+#define MAX_ITEMF	(110 + l_floatatt(MAX_10_EXP))
+
+
+/*
+** All formats except '%f' do not need that large limit.  The other
+** float formats use exponents, so that they fit in the 99 limit for
+** significant digits; 's' for large strings and 'q' add items directly
+** to the buffer; all integer formats also fit in the 99 limit.  The
+** worst case are floats: they may need 99 significant digits, plus
+** '0x', '-', '.', 'e+XXXX', and '\0'. Adding some extra, 120.
+*/
+#define MAX_ITEM	120
+
+
+/* valid flags in a format specification */
+#if !defined(L_FMTFLAGSF)
+
+/* valid flags for a, A, e, E, f, F, g, and G conversions */
+#define L_FMTFLAGSF	"-+#0 "
+
+/* valid flags for o, x, and X conversions */
+#define L_FMTFLAGSX	"-#0"
+
+/* valid flags for d and i conversions */
+#define L_FMTFLAGSI	"-+0 "
+
+/* valid flags for u conversions */
+#define L_FMTFLAGSU	"-0"
+
+/* valid flags for c, p, and s conversions */
+#define L_FMTFLAGSC	"-"
+
+#endif
+
+
+/*
+** Maximum size of each format specification (such as "%-099.99d"):
+** Initial '%', flags (up to 5), width (2), period, precision (2),
+** length modifier (8), conversion specifier, and final '\0', plus some
+** extra.
+*/
+#define MAX_FORMAT	32
+
+
+static void addquoted (luaL_Buffer *b, const char *s, size_t len) {
+  luaL_addchar(b, '"');
+  while (len--) {
+    if (*s == '"' || *s == '\\' || *s == '\n') {
+      luaL_addchar(b, '\\');
+      luaL_addchar(b, *s);
+    }
+    else if (iscntrl(uchar(*s))) {
+      char buff[10];
+      if (!isdigit(uchar(*(s+1))))
+        l_sprintf(buff, sizeof(buff), "\\%d", (int)uchar(*s));
+      else
+        l_sprintf(buff, sizeof(buff), "\\%03d", (int)uchar(*s));
+      luaL_addstring(b, buff);
+    }
+    else
+      luaL_addchar(b, *s);
+    s++;
+  }
+  luaL_addchar(b, '"');
+}
+
+
+/*
+** Serialize a floating-point number in such a way that it can be
+** scanned back by Lua. Use hexadecimal format for "common" numbers
+** (to preserve precision); inf, -inf, and NaN are handled separately.
+** (NaN cannot be expressed as a numeral, so we write '(0/0)' for it.)
+*/
+static int quotefloat (lua_State *L, char *buff, lua_Number n) {
+  const char *s;  /* for the fixed representations */
+  if (n == (lua_Number)HUGE_VAL)  /* inf? */
+    s = "1e9999";
+  else if (n == -(lua_Number)HUGE_VAL)  /* -inf? */
+    s = "-1e9999";
+  else if (n != n)  /* NaN? */
+    s = "(0/0)";
+  else {  /* format number as hexadecimal */
+    int  nb = lua_number2strx(L, buff, MAX_ITEM,
+                                 "%" LUA_NUMBER_FRMLEN "a", n);
+    /* ensures that 'buff' string uses a dot as the radix character */
+    if (memchr(buff, '.', nb) == NULL) {  /* no dot? */
+      char point = lua_getlocaledecpoint();  /* try locale point */
+      char *ppoint = (char *)memchr(buff, point, nb);
+      if (ppoint) *ppoint = '.';  /* change it to a dot */
+    }
+    return nb;
+  }
+  /* for the fixed representations */
+  return l_sprintf(buff, MAX_ITEM, "%s", s);
+}
+
+
+static void addliteral (lua_State *L, luaL_Buffer *b, int arg) {
+  switch (lua_type(L, arg)) {
+    case LUA_TSTRING: {
+      size_t len;
+      const char *s = lua_tolstring(L, arg, &len);
+      addquoted(b, s, len);
+      break;
+    }
+    case LUA_TNUMBER: {
+      char *buff = luaL_prepbuffsize(b, MAX_ITEM);
+      int nb;
+      if (!lua_isinteger(L, arg))  /* float? */
+        nb = quotefloat(L, buff, lua_tonumber(L, arg));
+      else {  /* integers */
+        lua_Integer n = lua_tointeger(L, arg);
+        const char *format = (n == LUA_MININTEGER)  /* corner case? */
+                           ? "0x%" LUA_INTEGER_FRMLEN "x"  /* use hex */
+                           : LUA_INTEGER_FMT;  /* else use default format */
+        nb = l_sprintf(buff, MAX_ITEM, format, (LUAI_UACINT)n);
+      }
+      luaL_addsize(b, nb);
+      break;
+    }
+    case LUA_TNIL: case LUA_TBOOLEAN: {
+      luaL_tolstring(L, arg, NULL);
+      luaL_addvalue(b);
+      break;
+    }
+    default: {
+      luaL_argerror(L, arg, "value has no literal form");
+    }
+  }
+}
+
+
+static const char *get2digits (const char *s) {
+  if (isdigit(uchar(*s))) {
+    s++;
+    if (isdigit(uchar(*s))) s++;  /* (2 digits at most) */
+  }
+  return s;
+}
+
+
+/*
+** Check whether a conversion specification is valid. First character
+** in 'form' must be '%' and last character must be a valid conversion
+** specifier. 'flags' are the accepted flags; 'precision' signals
+** whether to accept a precision.
+*/
+static int validformat (const char *form, const char *flags,
+                                          int precision) {
+  const char *spec = form + 1;  /* skip '%' */
+  spec += strspn(spec, flags);  /* skip flags */
+  if (*spec != '0') {  /* a width cannot start with '0' */
+    spec = get2digits(spec);  /* skip width */
+    if (*spec == '.' && precision) {
+      spec++;
+      spec = get2digits(spec);  /* skip precision */
+    }
+  }
+  return isalpha(uchar(*spec));  /* went to the end? */
+}
+
+
+static void checkformat (lua_State *L, const char *form, const char *flags,
+                                       int precision) {
+  if (!validformat(form, flags, precision))
+    luaL_error(L, "invalid conversion specification: '%s'", form);
+}
+
+
+/*
+** Get a conversion specification and copy it to 'form'.
+** Return the address of its last character.
+*/
+static const char *getformat (lua_State *L, const char *strfrmt,
+                                            char *form) {
+  /* spans flags, width, and precision ('0' is included as a flag) */
+  size_t len = strspn(strfrmt, L_FMTFLAGSF "123456789.");
+  len++;  /* adds following character (should be the specifier) */
+  /* still needs space for '%', '\0', plus a length modifier */
+  if (len >= MAX_FORMAT - 10)
+    luaL_error(L, "invalid format (too long)");
+  *(form++) = '%';
+  memcpy(form, strfrmt, len * sizeof(char));
+  *(form + len) = '\0';
+  return strfrmt + len - 1;
+}
+
+
+/*
+** add length modifier into formats
+*/
+static void addlenmod (char *form, const char *lenmod) {
+  size_t l = strlen(form);
+  size_t lm = strlen(lenmod);
+  char spec = form[l - 1];
+  strcpy(form + l - 1, lenmod);
+  form[l + lm - 1] = spec;
+  form[l + lm] = '\0';
+}
+
+
+/*
+** Format argument 'arg' following the specification 'form', whose
+** conversion specifier is 'conv'. When 'checked' is true, 'form' was
+** already validated and has its length modifier.
+*/
+static void addconversion (lua_State *L, luaL_Buffer *b, int arg,
+                           int conv, char *form, int checked) {
+  const char *flags;
+  int maxitem = MAX_ITEM;  /* maximum length for the result */
+  char *buff = luaL_prepbuffsize(b, maxitem);  /* to put result */
+  int nb = 0;  /* number of bytes in result */
+  switch (conv) {
+    case 'c': {
+      if (!checked) checkformat(L, form, L_FMTFLAGSC, 0);
+      nb = l_sprintf(buff, maxitem, form, (int)luaL_checkinteger(L, arg));
       break;
     }
-    case LUA_TTABLE: {  /* index the table */
-      push_onecapture(ms, 0, s, e);  /* first capture is the index */
-      lua_gettable(L, 3);
+    case 'd': case 'i':
+      flags = L_FMTFLAGSI;
+      goto intcase;
+    case 'u':
+      flags = L_FMTFLAGSU;
+      goto intcase;
+    case 'o': case 'x': case 'X':
+      flags = L_FMTFLAGSX;
+     intcase: {
+      lua_Integer n = luaL_checkinteger(L, arg);
+      if (!checked) {
+        checkformat(L, form, flags, 1);
+        addlenmod(form, LUA_INTEGER_FRMLEN);
+      }
+      nb = l_sprintf(buff, maxitem, form, (LUAI_UACINT)n);
       break;
     }
-    default: {  /* LUA_TNUMBER or LUA_TSTRING */
-      add_s(ms, b, s, e);  /* add value to the buffer */
-      return 1;  /* something changed */
+    case 'a': case 'A':
+      if (!checked) {
+        checkformat(L, form, L_FMTFLAGSF, 1);
+        addlenmod(form, LUA_NUMBER_FRMLEN);
+      }
+      nb = lua_number2strx(L, buff, maxitem, form,
+                              luaL_checknumber(L, arg));
+      break;
+    case 'f':
+      maxitem = MAX_ITEMF;  /* extra space for '%f' */
+      buff = luaL_prepbuffsize(b, maxitem);
+      /* FALLTHROUGH */
+    case 'e': case 'E': case 'g': case 'G': {
+      lua_Number n = luaL_checknumber(L, arg);
+      if (!checked) {
+        checkformat(L, form, L_FMTFLAGSF, 1);
+        addlenmod(form, LUA_NUMBER_FRMLEN);
+      }
+      nb = l_sprintf(buff, maxitem, form, (LUAI_UACNUMBER)n);
+      break;
+    }
+    case 'p': {
+      const void *p = lua_topointer(L, arg);
+      if (!checked) checkformat(L, form, L_FMTFLAGSC, 0);
+      if (p == NULL) {  /* avoid calling 'printf' with argument NULL */
+        p = "(null)";  /* result */
+        form[strlen(form) - 1] = 's';  /* format it as a string */
+      }
+      nb = l_sprintf(buff, maxitem, form, p);
+      break;
+    }
+    case 'q': {
+      if (form[2] != '\0')  /* modifiers? */
+        luaL_error(L, "specifier '%%q' cannot have modifiers");
+      addliteral(L, b, arg);
+      break;
+    }
+    case 's': {
+      size_t l;
+      const char *s = luaL_tolstring(L, arg, &l);
+      if (form[2] == '\0')  /* no modifiers? */
+        luaL_addvalue(b);  /* keep entire string */
+      else {
+        luaL_argcheck(L, l == strlen(s), arg, "string contains zeros");
+        if (!checked) checkformat(L, form, L_FMTFLAGSC, 1);
+        if (strchr(form, '.') == NULL && l >= 100) {
+          /* no precision and string is too long to be formatted */
+          luaL_addvalue(b);  /* keep entire string */
+        }
+        else {  /* format the string into 'buff' */
+          nb = l_sprintf(buff, maxitem, form, s);
+          lua_pop(L, 1);  /* remove result from 'luaL_tolstring' */
+        }
+      }
+      break;
+    }
+    default: {  /* also treat cases 'pnLlh' */
+      luaL_error(L, "invalid conversion '%s' to 'format'", form);
     }
   }
-  if (!lua_toboolean(L, -1)) {  /* nil or false? */
-    lua_pop(L, 1);  /* remove value */
-    luaL_addlstring(b, s, e - s);  /* keep original text */
-    return 0;  /* no changes */
-  }
-  else if (l_unlikely(!lua_isstring(L, -1)))
-    return luaL_error(L, "invalid replacement value (a %s)",
-                         luaL_typename(L, -1));
-  else {
-    luaL_addvalue(b);  /* add result to accumulator */
-    return 1;  /* something changed */
-  }
+  lua_assert(nb < maxitem);
+  luaL_addsize(b, nb);
 }
 
 
-static int str_gsub (lua_State *L) {
-  size_t srcl, lp;
-  const char *src = luaL_checklstring(L, 1, &srcl);  /* subject */
-  const char *p = luaL_checklstring(L, 2, &lp);  /* pattern */
-  const char *lastmatch = NULL;  /* end of last match */
-  int tr = lua_type(L, 3);  /* replacement type */
-  lua_Integer max_s = luaL_optinteger(L, 4, srcl + 1);  /* max replacements */
-  int anchor = (*p == '^');
-  lua_Integer n = 0;  /* replacement count */
-  int changed = 0;  /* change flag */
-  MatchState ms;
-  luaL_Buffer b;
-  luaL_argexpected(L, tr == LUA_TNUMBER || tr == LUA_TSTRING ||
-                   tr == LUA_TFUNCTION || tr == LUA_TTABLE, 3,
-                      "string/function/table");
-  luaL_buffinit(L, &b);
-  if (anchor) {
-    p++; lp--;  /* skip anchor character */
+/*
+** {======================================================
+** Compiled formats
+** =======================================================
+*/
+
+/*
+** Format strings are parsed once into a list of items, each one a
+** run of literal text followed by a conversion. Usual conversions are
+** formatted directly; the others are given to 'addconversion' with
+** their specification already checked.
+*/
+
+/* kinds of conversions */
+enum FmtKind {
+  FK_INT,  /* '%d'/'%i' with only flags '-' and '0', and no precision */
+  FK_HEX,  /* '%x'/'%X' with the same restrictions */
+  FK_STR,  /* '%s' without precision */
+  FK_FIXED,  /* '%.<n>f' without flags or width */
+  FK_GENERAL,  /* '%g'/'%G' without modifiers */
+  FK_OTHER  /* everything else */
+};
+
+
+typedef struct FmtItem {
+  size_t init, len;  /* literal text before the conversion */
+  char conv;  /* conversion specifier ('\0' if none) */
+  unsigned char kind;
+  unsigned char left;  /* flag '-' */
+  unsigned char zero;  /* flag '0' */
+  int width;
+  int prec;  /* precision (-1 if absent) */
+  char form[MAX_FORMAT];  /* specification, with its length modifier */
+} FmtItem;
+
+
+typedef struct Format {
+  int nitems;
+  FmtItem items[1];
+} Format;
+
+
+/*
+** Format floats directly only when they are doubles and integers have
+** 64 bits.
+*/
+#if !defined(l_fastfloat)
+#if LUA_FLOAT_TYPE == LUA_FLOAT_DOUBLE && \
+    (LUA_MAXINTEGER >> 31 >> 31) == 1
+#define l_fastfloat	1
+#else
+#define l_fastfloat	0
+#endif
+#endif
+
+
+/*
+** Fill the fields of 'it' from its specification 'form' (which has
+** been validated) and choose its kind.
+*/
+static void setfmtkind (FmtItem *it) {
+  const char *spec = it->form + 1;  /* skip '%' */
+  int other = 0;  /* flags other than '-' and '0'? */
+  it->left = it->zero = 0;
+  it->width = 0; it->prec = -1;
+  for (; *spec != '\0' && strchr(L_FMTFLAGSF, *spec) != NULL; spec++) {
+    if (*spec == '-') it->left = 1;
+    else if (*spec == '0') it->zero = 1;
+    else other = 1;
   }
-  prepstate(&ms, L, src, srcl, p, lp);
-  while (n < max_s) {
-    const char *e;
-    reprepstate(&ms);  /* (re)prepare state for new match */
-    if ((e = match(&ms, src, p)) != NULL && e != lastmatch) {  /* match? */
-      n++;
-      changed = add_value(&ms, &b, src, e, tr) | changed;
-      src = lastmatch = e;
-    }
-    else if (src < ms.src_end)  /* otherwise, skip one character */
-      luaL_addchar(&b, *src++);
-    else break;  /* end of subject */
-    if (anchor) break;
+  while (isdigit(uchar(*spec)))
+    it->width = it->width * 10 + (*spec++ - '0');
+  if (*spec == '.') {
+    it->prec = 0;
+    while (isdigit(uchar(*++spec)))
+      it->prec = it->prec * 10 + (*spec - '0');
   }
-  if (!changed)  /* no changes? */
-    lua_pushvalue(L, 1);  /* return original string */
-  else {  /* something changed */
-    luaL_addlstring(&b, src, ms.src_end-src);
-    luaL_pushresult(&b);  /* create and return new string */
+  it->kind = FK_OTHER;
+  switch (it->conv) {
+    case 'd': case 'i':
+      if (!other && it->prec < 0) it->kind = FK_INT;
+      break;
+    case 'x': case 'X':
+      if (!other && it->prec < 0) it->kind = FK_HEX;
+      break;
+    case 's':
+      if (it->prec < 0) it->kind = FK_STR;
+      break;
+    case 'f':
+      if (l_fastfloat && !other && !it->left && !it->zero && it->width == 0
+                      && it->prec <= 19) {
+        if (it->prec < 0) it->prec = 6;  /* default precision */
+        it->kind = FK_FIXED;
+      }
+      break;
+    case 'g': case 'G':
+      if (l_fastfloat && it->form[2] == '\0') it->kind = FK_GENERAL;
+      break;
   }
-  lua_pushinteger(L, n);  /* number of substitutions */
-  return 2;
 }
 
-/* }====================================================== */
 
+/*
+** Compile format 'strfrmt' (with length 'sfl') into a new userdata
+** on the stack. Formats that would raise an error are not compiled:
+** the function then returns NULL (leaving nothing on the stack), so
+** that the format is interpreted and the error raised in its proper
+** place.
+*/
+static const Format *compileformat (lua_State *L, const char *strfrmt,
+                                                  size_t sfl) {
+  const char *s = strfrmt;
+  const char *e = strfrmt + sfl;
+  int n = 1;  /* number of items */
+  Format *f;
+  FmtItem *it;
+  for (; s < e; s++)
+    n += (*s == L_ESC);
+  f = (Format *)lua_newuserdatauv(L, sizeof(Format) +
+                                     (n - 1) * sizeof(FmtItem), 0);
+  it = f->items;
+  it->init = 0;
+  for (s = strfrmt; s < e; s++) {
+    const char *flags;
+    size_t len;
+    if (*s != L_ESC)
+      continue;
+    if (s + 1 < e && s[1] == L_ESC) {  /* '%%'? */
+      it->len = (size_t)(s + 1 - strfrmt) - it->init;  /* keep one '%' */
+      it->conv = '\0';
+      s++;  /* skip second '%' */
+    }
+    else {  /* conversion */
+      it->len = (size_t)(s - strfrmt) - it->init;
+      len = strspn(s + 1, L_FMTFLAGSF "123456789.") + 1;
+      if (len >= MAX_FORMAT - 10 || s + len >= e)
+        goto invalid;  /* too long or without specifier */
+      it->form[0] = L_ESC;
+      memcpy(it->form + 1, s + 1, len * sizeof(char));
+      it->form[len + 1] = '\0';
+      s += len;  /* go to the specifier */
+      it->conv = *s;
+      switch (*s) {
+        case 'c': case 'p':
+          if (!validformat(it->form, L_FMTFLAGSC, 0)) goto invalid;
+          break;
+        case 's':
+          if (it->form[2] != '\0' && !validformat(it->form, L_FMTFLAGSC, 1))
+            goto invalid;
+          break;
+        case 'q':
+          if (it->form[2] != '\0') goto invalid;
+          break;
+        case 'd': case 'i':
+          flags = L_FMTFLAGSI;
+          goto intcase;
+        case 'u':
+          flags = L_FMTFLAGSU;
+          goto intcase;
+        case 'o': case 'x': case 'X':
+          flags = L_FMTFLAGSX;
+         intcase:
+          if (!validformat(it->form, flags, 1)) goto invalid;
+          addlenmod(it->form, LUA_INTEGER_FRMLEN);
+          break;
+        case 'a': case 'A': case 'f':
+        case 'e': case 'E': case 'g': case 'G':
+          if (!validformat(it->form, L_FMTFLAGSF, 1)) goto invalid;
+          addlenmod(it->form, LUA_NUMBER_FRMLEN);
+          break;
+        default:
+          goto invalid;
+      }
+      setfmtkind(it);
+    }
+    it++;
+    it->init = (size_t)(s + 1 - strfrmt);
+  }
+  it->len = sfl - it->init;  /* final text */
+  it->conv = '\0';
+  f->nitems = (int)(it - f->items) + 1;
+  return f;
+ invalid:
+  lua_pop(L, 1);  /* remove userdata */
+  return NULL;
+}
 
 
 /*
-** {======================================================
-** STRING FORMAT
-** =======================================================
+** Get the compiled form of the format at index 'arg', from the cache
+** (the second upvalue) or compiling it. Leaves the compiled format on
+** the stack, to keep it alive while in use; returns NULL (leaving
+** nothing on the stack) if the format cannot be compiled.
 */
+static const Format *getfmt (lua_State *L, int arg, const char *strfrmt,
+                                                    size_t sfl) {
+  const Format *f;
+  lua_pushvalue(L, arg);
+  if (lua_rawget(L, lua_upvalueindex(2)) == LUA_TUSERDATA)
+    return (const Format *)lua_touserdata(L, -1);
+  lua_pop(L, 1);  /* remove nil */
+  f = compileformat(L, strfrmt, sfl);
+  if (f != NULL) {
+    lua_pushvalue(L, arg);
+    lua_pushvalue(L, -2);
+    lua_rawset(L, lua_upvalueindex(2));  /* cache[format] = f */
+  }
+  return f;
+}
 
-#if !defined(lua_number2strx)	/* { */
 
 /*
-** Hexadecimal floating-point formatter
+** Write into 'buff' the 'nd' characters in 'digits', with sign 'neg',
+** padded to the width of 'it'. Return the number of bytes written.
 */
+static int padnumber (char *buff, const FmtItem *it, int neg,
+                      const char *digits, int nd) {
+  int pad = it->width - nd - neg;
+  char *p = buff;
+  if (pad < 0) pad = 0;
+  if (!it->left && !it->zero) {
+    memset(p, ' ', pad);  /* right-justify */
+    p += pad;
+  }
+  if (neg) *p++ = '-';
+  if (!it->left && it->zero) {
+    memset(p, '0', pad);  /* zeros after the sign */
+    p += pad;
+  }
+  memcpy(p, digits, nd);
+  p += nd;
+  if (it->left) {
+    memset(p, ' ', pad);  /* left-justify */
+    p += pad;
+  }
+  return (int)(p - buff);
+}
 
-#define SIZELENMOD	(sizeof(LUA_NUMBER_FRMLEN)/sizeof(char))
+
+/* size of a buffer for the digits of a lua_Unsigned */
+#define MAXDIGITS	(3 * sizeof(lua_Unsigned))
 
 
 /*
-** Number of bits that goes into the first digit. It can be any value
-** between 1 and 4; the following definition tries to align the number
-** to nibble boundaries by making what is left after that first digit a
-** multiple of 4.
+** Write 'u' in decimal into the space ending at 'end'. Return the
+** address of its first digit.
 */
-#define L_NBFD		((l_floatatt(MANT_DIG) - 1)%4 + 1)
+static char *udigits (char *end, lua_Unsigned u) {
+  do {
+    *--end = (char)('0' + (int)(u % 10));
+    u /= 10;
+  } while (u != 0);
+  return end;
+}
+
+
+static int fmtinteger (char *buff, const FmtItem *it, lua_Integer n) {
+  char digits[MAXDIGITS];
+  char *end = digits + MAXDIGITS;
+  char *d;
+  lua_Unsigned u = (lua_Unsigned)n;
+  int neg = 0;
+  if (it->kind == FK_HEX) {
+    const char *hex = (it->conv == 'x') ? "0123456789abcdef"
+                                        : "0123456789ABCDEF";
+    d = end;
+    do {
+      *--d = hex[u & 0xf];
+      u >>= 4;
+    } while (u != 0);
+  }
+  else {
+    if (n < 0) {
+      neg = 1;
+      u = 0u - u;
+    }
+    d = udigits(end, u);
+  }
+  return padnumber(buff, it, neg, d, (int)(end - d));
+}
+
 
+#if l_fastfloat
 
 /*
-** Add integer part of 'x' to buffer and return new 'x'
+** Write 'x' as '%.<prec>f' would, computing its digits exactly with
+** integer arithmetic, rounding ties to even. Return the number of
+** bytes written, or -1 if 'x' is out of the range handled here.
 */
-static lua_Number adddigit (char *buff, int n, lua_Number x) {
-  lua_Number dd = l_mathop(floor)(x);  /* get integer part from 'x' */
-  int d = (int)dd;
-  buff[n] = (d < 10 ? d + '0' : d - 10 + 'a');  /* add to buffer */
-  return x - dd;  /* return what is left */
+static int fmtfixed (char *buff, lua_Number x, int prec) {
+  lua_Number ax = l_mathop(fabs)(x);
+  lua_Unsigned m, ip, fd = 0;  /* mantissa, integer and fraction digits */
+  lua_Unsigned pow = 1;  /* 10^prec */
+  char digits[MAXDIGITS];
+  char *end = digits + MAXDIGITS;
+  char *d;
+  char *p = buff;
+  int e, i;
+  if (!(ax < 1e18))  /* too large, inf, or NaN? */
+    return -1;
+  m = (lua_Unsigned)l_mathop(ldexp)(l_mathop(frexp)(ax, &e), 53);
+  e -= 53;  /* ax == m * 2^e */
+  while (m != 0 && (m & 1) == 0) {  /* remove trailing zero bits */
+    m >>= 1; e++;
+  }
+  for (i = 0; i < prec; i++)
+    pow *= 10;
+  if (m == 0)
+    ip = 0;
+  else if (e >= 0) {
+    if (e > 10) return -1;
+    ip = m << e;
+  }
+  else {
+    int k = -e;
+    lua_Unsigned mask, frac, q, rem, half;
+    if (k > 63) return -1;
+    mask = (~(lua_Unsigned)0) >> (64 - k);
+    ip = m >> k;
+    frac = m & mask;
+    if (frac > (~(lua_Unsigned)0) / pow)
+      return -1;  /* 'frac * pow' would overflow */
+    q = frac * pow;
+    fd = q >> k;
+    rem = q & mask;
+    half = (lua_Unsigned)1 << (k - 1);
+    if (rem > half || (rem == half && ((prec > 0 ? fd : ip) & 1))) {
+      if (++fd == pow) {  /* carry into the integer part? */
+        fd = 0;
+        ip++;
+      }
+    }
+  }
+  if (x < 0 || (x == 0 && 1 / x < 0))  /* negative or -0.0? */
+    *p++ = '-';
+  d = udigits(end, ip);
+  memcpy(p, d, end - d);
+  p += end - d;
+  if (prec > 0) {
+    *p++ = lua_getlocaledecpoint();
+    d = udigits(end, fd);
+    memset(p, '0', prec - (end - d));  /* leading zeros */
+    memcpy(p + prec - (end - d), d, end - d);
+    p += prec;
+  }
+  return (int)(p - buff);
 }
 
 
-static int num2straux (char *buff, int sz, lua_Number x) {
-  /* if 'inf' or 'NaN', format it like '%g' */
-  if (x != x || x == (lua_Number)HUGE_VAL || x == -(lua_Number)HUGE_VAL)
-    return l_sprintf(buff, sz, LUA_NUMBER_FMT, (LUAI_UACNUMBER)x);
-  else if (x == 0) {  /* can be -0... */
-    /* create "0" or "-0" followed by exponent */
-    return l_sprintf(buff, sz, LUA_NUMBER_FMT "x0p+0", (LUAI_UACNUMBER)x);
+#if defined(FLT_EVAL_METHOD) && FLT_EVAL_METHOD == 0
+
+/* powers of ten that are exact as floats */
+static const lua_Number pow10tab[] = {
+  1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+
+/*
+** Write 'x' as '%g'/'%G' ('conv') would. Its 6 significant digits come
+** from rounding 'y' = 'x' * 10^k, for an exact power of ten. The error
+** of that single float operation is below 10^-9, so it cannot change
+** the rounding unless 'y' is near a tie. Return -1 if 'x' is not
+** handled here.
+*/
+static int fmtgeneral (char *buff, int conv, lua_Number x) {
+  lua_Number ax = l_mathop(fabs)(x);
+  lua_Number y;
+  lua_Unsigned n;
+  char digits[MAXDIGITS];
+  char *end = digits + MAXDIGITS;
+  char *d;
+  char *p = buff;
+  int nd, e, k;
+  if (x == 0) {
+    if (1 / x < 0) *p++ = '-';  /* -0.0 */
+    *p++ = '0';
+    return (int)(p - buff);
   }
-  else {
-    int e;
-    lua_Number m = l_mathop(frexp)(x, &e);  /* 'x' fraction and exponent */
-    int n = 0;  /* character count */
-    if (m < 0) {  /* is number negative? */
-      buff[n++] = '-';  /* add sign */
-      m = -m;  /* make it positive */
+  if (!(ax <= l_floatatt(MAX)))  /* inf or NaN? */
+    return -1;
+  l_mathop(frexp)(ax, &e);  /* 2^(e - 1) <= ax < 2^e */
+  e = (int)l_mathop(floor)((e - 1) * 0.30102999566398119521);
+  /* 'e' is the decimal exponent of 'ax' or one less than it */
+  k = 5 - e;
+  if (k > 22 || k < -21) return -1;
+  y = (k >= 0) ? ax * pow10tab[k] : ax / pow10tab[-k];
+  if (y >= 1e6) {
+    e++; k--;
+    y = (k >= 0) ? ax * pow10tab[k] : ax / pow10tab[-k];
+  }
+  if (l_mathop(fabs)(y - l_mathop(floor)(y) - 0.5) < 1e-6)
+    return -1;  /* near a tie */
+  n = (lua_Unsigned)(y + 0.5);
+  if (n == 1000000) {  /* rounded up to the next power of ten? */
+    n = 100000;
+    e++;
+  }
+  while (n % 10 == 0) n /= 10;  /* '%g' removes trailing zeros */
+  d = udigits(end, n);
+  nd = (int)(end - d);
+  if (x < 0) *p++ = '-';
+  if (e < -4 || e >= 6) {  /* exponential notation */
+    *p++ = *d;
+    if (nd > 1) {
+      *p++ = lua_getlocaledecpoint();
+      memcpy(p, d + 1, nd - 1);
+      p += nd - 1;
     }
-    buff[n++] = '0'; buff[n++] = 'x';  /* add "0x" */
-    m = adddigit(buff, n++, m * (1 << L_NBFD));  /* add first digit */
-    e -= L_NBFD;  /* this digit goes before the radix point */
-    if (m > 0) {  /* more digits? */
-      buff[n++] = lua_getlocaledecpoint();  /* add radix point */
-      do {  /* add as many digits as needed */
-        m = adddigit(buff, n++, m * 16);
-      } while (m > 0);
+    *p++ = (conv == 'g') ? 'e' : 'E';
+    *p++ = (e < 0) ? '-' : '+';
+    if (e < 0) e = -e;
+    *p++ = (char)('0' + e / 10);
+    *p++ = (char)('0' + e % 10);
+  }
+  else if (e >= 0) {  /* integer part has 'e' + 1 digits */
+    int ni = (nd < e + 1) ? nd : e + 1;  /* digits in integer part */
+    memcpy(p, d, ni);
+    memset(p + ni, '0', e + 1 - ni);
+    p += e + 1;
+    if (nd > ni) {
+      *p++ = lua_getlocaledecpoint();
+      memcpy(p, d + ni, nd - ni);
+      p += nd - ni;
+    }
+  }
+  else {  /* 0.000ddd */
+    *p++ = '0';
+    *p++ = lua_getlocaledecpoint();
+    memset(p, '0', -e - 1);
+    memcpy(p - e - 1, d, nd);
+    p += nd - e - 1;
+  }
+  return (int)(p - buff);
+}
+
+#else
+
+#define fmtgeneral(buff,conv,x)	(-1)
+
+#endif
+
+#endif
+
+
+/*
+** Format the values from index 'arg' + 1 on (up to 'top') following
+** the compiled format 'f' of format string 'strfrmt'.
+*/
+static void runformat (lua_State *L, luaL_Buffer *b, const Format *f,
+                       const char *strfrmt, int arg, int top) {
+  int i;
+  for (i = 0; i < f->nitems; i++) {
+    const FmtItem *it = &f->items[i];
+    char *buff;
+    int nb = -1;  /* number of bytes in result (-1 if not formatted) */
+    luaL_addlstring(b, strfrmt + it->init, it->len);
+    if (it->conv == '\0')  /* no conversion? */
+      continue;
+    if (++arg > top)
+      luaL_argerror(L, arg, "no value");
+    switch (it->kind) {
+      case FK_INT: case FK_HEX: {
+        lua_Integer n = luaL_checkinteger(L, arg);
+        buff = luaL_prepbuffsize(b, MAX_ITEM);
+        nb = fmtinteger(buff, it, n);
+        break;
+      }
+      case FK_STR: {
+        size_t l;
+        const char *s;
+        if (it->form[2] == '\0') {  /* no modifiers? */
+          luaL_tolstring(L, arg, NULL);
+          luaL_addvalue(b);  /* keep entire string */
+          continue;
+        }
+        buff = luaL_prepbuffsize(b, MAX_ITEM);
+        s = luaL_tolstring(L, arg, &l);
+        luaL_argcheck(L, l == strlen(s), arg, "string contains zeros");
+        if (l >= 100) {  /* string is too long to be formatted? */
+          luaL_addvalue(b);  /* keep entire string */
+          continue;
+        }
+        nb = padnumber(buff, it, 0, s, (int)l);
+        lua_pop(L, 1);  /* remove result from 'luaL_tolstring' */
+        break;
+      }
+#if l_fastfloat
+      case FK_FIXED: {
+        lua_Number n = luaL_checknumber(L, arg);
+        buff = luaL_prepbuffsize(b, MAX_ITEM);
+        nb = fmtfixed(buff, n, it->prec);
+        break;
+      }
+      case FK_GENERAL: {
+        lua_Number n = luaL_checknumber(L, arg);
+        buff = luaL_prepbuffsize(b, MAX_ITEM);
+        nb = fmtgeneral(buff, it->conv, n);
+        break;
+      }
+#endif
+    }
+    if (nb >= 0)
+      luaL_addsize(b, nb);
+    else {  /* not formatted here; use the specification */
+      char form[MAX_FORMAT];
+      memcpy(form, it->form, sizeof(form));
+      addconversion(L, b, arg, it->conv, form, 1);
+    }
+  }
+}
+
+/* }====================================================== */
+
+
+/*
+** Format the values from index 'arg' on with the format string at
+** index 'arg' into buffer 'b' (which this function initializes).
+*/
+static void strformat (lua_State *L, luaL_Buffer *b, int arg) {
+  int top = lua_gettop(L);
+  size_t sfl;
+  const char *strfrmt = luaL_checklstring(L, arg, &sfl);
+  const char *strfrmt_end = strfrmt+sfl;
+  const Format *f = getfmt(L, arg, strfrmt, sfl);
+  luaL_buffinit(L, b);
+  if (f != NULL) {  /* compiled format? */
+    runformat(L, b, f, strfrmt, arg, top);
+    return;
+  }
+  while (strfrmt < strfrmt_end) {
+    if (*strfrmt != L_ESC)
+      luaL_addchar(b, *strfrmt++);
+    else if (*++strfrmt == L_ESC)
+      luaL_addchar(b, *strfrmt++);  /* %% */
+    else { /* format item */
+      char form[MAX_FORMAT];  /* to store the format ('%...') */
+      if (++arg > top)
+        luaL_argerror(L, arg, "no value");
+      strfrmt = getformat(L, strfrmt, form);
+      addconversion(L, b, arg, uchar(*strfrmt++), form, 0);
     }
-    n += l_sprintf(buff + n, sz - n, "p%+d", e);  /* add exponent */
-    lua_assert(n < sz);
-    return n;
   }
 }
 
 
-static int lua_number2strx (lua_State *L, char *buff, int sz,
-                            const char *fmt, lua_Number x) {
-  int n = num2straux(buff, sz, x);
-  if (fmt[SIZELENMOD] == 'A') {
-    int i;
-    for (i = 0; i < n; i++)
-      buff[i] = toupper(uchar(buff[i]));
-  }
-  else if (l_unlikely(fmt[SIZELENMOD] != 'a'))
-    return luaL_error(L, "modifiers for format '%%a'/'%%A' not implemented");
-  return n;
+static int str_format (lua_State *L) {
+  luaL_Buffer b;
+  strformat(L, &b, 1);
+  luaL_pushresult(&b);
+  return 1;
 }
 
-#endif				/* } */
-
-
-/*
-** Maximum size for items formatted with '%f'. This size is produced
-** by format('%.99f', -maxfloat), and is equal to 99 + 3 ('-', '.',
-** and '\0') + number of decimal digits to represent maxfloat (which
-** is maximum exponent + 1). (99+3+1, adding some extra, 110)
-*/
-#define MAX_ITEMF	(110 + l_floatatt(MAX_10_EXP))
+/* }====================================================== */
 
 
 /*
-** All formats except '%f' do not need that large limit.  The other
-** float formats use exponents, so that they fit in the 99 limit for
-** significant digits; 's' for large strings and 'q' add items directly
-** to the buffer; all integer formats also fit in the 99 limit.  The
-** worst case are floats: they may need 99 significant digits, plus
-** '0x', '-', '.', 'e+XXXX', and '\0'. Adding some extra, 120.
+** {======================================================
+** STRING BUFFERS
+** =======================================================
 */
-#define MAX_ITEM	120
 
 
-/* valid flags in a format specification */
-#if !defined(L_FMTFLAGSF)
+#define STRBUFFER	"string.buffer"
 
-/* valid flags for a, A, e, E, f, F, g, and G conversions */
-#define L_FMTFLAGSF	"-+#0 "
 
-/* valid flags for o, x, and X conversions */
-#define L_FMTFLAGSX	"-#0"
+/*
+** A string buffer keeps its contents in a block from the allocation
+** function, which grows like the block of a 'luaL_Buffer' and is kept
+** across 'reset's, so that a reused buffer does not allocate.
+*/
+typedef struct StrBuffer {
+  char *b;  /* buffer address */
+  size_t size;  /* buffer size */
+  size_t n;  /* number of characters in buffer */
+} StrBuffer;
 
-/* valid flags for d and i conversions */
-#define L_FMTFLAGSI	"-+0 "
 
-/* valid flags for u conversions */
-#define L_FMTFLAGSU	"-0"
+#define checkstrbuffer(L,i)	((StrBuffer *)luaL_checkudata(L, i, STRBUFFER))
 
-/* valid flags for c, p, and s conversions */
-#define L_FMTFLAGSC	"-"
 
-#endif
+static void resizestrbuffer (lua_State *L, StrBuffer *sb, size_t newsize) {
+  void *ud;
+  lua_Alloc allocf = lua_getallocf(L, &ud);
+  void *temp = allocf(ud, sb->b, sb->size, newsize);
+  if (l_unlikely(temp == NULL && newsize > 0))  /* allocation error? */
+    luaL_error(L, "not enough memory");
+  sb->b = (char *)temp;
+  sb->size = newsize;
+}
 
 
 /*
-** Maximum size of each format specification (such as "%-099.99d"):
-** Initial '%', flags (up to 5), width (2), period, precision (2),
-** length modifier (8), conversion specifier, and final '\0', plus some
-** extra.
+** Returns a pointer to a free area with at least 'sz' bytes in buffer
+** 'sb'. As in 'luaL_prepbuffsize', a buffer at least doubles its size
+** when it grows.
 */
-#define MAX_FORMAT	32
+static char *prepstrbuffer (lua_State *L, StrBuffer *sb, size_t sz) {
+  if (sb->size - sb->n < sz) {  /* not enough space? */
+    size_t newsize = (sb->size > 0) ? sb->size * 2 : LUAL_BUFFERSIZE;
+    if (l_unlikely(MAX_SIZET - sz < sb->n))  /* overflow in (n + sz)? */
+      luaL_error(L, "buffer too large");
+    if (newsize < sb->n + sz)  /* not big enough? */
+      newsize = sb->n + sz;
+    resizestrbuffer(L, sb, newsize);
+  }
+  return sb->b + sb->n;
+}
 
 
-static void addquoted (luaL_Buffer *b, const char *s, size_t len) {
-  luaL_addchar(b, '"');
-  while (len--) {
-    if (*s == '"' || *s == '\\' || *s == '\n') {
-      luaL_addchar(b, '\\');
-      luaL_addchar(b, *s);
-    }
-    else if (iscntrl(uchar(*s))) {
-      char buff[10];
-      if (!isdigit(uchar(*(s+1))))
-        l_sprintf(buff, sizeof(buff), "\\%d", (int)uchar(*s));
-      else
-        l_sprintf(buff, sizeof(buff), "\\%03d", (int)uchar(*s));
-      luaL_addstring(b, buff);
-    }
-    else
-      luaL_addchar(b, *s);
-    s++;
+static void addstrbuffer (lua_State *L, StrBuffer *sb, const char *s,
+                                                       size_t l) {
+  if (l > 0) {  /* avoid 'memcpy' when 's' can be NULL */
+    memcpy(prepstrbuffer(L, sb, l), s, l * sizeof(char));
+    sb->n += l;
   }
-  luaL_addchar(b, '"');
 }
 
 
-/*
-** Serialize a floating-point number in such a way that it can be
-** scanned back by Lua. Use hexadecimal format for "common" numbers
-** (to preserve precision); inf, -inf, and NaN are handled separately.
-** (NaN cannot be expressed as a numeral, so we write '(0/0)' for it.)
-*/
-static int quotefloat (lua_State *L, char *buff, lua_Number n) {
-  const char *s;  /* for the fixed representations */
-  if (n == (lua_Number)HUGE_VAL)  /* inf? */
-    s = "1e9999";
-  else if (n == -(lua_Number)HUGE_VAL)  /* -inf? */
-    s = "-1e9999";
-  else if (n != n)  /* NaN? */
-    s = "(0/0)";
-  else {  /* format number as hexadecimal */
-    int  nb = lua_number2strx(L, buff, MAX_ITEM,
-                                 "%" LUA_NUMBER_FRMLEN "a", n);
-    /* ensures that 'buff' string uses a dot as the radix character */
-    if (memchr(buff, '.', nb) == NULL) {  /* no dot? */
-      char point = lua_getlocaledecpoint();  /* try locale point */
-      char *ppoint = (char *)memchr(buff, point, nb);
-      if (ppoint) *ppoint = '.';  /* change it to a dot */
-    }
-    return nb;
-  }
-  /* for the fixed representations */
-  return l_sprintf(buff, MAX_ITEM, "%s", s);
+static int buff_new (lua_State *L) {
+  lua_Integer size = luaL_optinteger(L, 1, 0);
+  StrBuffer *sb;
+  luaL_argcheck(L, 0 <= size && (lua_Unsigned)size < MAXSIZE, 1,
+                   "invalid size");
+  sb = (StrBuffer *)lua_newuserdatauv(L, sizeof(StrBuffer), 0);
+  sb->b = NULL;
+  sb->size = sb->n = 0;
+  luaL_setmetatable(L, STRBUFFER);
+  if (size > 0)
+    resizestrbuffer(L, sb, (size_t)size);
+  return 1;
 }
 
 
-static void addliteral (lua_State *L, luaL_Buffer *b, int arg) {
-  switch (lua_type(L, arg)) {
-    case LUA_TSTRING: {
-      size_t len;
-      const char *s = lua_tolstring(L, arg, &len);
-      addquoted(b, s, len);
-      break;
-    }
-    case LUA_TNUMBER: {
-      char *buff = luaL_prepbuffsize(b, MAX_ITEM);
-      int nb;
-      if (!lua_isinteger(L, arg))  /* float? */
-        nb = quotefloat(L, buff, lua_tonumber(L, arg));
-      else {  /* integers */
-        lua_Integer n = lua_tointeger(L, arg);
-        const char *format = (n == LUA_MININTEGER)  /* corner case? */
-                           ? "0x%" LUA_INTEGER_FRMLEN "x"  /* use hex */
-                           : LUA_INTEGER_FMT;  /* else use default format */
-        nb = l_sprintf(buff, MAX_ITEM, format, (LUAI_UACINT)n);
-      }
-      luaL_addsize(b, nb);
-      break;
+/*
+** Append the strings (or numbers, or other string buffers) given as
+** arguments.
+*/
+static int buff_put (lua_State *L) {
+  StrBuffer *sb = checkstrbuffer(L, 1);
+  int top = lua_gettop(L);
+  int i;
+  for (i = 2; i <= top; i++) {
+    StrBuffer *other;
+    if (lua_isinteger(L, i)) {  /* optimization: write it directly */
+      char *buff = prepstrbuffer(L, sb, MAX_ITEM);
+      sb->n += l_sprintf(buff, MAX_ITEM, LUA_INTEGER_FMT,
+                                         (LUAI_UACINT)lua_tointeger(L, i));
     }
-    case LUA_TNIL: case LUA_TBOOLEAN: {
-      luaL_tolstring(L, arg, NULL);
-      luaL_addvalue(b);
-      break;
+    else if ((other = (StrBuffer *)luaL_testudata(L, i, STRBUFFER)) != NULL) {
+      /* 'sb' may be 'other', so reserve space before taking its address */
+      prepstrbuffer(L, sb, other->n);
+      addstrbuffer(L, sb, other->b, other->n);
     }
-    default: {
-      luaL_argerror(L, arg, "value has no literal form");
+    else {
+      size_t l;
+      const char *s = luaL_checklstring(L, i, &l);
+      addstrbuffer(L, sb, s, l);
     }
   }
+  lua_settop(L, 1);
+  return 1;  /* return buffer */
 }
 
 
-static const char *get2digits (const char *s) {
-  if (isdigit(uchar(*s))) {
-    s++;
-    if (isdigit(uchar(*s))) s++;  /* (2 digits at most) */
-  }
-  return s;
+static int buff_putf (lua_State *L) {
+  StrBuffer *sb = checkstrbuffer(L, 1);
+  luaL_Buffer b;
+  strformat(L, &b, 2);
+  addstrbuffer(L, sb, luaL_buffaddr(&b), luaL_bufflen(&b));
+  lua_settop(L, 1);  /* also closes the box of 'b', if any */
+  return 1;  /* return buffer */
 }
 
 
 /*
-** Check whether a conversion specification is valid. When called,
-** first character in 'form' must be '%' and last character must
-** be a valid conversion specifier. 'flags' are the accepted flags;
-** 'precision' signals whether to accept a precision.
+** Make sure the buffer has room for 'n' more bytes.
 */
-static void checkformat (lua_State *L, const char *form, const char *flags,
-                                       int precision) {
-  const char *spec = form + 1;  /* skip '%' */
-  spec += strspn(spec, flags);  /* skip flags */
-  if (*spec != '0') {  /* a width cannot start with '0' */
-    spec = get2digits(spec);  /* skip width */
-    if (*spec == '.' && precision) {
-      spec++;
-      spec = get2digits(spec);  /* skip precision */
-    }
-  }
-  if (!isalpha(uchar(*spec)))  /* did not go to the end? */
-    luaL_error(L, "invalid conversion specification: '%s'", form);
+static int buff_reserve (lua_State *L) {
+  StrBuffer *sb = checkstrbuffer(L, 1);
+  lua_Integer sz = luaL_checkinteger(L, 2);
+  luaL_argcheck(L, 0 <= sz && (lua_Unsigned)sz < MAXSIZE, 2,
+                   "invalid size");
+  prepstrbuffer(L, sb, (size_t)sz);
+  lua_settop(L, 1);
+  return 1;  /* return buffer */
 }
 
 
-/*
-** Get a conversion specification and copy it to 'form'.
-** Return the address of its last character.
-*/
-static const char *getformat (lua_State *L, const char *strfrmt,
-                                            char *form) {
-  /* spans flags, width, and precision ('0' is included as a flag) */
-  size_t len = strspn(strfrmt, L_FMTFLAGSF "123456789.");
-  len++;  /* adds following character (should be the specifier) */
-  /* still needs space for '%', '\0', plus a length modifier */
-  if (len >= MAX_FORMAT - 10)
-    luaL_error(L, "invalid format (too long)");
-  *(form++) = '%';
-  memcpy(form, strfrmt, len * sizeof(char));
-  *(form + len) = '\0';
-  return strfrmt + len - 1;
+static int buff_reset (lua_State *L) {
+  StrBuffer *sb = checkstrbuffer(L, 1);
+  sb->n = 0;  /* keep the memory for reuse */
+  lua_settop(L, 1);
+  return 1;  /* return buffer */
+}
+
+
+static int buff_tostring (lua_State *L) {
+  StrBuffer *sb = checkstrbuffer(L, 1);
+  lua_pushlstring(L, sb->b, sb->n);
+  return 1;
+}
+
+
+static int buff_len (lua_State *L) {
+  StrBuffer *sb = checkstrbuffer(L, 1);
+  lua_pushinteger(L, (lua_Integer)sb->n);
+  return 1;
 }
 
 
 /*
-** add length modifier into formats
+** Write the contents of the buffer to a file, without creating a Lua
+** string. Returns the file, as 'file:write' does.
 */
-static void addlenmod (char *form, const char *lenmod) {
-  size_t l = strlen(form);
-  size_t lm = strlen(lenmod);
-  char spec = form[l - 1];
-  strcpy(form + l - 1, lenmod);
-  form[l + lm - 1] = spec;
-  form[l + lm] = '\0';
+static int buff_writeto (lua_State *L) {
+  StrBuffer *sb = checkstrbuffer(L, 1);
+  luaL_Stream *p = (luaL_Stream *)luaL_checkudata(L, 2, LUA_FILEHANDLE);
+  if (l_unlikely(p->closef == NULL))  /* closed file? */
+    return luaL_error(L, "attempt to use a closed file");
+  if (l_likely(fwrite(sb->b, sizeof(char), sb->n, p->f) == sb->n)) {
+    lua_settop(L, 2);
+    return 1;  /* return file */
+  }
+  return luaL_fileresult(L, 0, NULL);
 }
 
 
-static int str_format (lua_State *L) {
-  int top = lua_gettop(L);
-  int arg = 1;
-  size_t sfl;
-  const char *strfrmt = luaL_checklstring(L, arg, &sfl);
-  const char *strfrmt_end = strfrmt+sfl;
-  const char *flags;
-  luaL_Buffer b;
-  luaL_buffinit(L, &b);
-  while (strfrmt < strfrmt_end) {
-    if (*strfrmt != L_ESC)
-      luaL_addchar(&b, *strfrmt++);
-    else if (*++strfrmt == L_ESC)
-      luaL_addchar(&b, *strfrmt++);  /* %% */
-    else { /* format item */
-      char form[MAX_FORMAT];  /* to store the format ('%...') */
-      int maxitem = MAX_ITEM;  /* maximum length for the result */
-      char *buff = luaL_prepbuffsize(&b, maxitem);  /* to put result */
-      int nb = 0;  /* number of bytes in result */
-      if (++arg > top)
-        return luaL_argerror(L, arg, "no value");
-      strfrmt = getformat(L, strfrmt, form);
-      switch (*strfrmt++) {
-        case 'c': {
-          checkformat(L, form, L_FMTFLAGSC, 0);
-          nb = l_sprintf(buff, maxitem, form, (int)luaL_checkinteger(L, arg));
-          break;
-        }
-        case 'd': case 'i':
-          flags = L_FMTFLAGSI;
-          goto intcase;
-        case 'u':
-          flags = L_FMTFLAGSU;
-          goto intcase;
-        case 'o': case 'x': case 'X':
-          flags = L_FMTFLAGSX;
-         intcase: {
-          lua_Integer n = luaL_checkinteger(L, arg);
-          checkformat(L, form, flags, 1);
-          addlenmod(form, LUA_INTEGER_FRMLEN);
-          nb = l_sprintf(buff, maxitem, form, (LUAI_UACINT)n);
-          break;
-        }
-        case 'a': case 'A':
-          checkformat(L, form, L_FMTFLAGSF, 1);
-          addlenmod(form, LUA_NUMBER_FRMLEN);
-          nb = lua_number2strx(L, buff, maxitem, form,
-                                  luaL_checknumber(L, arg));
-          break;
-        case 'f':
-          maxitem = MAX_ITEMF;  /* extra space for '%f' */
-          buff = luaL_prepbuffsize(&b, maxitem);
-          /* FALLTHROUGH */
-        case 'e': case 'E': case 'g': case 'G': {
-          lua_Number n = luaL_checknumber(L, arg);
-          checkformat(L, form, L_FMTFLAGSF, 1);
-          addlenmod(form, LUA_NUMBER_FRMLEN);
-          nb = l_sprintf(buff, maxitem, form, (LUAI_UACNUMBER)n);
-          break;
-        }
-        case 'p': {
-          const void *p = lua_topointer(L, arg);
-          checkformat(L, form, L_FMTFLAGSC, 0);
-          if (p == NULL) {  /* avoid calling 'printf' with argument NULL */
-            p = "(null)";  /* result */
-            form[strlen(form) - 1] = 's';  /* format it as a string */
-          }
-          nb = l_sprintf(buff, maxitem, form, p);
-          break;
-        }
-        case 'q': {
-          if (form[2] != '\0')  /* modifiers? */
-            return luaL_error(L, "specifier '%%q' cannot have modifiers");
-          addliteral(L, &b, arg);
-          break;
-        }
-        case 's': {
-          size_t l;
-          const char *s = luaL_tolstring(L, arg, &l);
-          if (form[2] == '\0')  /* no modifiers? */
-            luaL_addvalue(&b);  /* keep entire string */
-          else {
-            luaL_argcheck(L, l == strlen(s), arg, "string contains zeros");
-            checkformat(L, form, L_FMTFLAGSC, 1);
-            if (strchr(form, '.') == NULL && l >= 100) {
-              /* no precision and string is too long to be formatted */
-              luaL_addvalue(&b);  /* keep entire string */
-            }
-            else {  /* format the string into 'buff' */
-              nb = l_sprintf(buff, maxitem, form, s);
-              lua_pop(L, 1);  /* remove result from 'luaL_tolstring' */
-            }
-          }
-          break;
-        }
-        default: {  /* also treat cases 'pnLlh' */
-          return luaL_error(L, "invalid conversion '%s' to 'format'", form);
-        }
-      }
-      lua_assert(nb < maxitem);
-      luaL_addsize(&b, nb);
-    }
-  }
-  luaL_pushresult(&b);
-  return 1;
+static int buff_gc (lua_State *L) {
+  StrBuffer *sb = checkstrbuffer(L, 1);
+  resizestrbuffer(L, sb, 0);
+  sb->n = 0;
+  return 0;
+}
+
+
+static const luaL_Reg buffmeth[] = {
+  {"put", buff_put},
+  {"putf", buff_putf},
+  {"reserve", buff_reserve},
+  {"reset", buff_reset},
+  {"tostring", buff_tostring},
+  {"writeto", buff_writeto},
+  {NULL, NULL}
+};
+
+
+static const luaL_Reg buffmetameth[] = {
+  {"__index", NULL},  /* place holder */
+  {"__tostring", buff_tostring},
+  {"__len", buff_len},
+  {"__gc", buff_gc},
+  {"__close", buff_gc},
+  {NULL, NULL}
+};
+
+
+/*
+** Create the metatable for string buffers. The two caches on the top
+** of the stack are shared as upvalues by its methods.
+*/
+static void createbuffmeta (lua_State *L) {
+  luaL_newmetatable(L, STRBUFFER);  /* metatable for string buffers */
+  luaL_setfuncs(L, buffmetameth, 0);  /* add metamethods to new metatable */
+  luaL_newlibtable(L, buffmeth);  /* create method table */
+  lua_pushvalue(L, -4);  /* pattern cache */
+  lua_pushvalue(L, -4);  /* format cache */
+  luaL_setfuncs(L, buffmeth, 2);  /* add string buffer methods */
+  lua_setfield(L, -2, "__index");  /* metatable.__index = method table */
+  lua_pop(L, 1);  /* pop metatable */
 }
 
 /* }====================================================== */
@@ -1828,6 +3310,7 @@ static int str_unpack (lua_State *L) {
 
 
 static const luaL_Reg strlib[] = {
+  {"buffer", buff_new},
   {"byte", str_byte},
   {"char", str_char},
   {"dump", str_dump},
@@ -1863,11 +3346,28 @@ static void createmetatable (lua_State *L) {
 }
 
 
+/*
+** Create a cache table for compiled patterns or formats. Its values are
+** weak, so that compiled forms not in use are collected.
+*/
+static void createcache (lua_State *L) {
+  lua_newtable(L);
+  lua_createtable(L, 0, 1);  /* its metatable */
+  lua_pushliteral(L, "v");
+  lua_setfield(L, -2, "__mode");  /* metatable.__mode = "v" */
+  lua_setmetatable(L, -2);
+}
+
+
 /*
 ** Open string library
 */
 LUAMOD_API int luaopen_string (lua_State *L) {
-  luaL_newlib(L, strlib);
+  luaL_newlibtable(L, strlib);
+  createcache(L);  /* cache of compiled patterns */
+  createcache(L);  /* cache of compiled formats */
+  createbuffmeta(L);
+  luaL_setfuncs(L, strlib, 2);  /* caches are shared upvalues */
   createmetatable(L);
   return 1;
 }
@@ -68,6 +68,10 @@
 #define MAXHSIZE	luaM_limitN(1u << MAXHBITS, Node)
 
 
+/* saturation value of the count of traversals in 'Table.travs' */
+#define MAXTRAVS	255
+
+
 /*
 ** When the original hash value is good, hashing by a power of 2
 ** avoids the cost of '%'.
@@ -344,14 +348,24 @@ static unsigned int findindex (lua_State *L, Table *t, TValue *key,
 }
 
 
-int luaH_next (lua_State *L, Table *t, StkId key) {
-  unsigned int asize = luaH_realasize(t);
-  unsigned int i = findindex(L, t, s2v(key), asize);  /* find original key */
+/*
+** Put in 'key' and 'key + 1' the first non-empty entry at or after
+** index 'i' (numbered as in 'findindex') and return the index of that
+** entry's key, or return 0 if there are no more elements.
+** 't->travs' counts the traversals that entered the hash part and did
+** not reach its end, so that 'luaH_compact' does not rehash the table
+** under them. Traversals that are abandoned are never discounted; the
+** count sticks at its maximum, and a rehash (which already ends any
+** traversal) resets it.
+*/
+static unsigned int nextfrom (lua_State *L, Table *t, StkId key,
+                              unsigned int i, unsigned int asize) {
+  int inhash = (i > asize);  /* was previous key in the hash part? */
   for (; i < asize; i++) {  /* try first array part */
     if (!isempty(&t->array[i])) {  /* a non-empty entry? */
       setivalue(s2v(key), i + 1);
       setobj2s(L, key + 1, &t->array[i]);
-      return 1;
+      return i + 1;
     }
   }
   for (i -= asize; cast_int(i) < sizenode(t); i++) {  /* hash part */
@@ -359,13 +373,49 @@ int luaH_next (lua_State *L, Table *t, StkId key) {
       Node *n = gnode(t, i);
       getnodekey(L, s2v(key), n);
       setobj2s(L, key + 1, gval(n));
-      return 1;
+      if (!inhash && t->travs < MAXTRAVS)  /* entering the hash part? */
+        t->travs++;
+      return (i + 1) + asize;
     }
   }
+  if (inhash && t->travs > 0 && t->travs < MAXTRAVS)
+    t->travs--;  /* a traversal through the hash part ended */
   return 0;  /* no more elements */
 }
 
 
+int luaH_next (lua_State *L, Table *t, StkId key) {
+  unsigned int asize = luaH_realasize(t);
+  unsigned int i = findindex(L, t, s2v(key), asize);  /* find original key */
+  return nextfrom(L, t, key, i, asize) != 0;
+}
+
+
+/*
+** Traversal step for callers that remember where they are: 'i' is the
+** index returned by the previous step (0 for the first one). When it
+** still matches 'key', the search for the key is skipped; otherwise
+** (e.g., the table was rehashed) the key is searched as in 'luaH_next'.
+** Returns the index of the new key, or 0 if there are no more elements.
+*/
+int luaH_nextat (lua_State *L, Table *t, StkId key, int i) {
+  unsigned int asize = luaH_realasize(t);
+  const TValue *k = s2v(key);
+  int valid;
+  if (i == 0)
+    valid = ttisnil(k);
+  else if (cast_uint(i) <= asize)
+    valid = (ttisinteger(k) && l_castS2U(ivalue(k)) == cast_uint(i));
+  else {
+    int j = i - cast_int(asize) - 1;  /* node index */
+    valid = (j < sizenode(t) && equalkey(k, gnode(t, j), 1));
+  }
+  if (!valid)
+    i = cast_int(findindex(L, t, s2v(key), asize));
+  return cast_int(nextfrom(L, t, key, cast_uint(i), asize));
+}
+
+
 static void freehash (lua_State *L, Table *t) {
   if (!isdummy(t))
     luaM_freearray(L, t->node, cast_sizet(sizenode(t)));
@@ -554,6 +604,8 @@ void luaH_resize (lua_State *L, Table *t, unsigned int newasize,
   Table newt;  /* to keep the new hash part */
   unsigned int oldasize = setlimittosize(t);
   TValue *newarray;
+  invalidatechains(L, t);  /* entries will move */
+  t->travs = 0;  /* traversals cannot go on after a rehash */
   /* create new hash part with appropriate size into 'newt' */
   setnodevector(L, &newt, nhsize);
   if (newasize < oldasize) {  /* will array shrink? */
@@ -616,6 +668,29 @@ static void rehash (lua_State *L, Table *t, const TValue *ek) {
 
 
 
+/*
+** Shrink the hash part of a table to the size needed by its live
+** entries (if that is smaller than its current size). The array part
+** is kept as it is. A rehash changes the order of a traversal and
+** drops the keys it removed, which it may still pass to 'next', so
+** tables that some traversal may be going through are left alone.
+*/
+void luaH_compact (lua_State *L, Table *t) {
+  unsigned int size = sizenode(t);
+  unsigned int live = 0;
+  unsigned int i;
+  if (isdummy(t) || t->travs > 0)
+    return;  /* no hash part or (maybe) in a traversal */
+  for (i = 0; i < size; i++) {
+    if (!isempty(gval(gnode(t, i))))
+      live++;
+  }
+  if (live == 0 || luaO_ceillog2(live) < t->lsizenode)
+    luaH_resize(L, t, luaH_realasize(t), live);
+}
+
+
+
 /*
 ** }=============================================================
 */
@@ -625,7 +700,8 @@ Table *luaH_new (lua_State *L) {
   GCObject *o = luaC_newobj(L, LUA_VTABLE, sizeof(Table));
   Table *t = gco2t(o);
   t->metatable = NULL;
-  t->flags = cast_byte(maskflags);  /* table has no metamethod fields */
+  t->flags = maskflags;  /* table has no metamethod fields */
+  t->travs = 0;
   t->array = NULL;
   t->alimit = 0;
   setnodevector(L, t, 0);
@@ -634,12 +710,27 @@ Table *luaH_new (lua_State *L) {
 
 
 void luaH_free (lua_State *L, Table *t) {
+  invalidatechains(L, t);
   freehash(L, t);
   luaM_freearray(L, t->array, luaH_realasize(t));
   luaM_free(L, t);
 }
 
 
+/*
+** Invalidate all entries in the cache of '__index' chains
+*/
+void luaH_newepoch (lua_State *L) {
+  global_State *g = G(L);
+  if (++g->chainepoch == 0) {  /* wrapped around? */
+    int i;
+    for (i = 0; i < LUAI_CHAINCACHE; i++)  /* old entries could match */
+      g->chaincache[i].epoch = 0;
+    g->chainepoch = 1;
+  }
+}
+
+
 static Node *getfreepos (Table *t) {
   if (!isdummy(t)) {
     while (t->lastfree > t->node) {
@@ -808,6 +899,7 @@ const TValue *luaH_get (Table *t, const TValue *key) {
 */
 void luaH_finishset (lua_State *L, Table *t, const TValue *key,
                                    const TValue *slot, TValue *value) {
+  invalidatechains(L, t);
   if (isabstkey(slot))
     luaH_newkey(L, t, key, value);
   else
@@ -827,6 +919,7 @@ void luaH_set (lua_State *L, Table *t, const TValue *key, TValue *value) {
 
 void luaH_setint (lua_State *L, Table *t, lua_Integer key, TValue *value) {
   const TValue *p = luaH_getint(t, key);
+  invalidatechains(L, t);
   if (isabstkey(p)) {
     TValue k;
     setivalue(&k, key);
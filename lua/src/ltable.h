@@ -23,6 +23,17 @@
 #define invalidateTMcache(t)	((t)->flags &= ~maskflags)
 
 
+/*
+** Bit set in the flags of tables that are (or were) part of a chain of
+** '__index' tables in the cache of 'lvm.c', and in their metatables.
+** Any change to such a table, or its collection, must invalidate that
+** cache.
+*/
+#define BITCHAIN		(1u << 30)
+
+#define invalidatechains(L,t)  	{ if (l_unlikely((t)->flags & BITCHAIN)) luaH_newepoch(L); }
+
+
 /* true when 't' is using 'dummynode' as its hash part */
 #define isdummy(t)		((t)->lastfree == NULL)
 
@@ -51,8 +62,11 @@ LUAI_FUNC Table *luaH_new (lua_State *L);
 LUAI_FUNC void luaH_resize (lua_State *L, Table *t, unsigned int nasize,
                                                     unsigned int nhsize);
 LUAI_FUNC void luaH_resizearray (lua_State *L, Table *t, unsigned int nasize);
+LUAI_FUNC void luaH_compact (lua_State *L, Table *t);
 LUAI_FUNC void luaH_free (lua_State *L, Table *t);
+LUAI_FUNC void luaH_newepoch (lua_State *L);
 LUAI_FUNC int luaH_next (lua_State *L, Table *t, StkId key);
+LUAI_FUNC int luaH_nextat (lua_State *L, Table *t, StkId key, int i);
 LUAI_FUNC lua_Unsigned luaH_getn (Table *t);
 LUAI_FUNC unsigned int luaH_realasize (const Table *t);
 
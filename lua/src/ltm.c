@@ -49,19 +49,33 @@ void luaT_init (lua_State *L) {
   for (i=0; i<TM_N; i++) {
     G(L)->tmname[i] = luaS_new(L, luaT_eventname[i]);
     luaC_fix(L, obj2gco(G(L)->tmname[i]));  /* never collect these names */
+    G(L)->tmhint[i] = 0;
   }
 }
 
 
 /*
 ** function to be used with macro "fasttm": optimized for absence of
-** tag methods
+** tag methods. When present, a tag method is first looked for in the
+** node slot where it was found the last time, in any metatable:
+** metatables built alike (e.g., by the same constructor) keep their
+** fields in the same slots. ('hint' points to that slot.)
 */
-const TValue *luaT_gettm (Table *events, TMS event, TString *ename) {
-  const TValue *tm = luaH_getshortstr(events, ename);
-  lua_assert(event <= TM_EQ);
+const TValue *luaT_gettm (Table *events, TMS event, TString *ename,
+                                                    unsigned int *hint) {
+  unsigned int slot = *hint;
+  const TValue *tm;
+  if (slot < cast_uint(sizenode(events)) &&
+      keyisshrstr(gnode(events, slot)) &&
+      keystrval(gnode(events, slot)) == ename)
+    tm = gval(gnode(events, slot));  /* hint is right */
+  else {
+    tm = luaH_getshortstr(events, ename);
+    if (!isabstkey(tm))  /* found the key? */
+      *hint = cast_uint(nodefromval(tm) - gnode(events, 0));
+  }
   if (notm(tm)) {  /* no tag method? */
-    events->flags |= cast_byte(1u<<event);  /* cache this fact */
+    events->flags |= 1u<<event;  /* cache this fact */
     return NULL;
   }
   else return tm;
@@ -70,6 +84,7 @@ const TValue *luaT_gettm (Table *events, TMS event, TString *ename) {
 
 const TValue *luaT_gettmbyobj (lua_State *L, const TValue *o, TMS event) {
   Table *mt;
+  const TValue *tm;
   switch (ttype(o)) {
     case LUA_TTABLE:
       mt = hvalue(o)->metatable;
@@ -80,7 +95,8 @@ const TValue *luaT_gettmbyobj (lua_State *L, const TValue *o, TMS event) {
     default:
       mt = G(L)->mt[ttype(o)];
   }
-  return (mt ? luaH_getshortstr(mt, G(L)->tmname[event]) : &G(L)->nilvalue);
+  tm = fasttm(L, mt, event);
+  return (tm ? tm : &G(L)->nilvalue);
 }
 
 
@@ -93,8 +109,10 @@ const char *luaT_objtypename (lua_State *L, const TValue *o) {
   if ((ttistable(o) && (mt = hvalue(o)->metatable) != NULL) ||
       (ttisfulluserdata(o) && (mt = uvalue(o)->metatable) != NULL)) {
     const TValue *name = luaH_getshortstr(mt, luaS_new(L, "__name"));
-    if (ttisstring(name))  /* is '__name' a string? */
+    if (ttisstring(name)) {  /* is '__name' a string? */
+      luaS_seal(L, tsvalue(name));
       return getstr(tsvalue(name));  /* use it as type name */
+    }
   }
   return ttypename(ttype(o));  /* else use standard type name */
 }
@@ -269,3 +287,50 @@ void luaT_getvarargs (lua_State *L, CallInfo *ci, StkId where, int wanted) {
     setnilvalue(s2v(where + i));
 }
 
+
+/*
+** Do 'select(sel, ...)' over the extra arguments of 'ci' without
+** copying them first, putting the results in 'where' as 'getvarargs'
+** does. Return false (doing nothing) unless 'sel' is a string starting
+** with '#' or an integer in range; other cases are left to 'select'.
+*/
+int luaT_selectvarargs (lua_State *L, CallInfo *ci, StkId where,
+                        const TValue *sel, int wanted) {
+  int i;
+  int nextra = ci->u.l.nextraargs;
+  int first;  /* first extra argument in the results */
+  if (ttisstring(sel) && getstr(tsvalue(sel))[0] == '#') {
+    if (wanted < 0) {
+      wanted = 1;
+      L->top = where + 1;
+    }
+    if (wanted > 0)
+      setivalue(s2v(where), nextra);
+    for (i = 1; i < wanted; i++)
+      setnilvalue(s2v(where + i));
+    return 1;
+  }
+  else if (ttisinteger(sel)) {
+    lua_Integer n = ivalue(sel);
+    if (n < 0)
+      n += nextra + 1;  /* count from the end */
+    else if (n > nextra + 1)
+      n = nextra + 1;
+    if (n < 1)
+      return 0;  /* let 'select' raise the error */
+    first = cast_int(n) - 1;
+  }
+  else
+    return 0;
+  if (wanted < 0) {
+    wanted = nextra - first;
+    checkstackGCp(L, wanted, where);  /* ensure stack space */
+    L->top = where + wanted;  /* next instruction will need top */
+  }
+  for (i = 0; i < wanted && first + i < nextra; i++)
+    setobjs2s(L, where + i, ci->func - nextra + first + i);
+  for (; i < wanted; i++)
+    setnilvalue(s2v(where + i));
+  return 1;
+}
+
@@ -21,7 +21,7 @@ typedef enum {
   TM_GC,
   TM_MODE,
   TM_LEN,
-  TM_EQ,  /* last tag method with fast access */
+  TM_EQ,
   TM_ADD,
   TM_SUB,
   TM_MUL,
@@ -46,12 +46,12 @@ typedef enum {
 
 
 /*
-** Mask with 1 in all fast-access methods. A 1 in any of these bits
-** in the flag of a (meta)table means the metatable does not have the
-** corresponding metamethod field. (Bit 7 of the flag is used for
-** 'isrealasize'.)
+** Mask with 1 in all tag methods, which all have fast access. A 1 in
+** any of these bits in the flag of a (meta)table means the metatable
+** does not have the corresponding metamethod field. (Bit 31 of the
+** flag is used for 'isrealasize'.)
 */
-#define maskflags	(~(~0u << (TM_EQ + 1)))
+#define maskflags	(~(~0u << TM_N))
 
 
 /*
@@ -62,7 +62,8 @@ typedef enum {
 
 
 #define gfasttm(g,et,e) ((et) == NULL ? NULL : \
-  ((et)->flags & (1u<<(e))) ? NULL : luaT_gettm(et, e, (g)->tmname[e]))
+  ((et)->flags & (1u<<(e))) ? NULL : \
+    luaT_gettm(et, e, (g)->tmname[e], &(g)->tmhint[e]))
 
 #define fasttm(l,et,e)	gfasttm(G(l), et, e)
 
@@ -73,7 +74,8 @@ LUAI_DDEC(const char *const luaT_typenames_[LUA_TOTALTYPES];)
 
 LUAI_FUNC const char *luaT_objtypename (lua_State *L, const TValue *o);
 
-LUAI_FUNC const TValue *luaT_gettm (Table *events, TMS event, TString *ename);
+LUAI_FUNC const TValue *luaT_gettm (Table *events, TMS event, TString *ename,
+                                                    unsigned int *hint);
 LUAI_FUNC const TValue *luaT_gettmbyobj (lua_State *L, const TValue *o,
                                                        TMS event);
 LUAI_FUNC void luaT_init (lua_State *L);
@@ -98,6 +100,8 @@ LUAI_FUNC void luaT_adjustvarargs (lua_State *L, int nfixparams,
                                    struct CallInfo *ci, const Proto *p);
 LUAI_FUNC void luaT_getvarargs (lua_State *L, struct CallInfo *ci,
                                               StkId where, int wanted);
+LUAI_FUNC int luaT_selectvarargs (lua_State *L, struct CallInfo *ci,
+                                  StkId where, const TValue *sel, int wanted);
 
 
 #endif
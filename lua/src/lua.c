@@ -82,7 +82,7 @@ static void laction (int i) {
 
 static void print_usage (const char *badoption) {
   lua_writestringerror("%s: ", progname);
-  if (badoption[1] == 'e' || badoption[1] == 'l')
+  if (badoption[1] == 'e' || badoption[1] == 'l' || badoption[1] == 'j')
     lua_writestringerror("'%s' needs argument\n", badoption);
   else
     lua_writestringerror("unrecognized option '%s'\n", badoption);
@@ -91,6 +91,7 @@ static void print_usage (const char *badoption) {
   "Available options are:\n"
   "  -e stat   execute string 'stat'\n"
   "  -i        enter interactive mode after executing 'script'\n"
+  "  -j mode   set native compiler mode ('off', 'on' or 'all')\n"
   "  -l mod    require library 'mod' into global 'mod'\n"
   "  -l g=mod  require library 'mod' into global 'g'\n"
   "  -v        show version information\n"
@@ -305,7 +306,7 @@ static int collectargs (char **argv, int *first) {
         break;
       case 'e':
         args |= has_e;  /* FALLTHROUGH */
-      case 'l':  /* both options need an argument */
+      case 'l':  case 'j':  /* these options need an argument */
         if (argv[i][2] == '\0') {  /* no concatenated argument? */
           i++;  /* try next 'argv' */
           if (argv[i] == NULL || argv[i][0] == '-')
@@ -323,7 +324,7 @@ static int collectargs (char **argv, int *first) {
 
 /*
 ** Processes options 'e' and 'l', which involve running Lua code, and
-** 'W', which also affects the state.
+** 'j' and 'W', which also affect the state.
 ** Returns 0 if some code raises an error.
 */
 static int runargs (lua_State *L, char **argv, int n) {
@@ -343,6 +344,21 @@ static int runargs (lua_State *L, char **argv, int n) {
         if (status != LUA_OK) return 0;
         break;
       }
+      case 'j': {
+        static const char *const modes[] = {"off", "on", "all", NULL};
+        char *extra = argv[i] + 2;
+        int mode;
+        if (*extra == '\0') extra = argv[++i];
+        lua_assert(extra != NULL);
+        for (mode = 0; modes[mode] != NULL; mode++)
+          if (strcmp(extra, modes[mode]) == 0) break;
+        if (modes[mode] == NULL) {
+          l_message(progname, "invalid compiler mode");
+          return 0;
+        }
+        lua_jitmode(L, mode);  /* ignored if there is no compiler */
+        break;
+      }
       case 'W':
         lua_warning(L, "@on", 0);  /* warnings on */
         break;
@@ -80,6 +80,10 @@ typedef struct lua_State lua_State;
 #define LUA_MINSTACK	20
 
 
+/* size of the buffer for 'lua_numbertocstring' */
+#define LUA_N2SBUFFSZ	64
+
+
 /* predefined values in the registry */
 #define LUA_RIDX_MAINTHREAD	1
 #define LUA_RIDX_GLOBALS	2
@@ -327,10 +331,38 @@ LUA_API void (lua_warning)  (lua_State *L, const char *msg, int tocont);
 #define LUA_GCISRUNNING		9
 #define LUA_GCGEN		10
 #define LUA_GCINC		11
+#define LUA_GCDEFERFINALIZERS	12
+#define LUA_GCRUNFINALIZERS	13
+#define LUA_GCPENDINGFINALIZERS	14
+#define LUA_GCCOMPACT		15
 
 LUA_API int (lua_gc) (lua_State *L, int what, ...);
 
 
+/*
+** native-code compiler modes
+*/
+
+#define LUA_JITOFF	0	/* interpret everything */
+#define LUA_JITON	1	/* compile hot functions */
+#define LUA_JITALL	2	/* compile every function when first called */
+
+LUA_API int (lua_jitmode) (lua_State *L, int mode);
+
+
+/*
+** standard functions the VM may run inline
+*/
+
+#define LUA_BUILTINSELECT	0	/* 'select' */
+#define LUA_BUILTINNEXT		1	/* 'next' */
+#define LUA_BUILTINIPAIRS	2	/* iterator returned by 'ipairs' */
+
+#define LUA_NUMBUILTINS		3
+
+LUA_API void (lua_setbuiltin) (lua_State *L, int id, lua_CFunction f);
+
+
 /*
 ** miscellaneous functions
 */
@@ -341,8 +373,10 @@ LUA_API int   (lua_next) (lua_State *L, int idx);
 
 LUA_API void  (lua_concat) (lua_State *L, int n);
 LUA_API void  (lua_len)    (lua_State *L, int idx);
+LUA_API int   (lua_sortarray) (lua_State *L, int idx, lua_Integer n);
 
 LUA_API size_t   (lua_stringtonumber) (lua_State *L, const char *s);
+LUA_API unsigned (lua_numbertocstring) (lua_State *L, int idx, char *buff);
 
 LUA_API lua_Alloc (lua_getallocf) (lua_State *L, void **ud);
 LUA_API void      (lua_setallocf) (lua_State *L, lua_Alloc f, void *ud);
@@ -1,9 +1,16 @@
 // lua.hpp
 // Lua header files for C++
 // <<extern "C">> not supplied automatically because Lua also compiles as C++
+// (LUA_USE_CXX tells that the library itself was compiled as C++)
 
+#if defined(LUA_USE_CXX)
+#include "lua.h"
+#include "lualib.h"
+#include "lauxlib.h"
+#else
 extern "C" {
 #include "lua.h"
 #include "lualib.h"
 #include "lauxlib.h"
 }
+#endif
@@ -27,6 +27,7 @@
 
 static void PrintFunction(const Proto* f, int full);
 #define luaU_print	PrintFunction
+static void WriteC(lua_State* L, const Proto* f, FILE* D);
 
 #define PROGNAME	"luac"		/* default program name */
 #define OUTPUT		PROGNAME ".out"	/* default output file */
@@ -37,6 +38,7 @@ static int stripping=0;			/* strip debug information? */
 static char Output[]={ OUTPUT };	/* default output file name */
 static const char* output=Output;	/* actual output file name */
 static const char* progname=PROGNAME;	/* actual program name */
+static const char* cname=NULL;		/* module name of C output */
 static TString **tmname;
 
 static void fatal(const char* message)
@@ -60,6 +62,7 @@ static void usage(const char* message)
  fprintf(stderr,
   "usage: %s [options] [filenames]\n"
   "Available options are:\n"
+  "  -C name  output C code for module 'name' instead of bytecodes\n"
   "  -l       list (use -l -l for full listing)\n"
   "  -o name  output to file 'name' (default is \"%s\")\n"
   "  -p       parse only\n"
@@ -90,6 +93,12 @@ static int doargs(int argc, char* argv[])
   }
   else if (IS("-"))			/* end of options; use stdin */
    break;
+  else if (IS("-C"))			/* C output */
+  {
+   cname=argv[++i];
+   if (cname==NULL || *cname==0 || *cname=='-')
+    usage("'-C' needs argument");
+  }
   else if (IS("-l"))			/* list */
    ++listing;
   else if (IS("-o"))			/* output file */
@@ -186,9 +195,14 @@ static int pmain(lua_State* L)
  {
   FILE* D= (output==NULL) ? stdout : fopen(output,"wb");
   if (D==NULL) cannot("open");
-  lua_lock(L);
-  luaU_dump(L,f,writer,D,stripping);
-  lua_unlock(L);
+  if (cname!=NULL)
+   WriteC(L,f,D);
+  else
+  {
+   lua_lock(L);
+   luaU_dump(L,f,writer,D,stripping);
+   lua_unlock(L);
+  }
   if (ferror(D)) cannot("write");
   if (fclose(D)) cannot("close");
  }
@@ -400,6 +414,7 @@ static void PrintCode(const Proto* f)
 	printf(" "); PrintConstant(f,c);
 	break;
    case OP_GETTABLE:
+   case OP_GETTABLE_ARRAYINT:
 	printf("%d %d %d",a,b,c);
 	break;
    case OP_GETI:
@@ -416,6 +431,7 @@ static void PrintCode(const Proto* f)
 	if (isk) { printf(" "); PrintConstant(f,c); }
 	break;
    case OP_SETTABLE:
+   case OP_SETTABLE_ARRAYINT:
 	printf("%d %d %d%s",a,b,c,ISK);
 	if (isk) { printf(COMMENT); PrintConstant(f,c); }
 	break;
@@ -486,12 +502,18 @@ static void PrintCode(const Proto* f)
 	printf("%d %d %d",a,b,sc);
 	break;
    case OP_ADD:
+   case OP_ADD_II:
+   case OP_ADD_FF:
 	printf("%d %d %d",a,b,c);
 	break;
    case OP_SUB:
+   case OP_SUB_II:
+   case OP_SUB_FF:
 	printf("%d %d %d",a,b,c);
 	break;
    case OP_MUL:
+   case OP_MUL_II:
+   case OP_MUL_FF:
 	printf("%d %d %d",a,b,c);
 	break;
    case OP_MOD:
@@ -501,6 +523,7 @@ static void PrintCode(const Proto* f)
 	printf("%d %d %d",a,b,c);
 	break;
    case OP_DIV:
+   case OP_DIV_FF:
 	printf("%d %d %d",a,b,c);
 	break;
    case OP_IDIV:
@@ -564,9 +587,13 @@ static void PrintCode(const Proto* f)
 	printf("%d %d %d",a,b,isk);
 	break;
    case OP_LT:
+   case OP_LT_II:
+   case OP_LT_FF:
 	printf("%d %d %d",a,b,isk);
 	break;
    case OP_LE:
+   case OP_LE_II:
+   case OP_LE_FF:
 	printf("%d %d %d",a,b,isk);
 	break;
    case OP_EQK:
@@ -723,3 +750,303 @@ static void PrintFunction(const Proto* f, int full)
  if (full) PrintDebug(f);
  for (i=0; i<n; i++) PrintFunction(f->p[i],full);
 }
+
+/*
+** write C code
+*/
+
+static const char* PREAMBLE=
+"#define LUA_CORE\n"
+"\n"
+"#include \"lprefix.h\"\n"
+"\n"
+"#include \"lua.h\"\n"
+"#include \"lauxlib.h\"\n"
+"\n"
+"#include \"lgc.h\"\n"
+"#include \"ljit.h\"\n"
+"#include \"lopcodes.h\"\n"
+"#include \"lstate.h\"\n"
+"#include \"ltable.h\"\n"
+"#include \"lvm.h\"\n"
+"\n"
+"#if !defined(LUA_USE_JIT)\n"
+"#error \"precompiled Lua code needs a Lua built with LUA_USE_JIT\"\n"
+"#endif\n"
+"\n"
+"static luaV_Helper helper[NUM_OPCODES];\n"
+"\n"
+"#define R(r)\ts2v(base + (r))\n"
+"#define K(x)\t(k + (x))\n"
+"\n"
+"#define ENTER  \\\n"
+"  LClosure *cl = clLvalue(s2v(ci->func));  \\\n"
+"  const Instruction *code = cl->p->qcode;  \\\n"
+"  const TValue *k = cl->p->k;  \\\n"
+"  StkId base = ci->func + 1;  \\\n"
+"  const Instruction *pc = ci->u.l.savedpc;  \\\n"
+"  UNUSED(L); UNUSED(k); UNUSED(base)\n"
+"\n"
+"/* run instruction 'i' at 'n' through its helper in 'lvm.c' */\n"
+"#define H(n,o,i)  \\\n"
+"  { pc = helper[o](L, ci, code + (n) + 1, i);  \\\n"
+"    if (pc == NULL) return;  /* entered a Lua function */  \\\n"
+"    if (l_unlikely(L->hookmask)) goto leave;  \\\n"
+"    base = ci->func + 1; }\n"
+"#define GO(n)\tif (pc == code + (n)) goto l##n;\n"
+"#define NEXT(n)\tif (pc != code + (n)) goto leave;\n"
+"#define EXIT(n)\t{ pc = code + (n); goto leave; }\n"
+"#define LOOP(n)\t{ if (l_unlikely(L->hookmask)) EXIT(n) goto l##n; }\n"
+"\n"
+"#define ARITH(a,b,c,iop,fop,n)  \\\n"
+"  { TValue *v1 = R(b); TValue *v2 = R(c);  \\\n"
+"    if (ttisinteger(v1) && ttisinteger(v2)) {  \\\n"
+"      setivalue(R(a), intop(iop, ivalue(v1), ivalue(v2))); goto l##n; }  \\\n"
+"    else if (ttisfloat(v1) && ttisfloat(v2)) {  \\\n"
+"      setfltvalue(R(a), fop(L, fltvalue(v1), fltvalue(v2))); goto l##n; } }\n"
+"#define ARITHI(a,b,im,n)  \\\n"
+"  { TValue *v1 = R(b);  \\\n"
+"    if (ttisinteger(v1)) {  \\\n"
+"      setivalue(R(a), intop(+, ivalue(v1), im)); goto l##n; } }\n"
+"#define ORDER(a,b,op,k,skip,jmp)  \\\n"
+"  { TValue *v1 = R(a); TValue *v2 = R(b);  \\\n"
+"    if (ttisinteger(v1) && ttisinteger(v2)) {  \\\n"
+"      if ((ivalue(v1) op ivalue(v2)) != (k)) goto l##skip; else goto l##jmp; } }\n"
+"#define ORDERI(a,im,op,k,skip,jmp)  \\\n"
+"  { TValue *v1 = R(a);  \\\n"
+"    if (ttisinteger(v1)) {  \\\n"
+"      if ((ivalue(v1) op (im)) != (k)) goto l##skip; else goto l##jmp; } }\n"
+"#define TEST(a,k,skip,jmp)  \\\n"
+"  { if ((!l_isfalse(R(a))) != (k)) goto l##skip; else goto l##jmp; }\n"
+"#define GETI(a,b,c,n)  \\\n"
+"  { const TValue *slot;  \\\n"
+"    if (luaV_fastgeti(L, R(b), c, slot)) {  \\\n"
+"      setobj2s(L, base + (a), slot); goto l##n; } }\n"
+"#define FORLOOP(a,back,n)  \\\n"
+"  { StkId ra = base + (a);  \\\n"
+"    if (ttisinteger(s2v(ra + 2))) {  \\\n"
+"      lua_Unsigned count = l_castS2U(ivalue(s2v(ra + 1)));  \\\n"
+"      if (count > 0) {  \\\n"
+"        lua_Integer idx = intop(+, ivalue(s2v(ra)), ivalue(s2v(ra + 2)));  \\\n"
+"        chgivalue(s2v(ra + 1), count - 1);  \\\n"
+"        chgivalue(s2v(ra), idx);  \\\n"
+"        setivalue(s2v(ra + 3), idx);  \\\n"
+"        LOOP(back) }  \\\n"
+"      goto l##n; } }\n"
+"\n";
+
+typedef struct
+{
+ FILE* D;
+ size_t n;
+} CWriter;
+
+static int cwriter(lua_State* L, const void* p, size_t size, void* u)
+{
+ CWriter* w=(CWriter*)u;
+ const unsigned char* b=(const unsigned char*)p;
+ size_t i;
+ UNUSED(L);
+ for (i=0; i<size; i++)
+  fprintf(w->D,"%d,%s",b[i],(++w->n%20==0) ? "\n" : "");
+ return ferror(w->D);
+}
+
+#define VALID(t)	((t)>=0 && (t)<n)
+
+static void WriteNext(FILE* D, int t, int n)	/* successor falling through */
+{
+ if (VALID(t)) fprintf(D,"  NEXT(%d)\n",t); else fprintf(D,"  goto leave;\n");
+}
+
+static void WriteGo(FILE* D, int t, int n)
+{
+ if (VALID(t)) fprintf(D,"  GO(%d)\n",t);
+}
+
+static void WriteCode(FILE* D, const Proto* f, int id)
+{
+ const Instruction* code=f->code;
+ int pc,n=f->sizecode;
+ fprintf(D,"static void f%d (lua_State *L, CallInfo *ci) {\n  ENTER;\n",id);
+ fprintf(D,"  switch (pc - code) {\n");
+ for (pc=0; pc<n; pc++) fprintf(D,"    case %d: goto l%d;\n",pc,pc);
+ fprintf(D,"    default: goto leave;\n  }\n");
+ for (pc=0; pc<n; pc++)
+ {
+  Instruction i=code[pc];
+  OpCode o=GET_OPCODE(i);
+  int a=GETARG_A(i);
+  int helper=0;
+  fprintf(D," l%d:  /* %s */\n",pc,opnames[o]);
+  switch (o)
+  {
+   case OP_MOVE:
+	fprintf(D,"  setobjs2s(L, base + %d, base + %d);\n",a,GETARG_B(i));
+	break;
+   case OP_LOADI:
+	fprintf(D,"  setivalue(R(%d), %d);\n",a,GETARG_sBx(i));
+	break;
+   case OP_LOADF:
+	fprintf(D,"  setfltvalue(R(%d), cast_num(%d));\n",a,GETARG_sBx(i));
+	break;
+   case OP_LOADK:
+	fprintf(D,"  setobj2s(L, base + %d, K(%d));\n",a,GETARG_Bx(i));
+	break;
+   case OP_LOADKX:
+	fprintf(D,"  setobj2s(L, base + %d, K(%d));\n",a,EXTRAARG);
+	fprintf(D,"  goto l%d;\n",pc+2);
+	break;
+   case OP_LOADFALSE:
+	fprintf(D,"  setbfvalue(R(%d));\n",a);
+	break;
+   case OP_LFALSESKIP:
+	fprintf(D,"  setbfvalue(R(%d));\n  goto l%d;\n",a,pc+2);
+	break;
+   case OP_LOADTRUE:
+	fprintf(D,"  setbtvalue(R(%d));\n",a);
+	break;
+   case OP_LOADNIL:
+   {
+	int b=GETARG_B(i);
+	do fprintf(D,"  setnilvalue(R(%d));\n",a++); while (b--);
+   }
+	break;
+   case OP_GETUPVAL:
+	fprintf(D,"  setobj2s(L, base + %d, cl->upvals[%d]->v);\n",a,GETARG_B(i));
+	break;
+   case OP_JMP:
+	if (GETARG_sJ(i)<0)
+	 fprintf(D,"  LOOP(%d)\n",pc+1+GETARG_sJ(i));
+	else
+	 fprintf(D,"  goto l%d;\n",pc+1+GETARG_sJ(i));
+	break;
+   case OP_ADD:
+	fprintf(D,"  ARITH(%d, %d, %d, +, luai_numadd, %d)\n",a,GETARG_B(i),GETARG_C(i),pc+2);
+	helper=1;
+	break;
+   case OP_SUB:
+	fprintf(D,"  ARITH(%d, %d, %d, -, luai_numsub, %d)\n",a,GETARG_B(i),GETARG_C(i),pc+2);
+	helper=1;
+	break;
+   case OP_MUL:
+	fprintf(D,"  ARITH(%d, %d, %d, *, luai_nummul, %d)\n",a,GETARG_B(i),GETARG_C(i),pc+2);
+	helper=1;
+	break;
+   case OP_ADDI:
+	fprintf(D,"  ARITHI(%d, %d, %d, %d)\n",a,GETARG_B(i),GETARG_sC(i),pc+2);
+	helper=1;
+	break;
+   case OP_EQ:
+   case OP_LT:
+   case OP_LE:
+	fprintf(D,"  ORDER(%d, %d, %s, %d, %d, %d)\n",a,GETARG_B(i),
+		o==OP_EQ ? "==" : o==OP_LT ? "<" : "<=",GETARG_k(i),pc+2,pc+1);
+	helper=1;
+	break;
+   case OP_EQI:
+   case OP_LTI:
+   case OP_LEI:
+   case OP_GTI:
+   case OP_GEI:
+	fprintf(D,"  ORDERI(%d, %d, %s, %d, %d, %d)\n",a,GETARG_sB(i),
+		o==OP_EQI ? "==" : o==OP_LTI ? "<" : o==OP_LEI ? "<=" :
+		o==OP_GTI ? ">" : ">=",GETARG_k(i),pc+2,pc+1);
+	helper=1;
+	break;
+   case OP_TEST:
+	fprintf(D,"  TEST(%d, %d, %d, %d)\n",a,GETARG_k(i),pc+2,pc+1);
+	break;
+   case OP_GETI:
+	fprintf(D,"  GETI(%d, %d, %d, %d)\n",a,GETARG_B(i),GETARG_C(i),pc+1);
+	helper=1;
+	break;
+   case OP_FORLOOP:
+	fprintf(D,"  FORLOOP(%d, %d, %d)\n",a,pc+1-GETARG_Bx(i),pc+1);
+	helper=1;
+	break;
+   case OP_TAILCALL:
+   case OP_RETURN:
+   case OP_RETURN0:
+   case OP_RETURN1:
+   case OP_EXTRAARG:
+	fprintf(D,"  EXIT(%d)\n",pc);		/* left to the interpreter */
+	break;
+   default:
+	helper=1;
+	break;
+  }
+  if (helper)
+  {
+   fprintf(D,"  H(%d, OP_%s, 0x%08lxu)\n",pc,opnames[o],(unsigned long)i);
+   switch (o)
+   {
+    case OP_FORLOOP:
+    case OP_TFORLOOP:
+	WriteGo(D,pc+1-GETARG_Bx(i),n);
+	WriteNext(D,pc+1,n);
+	break;
+    case OP_FORPREP:
+	WriteGo(D,pc+GETARG_Bx(i)+2,n);
+	WriteNext(D,pc+1,n);
+	break;
+    case OP_TFORPREP:
+	WriteGo(D,pc+1+GETARG_Bx(i),n);
+	fprintf(D,"  goto leave;\n");
+	break;
+    default:
+	WriteGo(D,pc+2,n);
+	WriteNext(D,pc+1,n);
+	break;
+   }
+  }
+ }
+ fprintf(D," leave:\n  ci->u.l.savedpc = pc;\n}\n\n");
+}
+
+static int WriteCodes(FILE* D, const Proto* f, int id)
+{
+ int i,n=f->sizep;
+ WriteCode(D,f,id++);
+ for (i=0; i<n; i++) id=WriteCodes(D,f->p[i],id);
+ return id;
+}
+
+static void WriteC(lua_State* L, const Proto* f, FILE* D)
+{
+ CWriter w;
+ char* name=(char*)malloc(strlen(cname)+1);
+ int i,n;
+ if (name==NULL) fatal("not enough memory");
+ for (i=0; cname[i]!=0; i++)		/* "a.b" opens as 'luaopen_a_b' */
+  name[i]=isalnum((unsigned char)cname[i]) ? cname[i] : '_';
+ name[i]=0;
+ fprintf(D,"/* precompiled code of module '%s' (made by " PROGNAME " -C) */\n\n",
+	cname);
+ fprintf(D,"%s",PREAMBLE);
+ n=WriteCodes(D,f,0);
+ fprintf(D,"static const luaJ_Native natives[%d] = {",n);
+ for (i=0; i<n; i++) fprintf(D,"%sf%d,",(i%10==0) ? "\n  " : " ",i);
+ fprintf(D,"\n};\n\n");
+ fprintf(D,"static const unsigned char chunk[] = {\n");
+ w.D=D; w.n=0;
+ lua_lock(L);
+ luaU_dump(L,f,cwriter,&w,stripping);
+ lua_unlock(L);
+ fprintf(D,"\n};\n\n");
+ fprintf(D,
+  "LUAMOD_API int luaopen_%s (lua_State *L) {\n"
+  "  int i;\n"
+  "  int n = lua_gettop(L);  /* arguments for the chunk */\n"
+  "  for (i = 0; i < NUM_OPCODES; i++)\n"
+  "    helper[i] = luaV_jithelper(i);\n"
+  "  if (luaL_loadbufferx(L, (const char *)chunk, sizeof(chunk), \"=%s\",\n"
+  "                       \"b\") != LUA_OK)\n"
+  "    return lua_error(L);\n"
+  "  luaJ_attach(L, natives, %d);\n"
+  "  lua_insert(L, 1);\n"
+  "  lua_call(L, n, LUA_MULTRET);\n"
+  "  return lua_gettop(L);\n"
+  "}\n",name,cname,n);
+ free(name);
+}
@@ -324,6 +324,14 @@
 ** ===================================================================
 */
 
+/*
+@@ LUA_COMPAT_NUMFMT makes Lua convert floats to strings with format
+** LUA_NUMBER_FMT, as in previous versions, instead of using the
+** shortest numeral that reads back as the same float.
+*/
+/* #define LUA_COMPAT_NUMFMT */
+
+
 /*
 @@ LUA_COMPAT_5_3 controls other macros for compatibility with Lua 5.3.
 ** You can define it to get all options, or change specific options
@@ -712,6 +720,25 @@
 #define luai_apicheck(l,e)	assert(e)
 #endif
 
+
+/*
+@@ LUA_USE_JIT builds the native-code compiler for hot functions
+** (see 'ljit.c'). It only generates code on x86-64 (not Windows);
+** elsewhere everything keeps being interpreted.
+*/
+/* #define LUA_USE_JIT */
+
+
+/*
+@@ LUA_USE_MAPSTACK reserves address space (with 'mmap') for the
+** stacks of threads that grow large, so that they then grow in place
+** and are not copied again. Only for POSIX systems. LUAI_MAPSTACKMIN,
+** LUAI_MAPSTACKSIZE and LUAI_STACKPOOL (in 'lstate.h') set when a stack
+** moves to a reservation, its size, and how many free reservations are
+** kept for reuse.
+*/
+/* #define LUA_USE_MAPSTACK */
+
 /* }================================================================== */
 
 
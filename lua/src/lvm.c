@@ -11,6 +11,7 @@
 
 #include <float.h>
 #include <limits.h>
+#include <locale.h>
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -18,10 +19,12 @@
 
 #include "lua.h"
 
+#include "lctype.h"
 #include "ldebug.h"
 #include "ldo.h"
 #include "lfunc.h"
 #include "lgc.h"
+#include "ljit.h"
 #include "lobject.h"
 #include "lopcodes.h"
 #include "lstate.h"
@@ -85,14 +88,30 @@
 ** If the value is not a string or is a string not representing
 ** a valid numeral (or if coercions from strings to numbers
 ** are disabled via macro 'cvt2num'), do not modify 'result'
-** and return 0.
+** and return 0. A shared string that is not the longest in its
+** buffer does not end with '\0' (see 'luaS_extend'), and it cannot be
+** sealed here (that may raise a memory error), so its numeral, without
+** the spaces around it, is converted from a copy.
 */
 static int l_strton (const TValue *obj, TValue *result) {
   lua_assert(obj != result);
   if (!cvt2num(obj))  /* is object not a string? */
     return 0;
-  else
-    return (luaO_str2num(svalue(obj), result) == vslen(obj) + 1);
+  else {
+    char buff[L_MAXLENNUM + 1];
+    const char *s = svalue(obj);
+    size_t len = vslen(obj);
+    if (l_unlikely(s[len] != '\0')) {  /* no ending '\0'? */
+      while (len > 0 && lisspace(cast_uchar(*s))) { s++; len--; }
+      while (len > 0 && lisspace(cast_uchar(s[len - 1]))) len--;
+      if (len > L_MAXLENNUM)
+        return 0;  /* too long to be a numeral */
+      memcpy(buff, s, len * sizeof(char));
+      buff[len] = '\0';
+      s = buff;
+    }
+    return (luaO_str2num(s, result) == len + 1);
+  }
 }
 
 
@@ -279,6 +298,96 @@ static int floatforloop (StkId ra) {
 }
 
 
+/*
+** Try to run a step of a generic for loop without calling its
+** iterator, when that is the standard 'next' or 'ipairs' iterator over
+** a table. 'ra' has the iterator function, the state, the control
+** variable, and the closing value, as in OP_TFORCALL; the 'nres' results
+** go to 'ra + 4'. Loops over 'next' keep the traversal index in the
+** (otherwise unused) closing value, so that each step does not need to
+** search the current key again. Returns false when the iterator must
+** be called.
+*/
+static int forstep (lua_State *L, StkId ra, int nres) {
+  TValue *state = s2v(ra + 1);
+  int n;  /* number of results produced */
+  if (!ttistable(state) || L->hookmask)
+    return 0;
+  else if (isbuiltin(L, s2v(ra), LUA_BUILTINNEXT)) {
+    int idx;
+    if (ttisinteger(s2v(ra + 3)))  /* traversal index from previous step? */
+      idx = cast_int(ivalue(s2v(ra + 3)));
+    else if (l_isfalse(s2v(ra + 3)) && ttisnil(s2v(ra + 2)))
+      idx = 0;  /* first step */
+    else
+      return 0;
+    setobjs2s(L, ra + 4, ra + 2);  /* key to be traversed */
+    idx = luaH_nextat(L, hvalue(state), ra + 4, idx);
+    setivalue(s2v(ra + 3), idx);
+    if (idx == 0) {  /* no more elements? */
+      setnilvalue(s2v(ra + 4));
+      n = 1;
+    }
+    else
+      n = 2;
+  }
+  else if (isbuiltin(L, s2v(ra), LUA_BUILTINIPAIRS) &&
+           ttisinteger(s2v(ra + 2))) {
+    lua_Integer k = intop(+, ivalue(s2v(ra + 2)), 1);
+    const TValue *slot;
+    if (!luaV_fastgeti(L, state, k, slot))
+      return 0;  /* end of loop or absent element; let 'ipairs' decide */
+    setivalue(s2v(ra + 4), k);
+    setobj2s(L, ra + 5, slot);
+    n = 2;
+  }
+  else
+    return 0;
+  for (; n < nres; n++)  /* complete missing results */
+    setnilvalue(s2v(ra + 4 + n));
+  return 1;
+}
+
+
+/*
+** Look for the short-string 'key' in the chain of '__index' tables that
+** starts at table 'h': 'h' itself, then the '__index' table of its
+** metatable, and so on. Returns the slot where the key was found, or
+** NULL if it was not found (or if the chain goes through a function).
+** A global cache remembers where each key was found from each 'h';
+** the tables visited and their metatables are marked with BITCHAIN,
+** so that any change to them invalidates the cache (see 'ltable.h').
+*/
+static const TValue *getchain (lua_State *L, Table *h, TString *key) {
+  global_State *g = G(L);
+  ChainEntry *e = &g->chaincache[
+                    (point2uint(h) ^ key->hash) & (LUAI_CHAINCACHE - 1)];
+  Table *t = h;
+  int loop;
+  if (e->epoch == g->chainepoch && e->t == h && e->key == key &&
+      !isempty(e->slot))
+    return e->slot;  /* cache hit */
+  for (loop = 0; loop < MAXTAGLOOP; loop++) {
+    const TValue *res = luaH_getshortstr(t, key);
+    const TValue *tm;
+    t->flags |= BITCHAIN;
+    if (!isempty(res)) {  /* found the key? */
+      e->t = h; e->key = key; e->slot = res;
+      e->epoch = g->chainepoch;
+      return res;
+    }
+    else if (t->metatable == NULL)
+      return NULL;  /* end of the chain */
+    t->metatable->flags |= BITCHAIN;
+    tm = fasttm(L, t->metatable, TM_INDEX);
+    if (tm == NULL || !ttistable(tm))
+      return NULL;  /* end of the chain or '__index' function */
+    t = hvalue(tm);
+  }
+  return NULL;  /* let the caller complain about the loop */
+}
+
+
 /*
 ** Finish the table access 'val = t[key]'.
 ** if 'slot' is NULL, 't' is not a table; otherwise, 'slot' points to
@@ -310,6 +419,11 @@ void luaV_finishget (lua_State *L, const TValue *t, TValue *key, StkId val,
       return;
     }
     t = tm;  /* else try to access 'tm[key]' */
+    if (ttistable(t) && ttisshrstring(key) &&
+        (slot = getchain(L, hvalue(t), tsvalue(key))) != NULL) {
+      setobj2s(L, val, slot);  /* found in the '__index' chain */
+      return;
+    }
     if (luaV_fastget(L, t, key, slot, luaH_get)) {  /* fast track? */
       setobj2s(L, val, slot);  /* done */
       return;
@@ -519,8 +633,11 @@ l_sinline int LEnum (const TValue *l, const TValue *r) {
 */
 static int lessthanothers (lua_State *L, const TValue *l, const TValue *r) {
   lua_assert(!ttisnumber(l) || !ttisnumber(r));
-  if (ttisstring(l) && ttisstring(r))  /* both are strings? */
+  if (ttisstring(l) && ttisstring(r)) {  /* both are strings? */
+    luaS_seal(L, tsvalue(l));  /* 'l_strcmp' needs the final '\0's */
+    luaS_seal(L, tsvalue(r));
     return l_strcmp(tsvalue(l), tsvalue(r)) < 0;
+  }
   else
     return luaT_callorderTM(L, l, r, TM_LT);
 }
@@ -541,8 +658,11 @@ int luaV_lessthan (lua_State *L, const TValue *l, const TValue *r) {
 */
 static int lessequalothers (lua_State *L, const TValue *l, const TValue *r) {
   lua_assert(!ttisnumber(l) || !ttisnumber(r));
-  if (ttisstring(l) && ttisstring(r))  /* both are strings? */
+  if (ttisstring(l) && ttisstring(r)) {  /* both are strings? */
+    luaS_seal(L, tsvalue(l));  /* 'l_strcmp' needs the final '\0's */
+    luaS_seal(L, tsvalue(r));
     return l_strcmp(tsvalue(l), tsvalue(r)) <= 0;
+  }
   else
     return luaT_callorderTM(L, l, r, TM_LE);
 }
@@ -558,6 +678,200 @@ int luaV_lessequal (lua_State *L, const TValue *l, const TValue *r) {
 }
 
 
+/*
+** {==================================================================
+** Sorting of arrays of numbers or strings
+** ===================================================================
+*/
+
+/* kinds of arrays that 'luaV_sortarray' sorts */
+#define SORTINT		0	/* integers */
+#define SORTFLT		1	/* floats (no NaN) */
+#define SORTNUM		2	/* integers and floats */
+#define SORTBYTES	3	/* strings, with the "C" collation */
+#define SORTSTR		4	/* strings, with other collations */
+
+/* ranges up to this size are sorted by insertion */
+#define SORTCUT		16
+
+
+/*
+** Compare two strings byte by byte, which gives the same order as
+** 'l_strcmp' with the "C" collation.
+*/
+static int bytescmp (const TString *ls, const TString *rs) {
+  size_t ll = tsslen(ls);
+  size_t lr = tsslen(rs);
+  int temp = memcmp(getstr(ls), getstr(rs), (ll < lr) ? ll : lr);
+  if (temp != 0)
+    return temp;
+  else
+    return (ll < lr) ? -1 : (ll > lr);
+}
+
+
+/*
+** 'a < b' for a sort of the given 'kind'. (Calls to this function
+** use a 'kind' that is invariant along a sort, so its tests are well
+** predicted.)
+*/
+l_sinline int sortlt (int kind, const TValue *a, const TValue *b) {
+  switch (kind) {
+    case SORTINT: return ivalue(a) < ivalue(b);
+    case SORTFLT: return luai_numlt(fltvalue(a), fltvalue(b));
+    case SORTNUM: return LTnum(a, b);
+    case SORTBYTES: return bytescmp(tsvalue(a), tsvalue(b)) < 0;
+    default: return l_strcmp(tsvalue(a), tsvalue(b)) < 0;
+  }
+}
+
+
+#define sortswap(L,a,i,j)  \
+  { TValue temp_; setobj(L, &temp_, &(a)[i]);  \
+    setobj(L, &(a)[i], &(a)[j]); setobj(L, &(a)[j], &temp_); }
+
+
+static void insertionsort (lua_State *L, TValue *a, int lo, int up,
+                           int kind) {
+  int i, j;
+  for (i = lo + 1; i <= up; i++) {
+    TValue v;
+    setobj(L, &v, &a[i]);
+    for (j = i; j > lo && sortlt(kind, &v, &a[j - 1]); j--)
+      setobj(L, &a[j], &a[j - 1]);
+    setobj(L, &a[j], &v);
+  }
+}
+
+
+static void heapsort (lua_State *L, TValue *a, int n, int kind) {
+  int i, start, end;
+  for (start = n / 2 - 1, end = n - 1; end > 0; ) {
+    int root;
+    if (start >= 0)  /* still building the heap? */
+      root = start--;
+    else {  /* move largest element to its place */
+      sortswap(L, a, 0, end);
+      end--;
+      root = 0;
+    }
+    while ((i = 2 * root + 1) <= end) {  /* sift down 'root' */
+      if (i < end && sortlt(kind, &a[i], &a[i + 1]))
+        i++;  /* larger child */
+      if (!sortlt(kind, &a[root], &a[i]))
+        break;
+      sortswap(L, a, root, i);
+      root = i;
+    }
+  }
+}
+
+
+/*
+** Introsort: quicksort with a median-of-three pivot and Hoare's
+** partition, with insertion sort for small ranges and heapsort for
+** ranges that go too deep. Larger parts are kept in an explicit stack
+** and smaller parts are sorted first, so the stack has at most
+** log2(n) entries.
+*/
+static void introsort (lua_State *L, TValue *a, int n, int kind) {
+  struct { int lo, up, depth; } stack[sizeof(int) * CHAR_BIT];
+  int top = 0;
+  int lo = 0, up = n - 1;
+  int depth = 2 * luaO_ceillog2(cast_uint(n));
+  for (;;) {
+    if (up - lo < SORTCUT || depth == 0) {
+      if (up - lo < SORTCUT)
+        insertionsort(L, a, lo, up, kind);
+      else  /* too many bad partitions */
+        heapsort(L, a + lo, up - lo + 1, kind);
+      if (top == 0)
+        return;
+      top--;
+      lo = stack[top].lo; up = stack[top].up; depth = stack[top].depth;
+    }
+    else {
+      int mid = lo + (up - lo) / 2;
+      int i = lo - 1, j = up + 1;
+      TValue p;
+      depth--;
+      /* sort a[lo], a[mid], a[up]; a[mid] is the pivot */
+      if (sortlt(kind, &a[mid], &a[lo])) sortswap(L, a, mid, lo);
+      if (sortlt(kind, &a[up], &a[mid])) {
+        sortswap(L, a, up, mid);
+        if (sortlt(kind, &a[mid], &a[lo])) sortswap(L, a, mid, lo);
+      }
+      setobj(L, &p, &a[mid]);
+      for (;;) {  /* a[lo .. i] <= p <= a[j .. up] */
+        do i++; while (sortlt(kind, &a[i], &p));
+        do j--; while (sortlt(kind, &p, &a[j]));
+        if (i >= j) break;
+        sortswap(L, a, i, j);
+      }
+      /* a[lo .. j] <= p <= a[j + 1 .. up] */
+      stack[top].depth = depth;
+      if (j - lo < up - j) {  /* lower part is smaller? */
+        stack[top].lo = j + 1; stack[top].up = up;
+        up = j;
+      }
+      else {
+        stack[top].lo = lo; stack[top].up = j;
+        lo = j + 1;
+      }
+      top++;
+    }
+  }
+}
+
+
+/*
+** If the first 'n' elements of table 't' are in its array part and
+** are all numbers (but no NaN) or all strings, sort them in place
+** with the primitive order of Lua and return 1. Otherwise, return 0
+** without touching 't'. (No function is called and nothing is
+** allocated after values start moving, so no collection can see a
+** value out of the array.)
+*/
+int luaV_sortarray (lua_State *L, Table *t, unsigned int n) {
+  TValue *a = t->array;
+  unsigned int i;
+  int kind;
+  if (n < 2 || n > luaH_realasize(t) || n >= cast_uint(INT_MAX))
+    return 0;
+  if (ttisstring(&a[0])) {
+    const char *coll;
+    for (i = 1; i < n; i++) {
+      if (!ttisstring(&a[i]))
+        return 0;
+    }
+    for (i = 0; i < n; i++)
+      luaS_seal(L, tsvalue(&a[i]));  /* 'l_strcmp' needs the final '\0's */
+    coll = setlocale(LC_COLLATE, NULL);
+    kind = (coll != NULL && (strcmp(coll, "C") == 0 ||
+                             strcmp(coll, "POSIX") == 0))
+           ? SORTBYTES : SORTSTR;
+  }
+  else {
+    kind = ttisinteger(&a[0]) ? SORTINT : SORTFLT;
+    for (i = 0; i < n; i++) {
+      if (ttisinteger(&a[i])) {
+        if (kind == SORTFLT) kind = SORTNUM;
+      }
+      else if (ttisfloat(&a[i]) && !luai_numisnan(fltvalue(&a[i]))) {
+        if (kind == SORTINT) kind = SORTNUM;
+      }
+      else
+        return 0;  /* not a number, or NaN */
+    }
+  }
+  introsort(L, a, cast_int(n), kind);
+  invalidatechains(L, t);
+  return 1;
+}
+
+/* }================================================================== */
+
+
 /*
 ** Main operation for equality of Lua values; return 't1 == t2'.
 ** L == NULL means raw equality (no metamethods)
@@ -665,6 +979,12 @@ void luaV_concat (lua_State *L, int total) {
         copy2buff(top, n, buff);  /* copy strings to buffer */
         ts = luaS_newlstr(L, buff, tl);
       }
+      else if (tl >= LUAI_MINSHAREDLEN && ttislngstring(s2v(top - n))) {
+        /* append to the first string, sharing its buffer if possible */
+        TString *first = tsvalue(s2v(top - n));
+        ts = luaS_extend(L, first, tl);
+        copy2buff(top, n - 1, getstr(ts) + tsslen(first));
+      }
       else {  /* long string; copy strings directly to final result */
         ts = luaS_createlngstrobj(L, tl);
         copy2buff(top, n, getstr(ts));
@@ -818,7 +1138,7 @@ void luaV_finishOp (lua_State *L) {
     }
     case OP_UNM: case OP_BNOT: case OP_LEN:
     case OP_GETTABUP: case OP_GETTABLE: case OP_GETI:
-    case OP_GETFIELD: case OP_SELF: {
+    case OP_GETFIELD: case OP_SELF: case OP_GETTABLE_ARRAYINT: {
       setobjs2s(L, base + GETARG_A(inst), --L->top);
       break;
     }
@@ -865,7 +1185,8 @@ void luaV_finishOp (lua_State *L) {
       /* only these other opcodes can yield */
       lua_assert(op == OP_TFORCALL || op == OP_CALL ||
            op == OP_TAILCALL || op == OP_SETTABUP || op == OP_SETTABLE ||
-           op == OP_SETI || op == OP_SETFIELD);
+           op == OP_SETI || op == OP_SETFIELD ||
+           op == OP_SETTABLE_ARRAYINT);
       break;
     }
   }
@@ -1034,6 +1355,136 @@ void luaV_finishOp (lua_State *L) {
         }  \
         docondjump(); }
 
+
+/*
+** Quickening: a generic instruction that sees operands of a stable
+** type rewrites itself in 'qcode' into a variant specialized for that
+** type. When the guard of a quickened instruction fails, it rewrites
+** itself back ("deoptimizes") and runs as the generic instruction.
+** The cache word of the instruction counts its deoptimizations; after
+** MAXDEOPT of them, the site is considered polymorphic and is left
+** generic. (Only instructions without inline caches are quickened.)
+*/
+#define MAXDEOPT	4
+
+#define rewrite(op)  \
+	{ SET_OPCODE(i, op); *cast(Instruction *, pc - 1) = i; }
+
+#define quicken(op)	{ if (*IC() < MAXDEOPT) rewrite(op); }
+
+#define deoptimize(op)	{ rewrite(op); (*IC())++; goto redispatch; }
+
+
+/*
+** Quicken a generic instruction with register operands 'v1' and 'v2'
+** that are both integers ('opii') or both floats ('opff').
+*/
+#define quickennum(v1,v2,opii,opff) {  \
+  if (ttisinteger(v1) && ttisinteger(v2)) quicken(opii)  \
+  else if (ttisfloat(v1) && ttisfloat(v2)) quicken(opff) }
+
+
+/*
+** Quickened arithmetic operations: 'tt' checks the type of the
+** operands, 'get' gets their values, and 'set' sets the result.
+*/
+#define op_arithQ(L,tt,get,set,op,gen) {  \
+  TValue *v1 = vRB(i);  \
+  TValue *v2 = vRC(i);  \
+  if (l_likely(tt(v1) && tt(v2))) {  \
+    pc++; set(s2v(ra), op(L, get(v1), get(v2)));  \
+  }  \
+  else deoptimize(gen); }
+
+
+/*
+** Quickened order operations.
+*/
+#define op_orderQ(L,tt,get,op,gen) {  \
+  TValue *rb = vRB(i);  \
+  if (l_likely(tt(s2v(ra)) && tt(rb))) {  \
+    int cond = op(get(s2v(ra)), get(rb));  \
+    docondjump();  \
+  }  \
+  else deoptimize(gen); }
+
+/* }================================================================== */
+
+
+/*
+** {==================================================================
+** Inline caches
+** ===================================================================
+*/
+
+/*
+** Each instruction that reads or writes a field with a constant
+** short-string key has an inline cache in 'p->icache': the hash slot
+** where that key was found the last time. That includes accesses to
+** global variables (OP_GETTABUP/OP_SETTABUP on '_ENV'). A hint is valid
+** only if the slot still holds that key, so it works for any table and
+** is harmless after a rehash or after the key is removed (at worst, it
+** misses and is updated).
+*/
+#define ichit(t,key,slot)  \
+	((slot) < cast_uint(sizenode(t)) && keyisshrstr(gnode(t, slot)) &&  \
+	 keystrval(gnode(t, slot)) == (key))
+
+
+/*
+** Cache miss: do the real lookup and remember where the key was.
+*/
+static const TValue *icmiss (Table *t, TString *key, unsigned int *ic) {
+  const TValue *res = luaH_getshortstr(t, key);
+  if (!isabstkey(res))  /* found the key? */
+    *ic = cast_uint(nodefromval(res) - gnode(t, 0));
+  return res;
+}
+
+
+/*
+** Equivalent to 'luaH_getshortstr(t, key)', using cache 'ic'.
+*/
+l_sinline const TValue *icget (Table *t, TString *key, unsigned int *ic) {
+  unsigned int slot = *ic;
+  if (ichit(t, key, slot))
+    return gval(gnode(t, slot));
+  else
+    return icmiss(t, key, ic);
+}
+
+
+/*
+** Like 'luaV_fastget' for short-string keys, using cache 'ic'.
+*/
+#define icfastget(t,key,slot,ic) \
+  (!ttistable(t)  \
+   ? (slot = NULL, 0)  /* not a table; 'slot' is NULL and result is 0 */  \
+   : (slot = icget(hvalue(t), key, ic),  /* else, do raw access */  \
+      !isempty(slot)))  /* result not empty? */
+
+
+/*
+** When a field is not present in 't' (or 't' is not a table), try to
+** find it in its '__index' table, as 'luaV_finishget' would do in its
+** first iteration, or further up in a chain of '__index' tables (e.g., a
+** class hierarchy). This is the usual case of a method call. Returns
+** NULL if that is not the case or if the field is not there either.
+*/
+static const TValue *icindex (lua_State *L, const TValue *t, TString *key) {
+  Table *mt;
+  const TValue *tm;
+  switch (ttype(t)) {
+    case LUA_TTABLE: mt = hvalue(t)->metatable; break;
+    case LUA_TUSERDATA: mt = uvalue(t)->metatable; break;
+    default: return NULL;
+  }
+  tm = fasttm(L, mt, TM_INDEX);
+  if (tm == NULL || !ttistable(tm))  /* no '__index' table? */
+    return NULL;
+  return getchain(L, hvalue(tm), key);
+}
+
 /* }================================================================== */
 
 
@@ -1063,6 +1514,9 @@ void luaV_finishOp (lua_State *L) {
 
 #define updatebase(ci)	(base = ci->func + 1)
 
+/* inline cache of the current instruction */
+#define IC()	(icache + pcRel(pc, cl->p))
+
 
 #define updatestack(ci)  \
 	{ if (l_unlikely(trap)) { updatebase(ci); ra = RA(i); } }
@@ -1121,6 +1575,25 @@ void luaV_finishOp (lua_State *L) {
            luai_threadyield(L); }
 
 
+/*
+** Count 'n' calls or loop iterations of the current function and, if
+** it is compiled (see 'ljit.c'), continue in its native code. The
+** native code returns either when it enters a Lua function, which
+** then starts running here, or when it needs the interpreter to run
+** the instruction at 'savedpc'. Hooks are handled only here.
+*/
+#if defined(LUA_USE_JIT)
+#define jitrun(n)  \
+  { if (!L->hookmask && luaJ_hot(L, cl->p, n)) { \
+      savepc(L); \
+      luaJ_run(L, ci); \
+      if (L->ci != ci) { ci = L->ci; goto startfunc; } \
+      pc = ci->u.l.savedpc; updatebase(ci); updatetrap(ci); } }
+#else
+#define jitrun(n)	((void)0)
+#endif
+
+
 /* fetch an instruction and prepare its execution */
 #define vmfetch()	{ \
   if (l_unlikely(trap)) {  /* stack reallocation or hooks? */ \
@@ -1136,9 +1609,73 @@ void luaV_finishOp (lua_State *L) {
 #define vmbreak		break
 
 
+/*
+** OP_VARARG taking all extra arguments to a call right after it:
+** for 'return f(...)' with a Lua 'f', put 'f' right below the extra
+** arguments, which then are already in place for the call ('f' takes
+** over the frame, so overwriting the slot of the current function is
+** harmless); for 'select(x, ...)' with a simple 'x', do the call here.
+*/
+#define vmforward()  \
+  { if (l_likely(!L->hookmask)) {  \
+      Instruction ni = *pc;  \
+      if (GET_OPCODE(ni) == OP_TAILCALL && GETARG_B(ni) == 0 &&  \
+          GETARG_A(ni) == GETARG_A(i) - 1 && ttisLclosure(s2v(ra - 1))) {  \
+        StkId func = ci->func - ci->u.l.nextraargs - 1;  \
+        if (TESTARG_k(ni)) {  /* close upvalues while top is still high */ \
+          L->top = ra;  \
+          luaF_closeupval(L, base);  \
+        }  \
+        setobjs2s(L, func, ra - 1);  \
+        L->top = ci->func;  \
+        i = ni;  \
+        ra = func;  \
+        pc++;  \
+        goto tailcall;  \
+      }  \
+      if ((GET_OPCODE(ni) == OP_CALL || GET_OPCODE(ni) == OP_TAILCALL) &&  \
+          GETARG_B(ni) == 0 && GETARG_A(ni) == GETARG_A(i) - 2 &&  \
+          isbuiltin(L, s2v(ra - 2), LUA_BUILTINSELECT)) {  \
+        int wanted = (GET_OPCODE(ni) == OP_CALL) ? GETARG_C(ni) - 1  \
+                                                 : LUA_MULTRET;  \
+        int ok;  \
+        Protect(ok = luaT_selectvarargs(L, ci, ra - 2, s2v(ra - 1),  \
+                                        wanted));  \
+        if (ok) {  \
+          pc++;  /* skip the call */ \
+          if (GET_OPCODE(ni) == OP_TAILCALL) {  \
+            i = ni;  /* return the results, which have the same operands */ \
+            updatebase(ci);  \
+            ra = RA(i);  \
+            goto doreturn;  \
+          }  \
+          vmbreak;  \
+        }  \
+      }  \
+  } }
+
+
+/*
+** Opcodes whose cases 'lvmops.h' shares with the helpers for compiled
+** code: 'vmenter' runs a Lua function, 'vmgoto' goes on with the
+** following instruction (which must be 'op') at label 'l', and
+** 'vmforward' does the calls after an OP_VARARG. The helpers give
+** these (and 'jitrun' and the quickening) their own definitions.
+*/
+#define vmenter(nci)	{ ci = nci; goto startfunc; }
+
+#define vmgoto(op,l)	{ \
+  i = *(pc++);  /* go to next instruction */ \
+  lua_assert(GET_OPCODE(i) == op && ra == RA(i)); \
+  goto l; }
+
+#define vmlabel(l)	l:
+
+
 void luaV_execute (lua_State *L, CallInfo *ci) {
   LClosure *cl;
   TValue *k;
+  unsigned int *icache;
   StkId base;
   const Instruction *pc;
   int trap;
@@ -1150,9 +1687,10 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
  returning:  /* trap already set */
   cl = clLvalue(s2v(ci->func));
   k = cl->p->k;
+  icache = cl->p->icache;
   pc = ci->u.l.savedpc;
   if (l_unlikely(trap)) {
-    if (pc == cl->p->code) {  /* first instruction (not resuming)? */
+    if (pc == cl->p->qcode) {  /* first instruction (not resuming)? */
       if (cl->p->is_vararg)
         trap = 0;  /* hooks will start after VARARGPREP instruction */
       else  /* check 'call' hook */
@@ -1161,6 +1699,7 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
     ci->u.l.trap = 1;  /* assume trap is on, for now */
   }
   base = ci->func + 1;
+  jitrun(pc == cl->p->qcode);
   /* main loop of interpreter */
   for (;;) {
     Instruction i;  /* instruction being executed */
@@ -1174,6 +1713,7 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
     lua_assert(base <= L->top && L->top < L->stack_last);
     /* invalidate top for instructions not expecting it */
     lua_assert(isIT(i) || (cast_void(L->top = base), 1));
+   redispatch:  /* deoptimized instructions restart here */
     vmdispatch (GET_OPCODE(i)) {
       vmcase(OP_MOVE) {
         setobjs2s(L, ra, RB(i));
@@ -1225,428 +1765,21 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         setobj2s(L, ra, cl->upvals[b]->v);
         vmbreak;
       }
-      vmcase(OP_SETUPVAL) {
-        UpVal *uv = cl->upvals[GETARG_B(i)];
-        setobj(L, uv->v, s2v(ra));
-        luaC_barrier(L, uv, s2v(ra));
-        vmbreak;
-      }
-      vmcase(OP_GETTABUP) {
-        const TValue *slot;
-        TValue *upval = cl->upvals[GETARG_B(i)]->v;
-        TValue *rc = KC(i);
-        TString *key = tsvalue(rc);  /* key must be a string */
-        if (luaV_fastget(L, upval, key, slot, luaH_getshortstr)) {
-          setobj2s(L, ra, slot);
-        }
-        else
-          Protect(luaV_finishget(L, upval, rc, ra, slot));
-        vmbreak;
-      }
-      vmcase(OP_GETTABLE) {
-        const TValue *slot;
-        TValue *rb = vRB(i);
-        TValue *rc = vRC(i);
-        lua_Unsigned n;
-        if (ttisinteger(rc)  /* fast track for integers? */
-            ? (cast_void(n = ivalue(rc)), luaV_fastgeti(L, rb, n, slot))
-            : luaV_fastget(L, rb, rc, slot, luaH_get)) {
-          setobj2s(L, ra, slot);
-        }
-        else
-          Protect(luaV_finishget(L, rb, rc, ra, slot));
-        vmbreak;
-      }
-      vmcase(OP_GETI) {
-        const TValue *slot;
-        TValue *rb = vRB(i);
-        int c = GETARG_C(i);
-        if (luaV_fastgeti(L, rb, c, slot)) {
-          setobj2s(L, ra, slot);
-        }
-        else {
-          TValue key;
-          setivalue(&key, c);
-          Protect(luaV_finishget(L, rb, &key, ra, slot));
-        }
-        vmbreak;
-      }
-      vmcase(OP_GETFIELD) {
-        const TValue *slot;
-        TValue *rb = vRB(i);
-        TValue *rc = KC(i);
-        TString *key = tsvalue(rc);  /* key must be a string */
-        if (luaV_fastget(L, rb, key, slot, luaH_getshortstr)) {
-          setobj2s(L, ra, slot);
-        }
-        else
-          Protect(luaV_finishget(L, rb, rc, ra, slot));
-        vmbreak;
-      }
-      vmcase(OP_SETTABUP) {
-        const TValue *slot;
-        TValue *upval = cl->upvals[GETARG_A(i)]->v;
-        TValue *rb = KB(i);
-        TValue *rc = RKC(i);
-        TString *key = tsvalue(rb);  /* key must be a string */
-        if (luaV_fastget(L, upval, key, slot, luaH_getshortstr)) {
-          luaV_finishfastset(L, upval, slot, rc);
-        }
-        else
-          Protect(luaV_finishset(L, upval, rb, rc, slot));
-        vmbreak;
-      }
-      vmcase(OP_SETTABLE) {
-        const TValue *slot;
-        TValue *rb = vRB(i);  /* key (table is in 'ra') */
-        TValue *rc = RKC(i);  /* value */
-        lua_Unsigned n;
-        if (ttisinteger(rb)  /* fast track for integers? */
-            ? (cast_void(n = ivalue(rb)), luaV_fastgeti(L, s2v(ra), n, slot))
-            : luaV_fastget(L, s2v(ra), rb, slot, luaH_get)) {
-          luaV_finishfastset(L, s2v(ra), slot, rc);
-        }
-        else
-          Protect(luaV_finishset(L, s2v(ra), rb, rc, slot));
-        vmbreak;
-      }
-      vmcase(OP_SETI) {
-        const TValue *slot;
-        int c = GETARG_B(i);
-        TValue *rc = RKC(i);
-        if (luaV_fastgeti(L, s2v(ra), c, slot)) {
-          luaV_finishfastset(L, s2v(ra), slot, rc);
-        }
-        else {
-          TValue key;
-          setivalue(&key, c);
-          Protect(luaV_finishset(L, s2v(ra), &key, rc, slot));
-        }
-        vmbreak;
-      }
-      vmcase(OP_SETFIELD) {
-        const TValue *slot;
-        TValue *rb = KB(i);
-        TValue *rc = RKC(i);
-        TString *key = tsvalue(rb);  /* key must be a string */
-        if (luaV_fastget(L, s2v(ra), key, slot, luaH_getshortstr)) {
-          luaV_finishfastset(L, s2v(ra), slot, rc);
-        }
-        else
-          Protect(luaV_finishset(L, s2v(ra), rb, rc, slot));
-        vmbreak;
-      }
-      vmcase(OP_NEWTABLE) {
-        int b = GETARG_B(i);  /* log2(hash size) + 1 */
-        int c = GETARG_C(i);  /* array size */
-        Table *t;
-        if (b > 0)
-          b = 1 << (b - 1);  /* size is 2^(b - 1) */
-        lua_assert((!TESTARG_k(i)) == (GETARG_Ax(*pc) == 0));
-        if (TESTARG_k(i))  /* non-zero extra argument? */
-          c += GETARG_Ax(*pc) * (MAXARG_C + 1);  /* add it to size */
-        pc++;  /* skip extra argument */
-        L->top = ra + 1;  /* correct top in case of emergency GC */
-        t = luaH_new(L);  /* memory allocation */
-        sethvalue2s(L, ra, t);
-        if (b != 0 || c != 0)
-          luaH_resize(L, t, c, b);  /* idem */
-        checkGC(L, ra + 1);
-        vmbreak;
-      }
-      vmcase(OP_SELF) {
-        const TValue *slot;
-        TValue *rb = vRB(i);
-        TValue *rc = RKC(i);
-        TString *key = tsvalue(rc);  /* key must be a string */
-        setobj2s(L, ra + 1, rb);
-        if (luaV_fastget(L, rb, key, slot, luaH_getstr)) {
-          setobj2s(L, ra, slot);
-        }
-        else
-          Protect(luaV_finishget(L, rb, rc, ra, slot));
-        vmbreak;
-      }
-      vmcase(OP_ADDI) {
-        op_arithI(L, l_addi, luai_numadd);
-        vmbreak;
-      }
-      vmcase(OP_ADDK) {
-        op_arithK(L, l_addi, luai_numadd);
-        vmbreak;
-      }
-      vmcase(OP_SUBK) {
-        op_arithK(L, l_subi, luai_numsub);
-        vmbreak;
-      }
-      vmcase(OP_MULK) {
-        op_arithK(L, l_muli, luai_nummul);
-        vmbreak;
-      }
-      vmcase(OP_MODK) {
-        op_arithK(L, luaV_mod, luaV_modf);
-        vmbreak;
-      }
-      vmcase(OP_POWK) {
-        op_arithfK(L, luai_numpow);
-        vmbreak;
-      }
-      vmcase(OP_DIVK) {
-        op_arithfK(L, luai_numdiv);
-        vmbreak;
-      }
-      vmcase(OP_IDIVK) {
-        op_arithK(L, luaV_idiv, luai_numidiv);
-        vmbreak;
-      }
-      vmcase(OP_BANDK) {
-        op_bitwiseK(L, l_band);
-        vmbreak;
-      }
-      vmcase(OP_BORK) {
-        op_bitwiseK(L, l_bor);
-        vmbreak;
-      }
-      vmcase(OP_BXORK) {
-        op_bitwiseK(L, l_bxor);
-        vmbreak;
-      }
-      vmcase(OP_SHRI) {
-        TValue *rb = vRB(i);
-        int ic = GETARG_sC(i);
-        lua_Integer ib;
-        if (tointegerns(rb, &ib)) {
-          pc++; setivalue(s2v(ra), luaV_shiftl(ib, -ic));
-        }
-        vmbreak;
-      }
-      vmcase(OP_SHLI) {
-        TValue *rb = vRB(i);
-        int ic = GETARG_sC(i);
-        lua_Integer ib;
-        if (tointegerns(rb, &ib)) {
-          pc++; setivalue(s2v(ra), luaV_shiftl(ic, ib));
-        }
-        vmbreak;
-      }
-      vmcase(OP_ADD) {
-        op_arith(L, l_addi, luai_numadd);
-        vmbreak;
-      }
-      vmcase(OP_SUB) {
-        op_arith(L, l_subi, luai_numsub);
-        vmbreak;
-      }
-      vmcase(OP_MUL) {
-        op_arith(L, l_muli, luai_nummul);
-        vmbreak;
-      }
-      vmcase(OP_MOD) {
-        op_arith(L, luaV_mod, luaV_modf);
-        vmbreak;
-      }
-      vmcase(OP_POW) {
-        op_arithf(L, luai_numpow);
-        vmbreak;
-      }
-      vmcase(OP_DIV) {  /* float division (always with floats) */
-        op_arithf(L, luai_numdiv);
-        vmbreak;
-      }
-      vmcase(OP_IDIV) {  /* floor division */
-        op_arith(L, luaV_idiv, luai_numidiv);
-        vmbreak;
-      }
-      vmcase(OP_BAND) {
-        op_bitwise(L, l_band);
-        vmbreak;
-      }
-      vmcase(OP_BOR) {
-        op_bitwise(L, l_bor);
-        vmbreak;
-      }
-      vmcase(OP_BXOR) {
-        op_bitwise(L, l_bxor);
-        vmbreak;
-      }
-      vmcase(OP_SHR) {
-        op_bitwise(L, luaV_shiftr);
-        vmbreak;
-      }
-      vmcase(OP_SHL) {
-        op_bitwise(L, luaV_shiftl);
-        vmbreak;
-      }
-      vmcase(OP_MMBIN) {
-        Instruction pi = *(pc - 2);  /* original arith. expression */
-        TValue *rb = vRB(i);
-        TMS tm = (TMS)GETARG_C(i);
-        StkId result = RA(pi);
-        lua_assert(OP_ADD <= GET_OPCODE(pi) && GET_OPCODE(pi) <= OP_SHR);
-        Protect(luaT_trybinTM(L, s2v(ra), rb, result, tm));
-        vmbreak;
-      }
-      vmcase(OP_MMBINI) {
-        Instruction pi = *(pc - 2);  /* original arith. expression */
-        int imm = GETARG_sB(i);
-        TMS tm = (TMS)GETARG_C(i);
-        int flip = GETARG_k(i);
-        StkId result = RA(pi);
-        Protect(luaT_trybiniTM(L, s2v(ra), imm, flip, result, tm));
-        vmbreak;
-      }
-      vmcase(OP_MMBINK) {
-        Instruction pi = *(pc - 2);  /* original arith. expression */
-        TValue *imm = KB(i);
-        TMS tm = (TMS)GETARG_C(i);
-        int flip = GETARG_k(i);
-        StkId result = RA(pi);
-        Protect(luaT_trybinassocTM(L, s2v(ra), imm, flip, result, tm));
-        vmbreak;
-      }
-      vmcase(OP_UNM) {
-        TValue *rb = vRB(i);
-        lua_Number nb;
-        if (ttisinteger(rb)) {
-          lua_Integer ib = ivalue(rb);
-          setivalue(s2v(ra), intop(-, 0, ib));
-        }
-        else if (tonumberns(rb, nb)) {
-          setfltvalue(s2v(ra), luai_numunm(L, nb));
-        }
-        else
-          Protect(luaT_trybinTM(L, rb, rb, ra, TM_UNM));
-        vmbreak;
-      }
-      vmcase(OP_BNOT) {
-        TValue *rb = vRB(i);
-        lua_Integer ib;
-        if (tointegerns(rb, &ib)) {
-          setivalue(s2v(ra), intop(^, ~l_castS2U(0), ib));
-        }
-        else
-          Protect(luaT_trybinTM(L, rb, rb, ra, TM_BNOT));
-        vmbreak;
-      }
-      vmcase(OP_NOT) {
-        TValue *rb = vRB(i);
-        if (l_isfalse(rb))
-          setbtvalue(s2v(ra));
-        else
-          setbfvalue(s2v(ra));
-        vmbreak;
-      }
-      vmcase(OP_LEN) {
-        Protect(luaV_objlen(L, ra, vRB(i)));
-        vmbreak;
-      }
-      vmcase(OP_CONCAT) {
-        int n = GETARG_B(i);  /* number of elements to concatenate */
-        L->top = ra + n;  /* mark the end of concat operands */
-        ProtectNT(luaV_concat(L, n));
-        checkGC(L, L->top); /* 'luaV_concat' ensures correct top */
-        vmbreak;
-      }
-      vmcase(OP_CLOSE) {
-        Protect(luaF_close(L, ra, LUA_OK, 1));
-        vmbreak;
-      }
-      vmcase(OP_TBC) {
-        /* create new to-be-closed upvalue */
-        halfProtect(luaF_newtbcupval(L, ra));
-        vmbreak;
-      }
+#include "lvmops.h"
+
       vmcase(OP_JMP) {
         dojump(ci, i, 0);
-        vmbreak;
-      }
-      vmcase(OP_EQ) {
-        int cond;
-        TValue *rb = vRB(i);
-        Protect(cond = luaV_equalobj(L, s2v(ra), rb));
-        docondjump();
-        vmbreak;
-      }
-      vmcase(OP_LT) {
-        op_order(L, l_lti, LTnum, lessthanothers);
-        vmbreak;
-      }
-      vmcase(OP_LE) {
-        op_order(L, l_lei, LEnum, lessequalothers);
-        vmbreak;
-      }
-      vmcase(OP_EQK) {
-        TValue *rb = KB(i);
-        /* basic types do not use '__eq'; we can use raw equality */
-        int cond = luaV_rawequalobj(s2v(ra), rb);
-        docondjump();
-        vmbreak;
-      }
-      vmcase(OP_EQI) {
-        int cond;
-        int im = GETARG_sB(i);
-        if (ttisinteger(s2v(ra)))
-          cond = (ivalue(s2v(ra)) == im);
-        else if (ttisfloat(s2v(ra)))
-          cond = luai_numeq(fltvalue(s2v(ra)), cast_num(im));
-        else
-          cond = 0;  /* other types cannot be equal to a number */
-        docondjump();
-        vmbreak;
-      }
-      vmcase(OP_LTI) {
-        op_orderI(L, l_lti, luai_numlt, 0, TM_LT);
-        vmbreak;
-      }
-      vmcase(OP_LEI) {
-        op_orderI(L, l_lei, luai_numle, 0, TM_LE);
-        vmbreak;
-      }
-      vmcase(OP_GTI) {
-        op_orderI(L, l_gti, luai_numgt, 1, TM_LT);
-        vmbreak;
-      }
-      vmcase(OP_GEI) {
-        op_orderI(L, l_gei, luai_numge, 1, TM_LE);
-        vmbreak;
-      }
-      vmcase(OP_TEST) {
-        int cond = !l_isfalse(s2v(ra));
-        docondjump();
-        vmbreak;
-      }
-      vmcase(OP_TESTSET) {
-        TValue *rb = vRB(i);
-        if (l_isfalse(rb) == GETARG_k(i))
-          pc++;
-        else {
-          setobj2s(L, ra, rb);
-          donextjump(ci);
-        }
-        vmbreak;
-      }
-      vmcase(OP_CALL) {
-        CallInfo *newci;
-        int b = GETARG_B(i);
-        int nresults = GETARG_C(i) - 1;
-        if (b != 0)  /* fixed number of arguments? */
-          L->top = ra + b;  /* top signals number of arguments */
-        /* else previous instruction set top */
-        savepc(L);  /* in case of errors */
-        if ((newci = luaD_precall(L, ra, nresults)) == NULL)
-          updatetrap(ci);  /* C call; nothing else to be done */
-        else {  /* Lua call: run function in this same C frame */
-          ci = newci;
-          goto startfunc;
-        }
+        if (GETARG_sJ(i) < 0)  /* loop? */
+          jitrun(1);
         vmbreak;
       }
       vmcase(OP_TAILCALL) {
-        int b = GETARG_B(i);  /* number of arguments + 1 (function) */
-        int n;  /* number of results when calling a C function */
-        int nparams1 = GETARG_C(i);
+        int b, n, nparams1, delta;
+       tailcall:
+        b = GETARG_B(i);  /* number of arguments + 1 (function) */
+        nparams1 = GETARG_C(i);
         /* delta is virtual 'func' - real 'func' (vararg functions) */
-        int delta = (nparams1) ? ci->u.l.nextraargs + nparams1 : 0;
+        delta = (nparams1) ? ci->u.l.nextraargs + nparams1 : 0;
         if (b != 0)
           L->top = ra + b;
         else  /* previous instruction set top */
@@ -1667,8 +1800,10 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         }
       }
       vmcase(OP_RETURN) {
-        int n = GETARG_B(i) - 1;  /* number of results */
-        int nparams1 = GETARG_C(i);
+        int n, nparams1;
+       doreturn:
+        n = GETARG_B(i) - 1;  /* number of results */
+        nparams1 = GETARG_C(i);
         if (n < 0)  /* not fixed? */
           n = cast_int(L->top - ra);  /* get what is available */
         savepc(ci);
@@ -1730,107 +1865,90 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
           goto returning;  /* continue running caller in this frame */
         }
       }
-      vmcase(OP_FORLOOP) {
-        if (ttisinteger(s2v(ra + 2))) {  /* integer loop? */
-          lua_Unsigned count = l_castS2U(ivalue(s2v(ra + 1)));
-          if (count > 0) {  /* still more iterations? */
-            lua_Integer step = ivalue(s2v(ra + 2));
-            lua_Integer idx = ivalue(s2v(ra));  /* internal index */
-            chgivalue(s2v(ra + 1), count - 1);  /* update counter */
-            idx = intop(+, idx, step);  /* add step to index */
-            chgivalue(s2v(ra), idx);  /* update internal index */
-            setivalue(s2v(ra + 3), idx);  /* and control variable */
-            pc -= GETARG_Bx(i);  /* jump back */
-          }
-        }
-        else if (floatforloop(ra))  /* float loop */
-          pc -= GETARG_Bx(i);  /* jump back */
-        updatetrap(ci);  /* allows a signal to break the loop */
+      vmcase(OP_EXTRAARG) {
+        lua_assert(0);
         vmbreak;
       }
-      vmcase(OP_FORPREP) {
-        savestate(L, ci);  /* in case of errors */
-        if (forprep(L, ra))
-          pc += GETARG_Bx(i) + 1;  /* skip the loop */
+      vmcase(OP_ADD_II) {
+        op_arithQ(L, ttisinteger, ivalue, setivalue, l_addi, OP_ADD);
         vmbreak;
       }
-      vmcase(OP_TFORPREP) {
-        /* create to-be-closed upvalue (if needed) */
-        halfProtect(luaF_newtbcupval(L, ra + 3));
-        pc += GETARG_Bx(i);
-        i = *(pc++);  /* go to next instruction */
-        lua_assert(GET_OPCODE(i) == OP_TFORCALL && ra == RA(i));
-        goto l_tforcall;
+      vmcase(OP_ADD_FF) {
+        op_arithQ(L, ttisfloat, fltvalue, setfltvalue, luai_numadd, OP_ADD);
+        vmbreak;
       }
-      vmcase(OP_TFORCALL) {
-       l_tforcall:
-        /* 'ra' has the iterator function, 'ra + 1' has the state,
-           'ra + 2' has the control variable, and 'ra + 3' has the
-           to-be-closed variable. The call will use the stack after
-           these values (starting at 'ra + 4')
-        */
-        /* push function, state, and control variable */
-        memcpy(ra + 4, ra, 3 * sizeof(*ra));
-        L->top = ra + 4 + 3;
-        ProtectNT(luaD_call(L, ra + 4, GETARG_C(i)));  /* do the call */
-        updatestack(ci);  /* stack may have changed */
-        i = *(pc++);  /* go to next instruction */
-        lua_assert(GET_OPCODE(i) == OP_TFORLOOP && ra == RA(i));
-        goto l_tforloop;
+      vmcase(OP_SUB_II) {
+        op_arithQ(L, ttisinteger, ivalue, setivalue, l_subi, OP_SUB);
+        vmbreak;
       }
-      vmcase(OP_TFORLOOP) {
-        l_tforloop:
-        if (!ttisnil(s2v(ra + 4))) {  /* continue loop? */
-          setobjs2s(L, ra + 2, ra + 4);  /* save control variable */
-          pc -= GETARG_Bx(i);  /* jump back */
-        }
+      vmcase(OP_SUB_FF) {
+        op_arithQ(L, ttisfloat, fltvalue, setfltvalue, luai_numsub, OP_SUB);
         vmbreak;
       }
-      vmcase(OP_SETLIST) {
-        int n = GETARG_B(i);
-        unsigned int last = GETARG_C(i);
-        Table *h = hvalue(s2v(ra));
-        if (n == 0)
-          n = cast_int(L->top - ra) - 1;  /* get up to the top */
-        else
-          L->top = ci->top;  /* correct top in case of emergency GC */
-        last += n;
-        if (TESTARG_k(i)) {
-          last += GETARG_Ax(*pc) * (MAXARG_C + 1);
-          pc++;
-        }
-        if (last > luaH_realasize(h))  /* needs more space? */
-          luaH_resizearray(L, h, last);  /* preallocate it at once */
-        for (; n > 0; n--) {
-          TValue *val = s2v(ra + n);
-          setobj2t(L, &h->array[last - 1], val);
-          last--;
-          luaC_barrierback(L, obj2gco(h), val);
-        }
+      vmcase(OP_MUL_II) {
+        op_arithQ(L, ttisinteger, ivalue, setivalue, l_muli, OP_MUL);
+        vmbreak;
+      }
+      vmcase(OP_MUL_FF) {
+        op_arithQ(L, ttisfloat, fltvalue, setfltvalue, luai_nummul, OP_MUL);
+        vmbreak;
+      }
+      vmcase(OP_DIV_FF) {
+        op_arithQ(L, ttisfloat, fltvalue, setfltvalue, luai_numdiv, OP_DIV);
+        vmbreak;
+      }
+      vmcase(OP_LT_II) {
+        op_orderQ(L, ttisinteger, ivalue, l_lti, OP_LT);
+        vmbreak;
+      }
+      vmcase(OP_LT_FF) {
+        op_orderQ(L, ttisfloat, fltvalue, luai_numlt, OP_LT);
         vmbreak;
       }
-      vmcase(OP_CLOSURE) {
-        Proto *p = cl->p->p[GETARG_Bx(i)];
-        halfProtect(pushclosure(L, p, cl->upvals, base, ra));
-        checkGC(L, ra + 1);
+      vmcase(OP_LE_II) {
+        op_orderQ(L, ttisinteger, ivalue, l_lei, OP_LE);
         vmbreak;
       }
-      vmcase(OP_VARARG) {
-        int n = GETARG_C(i) - 1;  /* required results */
-        Protect(luaT_getvarargs(L, ci, ra, n));
+      vmcase(OP_LE_FF) {
+        op_orderQ(L, ttisfloat, fltvalue, luai_numle, OP_LE);
         vmbreak;
       }
-      vmcase(OP_VARARGPREP) {
-        ProtectNT(luaT_adjustvarargs(L, GETARG_A(i), ci, cl->p));
-        if (l_unlikely(trap)) {  /* previous "Protect" updated trap */
-          luaD_hookcall(L, ci);
-          L->oldpc = 1;  /* next opcode will be seen as a "new" line */
+      vmcase(OP_GETTABLE_ARRAYINT) {
+        const TValue *slot;
+        TValue *rb = vRB(i);
+        TValue *rc = vRC(i);
+        if (l_likely(ttistable(rb) && ttisinteger(rc))) {
+          Table *h = hvalue(rb);
+          lua_Integer n = ivalue(rc);
+          slot = (l_castS2U(n) - 1u < h->alimit) ? &h->array[n - 1]
+                                                 : luaH_getint(h, n);
+          if (!isempty(slot)) {
+            setobj2s(L, ra, slot);
+          }
+          else
+            Protect(luaV_finishget(L, rb, rc, ra, slot));
         }
-        updatebase(ci);  /* function has new base after adjustment */
+        else
+          deoptimize(OP_GETTABLE);
         vmbreak;
       }
-      vmcase(OP_EXTRAARG) {
-        lua_assert(0);
+      vmcase(OP_SETTABLE_ARRAYINT) {
+        const TValue *slot;
+        TValue *rb = vRB(i);  /* key (table is in 'ra') */
+        TValue *rc = RKC(i);  /* value */
+        if (l_likely(ttistable(s2v(ra)) && ttisinteger(rb))) {
+          Table *h = hvalue(s2v(ra));
+          lua_Integer n = ivalue(rb);
+          slot = (l_castS2U(n) - 1u < h->alimit) ? &h->array[n - 1]
+                                                 : luaH_getint(h, n);
+          if (!isempty(slot)) {
+            luaV_finishfastset(L, s2v(ra), slot, rc);
+          }
+          else
+            Protect(luaV_finishset(L, s2v(ra), rb, rc, slot));
+        }
+        else
+          deoptimize(OP_SETTABLE);
         vmbreak;
       }
     }
@@ -1838,3 +1956,126 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
 }
 
 /* }================================================================== */
+
+
+/*
+** {==================================================================
+** Helpers for compiled code
+** ===================================================================
+*/
+
+#if defined(LUA_USE_JIT)
+
+/*
+** Code compiled by 'ljit.c' calls these helpers for the instructions
+** (or the slow paths of the instructions) it does not implement
+** itself. Each helper executes instruction 'i', whose following
+** instruction is at 'pc', with the case of 'luaV_execute' for it (see
+** 'lvmops.h') and returns the next 'pc'. A test does not follow its
+** jump: it returns the address of that jump, which the compiled code
+** then executes. An instruction that goes on with the following one
+** (as OP_TFORCALL does with OP_TFORLOOP) returns the address of that
+** instruction. OP_CALL returns NULL when it enters a Lua function,
+** which the compiled code leaves to the interpreter.
+*/
+
+#undef donextjump
+#define donextjump(ci)	((void)0)
+
+#undef jitrun
+#define jitrun(n)	((void)0)
+
+#undef quicken
+#define quicken(op)	((void)0)
+
+#undef quickennum
+#define quickennum(v1,v2,opii,opff)	((void)0)
+
+#undef vmenter
+#define vmenter(nci)	return NULL
+
+#undef vmgoto
+#define vmgoto(op,l)	vmbreak
+
+#undef vmlabel
+#define vmlabel(l)	/* empty */
+
+#undef vmforward
+#define vmforward()	((void)0)
+
+#undef vmdispatch
+#undef vmcase
+#undef vmbreak
+#define vmdispatch(o)	switch(o)
+#define vmcase(l)	case l:
+#define vmbreak		break
+
+
+/* the opcodes that have helpers: all the cases in 'lvmops.h' */
+#define jitops(_)  \
+  _(OP_SETUPVAL) _(OP_GETTABUP) _(OP_GETTABLE) _(OP_GETI) _(OP_GETFIELD)  \
+  _(OP_SETTABUP) _(OP_SETTABLE) _(OP_SETI) _(OP_SETFIELD) _(OP_NEWTABLE)  \
+  _(OP_SELF) _(OP_ADDI) _(OP_ADDK) _(OP_SUBK) _(OP_MULK) _(OP_MODK)  \
+  _(OP_POWK) _(OP_DIVK) _(OP_IDIVK) _(OP_BANDK) _(OP_BORK) _(OP_BXORK)  \
+  _(OP_SHRI) _(OP_SHLI) _(OP_ADD) _(OP_SUB) _(OP_MUL) _(OP_MOD) _(OP_POW)  \
+  _(OP_DIV) _(OP_IDIV) _(OP_BAND) _(OP_BOR) _(OP_BXOR) _(OP_SHL) _(OP_SHR)  \
+  _(OP_MMBIN) _(OP_MMBINI) _(OP_MMBINK) _(OP_UNM) _(OP_BNOT) _(OP_NOT)  \
+  _(OP_LEN) _(OP_CONCAT) _(OP_CLOSE) _(OP_TBC) _(OP_EQ) _(OP_LT) _(OP_LE)  \
+  _(OP_EQK) _(OP_EQI) _(OP_LTI) _(OP_LEI) _(OP_GTI) _(OP_GEI) _(OP_TEST)  \
+  _(OP_TESTSET) _(OP_CALL) _(OP_FORLOOP) _(OP_FORPREP) _(OP_TFORPREP)  \
+  _(OP_TFORCALL) _(OP_TFORLOOP) _(OP_SETLIST) _(OP_CLOSURE) _(OP_VARARG)  \
+  _(OP_VARARGPREP)
+
+
+/*
+** Each helper is a copy of 'jitexec' for a constant 'op', so it must
+** be inlined for the switch to go away.
+*/
+#if defined(__GNUC__)
+#define jitinline	l_sinline __attribute__((always_inline))
+#else
+#define jitinline	l_sinline
+#endif
+
+jitinline const Instruction *jitexec (lua_State *L, CallInfo *ci,
+                                      const Instruction *pc, Instruction i,
+                                      OpCode op) {
+  /* local state that the cases of 'luaV_execute' use */
+  LClosure *cl = clLvalue(s2v(ci->func));
+  TValue *k = cl->p->k;
+  unsigned int *icache = cl->p->icache;
+  StkId base = ci->func + 1;
+  StkId ra = RA(i);
+  int trap = 0;
+  UNUSED(k); UNUSED(icache);
+  vmdispatch (op) {
+#include "lvmops.h"
+    default: lua_assert(0);
+  }
+  return pc;
+}
+
+
+#define jithelper(op)  \
+  static const Instruction *jit_##op (lua_State *L, CallInfo *ci,  \
+                                     const Instruction *pc, Instruction i)  \
+    { return jitexec(L, ci, pc, i, op); }
+
+jitops(jithelper)
+
+
+#define jitcase(op)	case op: return jit_##op;
+
+/*
+** Helper for opcode 'op', or NULL if only the interpreter can run it.
+*/
+luaV_Helper luaV_jithelper (int op) {
+  switch (op) {
+    jitops(jitcase)
+    default: return NULL;
+  }
+}
+
+#endif
+
+/* }================================================================== */
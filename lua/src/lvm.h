@@ -107,6 +107,7 @@ typedef enum {
 */
 #define luaV_finishfastset(L,t,slot,v) \
     { setobj2t(L, cast(TValue *,slot), v); \
+      invalidatechains(L, hvalue(t)); \
       luaC_barrierback(L, gcvalue(t), v); }
 
 
@@ -115,6 +116,7 @@ typedef enum {
 LUAI_FUNC int luaV_equalobj (lua_State *L, const TValue *t1, const TValue *t2);
 LUAI_FUNC int luaV_lessthan (lua_State *L, const TValue *l, const TValue *r);
 LUAI_FUNC int luaV_lessequal (lua_State *L, const TValue *l, const TValue *r);
+LUAI_FUNC int luaV_sortarray (lua_State *L, Table *t, unsigned int n);
 LUAI_FUNC int luaV_tonumber_ (const TValue *obj, lua_Number *n);
 LUAI_FUNC int luaV_tointeger (const TValue *obj, lua_Integer *p, F2Imod mode);
 LUAI_FUNC int luaV_tointegerns (const TValue *obj, lua_Integer *p,
@@ -133,4 +135,12 @@ LUAI_FUNC lua_Number luaV_modf (lua_State *L, lua_Number x, lua_Number y);
 LUAI_FUNC lua_Integer luaV_shiftl (lua_Integer x, lua_Integer y);
 LUAI_FUNC void luaV_objlen (lua_State *L, StkId ra, const TValue *rb);
 
+#if defined(LUA_USE_JIT)
+/* executes one instruction for compiled code (see 'ljit.c') */
+typedef const Instruction *(*luaV_Helper) (lua_State *L, CallInfo *ci,
+                                           const Instruction *pc,
+                                           Instruction i);
+LUAI_FUNC luaV_Helper luaV_jithelper (int op);
+#endif
+
 #endif
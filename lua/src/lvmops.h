@@ -0,0 +1,562 @@
+/*
+** $Id: lvmops.h $
+** Opcode cases shared by the Lua interpreter and the helpers for
+** compiled code
+** See Copyright Notice in lua.h
+*/
+
+/*
+** This file is included inside the opcode switch of 'luaV_execute'
+** and of 'jitexec' (see 'lvm.c'), so that both always execute these
+** instructions the same way. It uses the local state and the macros
+** of the including function, plus 'vmenter', 'vmgoto', 'vmlabel',
+** and 'vmforward'.
+*/
+
+vmcase(OP_SETUPVAL) {
+  UpVal *uv = cl->upvals[GETARG_B(i)];
+  setobj(L, uv->v, s2v(ra));
+  luaC_barrier(L, uv, s2v(ra));
+  vmbreak;
+}
+vmcase(OP_GETTABUP) {
+  const TValue *slot;
+  const TValue *res;
+  TValue *upval = cl->upvals[GETARG_B(i)]->v;
+  TValue *rc = KC(i);
+  TString *key = tsvalue(rc);  /* key must be a string */
+  if (icfastget(upval, key, slot, IC())) {
+    setobj2s(L, ra, slot);
+  }
+  else if ((res = icindex(L, upval, key)) != NULL) {
+    setobj2s(L, ra, res);
+  }
+  else
+    Protect(luaV_finishget(L, upval, rc, ra, slot));
+  vmbreak;
+}
+vmcase(OP_GETTABLE) {
+  const TValue *slot;
+  TValue *rb = vRB(i);
+  TValue *rc = vRC(i);
+  lua_Unsigned n;
+  if (ttistable(rb) && ttisinteger(rc))
+    quicken(OP_GETTABLE_ARRAYINT);
+  if (ttisinteger(rc)  /* fast track for integers? */
+      ? (cast_void(n = ivalue(rc)), luaV_fastgeti(L, rb, n, slot))
+      : luaV_fastget(L, rb, rc, slot, luaH_get)) {
+    setobj2s(L, ra, slot);
+  }
+  else
+    Protect(luaV_finishget(L, rb, rc, ra, slot));
+  vmbreak;
+}
+vmcase(OP_GETI) {
+  const TValue *slot;
+  TValue *rb = vRB(i);
+  int c = GETARG_C(i);
+  if (luaV_fastgeti(L, rb, c, slot)) {
+    setobj2s(L, ra, slot);
+  }
+  else {
+    TValue key;
+    setivalue(&key, c);
+    Protect(luaV_finishget(L, rb, &key, ra, slot));
+  }
+  vmbreak;
+}
+vmcase(OP_GETFIELD) {
+  const TValue *slot;
+  const TValue *res;
+  TValue *rb = vRB(i);
+  TValue *rc = KC(i);
+  TString *key = tsvalue(rc);  /* key must be a string */
+  if (icfastget(rb, key, slot, IC())) {
+    setobj2s(L, ra, slot);
+  }
+  else if ((res = icindex(L, rb, key)) != NULL) {
+    setobj2s(L, ra, res);
+  }
+  else
+    Protect(luaV_finishget(L, rb, rc, ra, slot));
+  vmbreak;
+}
+vmcase(OP_SETTABUP) {
+  const TValue *slot;
+  TValue *upval = cl->upvals[GETARG_A(i)]->v;
+  TValue *rb = KB(i);
+  TValue *rc = RKC(i);
+  TString *key = tsvalue(rb);  /* key must be a string */
+  if (icfastget(upval, key, slot, IC())) {
+    luaV_finishfastset(L, upval, slot, rc);
+  }
+  else
+    Protect(luaV_finishset(L, upval, rb, rc, slot));
+  vmbreak;
+}
+vmcase(OP_SETTABLE) {
+  const TValue *slot;
+  TValue *rb = vRB(i);  /* key (table is in 'ra') */
+  TValue *rc = RKC(i);  /* value */
+  lua_Unsigned n;
+  if (ttistable(s2v(ra)) && ttisinteger(rb))
+    quicken(OP_SETTABLE_ARRAYINT);
+  if (ttisinteger(rb)  /* fast track for integers? */
+      ? (cast_void(n = ivalue(rb)), luaV_fastgeti(L, s2v(ra), n, slot))
+      : luaV_fastget(L, s2v(ra), rb, slot, luaH_get)) {
+    luaV_finishfastset(L, s2v(ra), slot, rc);
+  }
+  else
+    Protect(luaV_finishset(L, s2v(ra), rb, rc, slot));
+  vmbreak;
+}
+vmcase(OP_SETI) {
+  const TValue *slot;
+  int c = GETARG_B(i);
+  TValue *rc = RKC(i);
+  if (luaV_fastgeti(L, s2v(ra), c, slot)) {
+    luaV_finishfastset(L, s2v(ra), slot, rc);
+  }
+  else {
+    TValue key;
+    setivalue(&key, c);
+    Protect(luaV_finishset(L, s2v(ra), &key, rc, slot));
+  }
+  vmbreak;
+}
+vmcase(OP_SETFIELD) {
+  const TValue *slot;
+  TValue *rb = KB(i);
+  TValue *rc = RKC(i);
+  TString *key = tsvalue(rb);  /* key must be a string */
+  if (icfastget(s2v(ra), key, slot, IC())) {
+    luaV_finishfastset(L, s2v(ra), slot, rc);
+  }
+  else
+    Protect(luaV_finishset(L, s2v(ra), rb, rc, slot));
+  vmbreak;
+}
+vmcase(OP_NEWTABLE) {
+  int b = GETARG_B(i);  /* log2(hash size) + 1 */
+  int c = GETARG_C(i);  /* array size */
+  Table *t;
+  if (b > 0)
+    b = 1 << (b - 1);  /* size is 2^(b - 1) */
+  lua_assert((!TESTARG_k(i)) == (GETARG_Ax(*pc) == 0));
+  if (TESTARG_k(i))  /* non-zero extra argument? */
+    c += GETARG_Ax(*pc) * (MAXARG_C + 1);  /* add it to size */
+  pc++;  /* skip extra argument */
+  L->top = ra + 1;  /* correct top in case of emergency GC */
+  t = luaH_new(L);  /* memory allocation */
+  sethvalue2s(L, ra, t);
+  if (b != 0 || c != 0)
+    luaH_resize(L, t, c, b);  /* idem */
+  checkGC(L, ra + 1);
+  vmbreak;
+}
+vmcase(OP_SELF) {
+  const TValue *slot;
+  TValue *rb = vRB(i);
+  TValue *rc = RKC(i);
+  TString *key = tsvalue(rc);  /* key must be a string */
+  setobj2s(L, ra + 1, rb);
+  if (ttisshrstring(rc)) {  /* usual case: cacheable key */
+    const TValue *res;
+    if (icfastget(rb, key, slot, IC())) {
+      setobj2s(L, ra, slot);
+    }
+    else if ((res = icindex(L, rb, key)) != NULL) {
+      setobj2s(L, ra, res);
+    }
+    else
+      Protect(luaV_finishget(L, rb, rc, ra, slot));
+  }
+  else if (luaV_fastget(L, rb, key, slot, luaH_getstr)) {
+    setobj2s(L, ra, slot);
+  }
+  else
+    Protect(luaV_finishget(L, rb, rc, ra, slot));
+  vmbreak;
+}
+vmcase(OP_ADDI) {
+  op_arithI(L, l_addi, luai_numadd);
+  vmbreak;
+}
+vmcase(OP_ADDK) {
+  op_arithK(L, l_addi, luai_numadd);
+  vmbreak;
+}
+vmcase(OP_SUBK) {
+  op_arithK(L, l_subi, luai_numsub);
+  vmbreak;
+}
+vmcase(OP_MULK) {
+  op_arithK(L, l_muli, luai_nummul);
+  vmbreak;
+}
+vmcase(OP_MODK) {
+  op_arithK(L, luaV_mod, luaV_modf);
+  vmbreak;
+}
+vmcase(OP_POWK) {
+  op_arithfK(L, luai_numpow);
+  vmbreak;
+}
+vmcase(OP_DIVK) {
+  op_arithfK(L, luai_numdiv);
+  vmbreak;
+}
+vmcase(OP_IDIVK) {
+  op_arithK(L, luaV_idiv, luai_numidiv);
+  vmbreak;
+}
+vmcase(OP_BANDK) {
+  op_bitwiseK(L, l_band);
+  vmbreak;
+}
+vmcase(OP_BORK) {
+  op_bitwiseK(L, l_bor);
+  vmbreak;
+}
+vmcase(OP_BXORK) {
+  op_bitwiseK(L, l_bxor);
+  vmbreak;
+}
+vmcase(OP_SHRI) {
+  TValue *rb = vRB(i);
+  int ic = GETARG_sC(i);
+  lua_Integer ib;
+  if (tointegerns(rb, &ib)) {
+    pc++; setivalue(s2v(ra), luaV_shiftl(ib, -ic));
+  }
+  vmbreak;
+}
+vmcase(OP_SHLI) {
+  TValue *rb = vRB(i);
+  int ic = GETARG_sC(i);
+  lua_Integer ib;
+  if (tointegerns(rb, &ib)) {
+    pc++; setivalue(s2v(ra), luaV_shiftl(ic, ib));
+  }
+  vmbreak;
+}
+vmcase(OP_ADD) {
+  quickennum(vRB(i), vRC(i), OP_ADD_II, OP_ADD_FF);
+  op_arith(L, l_addi, luai_numadd);
+  vmbreak;
+}
+vmcase(OP_SUB) {
+  quickennum(vRB(i), vRC(i), OP_SUB_II, OP_SUB_FF);
+  op_arith(L, l_subi, luai_numsub);
+  vmbreak;
+}
+vmcase(OP_MUL) {
+  quickennum(vRB(i), vRC(i), OP_MUL_II, OP_MUL_FF);
+  op_arith(L, l_muli, luai_nummul);
+  vmbreak;
+}
+vmcase(OP_MOD) {
+  op_arith(L, luaV_mod, luaV_modf);
+  vmbreak;
+}
+vmcase(OP_POW) {
+  op_arithf(L, luai_numpow);
+  vmbreak;
+}
+vmcase(OP_DIV) {  /* float division (always with floats) */
+  if (ttisfloat(vRB(i)) && ttisfloat(vRC(i)))
+    quicken(OP_DIV_FF);
+  op_arithf(L, luai_numdiv);
+  vmbreak;
+}
+vmcase(OP_IDIV) {  /* floor division */
+  op_arith(L, luaV_idiv, luai_numidiv);
+  vmbreak;
+}
+vmcase(OP_BAND) {
+  op_bitwise(L, l_band);
+  vmbreak;
+}
+vmcase(OP_BOR) {
+  op_bitwise(L, l_bor);
+  vmbreak;
+}
+vmcase(OP_BXOR) {
+  op_bitwise(L, l_bxor);
+  vmbreak;
+}
+vmcase(OP_SHR) {
+  op_bitwise(L, luaV_shiftr);
+  vmbreak;
+}
+vmcase(OP_SHL) {
+  op_bitwise(L, luaV_shiftl);
+  vmbreak;
+}
+vmcase(OP_MMBIN) {
+  Instruction pi = *(pc - 2);  /* original arith. expression */
+  TValue *rb = vRB(i);
+  TMS tm = (TMS)GETARG_C(i);
+  StkId result = RA(pi);
+  /* (compiled code may come here from a quickened instruction) */
+  lua_assert((OP_ADD <= GET_OPCODE(pi) && GET_OPCODE(pi) <= OP_SHR) ||
+             (OP_ADD_II <= GET_OPCODE(pi) && GET_OPCODE(pi) <= OP_DIV_FF));
+  Protect(luaT_trybinTM(L, s2v(ra), rb, result, tm));
+  vmbreak;
+}
+vmcase(OP_MMBINI) {
+  Instruction pi = *(pc - 2);  /* original arith. expression */
+  int imm = GETARG_sB(i);
+  TMS tm = (TMS)GETARG_C(i);
+  int flip = GETARG_k(i);
+  StkId result = RA(pi);
+  Protect(luaT_trybiniTM(L, s2v(ra), imm, flip, result, tm));
+  vmbreak;
+}
+vmcase(OP_MMBINK) {
+  Instruction pi = *(pc - 2);  /* original arith. expression */
+  TValue *imm = KB(i);
+  TMS tm = (TMS)GETARG_C(i);
+  int flip = GETARG_k(i);
+  StkId result = RA(pi);
+  Protect(luaT_trybinassocTM(L, s2v(ra), imm, flip, result, tm));
+  vmbreak;
+}
+vmcase(OP_UNM) {
+  TValue *rb = vRB(i);
+  lua_Number nb;
+  if (ttisinteger(rb)) {
+    lua_Integer ib = ivalue(rb);
+    setivalue(s2v(ra), intop(-, 0, ib));
+  }
+  else if (tonumberns(rb, nb)) {
+    setfltvalue(s2v(ra), luai_numunm(L, nb));
+  }
+  else
+    Protect(luaT_trybinTM(L, rb, rb, ra, TM_UNM));
+  vmbreak;
+}
+vmcase(OP_BNOT) {
+  TValue *rb = vRB(i);
+  lua_Integer ib;
+  if (tointegerns(rb, &ib)) {
+    setivalue(s2v(ra), intop(^, ~l_castS2U(0), ib));
+  }
+  else
+    Protect(luaT_trybinTM(L, rb, rb, ra, TM_BNOT));
+  vmbreak;
+}
+vmcase(OP_NOT) {
+  TValue *rb = vRB(i);
+  if (l_isfalse(rb))
+    setbtvalue(s2v(ra));
+  else
+    setbfvalue(s2v(ra));
+  vmbreak;
+}
+vmcase(OP_LEN) {
+  Protect(luaV_objlen(L, ra, vRB(i)));
+  vmbreak;
+}
+vmcase(OP_CONCAT) {
+  int n = GETARG_B(i);  /* number of elements to concatenate */
+  L->top = ra + n;  /* mark the end of concat operands */
+  ProtectNT(luaV_concat(L, n));
+  checkGC(L, L->top); /* 'luaV_concat' ensures correct top */
+  vmbreak;
+}
+vmcase(OP_CLOSE) {
+  Protect(luaF_close(L, ra, LUA_OK, 1));
+  vmbreak;
+}
+vmcase(OP_TBC) {
+  /* create new to-be-closed upvalue */
+  halfProtect(luaF_newtbcupval(L, ra));
+  vmbreak;
+}
+vmcase(OP_EQ) {
+  int cond;
+  TValue *rb = vRB(i);
+  Protect(cond = luaV_equalobj(L, s2v(ra), rb));
+  docondjump();
+  vmbreak;
+}
+vmcase(OP_LT) {
+  quickennum(s2v(ra), vRB(i), OP_LT_II, OP_LT_FF);
+  op_order(L, l_lti, LTnum, lessthanothers);
+  vmbreak;
+}
+vmcase(OP_LE) {
+  quickennum(s2v(ra), vRB(i), OP_LE_II, OP_LE_FF);
+  op_order(L, l_lei, LEnum, lessequalothers);
+  vmbreak;
+}
+vmcase(OP_EQK) {
+  TValue *rb = KB(i);
+  /* basic types do not use '__eq'; we can use raw equality */
+  int cond = luaV_rawequalobj(s2v(ra), rb);
+  docondjump();
+  vmbreak;
+}
+vmcase(OP_EQI) {
+  int cond;
+  int im = GETARG_sB(i);
+  if (ttisinteger(s2v(ra)))
+    cond = (ivalue(s2v(ra)) == im);
+  else if (ttisfloat(s2v(ra)))
+    cond = luai_numeq(fltvalue(s2v(ra)), cast_num(im));
+  else
+    cond = 0;  /* other types cannot be equal to a number */
+  docondjump();
+  vmbreak;
+}
+vmcase(OP_LTI) {
+  op_orderI(L, l_lti, luai_numlt, 0, TM_LT);
+  vmbreak;
+}
+vmcase(OP_LEI) {
+  op_orderI(L, l_lei, luai_numle, 0, TM_LE);
+  vmbreak;
+}
+vmcase(OP_GTI) {
+  op_orderI(L, l_gti, luai_numgt, 1, TM_LT);
+  vmbreak;
+}
+vmcase(OP_GEI) {
+  op_orderI(L, l_gei, luai_numge, 1, TM_LE);
+  vmbreak;
+}
+vmcase(OP_TEST) {
+  int cond = !l_isfalse(s2v(ra));
+  docondjump();
+  vmbreak;
+}
+vmcase(OP_TESTSET) {
+  TValue *rb = vRB(i);
+  if (l_isfalse(rb) == GETARG_k(i))
+    pc++;
+  else {
+    setobj2s(L, ra, rb);
+    donextjump(ci);
+  }
+  vmbreak;
+}
+vmcase(OP_CALL) {
+  CallInfo *newci;
+  int b = GETARG_B(i);
+  int nresults = GETARG_C(i) - 1;
+  if (b != 0)  /* fixed number of arguments? */
+    L->top = ra + b;  /* top signals number of arguments */
+  /* else previous instruction set top */
+  savepc(L);  /* in case of errors */
+  if ((newci = luaD_precall(L, ra, nresults)) == NULL)
+    updatetrap(ci);  /* C call; nothing else to be done */
+  else  /* Lua call */
+    vmenter(newci);
+  vmbreak;
+}
+vmcase(OP_FORLOOP) {
+  if (ttisinteger(s2v(ra + 2))) {  /* integer loop? */
+    lua_Unsigned count = l_castS2U(ivalue(s2v(ra + 1)));
+    if (count > 0) {  /* still more iterations? */
+      lua_Integer step = ivalue(s2v(ra + 2));
+      lua_Integer idx = ivalue(s2v(ra));  /* internal index */
+      chgivalue(s2v(ra + 1), count - 1);  /* update counter */
+      idx = intop(+, idx, step);  /* add step to index */
+      chgivalue(s2v(ra), idx);  /* update internal index */
+      setivalue(s2v(ra + 3), idx);  /* and control variable */
+      pc -= GETARG_Bx(i);  /* jump back */
+      jitrun(1);
+    }
+  }
+  else if (floatforloop(ra)) {  /* float loop */
+    pc -= GETARG_Bx(i);  /* jump back */
+    jitrun(1);
+  }
+  updatetrap(ci);  /* allows a signal to break the loop */
+  vmbreak;
+}
+vmcase(OP_FORPREP) {
+  savestate(L, ci);  /* in case of errors */
+  if (forprep(L, ra))
+    pc += GETARG_Bx(i) + 1;  /* skip the loop */
+  vmbreak;
+}
+vmcase(OP_TFORPREP) {
+  /* create to-be-closed upvalue (if needed) */
+  halfProtect(luaF_newtbcupval(L, ra + 3));
+  pc += GETARG_Bx(i);
+  vmgoto(OP_TFORCALL, l_tforcall);
+}
+vmcase(OP_TFORCALL) {
+  int done;
+ vmlabel(l_tforcall);
+  /* 'ra' has the iterator function, 'ra + 1' has the state,
+     'ra + 2' has the control variable, and 'ra + 3' has the
+     to-be-closed variable. The call will use the stack after
+     these values (starting at 'ra + 4')
+  */
+  halfProtect(done = forstep(L, ra, GETARG_C(i)));
+  if (!done) {
+    /* push function, state, and control variable */
+    memcpy(ra + 4, ra, 3 * sizeof(*ra));
+    L->top = ra + 4 + 3;
+    ProtectNT(luaD_call(L, ra + 4, GETARG_C(i)));  /* do the call */
+    updatestack(ci);  /* stack may have changed */
+  }
+  vmgoto(OP_TFORLOOP, l_tforloop);
+}
+vmcase(OP_TFORLOOP) {
+ vmlabel(l_tforloop);
+  if (!ttisnil(s2v(ra + 4))) {  /* continue loop? */
+    setobjs2s(L, ra + 2, ra + 4);  /* save control variable */
+    pc -= GETARG_Bx(i);  /* jump back */
+    jitrun(1);
+  }
+  vmbreak;
+}
+vmcase(OP_SETLIST) {
+  int n = GETARG_B(i);
+  unsigned int last = GETARG_C(i);
+  Table *h = hvalue(s2v(ra));
+  if (n == 0)
+    n = cast_int(L->top - ra) - 1;  /* get up to the top */
+  else
+    L->top = ci->top;  /* correct top in case of emergency GC */
+  last += n;
+  if (TESTARG_k(i)) {
+    last += GETARG_Ax(*pc) * (MAXARG_C + 1);
+    pc++;
+  }
+  if (last > luaH_realasize(h))  /* needs more space? */
+    luaH_resizearray(L, h, last);  /* preallocate it at once */
+  for (; n > 0; n--) {
+    TValue *val = s2v(ra + n);
+    setobj2t(L, &h->array[last - 1], val);
+    last--;
+    luaC_barrierback(L, obj2gco(h), val);
+  }
+  vmbreak;
+}
+vmcase(OP_CLOSURE) {
+  Proto *p = cl->p->p[GETARG_Bx(i)];
+  halfProtect(pushclosure(L, p, cl->upvals, base, ra));
+  checkGC(L, ra + 1);
+  vmbreak;
+}
+vmcase(OP_VARARG) {
+  int n = GETARG_C(i) - 1;  /* required results */
+  if (n < 0)  /* all, maybe going to a call? */
+    vmforward();
+  Protect(luaT_getvarargs(L, ci, ra, n));
+  vmbreak;
+}
+vmcase(OP_VARARGPREP) {
+  ProtectNT(luaT_adjustvarargs(L, GETARG_A(i), ci, cl->p));
+  if (l_unlikely(trap)) {  /* previous "Protect" updated trap */
+    luaD_hookcall(L, ci);
+    L->oldpc = 1;  /* next opcode will be seen as a "new" line */
+  }
+  updatebase(ci);  /* function has new base after adjustment */
+  vmbreak;
+}
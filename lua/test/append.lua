@@ -0,0 +1,132 @@
+-- long strings built by appending share buffers with the strings they
+-- extend; each of them must still behave as an ordinary string, also
+-- when it is a prefix of a longer string in the same buffer
+
+print("testing appends to long strings")
+
+local rep = string.rep
+
+-- several strings appended to the same prefix
+do
+  local a = rep("x", 300)
+  local b = a .. "1"
+  local c = a .. "2"
+  local d = b .. "3"
+  local e = a .. "1"
+  assert(#a == 300 and #b == 301 and #c == 301 and #d == 302)
+  assert(a == rep("x", 300) and b == rep("x", 300) .. "1")
+  assert(c == rep("x", 300) .. "2" and d == rep("x", 300) .. "13")
+  assert(b == e and b ~= c and b ~= d)
+  assert(b:sub(-1) == "1" and c:sub(-1) == "2" and d:sub(-2) == "13")
+  assert(a < b and b < c and b < d and d < c)
+  assert(not (b < e) and b <= e and a <= b and not (c <= b))
+  collectgarbage()
+  assert(a .. "" == rep("x", 300) and b .. c == rep("x", 300) .. "1" ..
+         rep("x", 300) .. "2")
+end
+
+-- a string that is a prefix of another one in the same buffer
+do
+  local s = rep("y", 400)
+  local snaps = {}
+  for i = 1, 200 do
+    s = s .. string.char(65 + i % 26)
+    snaps[i] = s
+  end
+  for i = 1, 200 do
+    assert(#snaps[i] == 400 + i)
+    assert(snaps[i] == string.sub(s, 1, 400 + i))
+    assert(snaps[i]:byte(-1) == 65 + i % 26)
+    if i > 1 then assert(snaps[i - 1] < snaps[i]) end
+  end
+  collectgarbage()
+  local t = {}
+  for i = 1, #snaps, 7 do table.insert(t, snaps[i]) end
+  table.sort(t, function (x, y) return x > y end)
+  for i = 2, #t do assert(#t[i - 1] > #t[i]) end
+end
+
+-- numerals: the byte after a prefix string is not a '\0'
+do
+  local sp = rep(" ", 300)
+  local n1 = sp .. "12"
+  local n2 = n1 .. "3"
+  local n3 = n2 .. "  "
+  local n4 = n3 .. "x"
+  assert(math.abs(n1) == 12 and math.abs(n2) == 123)
+  assert(math.abs(n3) == 123 and math.abs(n1 .. "") == 12)
+  assert(string.rep("a", n1) == rep("a", 12))   -- 'lua_tointegerx'
+  assert(tonumber(n1) == 12 and tonumber(n2) == 123 and tonumber(n3) == 123)
+  assert(tonumber(n4) == nil and not pcall(math.abs, n4))
+  assert(n1 + 1 == 13 and n2 * 2 == 246 and -n3 == -123)
+  local f1 = sp .. "0x10"
+  local f2 = f1 .. "p1"
+  local f3 = f1 .. ".8"
+  assert(math.abs(f1) == 16 and math.abs(f2) == 32.0 and math.abs(f3) == 16.5)
+  local z = sp .. "5"
+  local z2 = z .. "\0"
+  assert(math.abs(z) == 5 and tonumber(z2) == nil and not pcall(math.abs, z2))
+  -- 'tonumber' converts the string that 'lua_tolstring' gives
+  local long = rep("0", 300) .. "7"
+  local l2 = long .. "1"
+  assert(tonumber(long) == 7 and tonumber(l2) == 71 and long .. "" == long)
+  collectgarbage()
+  assert(n1 == sp .. "12" and n2 == sp .. "123")
+end
+
+-- appended strings as table keys
+do
+  local a = rep("k", 500)
+  local keys = {}
+  local t = {}
+  for i = 1, 100 do
+    keys[i] = a .. tostring(i)
+    t[keys[i]] = i
+  end
+  local b = a
+  for i = 1, 20 do b = b .. "z"; t[b] = -i end
+  collectgarbage()
+  for i = 1, 100 do
+    assert(t[rep("k", 500) .. tostring(i)] == i and t[keys[i]] == i)
+  end
+  for i = 1, 20 do assert(t[rep("k", 500) .. rep("z", i)] == -i) end
+  local n = 0
+  for k, v in pairs(t) do
+    n = n + 1
+    assert(t[k] == v and string.sub(k, 1, 500) == a)
+  end
+  assert(n == 120)
+end
+
+-- library functions and values passed to C
+do
+  local a = rep("ab", 200)
+  local b = a .. "needle"
+  local c = a .. "pin"
+  local d = b .. "!"
+  assert(b:find("needle", 1, true) == 401 and c:find("needle", 1, true) == nil)
+  assert(b:find("needle$") == 401 and d:find("needle$") == nil)
+  assert(b:upper() == rep("AB", 200) .. "NEEDLE")
+  assert(string.format("%s|%s", b, c) == b .. "|" .. c)
+  assert(string.format("%q", c):sub(-4) == "pin\"")
+  assert(b:byte(-1) == string.byte("e") and #b:reverse() == #b)
+  assert(table.concat({b, c}, ",") == b .. "," .. c)
+  assert(select(2, b:gsub("needle", "")) == 1)
+  assert(string.len(b) == 406 and utf8.len(b) == 406)
+  assert(load("return ...")(b) == b)
+  local f = io.tmpfile()
+  f:write(b, "\n", c, "\n")
+  f:seek("set")
+  assert(f:read("l") == b and f:read("l") == c)
+  f:close()
+  local ok, msg = pcall(error, b)   -- error messages
+  assert(not ok and msg == b)
+  local mt = {__name = a .. "name"}
+  local tb = a .. "name!"
+  local ud = setmetatable({}, mt)
+  assert(tb ~= mt.__name)
+  assert(string.find(tostring(ud), mt.__name, 1, true) == 1)
+  collectgarbage()
+end
+
+print("OK")
@@ -0,0 +1,97 @@
+-- string buffers: their contents must always equal the concatenation
+-- of what was put in them
+
+print("testing string buffers")
+
+do
+  local b = string.buffer()
+  assert(#b == 0 and b:tostring() == "" and tostring(b) == "")
+  assert(b:put("abc") == b)
+  assert(#b == 3 and b:tostring() == "abc")
+  b:put(1, -2, 0.5, math.mininteger, "\0x\0")
+  assert(b:tostring() == "abc1-20.5" .. math.mininteger .. "\0x\0")
+  assert(b:put() == b and #b == 12 + #tostring(math.mininteger))
+  assert(b:reset() == b and #b == 0 and b:tostring() == "")
+  b:put("again")
+  assert(tostring(b) == "again")
+  local ok, e = pcall(b.put, b, "x", {})
+  assert(not ok and e:find("bad argument #3"))
+  assert(b:tostring() == "againx")   -- arguments before the bad one stay
+  ok, e = pcall(b.put, {}, "x")
+  assert(not ok and e:find("string.buffer expected"))
+end
+
+-- growth, with and without an initial size and reservations
+for _, size in ipairs{0, 1, 10, 1000} do
+  local b = string.buffer(size)
+  local parts = {}
+  for i = 1, 3000 do
+    local s = string.rep(string.char(32 + i % 90), i % 37)
+    parts[#parts + 1] = s
+    if i % 3 == 0 then b:put(s) else b:put(s, i) parts[#parts + 1] = i end
+    if i % 500 == 0 then b:reserve(i * 10) end
+  end
+  assert(b:tostring() == table.concat(parts))
+  assert(#b == #table.concat(parts))
+end
+assert(not pcall(string.buffer, -1))
+assert(not pcall(string.buffer().reserve, string.buffer(), -1))
+assert(not pcall(string.buffer().reserve, string.buffer(), math.maxinteger))
+
+-- buffers as arguments, including the buffer itself
+do
+  local a, b = string.buffer(), string.buffer()
+  a:put("x")
+  for _ = 1, 10 do a:put(a) end
+  assert(a:tostring() == string.rep("x", 1024))
+  b:put("<", a, ">", a, "!")
+  local x = string.rep("x", 1024)
+  assert(b:tostring() == "<" .. x .. ">" .. x .. "!")
+  b:reset():put("ab")
+  b:put(b, b)
+  assert(b:tostring() == "abababab")
+end
+
+-- formatting
+do
+  local b = string.buffer()
+  assert(b:putf("%d-%s", 10, "x") == b)
+  b:putf("|%5.2f|%q|", 3.14159, "a\nb")
+  b:putf("%s", b)
+  local s = "10-x|" .. string.format("%5.2f|%q|", 3.14159, "a\nb")
+  assert(b:tostring() == s .. s)
+  assert(not pcall(b.putf, b, "%d", "x"))
+  assert(b:tostring() == s .. s)
+end
+
+-- writing to files
+do
+  local name = os.tmpname()
+  local f = assert(io.open(name, "wb"))
+  local b = string.buffer():put("line\n", 42, "\0end")
+  assert(b:writeto(f) == f)
+  assert(b:writeto(f) == f)
+  f:close()
+  assert(not pcall(b.writeto, b, f))   -- closed file
+  assert(not pcall(b.writeto, b, {}))
+  f = assert(io.open(name, "rb"))
+  assert(f:read("a") == "line\n42\0endline\n42\0end")
+  f:close()
+  os.remove(name)
+end
+
+-- closing and collecting
+do
+  local b <close> = string.buffer(100):put("data")
+  do
+    local c <close> = string.buffer():put("x")
+  end
+  assert(b:tostring() == "data")
+  local c = string.buffer():put("x")
+  getmetatable(c).__close(c)   -- a closed buffer is empty but usable
+  assert(#c == 0 and c:put("y"):tostring() == "y")
+  for _ = 1, 100 do string.buffer(10000):put(string.rep("z", 10000)) end
+  collectgarbage()
+end
+
+print("OK")
@@ -0,0 +1,181 @@
+-- field accesses through chains of '__index' tables remember where
+-- each key was found (see 'getchain' in lvm.c); any change to a table
+-- in a chain, or to its metatable, must be seen by the next access
+
+if arg[1] ~= "run" then
+  print("testing __index chains")
+  local lua = 0
+  while arg[lua - 1] do lua = lua - 1 end
+  lua = arg[lua]
+  for _, mode in ipairs{"off", "all"} do
+    local cmd = string.format("%q -j %s %q run", lua, mode, arg[0])
+    assert(os.execute(cmd), "run with '-j " .. mode .. "' failed")
+  end
+  print("OK")
+  return
+end
+
+
+-- t[1] inherits from t[2], ..., from t[n]; each table has room for one
+-- more key, so that adding it does not rehash the table
+local function chain (n)
+  local t = {}
+  for i = 1, n do t[i] = {p1 = i, p2 = i, p3 = i} end
+  for i = 1, n - 1 do setmetatable(t[i], {__index = t[i + 1]}) end
+  return t
+end
+
+-- sets with variable and constant keys, raw, and through '__newindex'
+local setters = {
+  function (t, k, v) t[k] = v end,
+  function (t, k, v) rawset(t, k, v) end,
+  function (t, k, v) local f = load("local t, v = ...; t." .. k .. " = v")
+                     f(t, v) end,
+  function (t, k, v) setmetatable({}, {__newindex = t})[k] = v end,
+}
+
+for _, set in ipairs(setters) do
+  local t = chain(4)
+  local c = t[1]
+  set(t[4], "x", "d")
+  for _ = 1, 3 do assert(c.x == "d" and t[2].x == "d") end
+  set(t[3], "x", "c")   -- shadows the field in the last table
+  assert(c.x == "c" and t[3].x == "c" and t[4].x == "d")
+  set(t[2], "x", "b")
+  assert(c.x == "b")
+  set(c, "x", "a")
+  assert(c.x == "a" and rawget(c, "x") == "a")
+  set(c, "x", nil)
+  assert(c.x == "b")
+  set(t[2], "x", nil); set(t[3], "x", nil)
+  assert(c.x == "d")
+  set(t[4], "x", false)
+  assert(c.x == false)
+  set(t[4], "x", nil)
+  assert(c.x == nil and t[2].x == nil)
+  set(t[3], "x", 3)
+  assert(c.x == 3)
+end
+
+-- metatables of the chain
+do
+  local t = chain(3)
+  local c = t[1]
+  t[3].x = "end"
+  assert(c.x == "end")
+  setmetatable(t[2], {__index = {x = "other"}})
+  assert(c.x == "other")
+  setmetatable(t[2], nil)
+  assert(c.x == nil)
+  setmetatable(t[2], {__index = t[3]})
+  assert(c.x == "end")
+  getmetatable(t[2]).__index = {x = "new"}
+  assert(c.x == "new")
+  getmetatable(t[2]).__index = function (_, k) return k .. "!" end
+  assert(c.x == "x!" and c.y == "y!")
+  rawset(getmetatable(t[2]), "__index", t[3])
+  assert(c.x == "end")
+  debug.setmetatable(t[1], {__index = {x = "debug"}})
+  assert(c.x == "debug")
+  getmetatable(c).__index = nil
+  assert(c.x == nil)
+  getmetatable(c).__index = t[2]
+  assert(c.x == "end")
+  -- a loop in the chain
+  setmetatable(t[3], {__index = t[1]})
+  local ok, e = pcall(function () return c.nokey end)
+  assert(not ok and e:find("loop"))
+  setmetatable(t[3], nil)
+  assert(c.x == "end" and c.nokey == nil)
+end
+
+-- methods of classes
+do
+  local Base = {}
+  Base.__index = Base
+  function Base:name () return "base" end
+  local Derived = setmetatable({}, Base)
+  Derived.__index = Derived
+  local obj = setmetatable({}, Derived)
+  for _ = 1, 3 do assert(obj:name() == "base") end
+  function Derived:name () return "derived" end
+  assert(obj:name() == "derived")
+  obj.name = function () return "obj" end
+  assert(obj:name() == "obj")
+  obj.name = nil; Derived.name = nil
+  assert(obj:name() == "base")
+  function Base:name () return "base2" end
+  assert(obj:name() == "base2")
+end
+
+-- table.sort on a table of a chain
+do
+  local t = chain(2)
+  local a = t[2]
+  for i = 1, 50 do a[i] = 51 - i end
+  a.x = "x"
+  assert(t[1].x == "x" and t[1][1] == 50)
+  table.sort(a)
+  assert(t[1].x == "x" and t[1][1] == 1 and t[1][50] == 50)
+  t[1].s = "s"
+  table.sort(a, function (x, y) return x > y end)
+  assert(t[1].x == "x" and t[1][1] == 50 and t[1].s == "s")
+end
+
+-- tables of a chain that grow, shrink or are collected
+do
+  local t = chain(3)
+  local c = t[1]
+  t[2].y = "y"; t[3].x = "x"
+  assert(c.x == "x" and c.y == "y")
+  for i = 1, 1000 do t[2]["k" .. i] = i end   -- rehash of the middle table
+  assert(c.x == "x" and c.y == "y" and c.k500 == 500)
+  for i = 1, 1000 do t[3]["k" .. i] = -i end   -- and of the last one
+  assert(c.k500 == 500 and c.x == "x")
+  for i = 1, 1000 do t[2]["k" .. i] = nil end
+  assert(c.k500 == -500 and c.y == "y")
+  collectgarbage()   -- may shrink the emptied tables
+  assert(c.k500 == -500 and c.y == "y" and c.x == "x")
+  for i = 1, 1000 do c["c" .. i] = i end   -- rehash of the first table
+  assert(c.x == "x" and c.c10 == 10)
+  t[2].y = nil
+  assert(c.y == nil)
+  collectgarbage()
+  t[2].y = "y2"
+  assert(c.y == "y2")
+end
+
+do   -- new tables, maybe where collected tables were
+  for i = 1, 2000 do
+    local base = {x = i}
+    local obj = setmetatable({}, {__index = setmetatable({}, {__index = base})})
+    assert(obj.x == i)
+    if i % 100 == 0 then collectgarbage() end
+    assert(obj.x == i)
+  end
+end
+
+do   -- weak values removed from a table of a chain
+  local keep = {}
+  local t = chain(3)
+  setmetatable(t[2], {__mode = "v", __index = t[3]})
+  t[3].x = keep
+  local function fill ()   -- leaves no copies of the new value behind
+    t[2].x = {}
+    assert(t[1].x ~= keep and type(t[1].x) == "table")
+  end
+  collectgarbage()   -- no other table of a chain is freed by the next one
+  fill()
+  collectgarbage()
+  assert(t[1].x == keep)
+end
+
+-- long keys and keys that are not strings are not remembered
+do
+  local t = chain(3)
+  local long = string.rep("k", 100)
+  t[3][long] = 1; t[3][1] = 2; t[3][true] = 3
+  assert(t[1][long] == 1 and t[1][1] == 2 and t[1][true] == 3)
+  t[2][long] = 10; t[2][1] = 20; t[2][true] = 30
+  assert(t[1][long] == 10 and t[1][1] == 20 and t[1][true] == 30)
+end
@@ -0,0 +1,143 @@
+-- collectgarbage("compact")
+
+print("testing compaction")
+
+local function compact ()
+  local n = collectgarbage("compact")
+  assert(math.type(n) == "integer" and n >= 0)
+  return n
+end
+
+
+-- emptied tables return their hash parts
+do
+  local t = {}
+  for i = 1, 10000 do t["k" .. i] = i end
+  for k in pairs(t) do t[k] = nil end
+  assert(compact() > 100)   -- Kbytes
+  assert(next(t) == nil)
+  t.x = 1; t.y = 2          -- table still works
+  assert(t.x == 1 and t.y == 2 and t.k1 == nil)
+end
+
+
+-- sparse tables shrink to their live entries
+do
+  local t = {}
+  for i = 1, 20000 do t["k" .. i] = i end
+  for i = 11, 20000 do t["k" .. i] = nil end
+  assert(compact() > 100)
+  local n = 0
+  for k, v in pairs(t) do assert(t[k] == v and k == "k" .. v); n = n + 1 end
+  assert(n == 10)
+  t.new = true
+  assert(t.k1 == 1 and t.k10 == 10 and t.k11 == nil and t.new)
+end
+
+
+-- a table stays as it is while a traversal may be going through it,
+-- and shrinks when the traversal ends
+do
+  local t = {}
+  for i = 1, 20000 do t["k" .. i] = i end
+  local k = next(t)
+  for i = 1, 20000 do if "k" .. i ~= k then t["k" .. i] = nil end end
+  compact()
+  assert(t[k] and next(t, k) == nil)   -- traversal ended
+  t[k] = nil
+  assert(compact() > 100)
+  assert(next(t) == nil)
+end
+
+
+-- compaction inside traversals that remove entries
+do
+  local t = {}
+  for i = 1, 100 do t["k" .. i] = i end
+  local n = 0
+  for k in pairs(t) do t[k] = nil; n = n + 1; compact() end
+  assert(n == 100 and next(t) == nil)
+
+  local a = {10, 20, 30, x = 1, y = 2, [2.5] = true}
+  n = 0
+  for k in pairs(a) do a[k] = nil; n = n + 1; compact() end
+  assert(n == 6 and next(a) == nil)
+
+  -- with explicit calls to 'next'
+  local g = {}
+  for i = 1, 20 do g[{}] = i end
+  local k = next(g)
+  n = 0
+  while k do
+    g[k] = nil; n = n + 1; compact()
+    k = next(g, k)
+  end
+  assert(n == 20)
+end
+
+
+-- compaction while a coroutine is suspended in a traversal
+do
+  local t = {}
+  for i = 1, 10 do t[i * 1.5] = true end
+  local co = coroutine.wrap(function ()
+    for k in pairs(t) do t[k] = nil; coroutine.yield(k) end
+    return "done"
+  end)
+  local n = 0
+  repeat
+    local k = co(); n = n + 1
+    compact()
+  until k == "done"
+  assert(n == 11 and next(t) == nil)
+end
+
+
+-- traversals without removals see each key once
+do
+  local t = {}
+  for i = 1, 50 do t["a" .. i] = i end
+  for i = 1, 25 do t["a" .. i] = nil end   -- sparse, but not empty
+  local seen, n = {}, 0
+  for k, v in pairs(t) do
+    assert(not seen[k] and t[k] == v)
+    seen[k] = true; n = n + 1
+    compact()
+  end
+  assert(n == 25)
+end
+
+
+-- invalid keys are still errors
+do
+  local t = {x = 1}
+  assert(not pcall(next, t, "y"))
+  t.x = nil; compact()
+  assert(next(t) == nil)
+  assert(not pcall(next, t, "y"))
+  t.z = 1
+  assert(not pcall(next, t, "y"))
+  -- also in tables shrunk while a traversal was kept waiting
+  local s = {}
+  for i = 1, 100 do s[i * 1.5] = i end
+  local k = next(s)
+  for key in pairs(s) do s[key] = nil end   -- ends one traversal
+  compact()
+  assert(next(s, k) == nil)   -- the removed key is still accepted
+  assert(not pcall(next, s, 0.25))
+end
+
+
+-- stacks and strings
+do
+  local function deep (n) if n > 0 then return deep(n - 1) + 1 end return 0 end
+  assert(deep(10000) == 10000)
+  local s = {}
+  for i = 1, 20000 do s[i] = "str" .. i end
+  s = nil
+  compact()
+  assert(deep(100) == 100)
+  assert(("str" .. 10) == "str10")
+end
+
+print("OK")
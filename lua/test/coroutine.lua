@@ -0,0 +1,170 @@
+-- dead coroutines go to a pool from which new ones take their state and
+-- stack (see 'luaE_freethread' in lstate.c); a new coroutine must not
+-- keep anything of the one it reuses, however that one ended
+
+print("testing coroutines")
+
+local closed = 0   -- calls to '__close' of 'tbc' values
+local tbc = setmetatable({}, {__close = function () closed = closed + 1 end})
+
+local function deep (n, f, ...)   -- calls 'f' with 'n' frames below it
+  if n == 0 then return f(...) end
+  local r = deep(n - 1, f, ...)
+  return r
+end
+
+local saved = {}   -- closures over locals of dead coroutines
+local nsaved = 0
+
+-- coroutines that end in all possible ways; the one left suspended
+-- has a hook, a pending 'tbc' variable and an error handler
+local kinds = {
+  function ()   -- returns
+    return coroutine.wrap(function (a, b) return deep(10, function ()
+      return a + b end) end)(1, 2) == 3
+  end,
+  function ()   -- raises an error
+    local co = coroutine.create(function ()
+      local x <close> = tbc
+      deep(10, error, "boom")
+    end)
+    local ok, e = coroutine.resume(co)
+    return not ok and e:find("boom$") and coroutine.status(co) == "dead"
+  end,
+  function ()   -- left suspended, with everything in place
+    nsaved = nsaved + 1
+    local co = coroutine.create(function (i)
+      local x <close> = tbc
+      local up = i
+      saved[i % 50 + 1] = {function () return up end, i}
+      debug.sethook(function () end, "l")
+      return xpcall(deep, function (m) return "handler" .. m end,
+                    10, coroutine.yield)
+    end)
+    debug.sethook(co, function () end, "c", 5)
+    return coroutine.resume(co, nsaved) and
+           coroutine.status(co) == "suspended"
+  end,
+  function ()   -- closed while suspended
+    local co = coroutine.create(function ()
+      local x <close> = tbc
+      deep(10, coroutine.yield)
+    end)
+    coroutine.resume(co)
+    return coroutine.close(co) and coroutine.status(co) == "dead"
+  end,
+  function ()   -- raises an error after a yield
+    local co = coroutine.wrap(function () deep(5, coroutine.yield); error({}) end)
+    co()
+    return not pcall(co)
+  end,
+}
+
+local function nohook (co)   -- 'debug.gethook' gives only a fail
+  return select('#', debug.gethook(co)) == 1
+end
+
+-- a new coroutine starts clean
+local function checknew ()
+  local co = coroutine.create(function (...)
+    assert(select('#', ...) == 2)
+    local a, b, c
+    assert(a == nil and b == nil and c == nil)
+    assert(coroutine.isyieldable() and coroutine.running() ~= nil)
+    local y = coroutine.yield(nohook())
+    local name, v = debug.getlocal(1, 4)
+    assert(name == "y" and v == y)
+    error("plain")   -- no error handler left
+  end)
+  assert(coroutine.status(co) == "suspended" and nohook(co))
+  assert(debug.getinfo(co, 1) == nil)   -- no frames
+  local ok, h = coroutine.resume(co, nil, nil)
+  assert(ok and h and coroutine.status(co) == "suspended")
+  assert(debug.getinfo(co, 1) and debug.getinfo(co, 2) == nil)
+  local before = closed
+  local e
+  ok, e = coroutine.resume(co, 42)
+  assert(not ok and e:find("plain$") and coroutine.status(co) == "dead")
+  assert(closed == before)   -- no 'tbc' variables of others closed
+  assert(coroutine.close(co) == false)
+  ok, e = coroutine.resume(co)
+  assert(not ok and e == "cannot resume dead coroutine")
+end
+
+local function batch (n)
+  for i = 1, n do assert(kinds[i % #kinds + 1]()) end
+  for _ = 1, 20 do checknew() end
+end
+
+
+batch(200)
+collectgarbage(); collectgarbage()
+local mem = collectgarbage("count")
+for i = 1, 30 do
+  batch(300)
+  collectgarbage(); collectgarbage()
+  for _ = 1, 10 do checknew() end
+end
+-- reused coroutines keep no memory of their previous lives
+assert(collectgarbage("count") < mem * 1.5)
+assert(closed > 0)
+
+-- upvalues of dead coroutines were closed before their stacks were reused
+for _, s in pairs(saved) do assert(s[1]() == s[2]) end
+
+-- values left in the stacks of dead coroutines are not seen by the
+-- collector, which marks all registers of a function during a hook
+do
+  local function fill ()
+    local a, b, c, d, e, f, g, h = {}, {}, {}, {}, {}, {}, {}, {}
+    local i, j, k, l, m, n, o, p = {}, {}, {}, {}, {}, {}, {}, {}
+    coroutine.yield()
+  end
+  local function empty ()   -- registers not written yet when hook runs
+    local a, b, c, d, e, f, g, h, i, j, k, l, m, n, o, p
+    return a
+  end
+  local function hook () collectgarbage() end
+  for _ = 1, 10 do
+    for _ = 1, 20 do coroutine.wrap(fill)() end
+    collectgarbage(); collectgarbage()
+    for _ = 1, 20 do
+      local co = coroutine.create(empty)
+      debug.sethook(co, hook, "c")
+      assert(coroutine.resume(co))
+    end
+  end
+end
+
+-- values in dead coroutines can be collected
+do
+  local weak = setmetatable({}, {__mode = "k"})
+  for _ = 1, 100 do
+    local co = coroutine.wrap(function ()
+      local t = {}
+      weak[t] = true
+      coroutine.yield()
+    end)
+    co()
+  end
+  collectgarbage(); collectgarbage()
+  batch(50)
+  collectgarbage()
+  assert(next(weak) == nil)
+end
+
+-- coroutines created while a hook is set inherit it
+do
+  local n = 0
+  debug.sethook(function () n = n + 1 end, "l")
+  local co = coroutine.create(function () return 1 end)
+  local _, mask = debug.gethook(co)
+  debug.sethook()
+  assert(mask == "l" and coroutine.resume(co) and n > 0)
+  co = nil
+  collectgarbage()
+  co = coroutine.create(function () end)
+  assert(nohook(co))
+end
+
+print("OK")
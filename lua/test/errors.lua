@@ -0,0 +1,187 @@
+-- error handling: raising errors, catching them and unwinding through
+-- Lua and C frames, coroutines and to-be-closed variables. (Errors are
+-- C++ exceptions when Lua is compiled as C++; the results must not
+-- depend on that.)
+
+print("testing errors and unwinding")
+
+-- error values and levels
+do
+  local t = {}
+  local ok, e = pcall(error, t)
+  assert(not ok and e == t)
+  ok, e = pcall(error)
+  assert(not ok and e == nil)
+  ok, e = pcall(error, "msg", 0)
+  assert(not ok and e == "msg")
+  ok, e = pcall(function () error("msg") end)
+  assert(not ok and e:find("errors.lua:%d+: msg$"))
+  ok, e = pcall(function () local function f () error("msg", 2) end f() end)
+  assert(not ok and e:find("errors.lua:%d+: msg$"))
+  ok, e = pcall(function () return 1 + {} end)
+  assert(not ok and e:find("arithmetic on a table value"))
+  assert(select("#", pcall(function () return 1, nil, 3 end)) == 4)
+end
+
+-- errors through C functions
+do
+  local ok, e = pcall(table.sort, {3, 2, 1}, function (a, b) error("cmp") end)
+  assert(not ok and e:find("cmp$"))
+  ok, e = pcall(string.gsub, "abc", "%w", function (c) error{c} end)
+  assert(not ok and e[1] == "a")
+  ok, e = pcall(function ()
+    return setmetatable({}, {__index = function () error("idx", 0) end}).x
+  end)
+  assert(not ok and e == "idx")
+  ok, e = load(function () error("reader") end)   -- 'load' catches it
+  assert(ok == nil and e:find(": reader"))
+  -- errors crossing several protected calls, each one rethrowing
+  local function nest (n)
+    if n == 0 then error("bottom", 0) end
+    local ok, e = pcall(nest, n - 1)
+    assert(not ok)
+    error(e .. n, 0)
+  end
+  ok, e = pcall(nest, 5)
+  assert(not ok and e == "bottom12345")
+end
+
+-- nested handlers and message handlers
+do
+  local ok, e = xpcall(function () error("x", 0) end,
+                       function (m) return "handled " .. m end)
+  assert(not ok and e == "handled x")
+  ok, e = xpcall(function () error("x") end, debug.traceback)
+  assert(not ok and e:find("stack traceback"))
+  ok, e = xpcall(function () error("x", 0) end, function () error("y") end)
+  assert(not ok)    -- error in the message handler
+  ok, e = xpcall(function (...) return select("#", ...), ... end,
+                 print, 1, 2, 3)
+  assert(ok and e == 3)
+  local count = 0
+  for i = 1, 1000 do
+    if not pcall(error, i) then count = count + 1 end
+  end
+  assert(count == 1000)
+end
+
+-- stack overflows
+do
+  local function rec () return 1 + rec() end
+  for _ = 1, 3 do
+    local ok, e = pcall(rec)
+    assert(not ok and e:find("stack overflow"))
+  end
+  local ok, e = xpcall(rec, function (m) return m end)
+  assert(not ok and e:find("stack overflow"))
+  local t = setmetatable({}, {})
+  getmetatable(t).__index = function (t, k) return t[k] end
+  ok, e = pcall(function () return t.x end)
+  assert(not ok and e:find("stack overflow"))
+  -- the stack can be used again afterwards
+  local function deep (n) if n == 0 then return 0 end return 1 + deep(n - 1) end
+  assert(deep(10000) == 10000)
+end
+
+-- coroutines
+do
+  local co = coroutine.create(function (a)
+    local ok, e = pcall(function ()
+      local b = coroutine.yield(a + 1)   -- yield across pcall
+      error({b})
+    end)
+    assert(not ok)
+    coroutine.yield(e[1] * 2)
+    error("co", 0)
+  end)
+  local ok, v = coroutine.resume(co, 1)
+  assert(ok and v == 2)
+  ok, v = coroutine.resume(co, 10)
+  assert(ok and v == 20)
+  ok, v = coroutine.resume(co)
+  assert(not ok and v == "co" and coroutine.status(co) == "dead")
+  assert(not coroutine.resume(co))
+
+  local f = coroutine.wrap(function () error("wrapped", 0) end)
+  ok, v = pcall(f)
+  assert(not ok and v == "wrapped")
+
+  -- stack overflow inside a yieldable pcall
+  co = coroutine.wrap(function ()
+    local function rec () return 1 + rec() end
+    for i = 1, 3 do
+      local ok, e = pcall(rec)
+      coroutine.yield(not ok and e:find("stack overflow") ~= nil)
+    end
+    return "done"
+  end)
+  assert(co() and co() and co() and co() == "done")
+
+  -- errors in many coroutines, some left suspended
+  local cos = {}
+  for i = 1, 200 do
+    cos[i] = coroutine.create(function ()
+      coroutine.yield(pcall(error, i))
+      error(i)
+    end)
+    local ok, pok, e = coroutine.resume(cos[i])
+    assert(ok and not pok and e == i)
+  end
+  for i = 1, 200, 2 do
+    local ok, e = coroutine.resume(cos[i])
+    assert(not ok and e == i)
+  end
+  ok, v = coroutine.close(cos[2])
+  assert(ok and coroutine.status(cos[2]) == "dead")
+end
+
+-- to-be-closed variables
+do
+  local log = {}
+  local function closer (name)
+    return setmetatable({}, {__close = function (_, e)
+      log[#log + 1] = name .. ":" .. tostring(e)
+    end})
+  end
+  local ok, e = pcall(function ()
+    local a <close> = closer("a")
+    local b <close> = closer("b")
+    error("boom", 0)
+  end)
+  assert(not ok and e == "boom")
+  assert(log[1] == "b:boom" and log[2] == "a:boom" and #log == 2)
+
+  log = {}
+  ok, e = pcall(function ()
+    local a <close> = closer("a")
+    local b <close> = setmetatable({}, {__close = function () error("in b", 0) end})
+    error("first", 0)
+  end)
+  assert(not ok and e == "in b" and log[1] == "a:in b")
+
+  log = {}
+  local co = coroutine.create(function ()
+    local a <close> = closer("a")
+    coroutine.yield()
+    error("never")
+  end)
+  coroutine.resume(co)
+  assert(coroutine.close(co) and log[1] == "a:nil")
+
+  log = {}
+  co = coroutine.wrap(function ()
+    local a <close> = closer("a")
+    local ok, e = pcall(function ()
+      local b <close> = setmetatable({}, {__close = function (_, e)
+        coroutine.yield("closing")   -- yield inside a closing method
+        log[#log + 1] = "b:" .. e
+      end})
+      error("err", 0)
+    end)
+    return e
+  end)
+  assert(co() == "closing" and co() == "err")
+  assert(log[1] == "b:err" and log[2] == "a:nil")
+end
+
+print("OK")
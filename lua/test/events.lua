@@ -0,0 +1,227 @@
+-- metatables remember which metamethods they lack, for all events, and
+-- where the ones they have were last found (see 'luaT_gettm' in ltm.c);
+-- adding or removing a metamethod must be seen by the next operation
+
+if arg[1] ~= "run" then
+  print("testing metamethods")
+  local lua = 0
+  while arg[lua - 1] do lua = lua - 1 end
+  lua = arg[lua]
+  for _, mode in ipairs{"off", "all"} do
+    local cmd = string.format("%q -j %s %q run", lua, mode, arg[0])
+    assert(os.execute(cmd), "run with '-j " .. mode .. "' failed")
+  end
+  print("OK")
+  return
+end
+
+
+local last   -- tag of the last metamethod called
+
+local function tm (tag)
+  return function () last = tag; return tag end
+end
+
+-- operations that use each event, on a value 'a' and a table 'b'
+local uses = {
+  __index = {"return a.k", "return a[1]", "return a.k.k"},
+  __newindex = {"a.nk = 1; rawset(a, 'nk', nil)", "a[10] = 1; rawset(a, 10, nil)"},
+  __len = {"return #a"},
+  __eq = {"return a == b", "return b ~= a"},
+  __unm = {"return -a"},
+  __bnot = {"return ~a"},
+  __call = {"return a()", "return a(1, 2)", "return a()()"},
+  __close = {"do local x <close> = a end"},
+}
+for ev, op in pairs{__add = "+", __sub = "-", __mul = "*", __mod = "%",
+                    __pow = "^", __div = "/", __idiv = "//", __band = "&",
+                    __bor = "|", __bxor = "~", __shl = "<<", __shr = ">>",
+                    __concat = "..", __lt = "<", __le = "<="} do
+  uses[ev] = {}
+  for _, e in ipairs{"a %s 1", "1 %s a", "a %s 2.5", "a %s a", "'x' %s a"} do
+    table.insert(uses[ev], "return " .. string.format(e, op))
+  end
+end
+local events = {}
+for ev, list in pairs(uses) do
+  table.insert(events, ev)
+  for i, code in ipairs(list) do
+    list[i] = assert(load("local a, b = ...; " .. code))
+  end
+end
+table.sort(events)   -- same order in every run
+
+-- tag of the metamethod that each use of event 'ev' on 'a' called
+local function check (a, ev, tag)
+  for _, f in ipairs(uses[ev]) do
+    last = nil
+    pcall(f, a, {})
+    assert(last == tag, ev .. ": " .. tostring(last) .. " instead of " ..
+                        tostring(tag))
+  end
+end
+
+local function checkall (a, mt)
+  for _, ev in ipairs(events) do
+    local f = rawget(mt, ev)
+    check(a, ev, f and mt.tags[ev])
+  end
+end
+
+-- sets with variable and constant keys, raw, and through '__newindex'
+local setters = {
+  function (t, k, v) t[k] = v end,
+  function (t, k, v) rawset(t, k, v) end,
+  function (t, k, v) local f = load("local t, v = ...; t." .. k .. " = v")
+                     f(t, v) end,
+  function (t, k, v) setmetatable({}, {__newindex = t})[k] = v end,
+}
+
+local function setevent (mt, ev, tag, set)
+  mt.tags[ev] = tag
+  set(mt, ev, tag and tm(tag))
+end
+
+
+-- each event added to and removed from a metatable that lacks it
+for _, subject in ipairs{"table", "boolean"} do
+  for i, set in ipairs(setters) do
+    local mt = {tags = {}}
+    local a = {}
+    if subject == "table" then setmetatable(a, mt)
+    else a = true; debug.setmetatable(a, mt)
+    end
+    for _, ev in ipairs(events) do
+      if subject == "table" or ev ~= "__eq" then
+        check(a, ev, nil); check(a, ev, nil)   -- absence is remembered
+        setevent(mt, ev, ev .. i, set)
+        check(a, ev, ev .. i)
+        setevent(mt, ev, nil, set)
+        check(a, ev, nil)
+        setevent(mt, ev, ev .. "again", set)   -- over an empty field
+        check(a, ev, ev .. "again")
+        setevent(mt, ev, nil, set)
+      end
+    end
+    debug.setmetatable(true, nil)
+  end
+end
+
+-- metatables with different fields, changed at random; each one misses
+-- or hits where others found their metamethods
+math.randomseed(2042)
+do
+  local mts = {}
+  for m = 1, 20 do
+    local mt = {tags = {}}
+    for _, ev in ipairs(events) do
+      if math.random(2) == 1 then setevent(mt, ev, ev .. m, setters[1]) end
+    end
+    mts[m] = mt
+  end
+  local objs = {}
+  for m = 1, #mts do objs[m] = setmetatable({}, mts[m]) end
+  for round = 1, 200 do
+    local m = math.random(#mts)
+    local mt = mts[m]
+    local ev = events[math.random(#events)]
+    local set = setters[math.random(#setters)]
+    setevent(mt, ev, (not mt.tags[ev]) and ev .. m .. "/" .. round or nil, set)
+    if round % 50 == 0 then   -- rehash a metatable
+      for i = 1, 100 do mt["f" .. i] = i end
+      for i = 1, 100 do mt["f" .. i] = nil end
+    end
+    for _ = 1, 3 do
+      local k = math.random(#mts)
+      checkall(objs[k], mts[k])
+    end
+  end
+  -- metatables built alike keep the same fields in the same slots
+  local function new (tag)
+    local mt = {tags = {}}
+    for _, ev in ipairs(events) do setevent(mt, ev, ev .. tag, setters[1]) end
+    return setmetatable({}, mt), mt
+  end
+  local a, mta = new("a")
+  local b, mtb = new("b")
+  for _ = 1, 2 do checkall(a, mta); checkall(b, mtb) end
+  setevent(mtb, "__add", nil, setters[1])
+  checkall(a, mta); checkall(b, mtb)
+end
+
+-- other flags of a metatable are kept
+do
+  local mt = {1, 2, 3, tags = {}}
+  local base = setmetatable({}, mt)
+  mt.__index = mt
+  local a = setmetatable({}, {__index = base, tags = {}})
+  assert(a[2] == 2 and a.tags and #mt == 3)
+  setevent(mt, "__add", "add", setters[1])
+  assert(base + 1 == "add" and a[3] == 3 and #mt == 3)
+  setevent(mt, "__len", "len", setters[2])
+  assert(#base == "len" and rawlen(mt) == 3)
+  mt[4] = 4
+  assert(a[4] == 4 and rawlen(mt) == 4)
+end
+
+
+-- '__gc', looked for when an object gets its metatable
+do
+  local n = 0
+  local mt = {}
+  setmetatable({}, mt)
+  collectgarbage()
+  mt.__gc = function () n = n + 1 end
+  setmetatable({}, mt); setmetatable({}, mt)
+  collectgarbage()
+  assert(n == 2)
+  mt.__gc = nil
+  setmetatable({}, mt)
+  collectgarbage()
+  assert(n == 2)
+  rawset(mt, "__gc", function () n = n + 10 end)
+  setmetatable({}, mt)
+  collectgarbage()
+  assert(n == 12)
+end
+
+-- '__mode', looked for by the collector
+do
+  local mt = {}
+  local t = setmetatable({}, mt)
+  local function addkey () t[{}] = true end
+  addkey()
+  collectgarbage(); collectgarbage()
+  assert(next(t) ~= nil)
+  mt.__mode = "k"
+  collectgarbage()
+  assert(next(t) == nil)
+  mt.__mode = nil
+  addkey()
+  collectgarbage()
+  assert(next(t) ~= nil)
+  rawset(mt, "__mode", "k")
+  collectgarbage()
+  assert(next(t) == nil)
+end
+
+-- fields that are not events: '__name', '__tostring' and '__metatable'
+do
+  local mt = {}
+  local a = setmetatable({}, mt)
+  assert(string.find(tostring(a), "^table: "))
+  local ok, e = pcall(string.rep, a)
+  assert(not ok and string.find(e, "got table"))
+  mt.__name = "MyType"
+  assert(string.find(tostring(a), "^MyType: "))
+  ok, e = pcall(string.rep, a)
+  assert(not ok and string.find(e, "got MyType"))
+  mt.__tostring = function () return "mine" end
+  assert(tostring(a) == "mine")
+  mt.__name = nil; mt.__tostring = nil
+  assert(string.find(tostring(a), "^table: "))
+  mt.__metatable = "locked"
+  assert(getmetatable(a) == "locked" and not pcall(setmetatable, a, {}))
+  mt.__metatable = nil
+  assert(getmetatable(a) == mt)
+end
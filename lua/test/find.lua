@@ -0,0 +1,117 @@
+-- substring search: plain 'string.find' and patterns with a literal
+-- prefix must find the same occurrences as a naive search, whatever
+-- the lengths, alignments and periodicity of texts and needles
+
+print("testing substring search")
+
+local function naive (s, n, init)
+  for i = init, #s - #n + 1 do
+    if string.sub(s, i, i + #n - 1) == n then return i end
+  end
+  return nil
+end
+
+local function check (s, n, init)
+  init = init or 1
+  local i = naive(s, n, init)
+  local f, e = string.find(s, n, init, true)
+  assert(f == i and (i == nil or e == i + #n - 1), n)
+  -- the same search through a compiled pattern with a literal prefix
+  local p = string.gsub(n, "%W", "%%%0") .. "()"
+  f, e = string.find(s, p, init)
+  assert(f == i)
+end
+
+math.randomseed(1947)
+
+local function randstr (len, alphabet)
+  local t = {}
+  for i = 1, len do
+    local c = math.random(#alphabet)
+    t[i] = string.sub(alphabet, c, c)
+  end
+  return table.concat(t)
+end
+
+-- small alphabets give many partial matches
+for _, alphabet in ipairs{"ab", "abc", "a\0", "\0\255", "\128\127a",
+                          "abcdefghijklmnopqrstuvwxyz"} do
+  for _ = 1, 300 do
+    local s = randstr(math.random(0, 200), alphabet)
+    local n = randstr(math.random(1, 12), alphabet)
+    check(s, n)
+    check(s, n, math.random(1, #s + 1))
+    if #s > 0 then   -- a needle taken from the text itself
+      local i = math.random(#s)
+      check(s, string.sub(s, i, math.random(i, #s)))
+    end
+  end
+end
+
+-- occurrences at every position and near block boundaries
+for len = 1, 80 do
+  local n = string.rep("x", len - 1) .. "y"
+  for _, size in ipairs{len, len + 1, 15, 16, 17, 31, 32, 33, 63, 64, 65, 200} do
+    if size >= len then
+      for pos = 1, size - len + 1 do
+        local s = string.rep("x", pos - 1) .. n .. string.rep("x", size - len - pos + 1)
+        assert(#s == size)
+        check(s, n)
+        check(s .. "z", n)
+      end
+      check(string.rep("x", size), n)   -- not found
+    end
+  end
+end
+
+-- periodic texts and needles, which make the search switch to the
+-- two-way algorithm
+do
+  local s = string.rep("ab", 5000)
+  check(s, "abababababc")
+  check(s .. "c", "abababababc")
+  check(s, string.rep("ab", 100) .. "a")
+  check(s, string.rep("ba", 2500))
+  s = string.rep("a", 20000) .. "b"
+  check(s, "aaaaaaaab")
+  check(s, string.rep("a", 1000) .. "b")
+  check(s, "aab" .. "a")
+  check(s, string.rep("a", 999) .. "ba")
+  s = string.rep("abcabcabd", 2000)
+  check(s, "abcabcabcabd")
+  check(s, "abdabcabcabdabc")
+  check(s, "cabd", 17000)
+  for _ = 1, 100 do
+    local unit = randstr(math.random(1, 5), "ab")
+    s = string.rep(unit, math.random(100, 2000)) .. randstr(10, "ab")
+    check(s, string.rep(unit, math.random(2, 40)) .. randstr(math.random(0, 3), "ab"))
+    check(s, randstr(math.random(1, 3), "ab") .. string.rep(unit, math.random(2, 40)))
+  end
+end
+
+-- texts with zeros and with all byte values
+do
+  local all = {}
+  for i = 0, 255 do all[#all + 1] = string.char(i) end
+  all = table.concat(all)
+  local s = string.rep(all, 4)
+  for i = 1, 256, 17 do
+    for len = 1, 40, 3 do
+      check(s, string.sub(s, i, i + len - 1))
+      check(s, string.sub(s, i, i + len - 1), 300)
+    end
+  end
+  check("\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\1", "\0\0\1")
+  check(string.rep("\0", 100), "\0\0\0")
+  check(string.rep("\255", 100) .. "\254", "\255\254")
+end
+
+-- edge cases of the arguments
+assert(string.find("", "", 1, true) == 1)
+assert(string.find("abc", "", 4, true) == 4)
+assert(string.find("abc", "", 5, true) == nil)
+assert(string.find("abc", "abcd", 1, true) == nil)
+assert(string.find("abc", "c", -1, true) == 3)
+assert(string.find("abc", "abc", -10, true) == 1)
+
+print("OK")
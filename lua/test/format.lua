@@ -0,0 +1,149 @@
+-- string.format: compiled and cached formats, including conversions
+-- written without 'sprintf', must give the same results and errors as
+-- the C library. Each fast conversion is compared with an equivalent
+-- spec that goes through 'sprintf' (e.g., '%5d' with '%5.1d').
+
+print("testing string.format")
+
+local format = string.format
+
+local function checkerror (msg, f, ...)
+  local ok, e = pcall(f, ...)
+  assert(not ok and e:find(msg, 1, true), e)
+end
+
+math.randomseed(1492)
+
+local ints = {0, 1, -1, 7, -7, 9, 10, 99, 100, -100, 12345, 999999,
+              1000000, math.maxinteger, math.mininteger,
+              math.maxinteger - 1, math.mininteger + 1, 0x7fffffff,
+              -0x80000000, 0xffffffff}
+for _ = 1, 200 do
+  ints[#ints + 1] = math.random(math.mininteger, math.maxinteger) >> math.random(0, 63)
+  ints[#ints + 1] = -ints[#ints]
+end
+
+-- integers, with the flags and widths handled without 'sprintf'
+for _, fmt in ipairs{"", "1", "5", "-5", "05", "20", "-25", "025", "99"} do
+  for _, conv in ipairs{"d", "i", "x", "X"} do
+    local fast = "%" .. fmt .. conv
+    local zeros = tonumber(string.match(fmt, "^0(%d+)"))
+    -- (the '0' flag is ignored with a precision, so pad those here)
+    local ref = "%" .. (zeros and "" or fmt) .. ".1" .. conv
+    for _, n in ipairs(ints) do
+      local r = format(ref, n)
+      if zeros and #r < zeros then   -- pad after the sign
+        r = string.gsub(r, "^(%-?)", "%1" .. string.rep("0", zeros - #r))
+      end
+      assert(format(fast, n) == r, fast)
+    end
+    assert(format(fast, 3.0) == format(fast, 3))
+    checkerror("number has no integer representation", format, fast, 3.5)
+  end
+end
+assert(format("%d|%5d|%-5d|%05d", 42, 42, 42, 42) == "42|   42|42   |00042")
+assert(format("%x|%X|%08x", 255, 255, -1) == "ff|FF|ffffffffffffffff")
+assert(format("%05d", -42) == "-0042" and format("%-05d", -42) == "-42  ")
+assert(format("%d", "10") == "10")
+
+-- strings, with and without a width
+do
+  local strs = {"", "a", "hello", string.rep("x", 30), "a\0b", "\255\1"}
+  for _, s in ipairs(strs) do
+    assert(format("%s", s) == s)
+    for _, w in ipairs(string.find(s, "\0") and {} or {1, 5, 10, 31, 99}) do
+      local pad = string.rep(" ", w - #s)
+      assert(format("%" .. w .. "s", s) == pad .. s)
+      assert(format("%-" .. w .. "s", s) == s .. pad)
+    end
+  end
+  assert(format("%s %s", 1, 2.5) == "1 2.5")
+  assert(format("%s", setmetatable({}, {__tostring = function () return "T" end}))
+         == "T")
+  assert(format("%10s", setmetatable({}, {__tostring = function () return "T" end}))
+         == "         T")
+  checkerror("'__tostring' must return a string", format, "%s",
+             setmetatable({}, {__tostring = function () return {} end}))
+  checkerror("string contains zeros", format, "%10s", "a\0b")
+end
+
+-- fixed-point floats, computed exactly and rounded half to even
+do
+  local vals = {0.0, -0.0, 1.0, -1.0, 0.5, 1.5, 2.5, -2.5, 0.125, 0.375,
+                1/3, 2/3, 0.1, 0.7, 1e-5, 9.995, 1.005, 123456.789,
+                2^53, 2^63, 1e18, 1e19, 1e20, 1e300, -1e300, 5e-324,
+                2^-30, 999999.9999999, 0.05, 0.15, 0.25, 0.35}
+  for _ = 1, 1000 do
+    vals[#vals + 1] = (math.random() - 0.5) * 10.0^math.random(-10, 25)
+    vals[#vals + 1] = math.random(-100000, 100000) / 2^math.random(1, 20)
+  end
+  for prec = 0, 20 do
+    local fast = "%." .. prec .. "f"
+    local ref = "%1." .. prec .. "f"
+    for _, x in ipairs(vals) do
+      assert(format(fast, x) == format(ref, x), fast .. " " .. format("%a", x))
+    end
+    assert(format(fast, 12) == format(ref, 12.0))
+  end
+  assert(format("%.2f", 0.125) == "0.12" and format("%.2f", 0.375) == "0.38")
+  assert(format("%.0f", 0.5) == "0" and format("%.0f", 1.5) == "2")
+  assert(format("%.3f", -0.0) == "-0.000")
+  assert(format("%.1f", 1/0) == format("%1.1f", 1/0))
+  assert(format("%.1f", -1/0) == format("%1.1f", -1/0))
+end
+
+-- general format of integral values
+do
+  for _, x in ipairs{0.0, -0.0, 1.0, -1.0, 10.0, 123456.0, 999999.0,
+                     -999999.0, 1e6, 1e15, 0.5, 1e-5, 2^53, 1/0} do
+    assert(format("%g", x) == format("%1g", x))
+    assert(format("%G", x) == format("%1G", x))
+  end
+  for _ = 1, 500 do
+    local x = math.random(-1000000, 1000000) + 0.0
+    assert(format("%g", x) == format("%1g", x))
+  end
+  assert(format("%g", 100) == "100" and format("%g", 1e20) == "1e+20")
+end
+
+-- other conversions, mixed in a format
+do
+  local s = format("[%5.2f|%-8s|%c|%q|%a|%e|%%|%i]", 3.14159, "ab", 65,
+                   "a\nb", 1.0, 12345.678, 7)
+  assert(s == "[ 3.14|ab      |A|\"a\\\nb\"|0x1p+0|1.234568e+04|%|7]")
+  assert(format("%q", 1/0) == "1e9999" and format("%q", math.mininteger)
+         == "0x8000000000000000")
+  assert(format("no conversions") == "no conversions")
+  assert(format("%s", "x", "extra") == "x")
+  local b = string.buffer()
+  for i = 1, 3 do b:putf("%03d:%-3s;", i, string.rep("z", i)) end
+  assert(b:tostring() == "001:z  ;002:zz ;003:zzz;")
+end
+
+-- errors; each runs twice, the second time with any cached format
+for _ = 1, 2 do
+  checkerror("invalid conversion '%y' to 'format'", format, "%y", 1)
+  checkerror("invalid conversion '%' to 'format'", format, "abc%", 1)
+  checkerror("invalid conversion specification: '%123d'", format, "%123d", 1)
+  checkerror("specifier '%q' cannot have modifiers", format, "%10q", "x")
+  checkerror("invalid conversion specification: '%#d'", format, "%#d", 1)
+  checkerror("bad argument #2 to 'string.format' (no value)", format, "%d")
+  checkerror("bad argument #3 to 'string.format' (no value)", format, "%d %s", 1)
+  checkerror("bad argument #2 to 'string.format' (number expected, got string)",
+             format, "%d", "x")
+  checkerror("bad argument #3 to 'string.format' (number expected, got table)",
+             format, "%s %5.2f", 1, {})
+  checkerror("value has no literal form", format, "%q", {})
+  assert(format("%5d", 1) == "    1")
+end
+
+-- many formats, so that unused compiled ones are collected
+for i = 1, 2000 do
+  local w = i % 30 + 1
+  local fmt = "%d" .. string.rep("-", i % 50) .. "%" .. w .. "s"
+  assert(format(fmt, i, "x") ==
+         i .. string.rep("-", i % 50) .. string.rep(" ", w - 1) .. "x")
+  if i % 500 == 0 then collectgarbage() end
+end
+
+print("OK")
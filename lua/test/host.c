@@ -0,0 +1,59 @@
+/*
+** Host for a chunk precompiled by 'luac -C' (see CMakeLists.txt): runs
+** the source of the chunk, given as argument, and then its precompiled
+** module 'precompiled', and fails if they print different outputs.
+*/
+
+#include <stdio.h>
+
+#include "lua.h"
+#include "lauxlib.h"
+#include "lualib.h"
+
+
+LUAMOD_API int luaopen_precompiled (lua_State *L);
+
+
+static const char *const script =
+  "local src = ...\n"
+  "local function capture (f)\n"
+  "  local out, oldprint = {}, print\n"
+  "  print = function (...)\n"
+  "    local t = table.pack(...)\n"
+  "    for i = 1, t.n do t[i] = tostring(t[i]) end\n"
+  "    out[#out + 1] = table.concat(t, '\\t')\n"
+  "  end\n"
+  "  arg = {[0] = src, 'run'}\n"
+  "  f()\n"
+  "  print = oldprint\n"
+  "  return table.concat(out, '\\n')\n"
+  "end\n"
+  "print('testing precompiled code')\n"
+  "local ref = capture(assert(loadfile(src)))\n"
+  "local out = capture(function () return require('precompiled') end)\n"
+  "assert(#ref > 1000 and out == ref, 'precompiled code differs from source')\n"
+  "print('OK')\n";
+
+
+int main (int argc, char **argv) {
+  lua_State *L = luaL_newstate();
+  int status;
+  if (L == NULL || argc != 2) {
+    fprintf(stderr, "usage: %s chunk.lua\n", argv[0]);
+    return 1;
+  }
+  luaL_openlibs(L);
+  luaL_getsubtable(L, LUA_REGISTRYINDEX, LUA_PRELOAD_TABLE);
+  lua_pushcfunction(L, luaopen_precompiled);
+  lua_setfield(L, -2, "precompiled");
+  lua_pop(L, 1);
+  status = luaL_loadstring(L, script);
+  if (status == LUA_OK) {
+    lua_pushstring(L, argv[1]);
+    status = lua_pcall(L, 1, 0, 0);
+  }
+  if (status != LUA_OK)
+    fprintf(stderr, "%s\n", lua_tostring(L, -1));
+  lua_close(L);
+  return (status == LUA_OK) ? 0 : 1;
+}
@@ -0,0 +1,218 @@
+-- native compiler: the programs below run with the compiler off, on
+-- and compiling every function, and their outputs must be equal.
+-- (Without a compiler, all runs interpret them.)
+
+if arg[1] ~= "run" then
+  print("testing native compiler")
+  local lua = 0
+  while arg[lua - 1] do lua = lua - 1 end
+  lua = arg[lua]
+  local function run (mode)
+    local tmp = os.tmpname()
+    local cmd = string.format("%q -j %s %q run > %q", lua, mode, arg[0], tmp)
+    assert(os.execute(cmd), "run with '-j " .. mode .. "' failed")
+    local f = assert(io.open(tmp))
+    local out = f:read("a")
+    f:close()
+    os.remove(tmp)
+    return out
+  end
+  local ref = run("off")
+  assert(#ref > 1000)
+  for _, mode in ipairs{"on", "all"} do
+    local out = run(mode)
+    if out ~= ref then
+      local i = 1
+      for l1, l2 in function () return ref:match("[^\n]*\n", i), out:match("[^\n]*\n", i) end do
+        if l1 ~= l2 then
+          error(string.format("'-j %s' differs:\n%s%s", mode, l1, tostring(l2)))
+        end
+        i = i + #l1
+      end
+      error("'-j " .. mode .. "' differs")
+    end
+  end
+  print("OK")
+  return
+end
+
+
+local function str (v)
+  local t = math.type(v)
+  if t == "integer" then return string.format("%d", v)
+  elseif t == "float" then
+    return v ~= v and "nan" or string.format("%a", v)
+  elseif type(v) == "string" then return string.format("%q", v)
+  else return tostring(v):match("^%a+")   -- no addresses
+  end
+end
+
+local function out (...)
+  local t = table.pack(...)
+  for i = 1, t.n do t[i] = str(t[i]) end
+  print(table.concat(t, " "))
+end
+
+local maxi, mini = math.maxinteger, math.mininteger
+
+
+-- arithmetic, including overflows and mixed operands
+local function arith (a, b)
+  out(pcall(function () return a + b, a - b, a * b, a / b, -a end))
+  out(pcall(function () return a == b, a < b, a <= b, a > b, a >= b end))
+  out(pcall(function () return a // b end))
+  out(pcall(function () return a % b end))
+  out(pcall(function () return a & b, a | b, a ~ b, a << 3, a >> 1, ~a end))
+  out(pcall(function () return a ^ 2, a + 0.5, a * 1.0, a - 1 end))
+end
+
+do
+  local vals = {0, 1, -1, 2, -7, 3, maxi, mini, maxi - 1, mini + 1,
+                0.0, -0.0, 0.5, -2.5, 1e308, -1e308, 1/0, -1/0, 2^53,
+                2^53 + 1, 2^63, -2^63, "10", "0x10", "2.5"}
+  for i = 1, #vals do
+    for j = 1, #vals do
+      arith(vals[i], vals[j])
+    end
+  end
+  out(pcall(arith, 1, {}))
+  out(0/0 ~= 0/0, 2^53 == 2^53 + 1, maxi + 0.0 == 2^63, maxi < 2^63,
+      mini == -2^63, mini <= -2^63, 1 < 1.5, 2 <= 1.5)
+end
+
+
+-- numeric for loops and their edges
+local function loop (a, b, c)
+  local n, s, last = 0, 0, nil
+  local ok, err = pcall(function ()
+    for i = a, b, c do
+      n = n + 1; s = s + i; last = i
+      if n >= 50 then break end
+    end
+  end)
+  out(ok, err and err:match("'for' .*"), n, s, last)
+end
+
+do
+  loop(1, 10, 1); loop(10, 1, -1); loop(1, 0, 1); loop(1, 1, 1)
+  loop(maxi - 2, maxi, 1); loop(mini + 2, mini, -1)
+  loop(maxi - 10, maxi, 7); loop(mini, mini + 3, 2)
+  loop(1, maxi, maxi); loop(-1, mini, mini)
+  loop(1, 3, 0); loop(1.0, 3, 0); loop(1, 2, 0.5)
+  loop(0.1, 1, 0.3); loop(1, 0, -0.25); loop(1, 1/0, 1e308)
+  loop(1, 2.5, 1); loop(3, -1.5, -1); loop(1, 0/0, 1)
+  loop(mini, 1.5, maxi); loop(maxi, -1e300, mini)
+  loop(1, maxi + 0.0, 2^62); loop("1", 2, 1)
+  for _, f in ipairs{function () for i = 1, {} do end end,
+                     function () for i = nil, 2 do end end,
+                     function () for i = 1, 2, "x" do end end} do
+    out(pcall(f))
+  end
+  local acc = 0
+  for i = 1, 1000 do
+    for j = i, 1, -3 do acc = acc + i * j end
+  end
+  out(acc)
+end
+
+
+-- tables: arrays, holes, hash parts and metamethods
+do
+  local t = {}
+  for i = 1, 300 do t[i] = i * i end
+  out(#t, t[1], t[300], t[301], t[0], t[-1], t[150.0], t[2^53])
+  for i = 300, 1, -2 do t[i] = nil end
+  local s = 0
+  for i = 1, 300 do s = s + (t[i] or 0) end
+  out(s, t[299], t[300])
+  t[1.5] = "f"; t.x = "x"; t[true] = 1
+  out(t[1.5], t.x, t[true], t[3.0])
+  local n = 0
+  for k, v in pairs(t) do n = n + 1 end
+  out(n)
+  for i, v in ipairs({10, 20, nil, 40}) do out(i, v) end
+
+  local log = {}
+  local p = setmetatable({}, {
+    __index = function (_, k) log[#log + 1] = k; return k * 2 end,
+    __newindex = function (_, k, v) rawset(log, #log + 1, -v) end,
+  })
+  local v = 0
+  for i = 1, 10 do v = v + p[i]; p[i] = i end
+  out(v, #log, log[1], log[2], rawget(p, 1))
+
+  local proto = {get = function (self) return self.v end}
+  proto.__index = proto
+  local objs = {}
+  for i = 1, 100 do objs[i] = setmetatable({v = i}, proto) end
+  local sum = 0
+  for i = 1, 100 do sum = sum + objs[i]:get() end
+  out(sum)
+
+  local grow = {}
+  for i = 1, 1000 do grow[#grow + 1] = i; grow["k" .. (i % 7)] = i end
+  out(#grow, grow.k0, grow.k6, grow[1000])
+  out(pcall(function () local z; return z.x end))
+  out(pcall(function () local z = {}; z[nil] = 1 end))
+  out(pcall(function () local z = {}; z[0/0] = 1 end))
+end
+
+
+-- upvalues and closures
+do
+  local fs = {}
+  for i = 1, 10 do fs[i] = function () i = i + 1; return i end end
+  out(fs[1](), fs[1](), fs[10](), fs[10]())
+
+  local function counter ()
+    local c = 0
+    return function () c = c + 1; return c end,
+           function () return c end
+  end
+  local inc, get = counter()
+  for _ = 1, 500 do inc() end
+  out(get())
+
+  local shared = {}
+  local x = 0
+  for i = 1, 5 do
+    local y = i
+    shared[i] = function (d) x = x + d; y = y + d; return x, y end
+  end
+  out(shared[1](1)); out(shared[5](10)); out(shared[1](100))
+
+  local function mk (n)
+    if n == 0 then return function () return 0 end end
+    local inner = mk(n - 1)
+    return function () return n + inner() end
+  end
+  out(mk(50)())
+
+  do
+    local log = {}
+    do
+      local a <close> = setmetatable({}, {__close = function () log[#log + 1] = "a" end})
+      local b <close> = setmetatable({}, {__close = function () log[#log + 1] = "b" end})
+    end
+    out(table.concat(log))
+  end
+end
+
+
+-- calls, varargs and errors
+do
+  local function va (...) return select("#", ...), ... end
+  out(va()); out(va(nil, nil)); out(va(1, 2, 3))
+  local function rec (n) if n == 0 then return 0 end return n + rec(n - 1) end
+  out(rec(1000))
+  local function tail (n, acc) if n == 0 then return acc end return tail(n - 1, acc + n) end
+  out(tail(100000, 0))
+  out(pcall(error, "msg", 0)); out(pcall(error, {}))
+  out(select(2, pcall(function () local a = {} ; return a.b.c end)))
+  out(string.format("%5.1f|%d|%s", 3.14159, 42, "s"), ("x"):rep(3, ","))
+  local co = coroutine.wrap(function (a)
+    for i = 1, 3 do a = a + coroutine.yield(a * i) end
+    return "end", a
+  end)
+  out(co(1)); out(co(2)); out(co(3)); out(co(4))
+end
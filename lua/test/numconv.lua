@@ -0,0 +1,122 @@
+-- conversions between floats and numerals: 'tostring' must give the
+-- shortest numeral that reads back as the same float, and reading a
+-- numeral must give the float nearest to it, as 'strtod' does
+
+print("testing number conversions")
+
+local format = string.format
+
+-- numeral with the fewest significant digits (up to 17) that reads back
+-- as 'x', computed through 'sprintf'
+local function shortest (x)
+  for p = 1, 17 do
+    local s = format("%." .. p .. "g", x)
+    if tonumber(s) == x then return s end
+  end
+  error("no shortest numeral for " .. format("%a", x))
+end
+
+local function digits (s)   -- significant digits of a numeral
+  s = string.gsub(string.match(s, "^-?([%d.]+)"), "%.", "")
+  return #string.gsub(string.gsub(s, "^0+", ""), "0+$", "")
+end
+
+local function check (x)
+  local s = tostring(x)
+  assert(tonumber(s) == x and math.type(tonumber(s)) == "float", s)
+  assert((1 / tonumber(s) < 0) == (1 / x < 0))   -- sign of zeros
+  local r = shortest(x)
+  assert(digits(s) <= digits(r), s .. " " .. r)
+  -- the same numeral through 'sprintf' must give the same float
+  assert(tonumber(format("%.17g", x)) == x)
+  assert(tonumber(r) == tonumber(s))
+end
+
+math.randomseed(1961)
+
+-- special values
+check(0.0); check(-0.0)
+assert(tostring(0.0) == "0.0" and tostring(-0.0) == "-0.0")
+assert(tostring(1/0) == "inf" and tostring(-1/0) == "-inf")
+assert(string.find(tostring(0/0), "nan"))
+assert(tostring(1.0) == "1.0" and tostring(-2.0) == "-2.0")
+assert(tostring(0.1) == "0.1" and tostring(1/3) == "0.3333333333333333")
+assert(tostring(1e15) == "1000000000000000.0" and tostring(2^-1074) == "5e-324")
+assert(tostring(1e100) == "1e+100" and tostring(123456789012.0) == "123456789012.0")
+
+-- powers of two and of ten, and their neighbours
+for e = -1074, 1023 do
+  local x = 2.0^e
+  check(x); check(-x)
+  if e > -1074 then check(x - x * 2^-53) end
+  if e < 1023 then check(x + x * 2^-52) end
+end
+for e = -323, 308 do
+  local x = tonumber("1e" .. e)
+  check(x)
+  check(x * (1 + 2^-52))
+end
+
+-- integral floats, subnormals and random doubles
+for _ = 1, 2000 do
+  check(math.random(-2^53, 2^53) + 0.0)
+  check(math.random(1, 2^52) * 2^-1074)   -- subnormal
+  check((math.random() - 0.5) * 10.0^math.random(-300, 300))
+  local x = string.unpack("d", string.pack("i8", math.random(0, math.maxinteger)))
+  if x < math.huge then check(x) end   -- any bit pattern but inf and NaN
+end
+
+-- reading numerals: the nearest float, even when they have many digits
+-- or need a correct rounding at a tie
+assert(tonumber("0.1") == 1 / 10 and tonumber("1e22") == 10.0^22)
+assert(tonumber("9007199254740993") == 9007199254740993)   -- an integer
+assert(tonumber("9007199254740993.0") == 2.0^53)   -- tie, to even
+assert(tonumber("9007199254740995.0") == 2.0^53 + 4)
+assert(tonumber("1.7976931348623157e308") == (2 - 2^-52) * 2^1023)
+assert(tonumber("1.8e308") == math.huge and tonumber("-1e400") == -math.huge)
+assert(tonumber("4.9e-324") == 2^-1074 and tonumber("2e-324") == 0.0)
+assert(tonumber("2.4703282292062328e-324") == 2^-1074)   -- above the tie
+assert(tonumber("0." .. string.rep("0", 400) .. "1") == 0.0)
+assert(tonumber("1" .. string.rep("0", 30) .. ".0") == 1e30)
+assert(tonumber(" 0x1p-2 ") == 0.25 and tonumber("1e") == nil)
+assert(tonumber(".5") == 0.5 and tonumber("5.") == 5.0 and tonumber(".") == nil)
+for _ = 1, 2000 do
+  local x = (math.random() - 0.5) * 10.0^math.random(-300, 300)
+  for p = 0, 14 do   -- up to 15 digits, which a float always keeps
+    local s = format("%." .. p .. "e", x)
+    assert(format("%." .. p .. "e", tonumber(s)) == s, s)
+  end
+  assert(tonumber(format("%.30e", x)) == x)   -- more digits than needed
+end
+
+-- 'io.write' writes numbers as 'tostring', without the ".0"
+do
+  local vals = {0.0, -0.0, 1.0, 0.1, 1e300, 2^-1074, 2^63, 1/0, -1/0,
+                3, -7, math.mininteger, math.maxinteger}
+  for _ = 1, 500 do
+    vals[#vals + 1] = (math.random() - 0.5) * 10.0^math.random(-300, 300)
+  end
+  local f = io.tmpfile()
+  for _, x in ipairs(vals) do f:write(x, "\n") end
+  f:seek("set")
+  for _, x in ipairs(vals) do
+    local r = tostring(x)
+    if math.type(x) == "float" then r = string.gsub(r, "%.0$", "") end
+    assert(f:read("l") == r)
+  end
+  f:close()
+end
+
+-- '%g' in 'string.format' as in 'sprintf'
+for _ = 1, 2000 do
+  local x = (math.random() - 0.5) * 10.0^math.random(-30, 30)
+  assert(format("%g", x) == format("%1g", x))
+  assert(format("%G", x) == format("%1G", x))
+end
+for _, x in ipairs{1e-5, 1e-4, 0.0001234565, 123456.5, 999999.5, 1e6,
+                   9.9999995e-5, 2^-1074, 1e300} do
+  assert(format("%g", x) == format("%1g", x))
+  assert(format("%g", -x) == format("%1g", -x))
+end
+
+print("OK")
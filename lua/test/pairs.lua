@@ -0,0 +1,248 @@
+-- generic 'for' loops over 'next' and 'ipairs' run without calling
+-- the iterator (see 'forstep' in lvm.c); they must visit the same
+-- elements as calls to the iterator, with the interpreter, with all
+-- functions compiled, and with hooks
+
+if arg[1] ~= "run" then
+  print("testing pairs and ipairs")
+  local lua = 0
+  while arg[lua - 1] do lua = lua - 1 end
+  lua = arg[lua]
+  for _, mode in ipairs{"off", "all"} do
+    local cmd = string.format("%q -j %s %q run", lua, mode, arg[0])
+    assert(os.execute(cmd), "run with '-j " .. mode .. "' failed")
+  end
+  print("OK")
+  return
+end
+
+
+local function checkerror (msg, f, ...)
+  local ok, e = pcall(f, ...)
+  assert(not ok and e:find(msg, 1, true), e)
+end
+
+-- the same iterator, but not recognized as 'next'
+local function slownext (t, k) return next(t, k) end
+
+local function newtable (na, nh)
+  local t = {}
+  for i = 1, na do t[i] = i * 10 end
+  for i = 1, nh do t["k" .. i] = i end
+  t[2.5] = "f"; t[true] = "b"; t[t] = "self"
+  return t
+end
+
+-- keys and values that 'for' gives, checked against calls to 'next'
+local function traverse (t)
+  local seen, n = {}, 0
+  for k, v in pairs(t) do
+    assert(seen[k] == nil and rawget(t, k) == v)
+    seen[k] = true; n = n + 1
+  end
+  local m = 0
+  for k, v in slownext, t do
+    assert(seen[k] and rawget(t, k) == v)
+    m = m + 1
+  end
+  assert(n == m)
+  return n
+end
+
+
+local function tests ()
+  -- plain traversals, with one, two or more variables
+  for _, sz in ipairs{{0, 0}, {5, 0}, {0, 7}, {20, 30}, {1, 100}} do
+    local t = newtable(sz[1], sz[2])
+    assert(traverse(t) == sz[1] + sz[2] + 3)
+    local n = 0
+    for k in pairs(t) do n = n + 1 end
+    for k, v, x, y in pairs(t) do
+      assert(x == nil and y == nil); n = n - 1
+    end
+    assert(n == 0)
+  end
+  assert(traverse({}) == 0)
+
+  -- continuing a traversal from a given key
+  do
+    local t = newtable(10, 10)
+    local k0 = next(t, next(t))
+    local rest1, rest2 = {}, {}
+    for k in next, t, k0 do rest1[#rest1 + 1] = k end
+    local k = k0
+    while true do
+      k = next(t, k)
+      if k == nil then break end
+      rest2[#rest2 + 1] = k
+    end
+    assert(#rest1 == #rest2 and #rest1 == 21)
+    for i = 1, #rest1 do assert(rest1[i] == rest2[i]) end
+  end
+
+  -- clearing fields, also the current one, during the traversal
+  do
+    local t = newtable(50, 50)
+    local n = 0
+    for k in pairs(t) do
+      t[k] = nil; n = n + 1
+      if n % 10 == 0 then collectgarbage() end
+    end
+    assert(n == 103 and next(t) == nil)
+    t = newtable(50, 50)
+    local seen = {}
+    n = 0
+    for k, v in pairs(t) do
+      assert(not seen[k]); seen[k] = true; n = n + 1
+      local k2 = next(t, k)   -- clear a field not visited yet
+      if k2 ~= nil then t[k2] = nil; seen[k2] = true end
+      t[k] = v   -- assign to the current field
+    end
+    assert(n >= 51 and n <= 52)
+  end
+
+  -- weak tables collected in the middle of a traversal
+  do
+    local t = setmetatable({}, {__mode = "v"})
+    local keep = {}
+    for i = 1, 200 do
+      local v = {}
+      if i % 3 == 0 then keep[#keep + 1] = v end
+      t[i] = v; t["s" .. i] = v
+    end
+    local n = 0
+    for k, v in pairs(t) do
+      if n == 5 then collectgarbage() end
+      assert(type(v) == "table")
+      n = n + 1
+    end
+    assert(n >= #keep * 2 and n <= 400)
+    collectgarbage()
+    assert(traverse(t) == #keep * 2)
+  end
+
+  -- a traversal can be abandoned and the table used again
+  do
+    local t = newtable(0, 40)
+    for i = 1, 5 do
+      for k in pairs(t) do break end
+    end
+    for i = 1, 40 do t["k" .. i] = nil end
+    collectgarbage()
+    for i = 41, 80 do t["k" .. i] = i end
+    assert(traverse(t) == 43)
+  end
+
+  -- invalid keys and closing values
+  checkerror("invalid key to 'next'", function ()
+    for k in next, {a = 1}, "nokey" do end
+  end)
+  checkerror("invalid key to 'next'", function ()
+    for k in next, {1, 2, 3}, 10 do end
+  end)
+  checkerror("non-closable value", function ()
+    for k in next, {1, 2}, nil, 3 do end
+  end)
+  checkerror("table expected", function ()
+    for k in next, 12 do end
+  end)
+
+  -- '__pairs' and replaced iterators are called
+  do
+    local t = setmetatable({}, {__pairs = function (t)
+      return function (_, k)
+        if k < 3 then return k + 1, "v" end
+      end, t, 0
+    end})
+    local n = 0
+    for k, v in pairs(t) do n = n + k; assert(v == "v") end
+    assert(n == 6)
+    local calls = 0
+    local oldnext = next
+    next = function (...) calls = calls + 1; return oldnext(...) end
+    for k in next, {1, 2, 3} do end
+    next = oldnext
+    assert(calls == 4)
+  end
+
+  -- 'ipairs', also with '__index'
+  do
+    local t = {1, 2, 3, nil, 5}
+    local n = 0
+    for i, v in ipairs(t) do assert(v == i); n = n + 1 end
+    assert(n == 3)
+    local calls = 0
+    local p = setmetatable({10, 20}, {__index = function (_, i)
+      calls = calls + 1
+      if i <= 5 then return i * 10 end
+    end})
+    n = 0
+    for i, v in ipairs(p) do assert(v == i * 10); n = n + 1 end
+    assert(n == 5 and calls == 4)
+    local q = setmetatable({}, {__index = {"a", "b", "c"}})
+    local s = ""
+    for i, v in ipairs(q) do s = s .. i .. v end
+    assert(s == "1a2b3c")
+    q[2] = "x"   -- the table's own value comes first
+    s = ""
+    for i, v in ipairs(q) do s = s .. v end
+    assert(s == "axc")
+    -- changes during the loop are seen
+    t = {1, 2, 3, 4, 5, 6}
+    n = 0
+    for i in ipairs(t) do
+      n = n + 1
+      if i == 2 then t[4] = nil end
+      if i == 3 then collectgarbage() end
+    end
+    assert(n == 3)
+    t = {1}
+    n = 0
+    for i in ipairs(t) do
+      n = n + 1
+      if i < 100 then t[i + 1] = i + 1 end
+    end
+    assert(n == 100)
+    local ud = setmetatable({}, {__index = function (_, i)
+      if i < 4 then return i end
+    end})
+    n = 0
+    for i, v in ipairs(ud) do n = n + v end
+    assert(n == 6)
+    for i, v in ipairs("abc") do error("no elements") end
+  end
+end
+
+
+tests()
+
+-- the same, with hooks, which turn off the loops without calls
+do
+  local lines = 0
+  debug.sethook(function () lines = lines + 1 end, "l")
+  tests()
+  debug.sethook(function () end, "", 1)
+  tests()
+  debug.sethook()
+  assert(lines > 0)
+  -- with hooks, the iterators are called
+  local t = newtable(5, 5)
+  local calls = 0
+  debug.sethook(function ()
+    local f = debug.getinfo(2, "f").func
+    if f == next or f == ipairs(t) then calls = calls + 1 end
+  end, "c")
+  for k in pairs(t) do end
+  for i in ipairs(t) do end
+  debug.sethook()
+  assert(calls == (13 + 1) + (5 + 1))
+  -- a hook set in the middle of a traversal
+  t = newtable(20, 20)
+  local n = 0
+  for k in pairs(t) do
+    n = n + 1
+    if n == 10 then debug.sethook(function () end, "l") end
+    if n == 30 then debug.sethook() end
+  end
+  assert(n == 43)
+end
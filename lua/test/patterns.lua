@@ -0,0 +1,169 @@
+-- pattern matching: compiled and cached patterns must give the same
+-- results and errors as the plain interpretation of patterns
+
+print("testing patterns")
+
+local function checkerror (msg, f, ...)
+  local ok, e = pcall(f, ...)
+  assert(not ok and e:find(msg, 1, true), e)
+end
+
+-- each check runs twice, so that the second one uses a cached pattern
+for _ = 1, 2 do
+  assert(string.find("", "") == 1)
+  assert(string.find("alo", "") == 1)
+  assert(string.find("a\0o a\0o a\0o", "a", 1) == 1)
+  assert(string.find("a\0o a\0o a\0o", "a\0o", 2) == 5)
+  assert(string.find("a\0a\0a\0a\0\0ab", "\0ab", 2) == 9)
+  assert(string.find("a\0a\0a\0a\0\0ab", "b") == 11)
+  assert(string.find("a\0a\0a\0a\0\0ab", "b\0") == nil)
+  assert(string.find("", "\0") == nil)
+  assert(string.find("alo123alo", "12") == 4)
+  assert(string.find("alo123alo", "^12") == nil)
+  assert(string.find("aaab", ".-b") == 1)
+  assert(select(2, string.find("aaab", "a*")) == 3)
+  assert(string.find("abc", "^abc$") == 1)
+  assert(string.find("xabc", "^abc") == nil)
+  assert(string.find("abc$", "c$", 1, true) == 3)
+
+  assert(string.match("aaab", ".*b") == "aaab")
+  assert(string.match("aaa", ".*$") == "aaa")
+  assert(string.match("aaa", "b*") == "")
+  assert(string.match("aaa", "ab*a") == "aa")
+  assert(string.match("aba", "ab*a") == "aba")
+  assert(string.match("aaab", "a+") == "aaa")
+  assert(string.match("aaa", "^.+$") == "aaa")
+  assert(string.match("aaa", "b+") == nil)
+  assert(string.match("aaab", "a-") == "")
+  assert(string.match("aaa", "^.-$") == "aaa")
+  assert(string.match("aabaaabaaabaaaba", "b.*b") == "baaabaaabaaab")
+  assert(string.match("aabaaabaaabaaaba", "b.-b") == "baaab")
+  assert(string.match("alo xo", ".o$") == "xo")
+  assert(string.match(" \n isto \xe9 assim", "%S%S*") == "isto")
+  assert(string.match(" \n isto \xe9 assim", "%S*$") == "assim")
+  assert(string.match(" \n isto \xe9 assim", "[a-z]*$") == "assim")
+  assert(string.match("um caracter ? extra", "[^%sa-z]") == "?")
+  assert(string.match("", "a?") == "")
+  assert(string.match("\xe1", "\xe1?") == "\xe1")
+  assert(string.match("\xe1bl", "\xe1?b?l?") == "\xe1bl")
+  assert(string.match("  \xe1bl", "\xe1?b?l?") == "")
+  assert(string.match("aa", "^aa?a?a") == "aa")
+  assert(string.match("]]]\xe1b", "[^]]") == "\xe1")
+  assert(string.match("0alo alo", "%x*") == "0a")
+  assert(string.match("alo alo", "%C+") == "alo alo")
+  assert(string.match("x-y", "[a-]+") == "-" and string.match("-a-", "[a-]+") == "-a-")
+  assert(string.match("  (  ", "[%(]") == "(")
+
+  -- captures
+  assert(select(3, string.find("hello world", "(%w+) (%w+)")) == "hello")
+  assert(select(4, string.find("hello world", "(%w+) (%w+)")) == "world")
+  local a, b, c = string.match("key = value", "()(%w+)%s*=%s*()")
+  assert(a == 1 and b == "key" and c == 7)
+  assert(string.match("  [[x]] [[y]]", "%[(=*)%[(.-)%]%1%]") == "")
+  assert(select(2, string.match("[==[x]=]y]==]", "%[(=*)%[(.-)%]%1%]")) == "x]=]y")
+  assert(string.match("THE (quick) fox", "%((%a+)%)") == "quick")
+  assert(string.match("f(a(b)c)d", "%b()") == "(a(b)c)")
+  assert(string.match("f(a(b c)d", "%b()") == "(b c)")
+  assert(string.match("THE (quick) fox", "%f[%a]%a+") == "THE")
+  assert(string.match("THE (quick) fox", "%f[%l]%a+") == "quick")
+  assert(string.match("aaa", "%f[%z]") == "" and string.find("aaa", "%f[%z]") == 4)
+  assert(string.find("a", "%f[a]") == 1 and string.find("a", "%f[^%z]") == 1)
+  assert(string.match("abcabc", "(abc)%1") == "abc")
+  assert(string.match("abcabd", "(abc)%1") == nil)
+
+  -- gmatch
+  local t = {}
+  for w in string.gmatch("one two  three", "%a+") do t[#t + 1] = w end
+  assert(#t == 3 and t[1] == "one" and t[3] == "three")
+  t = {}
+  for k, v in string.gmatch("a=1, b=2, c=3", "(%w+)=(%w+)") do t[k] = tonumber(v) end
+  assert(t.a == 1 and t.b == 2 and t.c == 3)
+  t = {}
+  for p in string.gmatch("abc", "()") do t[#t + 1] = p end
+  assert(#t == 4 and t[4] == 4)
+  t = {}
+  for w in string.gmatch("first second word", "%w+", 3) do t[#t + 1] = w end
+  assert(t[1] == "rst" and #t == 3)
+  t = {}
+  for w in string.gmatch("xuxx uu ppar r", "()(.)%2") do t[#t + 1] = w end
+  assert(#t == 3 and t[1] == 3 and t[3] == 9)
+
+  -- gsub
+  assert(string.gsub("hello world", "(%w+)", "<%1>") == "<hello> <world>")
+  assert(string.gsub("hello world", "%w+", "%0 %0", 1) == "hello hello world")
+  assert(string.gsub("abc", "%w", "%%%0") == "%a%b%c")
+  assert(string.gsub("abc", "", "-") == "-a-b-c-")
+  assert(string.gsub("hello", "l+", {ll = "LL"}) == "heLLo")
+  assert(string.gsub("hello", "(l)(l)", function (a, b) return b .. a .. "!" end)
+         == "hell!o")
+  assert(string.gsub("abc", "%w", {a = false, b = 1}) == "a1c")
+  assert(select(2, string.gsub("a b c d", " ", "")) == 3)
+  assert(string.gsub("alo alo", "()[al]", "%1") == "12o 56o")
+  assert(string.gsub("abc=xyz", "(%w*)(%p)(%w+)", "%3%2%1-%0") == "xyz=abc-abc=xyz")
+  assert(string.gsub("trim  me   ", "^%s*(.-)%s*$", "%1") == "trim  me")
+  assert(string.gsub("\0\1\0", "%z", "z") == "z\1z")
+  assert(string.gsub("a.b.c", "%.", "/") == "a/b/c")
+  assert(string.gsub("abc", ".", {}) == "abc")
+end
+
+-- errors, also from malformed patterns (raised only when reached)
+for _ = 1, 2 do
+  checkerror("malformed pattern (ends with '%')", string.find, "a", "%")
+  checkerror("malformed pattern (missing ']')", string.find, "a", "[a")
+  checkerror("missing '[' after '%f'", string.find, "a", "%f")
+  checkerror("malformed pattern (missing arguments to '%b')", string.find, "a", "%b")
+  checkerror("invalid capture index %1", string.find, "a", "%1")
+  checkerror("invalid capture index %2", string.find, "a", "(a)%2")
+  checkerror("invalid capture index %2", string.gsub, "alo", ".", "%2")
+  checkerror("invalid use of '%'", string.gsub, "alo", ".", "%x")
+  checkerror("unfinished capture", string.find, "a", "(a")
+  checkerror("invalid pattern capture", string.match, "a", "a)")
+  checkerror("invalid replacement value (a table)", string.gsub, "alo", ".",
+             {a = {}})
+  assert(string.find("b", "a%") == nil)   -- not reached
+  assert(string.find("b", "a[") == nil)
+  assert(string.gsub("alo", "z%", "") == "alo")
+  checkerror("pattern too complex", string.match, string.rep("a", 300000),
+             string.rep("a?", 300000))
+end
+
+-- many patterns, so that unused compiled ones are collected
+do
+  local s = string.rep("abc123 ", 10)
+  for i = 1, 1000 do
+    local a, n = string.match(s, "(%a+)(%d+)" .. string.rep("x?", i))
+    assert(a == "abc" and n == "123")
+    if i % 200 == 0 then collectgarbage() end
+  end
+end
+
+-- compiled patterns follow changes of the locale
+do
+  local all = {}
+  for i = 0, 255 do all[#all + 1] = string.char(i) end
+  all = table.concat(all)
+  local function classes (prefix)   -- chars in each class, as a string
+    local t = {}
+    for c in string.gmatch("acdglpsuwx", ".") do
+      t[#t + 1] = string.gsub(all, "[^%" .. c .. "]", "")
+      t[#t + 1] = string.gsub(all, prefix .. "%" .. c:upper(), "")
+    end
+    return table.concat(t, "|")
+  end
+  local old = os.setlocale(nil, "ctype")
+  local ref = classes("")
+  for _, loc in ipairs{"C.UTF-8", "en_US.ISO-8859-1", "pt_BR.ISO-8859-1",
+                       "de_DE.ISO-8859-1", "C"} do
+    if os.setlocale(loc, "ctype") then
+      -- patterns compiled before agree with new ones
+      assert(classes("") == classes("()"), loc)
+      if loc:find("8859") then
+        assert(string.match("\xe9t\xe9", "%a+") == "\xe9t\xe9")
+      end
+    end
+  end
+  os.setlocale(old, "ctype")
+  assert(classes("") == ref)
+end
+
+print("OK")
@@ -0,0 +1,124 @@
+-- table.sort: arrays of plain numbers or strings, which are sorted in
+-- place without calling Lua, must end up as when sorted with an order
+-- function; other arrays keep the general algorithm
+
+print("testing table.sort")
+
+local function checkerror (msg, f, ...)
+  local ok, e = pcall(f, ...)
+  assert(not ok and e:find(msg, 1, true), e)
+end
+
+local function key (v)   -- integers and floats with equal values differ
+  return math.type(v) == "float" and ("f" .. string.format("%a", v)) or v
+end
+
+local function check (t)
+  local n = #t
+  local count = {}
+  for i = 1, n do count[key(t[i])] = (count[key(t[i])] or 0) + 1 end
+  local c = table.move(t, 1, n, 1, {})
+  table.sort(t)
+  table.sort(c, function (a, b) return a < b end)
+  for i = 1, n do
+    assert(t[i] == c[i])   -- same order as with an order function
+    if i > 1 then assert(not (t[i] < t[i - 1])) end
+    count[key(t[i])] = count[key(t[i])] - 1
+  end
+  for _, v in pairs(count) do assert(v == 0) end   -- same elements
+end
+
+math.randomseed(1968)
+
+-- integers, floats, both, and strings, with many repetitions and with
+-- orderings that make quicksort degenerate
+local gens = {
+  function () return math.random(-50, 50) end,
+  function () return math.random(math.mininteger, math.maxinteger) end,
+  function () return (math.random() - 0.5) * 10.0^math.random(-5, 5) end,
+  function ()
+    return (math.random(2) == 1) and math.random(-5, 5) or math.random(-10, 10) / 2
+  end,
+  function () return math.random(1, 3) end,
+  function () return tostring(math.random(1, 40)) .. string.rep("z", math.random(0, 3)) end,
+  function () return string.char(math.random(0, 255), math.random(0, 2)) end,
+}
+for _, gen in ipairs(gens) do
+  for _ = 1, 200 do
+    local t = {}
+    for i = 1, math.random(0, 300) do t[i] = gen() end
+    check(t)
+  end
+end
+for _, n in ipairs{2, 3, 10, 100, 5000} do
+  local up, down, saw, equal, organ = {}, {}, {}, {}, {}
+  for i = 1, n do
+    up[i] = i; down[i] = n - i; saw[i] = i % 17; equal[i] = 5
+    organ[i] = (i <= n // 2) and i or n - i
+  end
+  check(up); check(down); check(saw); check(equal); check(organ)
+  for i = 1, n do down[i] = tostring(n - i) end
+  check(down)
+end
+
+-- values at the limits and mixed integers and floats
+do
+  local t = {2^53 + 1, 2.0^53, 2^53 - 1, -0.0, 0, 0.0, math.maxinteger,
+             math.mininteger, math.maxinteger + 0.0, math.mininteger + 0.0,
+             1e300, -1e300, 1/0, -1/0, 2^-1074, 0.5, -1}
+  check(t)
+  assert(t[1] == -1/0 and t[#t] == 1/0)
+  assert(math.type(t[#t - 3]) == "integer" and t[#t - 3] == math.maxinteger)
+  assert(t[#t - 2] == 2.0^63)
+  local old = os.setlocale(nil, "collate")
+  os.setlocale("C", "collate")
+  local s = {"a\0b", "a", "a\0a", "\0", "", "b", "\255", "a\0"}
+  check(s)
+  assert(table.concat(s, ",") == ",\0,a,a\0,a\0a,a\0b,b,\255")
+  os.setlocale(old, "collate")
+end
+
+-- arrays that are not plain numbers or strings, or that are not all
+-- in the array part, go through the general algorithm
+do
+  local t = {3, 1, 2}
+  t[5] = 0   -- a hole after the elements to sort is not a problem
+  table.sort(t)
+  assert(t[1] == 1 and t[3] == 3 and t[5] == 0)
+  local h = {}
+  for i = 10, 1, -1 do h[i] = i * 1.5 end   -- in the hash part
+  table.sort(h)
+  for i = 1, 10 do assert(h[i] == i * 1.5) end
+  local p = setmetatable({}, {__index = function (_, i) return ({3, 1, 2})[i] end,
+                              __len = function () return 3 end})
+  table.sort(p)
+  assert(rawget(p, 1) == 1 and rawget(p, 2) == 2 and rawget(p, 3) == 3)
+  local mt = {__lt = function (a, b) return a.v < b.v end}
+  local o = {}
+  for i = 1, 100 do o[i] = setmetatable({v = math.random(1000)}, mt) end
+  table.sort(o)
+  for i = 2, 100 do assert(o[i - 1].v <= o[i].v) end
+  local d = {}
+  for i = 1, 100 do d[i] = math.random(1000) end
+  table.sort(d, function (a, b) return a > b end)   -- an order function
+  for i = 2, 100 do assert(d[i - 1] >= d[i]) end
+end
+
+-- errors
+checkerror("attempt to compare", table.sort, {1, "2", 3})
+checkerror("attempt to compare", table.sort, {"x", 1})
+checkerror("attempt to compare", table.sort, {1, 0/0, {}})
+checkerror("invalid order function", table.sort, {1, 2, 3, 4, 5, 6, 7, 8, 9, 10},
+           function () return true end)
+checkerror("array too big", table.sort,
+           setmetatable({}, {__len = function () return math.maxinteger end}))
+checkerror("bad argument #2", table.sort, {1, 2}, 3)
+do   -- NaN is not sorted in place, but does not raise errors
+  local t = {3, 0/0, 1, 2}
+  table.sort(t)
+  local n = 0
+  for i = 1, 4 do if t[i] ~= t[i] then n = n + 1 end end
+  assert(n == 1)
+end
+
+print("OK")
@@ -0,0 +1,224 @@
+-- 'select(n, ...)' and 'return f(...)' use the extra arguments where
+-- they are, without copying them first (see OP_VARARG in lvm.c); the
+-- results must be those of plain calls, also with hooks and with all
+-- functions compiled
+
+if arg[1] ~= "run" then
+  print("testing varargs")
+  local lua = 0
+  while arg[lua - 1] do lua = lua - 1 end
+  lua = arg[lua]
+  for _, mode in ipairs{"off", "all"} do
+    local cmd = string.format("%q -j %s %q run", lua, mode, arg[0])
+    assert(os.execute(cmd), "run with '-j " .. mode .. "' failed")
+  end
+  print("OK")
+  return
+end
+
+
+local function checkerror (msg, f, ...)
+  local ok, e = pcall(f, ...)
+  assert(not ok and e:find(msg, 1, true), e)
+end
+
+local function pack (...) return {n = select('#', ...), ...} end
+
+local function eqpack (a, b)
+  if a.n ~= b.n then return false end
+  for i = 1, a.n do
+    if a[i] ~= b[i] then return false end
+  end
+  return true
+end
+
+-- 'select' on values that do not come directly from a '...'
+local function slowselect (n, ...)
+  local t = table.pack(...)
+  return select(n, table.unpack(t, 1, t.n))
+end
+
+
+local function tests ()
+  -- 'select' with counts, positive, negative and out-of-range selectors
+  local function count (...) return select('#', ...) end
+  local function count2 (...) local n = select('#', ...); return n end
+  local function countx (...) return select("#x", ...) end
+  assert(count() == 0 and count(nil) == 1 and count(1, nil, nil) == 3)
+  assert(count2(1, 2, 3) == 3 and countx(nil, nil) == 2)
+  assert(pack(count(1, 2)).n == 1 and pack(countx()).n == 1)
+  local function sel (n, ...) return select(n, ...) end
+  local function sel1 (n, ...) local a = select(n, ...); return a end
+  local function sel3 (n, ...)
+    local a, b, c = select(n, ...)
+    return a, b, c
+  end
+  local function selt (n, ...) return {select(n, ...)} end
+  local args = {"a", nil, "c", false, 5, n = 5}
+  for n = -5, 7 do
+    local r = pack(slowselect(n ~= 0 and n or 1, table.unpack(args, 1, 5)))
+    if n == 0 then
+      checkerror("index out of range", sel, 0, 1, 2)
+    else
+      assert(eqpack(pack(sel(n, table.unpack(args, 1, 5))), r))
+      assert(sel1(n, table.unpack(args, 1, 5)) == r[1])
+      local a, b, c = sel3(n, table.unpack(args, 1, 5))
+      assert(a == r[1] and b == r[2] and c == r[3])
+      if n >= -3 then
+        assert(#selt(n, "x", "y", "z") == #{slowselect(n, "x", "y", "z")})
+      end
+    end
+  end
+  assert(pack(sel(1)).n == 0 and pack(sel(10)).n == 0)
+  assert(pack(sel(100, 1, 2)).n == 0)
+  checkerror("index out of range", sel, -1)
+  checkerror("index out of range", sel, -4, 1, 2, 3)
+  checkerror("index out of range", sel, math.mininteger, 1)
+  assert(sel(math.maxinteger, 1, 2) == nil)
+  checkerror("number expected", sel, "x", 1, 2)
+  checkerror("number expected", sel, nil, 1)
+  assert(sel(2.0, "a", "b") == "b" and sel("2", "a", "b") == "b")
+  assert(sel(-1.0, "a", "b") == "b")
+  checkerror("has no integer representation", sel, 1.5, 1)
+  assert(select(2, sel(1, "a", "b", "c")) == "b")
+  assert(select('#', sel(2, table.unpack({}, 1, 300))) == 299)
+
+  -- 'select' not called as 'select'
+  do
+    local mysel = select
+    local function f (...) return mysel(-1, ...) end
+    assert(f(1, 2, 3) == 3)
+    local oldselect = select
+    local calls = 0
+    select = function (...) calls = calls + 1; return oldselect(...) end
+    local function g (...) return select(2, ...) end
+    local function h (...) local a, b = select(1, ...); return b end
+    assert(g("a", "b", "c") == "b" and h(1, 2) == 2 and calls == 2)
+    select = function () return "mine" end
+    assert(g(1, 2) == "mine" and h(1, 2) == nil)
+    select = oldselect
+    assert(g(1, 2) == 2)
+  end
+
+  -- 'return f(...)', also with fixed parameters
+  do
+    local function id (...) return ... end
+    local function fw (...) return id(...) end
+    local function fw2 (a, b, ...) return id(...) end
+    local function fw3 (a, ...)
+      local x = a .. "!"
+      return id(...)
+    end
+    assert(eqpack(pack(fw()), pack()))
+    assert(eqpack(pack(fw(1, nil, 3, nil)), pack(1, nil, 3, nil)))
+    assert(eqpack(pack(fw2(1, 2)), pack()))
+    assert(eqpack(pack(fw2(1, 2, 3, nil, 5)), pack(3, nil, 5)))
+    assert(eqpack(pack(fw2(1)), pack()))
+    assert(eqpack(pack(fw3("a", "b", "c")), pack("b", "c")))
+    local big = table.pack(table.unpack({}, 1, 5000))
+    big[1] = 1; big[5000] = 5000
+    local r = pack(fw2(0, 0, table.unpack(big, 1, big.n)))
+    assert(r.n == 5000 and r[1] == 1 and r[5000] == 5000)
+    -- the called function sees a proper tail call
+    local function where (...)
+      return debug.getinfo(1, "t").istailcall, select('#', ...)
+    end
+    local function tw (x, ...) return where(...) end
+    local t, n = tw(1, 2, 3)
+    assert(t == true and n == 2)
+    -- upvalues of the forwarding function are closed
+    local function mk (a, ...)
+      local f = function () return a end
+      a = a * 2
+      return (function (...) return f, ... end)(...)
+    end
+    local function cl (a, ...)
+      local f = function () return a end
+      return id(f, ...)
+    end
+    local f, x = mk(21, "x")
+    assert(f() == 42 and x == "x")
+    local saved
+    local function cu (a, ...)
+      saved = function () return a end
+      return id(...)
+    end
+    assert(cu(7, "p") == "p" and cu(8) == nil)
+    id(1, 2, 3, 4, 5)   -- overwrite the stack
+    collectgarbage()
+    assert(saved() == 8)
+    local fs = {}
+    for i = 1, 10 do fs[i] = cl(i, i) end
+    collectgarbage()
+    for i = 1, 10 do assert(fs[i]() == i) end
+    -- deep chains of forwarding calls do not grow the stack
+    local depth = 0
+    local ping, pong
+    function ping (...)
+      depth = depth + 1
+      if depth == 100000 then return select('#', ...), ... end
+      return pong(...)
+    end
+    function pong (...) return ping(...) end
+    local n, a, b = ping("a", "b")
+    assert(n == 2 and a == "a" and b == "b")
+    -- C functions, non-functions and errors
+    local function cf (...) return string.format(...) end
+    assert(cf("%d-%s", 1, "x") == "1-x")
+    local obj = setmetatable({}, {__call = function (self, ...)
+      return select('#', ...)
+    end})
+    local function co (...) return obj(...) end
+    assert(co(1, 2, 3) == 3)
+    local function bad (...) return (nil)(...) end
+    checkerror("attempt to call a nil value", bad, 1)
+    local function err (...) error(select(2, ...)) end
+    local function fe (...) return err(...) end
+    local ok, e = pcall(fe, 1, "boom")
+    assert(not ok and e:find("boom"))
+    -- the vararg function itself as the callee
+    local function rec (n, ...)
+      if n == 0 then return ... end
+      return rec(n - 1, n, ...)
+    end
+    assert(eqpack(pack(rec(3)), pack(1, 2, 3)))
+  end
+
+  -- varargs in coroutines
+  do
+    local co = coroutine.wrap(function (...)
+      local function y (...) return coroutine.yield(...) end
+      local function f (...) return y(...) end
+      local a, b = f(select(2, ...))
+      return select('#', a, b), a, b
+    end)
+    local a, b = co(1, 2, 3)
+    assert(a == 2 and b == 3)
+    local n, x, y = co("x", "y")
+    assert(n == 2 and x == "x" and y == "y")
+  end
+end
+
+
+tests()
+
+-- the same, with hooks, which turn off the shortcuts
+do
+  local lines = 0
+  debug.sethook(function () lines = lines + 1 end, "l")
+  tests()
+  debug.sethook(function () end, "", 1)
+  tests()
+  debug.sethook()
+  assert(lines > 0)
+  -- with hooks, 'select' is called
+  local calls = 0
+  local function f (...) return select(2, ...) end
+  local function g (...) local a = select(-1, ...); return a end
+  debug.sethook(function ()
+    if debug.getinfo(2, "f").func == select then calls = calls + 1 end
+  end, "c")
+  assert(f(1, 2) == 2 and g(1, 2) == 2)
+  debug.sethook()
+  assert(calls == 2)
+end